@@ -16,7 +16,8 @@
 // MARK: Circular buffer
 
 typedef struct {
-    uint8_t *data;
+    const uint8_t *data;
+    uint8_t *writable_data; // Same as data, or NULL if the buffer is a view of read-only memory
     size_t capacity;
     size_t start;
     size_t length;
@@ -25,7 +26,8 @@ typedef struct {
 static bool ok_csv_circular_buffer_init(ok_csv_circular_buffer *buffer, size_t capacity) {
     buffer->start = 0;
     buffer->length = 0;
-    buffer->data = malloc(capacity);
+    buffer->writable_data = malloc(capacity);
+    buffer->data = buffer->writable_data;
     if (buffer->data) {
         buffer->capacity = capacity;
         return true;
@@ -57,7 +59,8 @@ static bool ok_csv_circular_buffer_expand(ok_csv_circular_buffer *buffer) {
     const size_t readable2 = buffer->length - readable1;
     memcpy(new_data, buffer->data + buffer->start, readable1);
     memcpy(new_data + readable1, buffer->data, readable2);
-    free(buffer->data);
+    free(buffer->writable_data);
+    buffer->writable_data = new_data;
     buffer->data = new_data;
     buffer->capacity = new_capacity;
     buffer->start = 0;
@@ -99,13 +102,15 @@ typedef struct {
     // The circular buffer is expanded if needed (for example, a field is larger than 4K)
     ok_csv_circular_buffer input_buffer;
 
-    // Input
+    // Input. When reading from memory, input_read_func is NULL and the input buffer is a view of
+    // the caller's data.
     void *input_data;
     ok_csv_read_func input_read_func;
 
 } ok_csv_decoder;
 
-static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_read_func);
+static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_read_func,
+                          const uint8_t *memory, size_t memory_length);
 static void ok_csv_decode2(ok_csv_decoder *decoder);
 
 static void ok_csv_cleanup(ok_csv *csv) {
@@ -155,7 +160,7 @@ static size_t ok_file_read_func(void *user_data, uint8_t *buffer, size_t length)
 ok_csv *ok_csv_read(FILE *file) {
     ok_csv *csv = calloc(1, sizeof(ok_csv));
     if (file) {
-        ok_csv_decode(csv, file, ok_file_read_func);
+        ok_csv_decode(csv, file, ok_file_read_func, NULL, 0);
     } else {
         ok_csv_error(csv, "File not found");
     }
@@ -167,13 +172,23 @@ ok_csv *ok_csv_read(FILE *file) {
 ok_csv *ok_csv_read_from_callbacks(void *user_data, ok_csv_read_func input_read_func) {
     ok_csv *csv = calloc(1, sizeof(ok_csv));
     if (input_read_func) {
-        ok_csv_decode(csv, user_data, input_read_func);
+        ok_csv_decode(csv, user_data, input_read_func, NULL, 0);
     } else {
         ok_csv_error(csv, "Invalid argument: input_func is NULL");
     }
     return csv;
 }
 
+ok_csv *ok_csv_read_from_memory(const uint8_t *data, size_t length) {
+    ok_csv *csv = calloc(1, sizeof(ok_csv));
+    if (data || length == 0) {
+        ok_csv_decode(csv, NULL, NULL, data, length);
+    } else {
+        ok_csv_error(csv, "Invalid argument: data is NULL");
+    }
+    return csv;
+}
+
 void ok_csv_free(ok_csv *csv) {
     if (csv) {
         ok_csv_cleanup(csv);
@@ -201,7 +216,8 @@ typedef enum {
     OK_CSV_NONESCAPED_FIELD,
 } ok_csv_decoder_state;
 
-static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_read_func) {
+static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_read_func,
+                          const uint8_t *memory, size_t memory_length) {
     if (!csv) {
         return;
     }
@@ -210,7 +226,14 @@ static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_
         ok_csv_error(csv, "Couldn't allocate decoder.");
         return;
     }
-    if (!ok_csv_circular_buffer_init(&decoder->input_buffer, OK_CSV_INPUT_BUFFER_CAPACITY)) {
+    if (!input_read_func) {
+        // The buffer is full, and is never written to or expanded. The capacity is nonzero so that
+        // offsets can be wrapped.
+        decoder->input_buffer.data = memory;
+        decoder->input_buffer.capacity = memory_length > 0 ? memory_length : 1;
+        decoder->input_buffer.length = memory_length;
+    } else if (!ok_csv_circular_buffer_init(&decoder->input_buffer,
+                                            OK_CSV_INPUT_BUFFER_CAPACITY)) {
         free(decoder);
         ok_csv_error(csv, "Couldn't allocate input buffer.");
         return;
@@ -221,7 +244,9 @@ static void ok_csv_decode(ok_csv *csv, void *input_data, ok_csv_read_func input_
 
     ok_csv_decode2(decoder);
 
-    free(decoder->input_buffer.data);
+    if (input_read_func) {
+        free(decoder->input_buffer.writable_data);
+    }
     free(decoder);
 }
 
@@ -283,13 +308,13 @@ static void ok_csv_decode2(ok_csv_decoder *decoder) {
 
     while (true) {
         // Read data if needed
-        if (decoder->input_buffer.length - peek == 0) {
+        if (decoder->input_buffer.length - peek == 0 && decoder->input_read_func) {
             size_t writeable = ok_csv_circular_buffer_writable(&decoder->input_buffer);
             if (writeable == 0) {
                 ok_csv_circular_buffer_expand(&decoder->input_buffer);
                 writeable = ok_csv_circular_buffer_writable(&decoder->input_buffer);
             }
-            uint8_t *end = decoder->input_buffer.data +
+            uint8_t *end = decoder->input_buffer.writable_data +
                 ((decoder->input_buffer.start + decoder->input_buffer.length) %
                  decoder->input_buffer.capacity);
             size_t bytesRead = decoder->input_read_func(decoder->input_data, end, writeable);
@@ -99,6 +99,20 @@ typedef size_t (*ok_csv_read_func)(void *user_data, uint8_t *buffer, size_t coun
  */
 ok_csv *ok_csv_read_from_callbacks(void *user_data, ok_csv_read_func read_func);
 
+// MARK: Read from memory
+
+/**
+ * Reads a CSV file from memory. The data is parsed in place, without copying it to an input
+ * buffer, so this function works well with memory-mapped files.
+ * On failure, #ok_csv.num_records is zero and #ok_csv.error_message is set.
+ *
+ * @param data The CSV file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @return a new #ok_csv object. Never returns `NULL`. The object should be freed with
+ * #ok_csv_free().
+ */
+ok_csv *ok_csv_read_from_memory(const uint8_t *data, size_t length);
+
 
 #ifdef __cplusplus
 }
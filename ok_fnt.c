@@ -64,6 +64,42 @@ static size_t ok_file_read_func(void *user_data, uint8_t *buffer, size_t length)
 
 #endif
 
+// Input function for ok_fnt_read_from_memory()
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} ok_fnt_memory_input;
+
+static size_t ok_memory_read_func(void *user_data, uint8_t *buffer, size_t length) {
+    ok_fnt_memory_input *memory = user_data;
+    size_t len = memory->length - memory->position;
+    if (len > length) {
+        len = length;
+    }
+    if (len > 0) {
+        memcpy(buffer, memory->data + memory->position, len);
+        memory->position += len;
+    }
+    return len;
+}
+
+// Reads `length` bytes. When reading from memory, returns a pointer to the data in place.
+// Otherwise, the data is copied to `buffer`, and `buffer` is returned. Returns NULL on failure.
+static const uint8_t *ok_read_in_place(ok_fnt_decoder *decoder, uint8_t *buffer, size_t length) {
+    if (decoder->input_read_func == ok_memory_read_func) {
+        ok_fnt_memory_input *memory = decoder->input_data;
+        if (length > memory->length - memory->position) {
+            ok_fnt_error(decoder->fnt, "Read error: unexpected end of data");
+            return NULL;
+        }
+        const uint8_t *data = memory->data + memory->position;
+        memory->position += length;
+        return data;
+    }
+    return ok_read(decoder, buffer, length) ? buffer : NULL;
+}
+
 // MARK: Public API
 
 #ifndef OK_NO_STDIO
@@ -90,6 +126,17 @@ ok_fnt *ok_fnt_read_from_callbacks(void *user_data, ok_fnt_read_func input_read_
     return fnt;
 }
 
+ok_fnt *ok_fnt_read_from_memory(const uint8_t *data, size_t length) {
+    ok_fnt *fnt = calloc(1, sizeof(ok_fnt));
+    if (data || length == 0) {
+        ok_fnt_memory_input memory = { data, length, 0 };
+        ok_fnt_decode(fnt, &memory, ok_memory_read_func);
+    } else {
+        ok_fnt_error(fnt, "Invalid argument: data is NULL");
+    }
+    return fnt;
+}
+
 void ok_fnt_free(ok_fnt *fnt) {
     if (fnt) {
         free(fnt->name);
@@ -250,8 +297,8 @@ static void ok_fnt_decode2(ok_fnt_decoder *decoder) {
             }
 
             case OK_FNT_BLOCK_TYPE_CHARS: {
-                uint8_t data[20];
-                fnt->num_glyphs = block_length / sizeof(data);
+                uint8_t buffer[20];
+                fnt->num_glyphs = block_length / sizeof(buffer);
                 fnt->glyphs = malloc(fnt->num_glyphs * sizeof(ok_fnt_glyph));
                 if (!fnt->glyphs) {
                     fnt->num_glyphs = 0;
@@ -261,7 +308,8 @@ static void ok_fnt_decode2(ok_fnt_decoder *decoder) {
                 // On little-endian systems we could just load the entire block into memory, but
                 // we'll assume the byte order is unknown here.
                 for (size_t i = 0; i < fnt->num_glyphs; i++) {
-                    if (!ok_read(decoder, data, sizeof(data))) {
+                    const uint8_t *data = ok_read_in_place(decoder, buffer, sizeof(buffer));
+                    if (!data) {
                         return;
                     }
                     ok_fnt_glyph *glyph = &fnt->glyphs[i];
@@ -280,8 +328,8 @@ static void ok_fnt_decode2(ok_fnt_decoder *decoder) {
             }
 
             case OK_FNT_BLOCK_TYPE_KERNING: {
-                uint8_t data[10];
-                fnt->num_kerning_pairs = block_length / sizeof(data);
+                uint8_t buffer[10];
+                fnt->num_kerning_pairs = block_length / sizeof(buffer);
                 fnt->kerning_pairs = malloc(fnt->num_kerning_pairs * sizeof(ok_fnt_kerning));
                 if (!fnt->kerning_pairs) {
                     fnt->num_kerning_pairs = 0;
@@ -291,7 +339,8 @@ static void ok_fnt_decode2(ok_fnt_decoder *decoder) {
                 // On little-endian systems we could just load the entire block into memory, but
                 // we'll assume the byte order is unknown here.
                 for (size_t i = 0; i < fnt->num_kerning_pairs; i++) {
-                    if (!ok_read(decoder, data, sizeof(data))) {
+                    const uint8_t *data = ok_read_in_place(decoder, buffer, sizeof(buffer));
+                    if (!data) {
                         return;
                     }
                     ok_fnt_kerning *kerning = &fnt->kerning_pairs[i];
@@ -139,6 +139,20 @@ typedef size_t (*ok_fnt_read_func)(void *user_data, uint8_t *buffer, size_t coun
  */
 ok_fnt *ok_fnt_read_from_callbacks(void *user_data, ok_fnt_read_func read_func);
 
+// MARK: Read from memory
+
+/**
+ * Reads a FNT file from memory. The glyph and kerning tables are read in place, without copying
+ * them, so this function works well with memory-mapped files.
+ * On failure, #ok_fnt.num_glyphs is 0 and #ok_fnt.error_message is set.
+ *
+ * @param data The FNT file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @return a new #ok_fnt object. Never returns `NULL`. The object should be freed with
+ * #ok_fnt_free().
+ */
+ok_fnt *ok_fnt_read_from_memory(const uint8_t *data, size_t length);
+
 #ifdef __cplusplus
 }
 #endif
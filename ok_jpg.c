@@ -40,13 +40,74 @@
 #define max(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+#if !defined(OK_NO_SIMD)
+#  if defined(__x86_64__) || defined(_M_X64) || \
+      ((defined(__i386__) || defined(_M_IX86)) && defined(__SSE2__)) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define OK_JPG_USE_SSE
+#    include <emmintrin.h>
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#      include <intrin.h>
+#    endif
+#  elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    define OK_JPG_USE_NEON
+#    include <arm_neon.h>
+#  endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define OK_JPG_TARGET(isa) __attribute__((target(isa)))
+#else
+#define OK_JPG_TARGET(isa)
+#endif
+
 // JPEG spec allows up to 4, but values greater than 2 are rare. The IDCT functions here only
 // support up to 2.
 #define MAX_SAMPLING_FACTOR 2
-#define C_WIDTH (MAX_SAMPLING_FACTOR * 8)
 #define MAX_COMPONENTS 3
-#define HUFFMAN_LOOKUP_SIZE_BITS 10
+#define OK_JPG_MCU_ROW_CHUNK_WIDTH 1024
+// Padding after the MCU row planes. When decoding a region, a row may be converted starting in the
+// middle of a chunk, so the SIMD color conversion can read up to 15 bytes past the last plane.
+#define OK_JPG_MCU_ROW_PADDING 16
+
+// Number of bits used for the first-level Huffman lookup tables. Codes (and, for AC tables, code
+// plus extra bits) up to this length are decoded with a single table access. Valid values are 9
+// to 12. Larger tables decode more codes in one step but use more memory per table.
+#ifndef OK_JPG_HUFFMAN_LOOKUP_BITS
+#define OK_JPG_HUFFMAN_LOOKUP_BITS 11
+#endif
+#if OK_JPG_HUFFMAN_LOOKUP_BITS < 9 || OK_JPG_HUFFMAN_LOOKUP_BITS > 12
+#error OK_JPG_HUFFMAN_LOOKUP_BITS must be between 9 and 12
+#endif
+#define HUFFMAN_LOOKUP_SIZE_BITS OK_JPG_HUFFMAN_LOOKUP_BITS
 #define HUFFMAN_LOOKUP_SIZE (1 << HUFFMAN_LOOKUP_SIZE_BITS)
+// Codes longer than HUFFMAN_LOOKUP_SIZE_BITS are decoded with a second-level table, indexed by the
+// remaining bits of a 16-bit code. If a table has more long-code prefixes than there are
+// subtables, the remaining long codes are decoded with the slower search.
+#define HUFFMAN_SUBTABLE_SIZE (1 << (16 - HUFFMAN_LOOKUP_SIZE_BITS))
+#define HUFFMAN_SUBTABLE_COUNT 16
+
+// Size of the input buffer used when reading from a FILE or custom input.
+#ifndef OK_JPG_INPUT_BUFFER_SIZE
+#define OK_JPG_INPUT_BUFFER_SIZE 4096
+#endif
+
+// Parallel decoding (ok_jpg_read_from_memory_with_thread_pool) splits the work into at most
+// OK_JPG_PARALLEL_MAX_TASKS tasks, each with at least OK_JPG_PARALLEL_MIN_TASK_MCUS MCUs. Each task
+// uses a copy of the decoder (over 100 KB, mostly Huffman tables) and its own MCU row buffers, so
+// small tasks spend much of their time on setup.
+#ifndef OK_JPG_PARALLEL_MAX_TASKS
+#define OK_JPG_PARALLEL_MAX_TASKS 64
+#endif
+#ifndef OK_JPG_PARALLEL_MIN_TASK_MCUS
+#define OK_JPG_PARALLEL_MIN_TASK_MCUS 256
+#endif
+
+// The most data an MCU can use: up to 12 blocks, with a 16-bit Huffman code and 15 extra bits
+// per coefficient, plus bits loaded ahead, with every byte stuffed, plus a restart marker.
+#define OK_JPG_PUSH_MCU_SIZE_MAX \
+    ((MAX_COMPONENTS * MAX_SAMPLING_FACTOR * MAX_SAMPLING_FACTOR * 64 * (16 + 15) / 8 + 4) * 2 + 2)
 
 #ifndef OK_NO_DEFAULT_ALLOCATOR
 
@@ -68,7 +129,8 @@ const ok_jpg_allocator OK_JPG_DEFAULT_ALLOCATOR = {
 
 #endif
 
-typedef void (*ok_jpg_idct_func)(const int16_t *const input, uint8_t *output);
+typedef void (*ok_jpg_idct_func)(const int16_t *const input, uint8_t *output,
+                                 const size_t output_stride);
 
 typedef struct {
     uint8_t id;
@@ -77,7 +139,7 @@ typedef struct {
     uint8_t Tq;
     uint8_t Td;
     uint8_t Ta;
-    uint8_t output[C_WIDTH * C_WIDTH];
+    uint8_t *output; // Decoded MCU row, with a stride of mcu_row_stride
     int16_t pred;
     int16_t *blocks;
     size_t next_block;
@@ -88,21 +150,54 @@ typedef struct {
     bool complete;
 } ok_jpg_component;
 
+typedef struct {
+    // Number of bits in the code, or 0 if the code is longer than HUFFMAN_LOOKUP_SIZE_BITS.
+    uint8_t num_bits;
+    // The decoded value. If num_bits is 0, this is the subtable index plus one, or 0 if the code
+    // must be decoded with the slower search.
+    uint8_t val;
+} ok_jpg_huffman_lookup;
+
+typedef struct {
+    // AC coefficient (or EOB run length) already sign-extended from the extra bits.
+    int16_t val;
+    // Number of bits in the code plus extra bits, or 0 if they don't fit in the lookup.
+    uint8_t num_bits;
+    // The run/size value ("RS").
+    uint8_t rs;
+} ok_jpg_huffman_ac_lookup;
+
 typedef struct {
     uint16_t code[256];
     uint8_t val[256];
     uint8_t size[257];
-    uint8_t lookup_num_bits[HUFFMAN_LOOKUP_SIZE];
-    uint8_t lookup_val[HUFFMAN_LOOKUP_SIZE];
-    uint8_t lookup_ac_num_bits[HUFFMAN_LOOKUP_SIZE];
-    int16_t lookup_ac_val[HUFFMAN_LOOKUP_SIZE];
+    ok_jpg_huffman_lookup lookup[HUFFMAN_LOOKUP_SIZE];
+    ok_jpg_huffman_ac_lookup lookup_ac[HUFFMAN_LOOKUP_SIZE];
+    ok_jpg_huffman_lookup subtables[HUFFMAN_SUBTABLE_COUNT][HUFFMAN_SUBTABLE_SIZE];
     int maxcode[16];
     int mincode[16];
     int valptr[16];
     int count; // "lastk" in spec
 } ok_jpg_huffman_table;
 
+// A region of the image, in output coordinates (ok_jpg_read_region_from_input)
 typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} ok_jpg_region;
+
+typedef enum {
+    OK_JPG_PUSH_SIGNATURE = 0,
+    OK_JPG_PUSH_MARKER,
+    OK_JPG_PUSH_SEGMENT,
+    OK_JPG_PUSH_SCAN,
+    OK_JPG_PUSH_DONE,
+    OK_JPG_PUSH_ERROR,
+} ok_jpg_push_state;
+
+struct ok_jpg_decoder {
     // Output image
     ok_jpg *jpg;
     
@@ -116,20 +211,64 @@ typedef struct {
     bool flip_y;
     bool rotate;
     bool info_only;
+    ok_jpg_simd simd;
+
+    // Region (ok_jpg_read_region_from_input). Set in SOF from the requested region, in scaled
+    // coordinates before rotation. Without a requested region, the region is the whole image.
+    bool has_region;
+    bool region_flip_y; // OK_JPG_FLIP_Y was set, so the requested region isn't flipped by it
+    ok_jpg_region requested_region;
+    int region_x;
+    int region_y;
+    int region_width;
+    int region_height;
+    int region_begin_x; // Data units that overlap the region, from begin up to (not including) end
+    int region_end_x;
+    int region_begin_y;
+    int region_end_y;
+
+    // Row output (ok_jpg_read_rows). Unless the image is rotated, the image data holds one MCU row.
+    ok_jpg_rows_func rows_func;
+    void *rows_user_data;
+    bool row_output;
+
+    // Parallel decoding (ok_jpg_read_from_memory_with_thread_pool)
+    bool has_thread_pool;
+    ok_jpg_thread_pool thread_pool;
+    void *thread_pool_user_data;
 
     // Input
     ok_jpg_input input;
     void *input_user_data;
-    uint8_t input_buffer[256];
-    uint8_t *input_buffer_start;
-    uint8_t *input_buffer_end;
-    uint32_t input_buffer_bits;
+    uint8_t input_buffer[OK_JPG_INPUT_BUFFER_SIZE];
+    const uint8_t *input_buffer_start; // When reading from memory, points to the caller's data
+    const uint8_t *input_buffer_end;
+    uint64_t input_buffer_bits;
     int input_buffer_bit_count;
 
+    // Push decoding (ok_jpg_decoder_feed). Input is read from push_buffer, which holds data not
+    // decoded in previous calls, and then from push_input.
+    bool push;
+    ok_jpg push_image;
+    ok_jpg_push_state push_state;
+    int push_marker;
+    bool push_suspended;
+    const uint8_t *push_input;
+    size_t push_input_length;
+    uint8_t *push_buffer;
+    size_t push_buffer_start;
+    size_t push_buffer_length;
+    size_t push_buffer_capacity;
+    uint64_t push_total_length;  // Length of all data fed
+    uint64_t push_marker_offset; // Offset of the last marker in the data fed, plus one
+    bool push_last_byte_ff;
+    uint32_t rows_completed;
+
     // State
     bool progressive;
     bool eoi_found;
     bool sof_found;
+    bool info_complete;
     bool eof_found;
     int next_marker;
     int restart_intervals;
@@ -139,10 +278,23 @@ typedef struct {
     // JPEG data
     uint16_t in_width;
     uint16_t in_height;
+    int scale_shift; // Decoded at a scale of 1 / (1 << scale_shift)
+    int scaled_width; // Size after scaling, before rotation
+    int scaled_height;
     int data_units_x;
     int data_units_y;
     int num_components;
     ok_jpg_component components[MAX_COMPONENTS];
+
+    // Output stage. Each MCU row is decoded to component planes in chunks of up to
+    // OK_JPG_MCU_ROW_CHUNK_WIDTH pixels, and each chunk is converted a row at a time.
+    int mcu_width;
+    int mcu_height;
+    int block_size; // Size of a decoded block, without upsampling (8, or less when scaled)
+    int data_units_per_chunk;
+    size_t mcu_row_stride;
+    uint8_t *mcu_row_data;
+    uint8_t *transform_data; // Converted chunk, if rotating or flipping horizontally
     uint8_t q_table[4][8 * 8];
 
     // Scan
@@ -152,11 +304,13 @@ typedef struct {
     int scan_end;        // "Se"
     int scan_prev_scale; // "Ah"
     int scan_scale;      // "Al"
+    int scan_x;          // Position of the next data unit to decode
+    int scan_y;
 
     ok_jpg_huffman_table dc_huffman_tables[4];
     ok_jpg_huffman_table ac_huffman_tables[4];
     bool huffman_error;
-} ok_jpg_decoder;
+};
 
 #define ok_jpg_error(jpg, error_code, message) ok_jpg_set_error((jpg), (error_code))
 
@@ -245,9 +399,37 @@ static const ok_jpg_input OK_JPG_FILE_INPUT = {
 
 #endif
 
+// Input functions for ok_jpg_read_from_memory(). The data is not read through these functions;
+// instead, the decoder's input buffer points to the data, so it is read in place.
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+} ok_jpg_memory_input;
+
+static size_t ok_memory_read(void *user_data, uint8_t *buffer, size_t length) {
+    (void)user_data;
+    (void)buffer;
+    (void)length;
+    return 0;
+}
+
+static bool ok_memory_seek(void *user_data, long count) {
+    (void)user_data;
+    (void)count;
+    return false;
+}
+
+static const ok_jpg_input OK_JPG_MEMORY_INPUT = {
+    .read = ok_memory_read,
+    .seek = ok_memory_seek,
+};
+
 static void ok_jpg_decode(ok_jpg *jpg, ok_jpg_decode_flags decode_flags,
+                          const ok_jpg_region *region,
                           ok_jpg_input input, void *input_user_data,
-                          ok_jpg_allocator allocator, void *allocator_user_data);
+                          ok_jpg_allocator allocator, void *allocator_user_data,
+                          ok_jpg_rows_func rows_func, void *rows_user_data,
+                          const ok_jpg_thread_pool *thread_pool, void *thread_pool_user_data);
 
 // MARK: Public API
 
@@ -265,7 +447,8 @@ ok_jpg ok_jpg_read_with_allocator(FILE *file, ok_jpg_decode_flags decode_flags,
                                   ok_jpg_allocator allocator, void *allocator_user_data) {
     ok_jpg jpg = { 0 };
     if (file) {
-        ok_jpg_decode(&jpg, decode_flags, OK_JPG_FILE_INPUT, file, allocator, allocator_user_data);
+        ok_jpg_decode(&jpg, decode_flags, NULL, OK_JPG_FILE_INPUT, file,
+                      allocator, allocator_user_data, NULL, NULL, NULL, NULL);
     } else {
         ok_jpg_error(&jpg, OK_JPG_ERROR_API, "File not found");
     }
@@ -278,8 +461,73 @@ ok_jpg ok_jpg_read_from_input(ok_jpg_decode_flags decode_flags,
                               ok_jpg_input input_callbacks, void *input_callbacks_user_data,
                               ok_jpg_allocator allocator, void *allocator_user_data) {
     ok_jpg jpg = { 0 };
-    ok_jpg_decode(&jpg, decode_flags, input_callbacks, input_callbacks_user_data,
-                  allocator, allocator_user_data);
+    ok_jpg_decode(&jpg, decode_flags, NULL, input_callbacks, input_callbacks_user_data,
+                  allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    return jpg;
+}
+
+ok_jpg ok_jpg_read_region_from_input(ok_jpg_decode_flags decode_flags,
+                                     uint32_t region_x, uint32_t region_y,
+                                     uint32_t region_width, uint32_t region_height,
+                                     ok_jpg_input input_callbacks, void *input_callbacks_user_data,
+                                     ok_jpg_allocator allocator, void *allocator_user_data) {
+    ok_jpg jpg = { 0 };
+    if (region_width > 0 && region_height > 0) {
+        ok_jpg_region region = { region_x, region_y, region_width, region_height };
+        ok_jpg_decode(&jpg, decode_flags, &region, input_callbacks, input_callbacks_user_data,
+                      allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    } else {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API, "Invalid argument: region must not be empty");
+    }
+    return jpg;
+}
+
+ok_jpg ok_jpg_read_from_memory(const uint8_t *data, size_t length,
+                               ok_jpg_decode_flags decode_flags,
+                               ok_jpg_allocator allocator, void *allocator_user_data) {
+    ok_jpg jpg = { 0 };
+    if (data || length == 0) {
+        ok_jpg_memory_input memory = { data, length };
+        ok_jpg_decode(&jpg, decode_flags, NULL, OK_JPG_MEMORY_INPUT, &memory,
+                      allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    } else {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API, "Invalid argument: data must not be NULL");
+    }
+    return jpg;
+}
+
+ok_jpg ok_jpg_read_from_memory_with_thread_pool(const uint8_t *data, size_t length,
+                                                ok_jpg_decode_flags decode_flags,
+                                                ok_jpg_allocator allocator,
+                                                void *allocator_user_data,
+                                                ok_jpg_thread_pool thread_pool,
+                                                void *thread_pool_user_data) {
+    ok_jpg jpg = { 0 };
+    if (!thread_pool.run_tasks) {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API,
+                     "Invalid argument: thread pool run_tasks function must not be NULL");
+    } else if (data || length == 0) {
+        ok_jpg_memory_input memory = { data, length };
+        ok_jpg_decode(&jpg, decode_flags, NULL, OK_JPG_MEMORY_INPUT, &memory,
+                      allocator, allocator_user_data, NULL, NULL,
+                      &thread_pool, thread_pool_user_data);
+    } else {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API, "Invalid argument: data must not be NULL");
+    }
+    return jpg;
+}
+
+ok_jpg ok_jpg_read_rows(ok_jpg_decode_flags decode_flags,
+                        ok_jpg_input input_callbacks, void *input_callbacks_user_data,
+                        ok_jpg_allocator allocator, void *allocator_user_data,
+                        ok_jpg_rows_func rows_func, void *rows_user_data) {
+    ok_jpg jpg = { 0 };
+    if (rows_func) {
+        ok_jpg_decode(&jpg, decode_flags, NULL, input_callbacks, input_callbacks_user_data,
+                      allocator, allocator_user_data, rows_func, rows_user_data, NULL, NULL);
+    } else {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API, "Invalid argument: rows_func must not be NULL");
+    }
     return jpg;
 }
 
@@ -296,6 +544,10 @@ static inline uint32_t readBE32(const uint8_t *data) {
             ((uint32_t)data[3] << 0));
 }
 
+static inline uint64_t readBE64(const uint8_t *data) {
+    return (((uint64_t)readBE32(data) << 32) | readBE32(data + 4));
+}
+
 static inline uint16_t readLE16(const uint8_t *data) {
     return (uint16_t)((data[1] << 8) | data[0]);
 }
@@ -307,8 +559,33 @@ static inline uint32_t readLE32(const uint8_t *data) {
             ((uint32_t)data[0] << 0));
 }
 
-// Load bits without reading them
+// Returns true if any byte in the word is 0xff
+static inline bool ok_jpg_has_ff_byte(uint64_t word) {
+    const uint64_t inverted = ~word;
+    return ((inverted - UINT64_C(0x0101010101010101)) & word &
+            UINT64_C(0x8080808080808080)) != 0;
+}
+
+// Load bits without reading them. Up to 16 bits may be requested.
 static inline void ok_jpg_load_bits(ok_jpg_decoder *decoder, int num_bits) {
+    if (decoder->input_buffer_bit_count >= num_bits) {
+        return;
+    }
+    // Fast path: If the next 8 bytes don't contain a marker or a stuffed byte (no 0xff), load
+    // as many whole bytes as fit in the bit buffer (at most 7 bytes).
+    const int num_bytes = (63 - decoder->input_buffer_bit_count) >> 3;
+    if (decoder->next_marker == 0 && num_bytes > 0 && num_bytes <= 7 &&
+        decoder->input_buffer_end - decoder->input_buffer_start >= 8) {
+        const uint64_t word = readBE64(decoder->input_buffer_start);
+        if (!ok_jpg_has_ff_byte(word)) {
+            decoder->input_buffer_bits = ((decoder->input_buffer_bits << (num_bytes * 8)) |
+                                          (word >> (64 - num_bytes * 8)));
+            decoder->input_buffer_bit_count += num_bytes * 8;
+            decoder->input_buffer_start += num_bytes;
+            return;
+        }
+    }
+    // Slow path: Load one byte at a time, handling stuffed bytes and markers
     while (decoder->input_buffer_bit_count < num_bits) {
         if (decoder->next_marker != 0) {
             decoder->input_buffer_bits <<= 8;
@@ -415,31 +692,71 @@ static bool ok_jpg_generate_huffman_table(ok_jpg_huffman_table *huff, const uint
     return true;
 }
 
+static uint8_t ok_jpg_huffman_search(const ok_jpg_huffman_table *huff, int code16,
+                                     uint8_t *num_bits) {
+    // Slow path for codes longer than HUFFMAN_LOOKUP_SIZE_BITS
+    for (int i = HUFFMAN_LOOKUP_SIZE_BITS; i < 16; i++) {
+        if (code16 <= huff->maxcode[i]) {
+            int j = huff->valptr[i];
+            j += (code16 >> (15 - i)) - huff->mincode[i];
+            *num_bits = (uint8_t)(i + 1);
+            return huff->val[j];
+        }
+    }
+    *num_bits = 0;
+    return 0;
+}
+
 static void ok_jpg_generate_huffman_table_lookups(ok_jpg_huffman_table *huff, bool is_ac_table) {
-    // Look up table for codes that use N bits or less (most of them)
-    for (int q = 0; q < HUFFMAN_LOOKUP_SIZE; q++) {
-        huff->lookup_num_bits[q] = 0;
-        for (uint8_t i = 0; i < HUFFMAN_LOOKUP_SIZE_BITS; i++) {
-            uint8_t num_bits = i + 1;
-            int code = q >> (HUFFMAN_LOOKUP_SIZE_BITS - num_bits);
-            if (code <= huff->maxcode[i]) {
-                huff->lookup_num_bits[q] = num_bits;
-
-                int j = huff->valptr[i];
-                j += code - huff->mincode[i];
-                huff->lookup_val[q] = huff->val[j];
-                break;
+    // Look up table for codes that use N bits or less (most of them). Shorter codes take
+    // precedence, so each code length fills the entries after the ones already filled.
+    int q = 0;
+    for (int i = 0; i < HUFFMAN_LOOKUP_SIZE_BITS && q < HUFFMAN_LOOKUP_SIZE; i++) {
+        int shift = HUFFMAN_LOOKUP_SIZE_BITS - (i + 1);
+        int q_end = (huff->maxcode[i] + 1) << shift;
+        if (q_end > HUFFMAN_LOOKUP_SIZE) {
+            q_end = HUFFMAN_LOOKUP_SIZE;
+        }
+        for (; q < q_end; q++) {
+            int j = huff->valptr[i];
+            j += (q >> shift) - huff->mincode[i];
+            huff->lookup[q].num_bits = (uint8_t)(i + 1);
+            huff->lookup[q].val = huff->val[j];
+        }
+    }
+
+    // Second-level tables for longer codes
+    int num_subtables = 0;
+    for (; q < HUFFMAN_LOOKUP_SIZE; q++) {
+        ok_jpg_huffman_lookup *lookup = huff->lookup + q;
+        lookup->num_bits = 0;
+        lookup->val = 0;
+        if (num_subtables < HUFFMAN_SUBTABLE_COUNT) {
+            ok_jpg_huffman_lookup *subtable = huff->subtables[num_subtables];
+            bool has_codes = false;
+            for (int r = 0; r < HUFFMAN_SUBTABLE_SIZE; r++) {
+                int code16 = (q << (16 - HUFFMAN_LOOKUP_SIZE_BITS)) | r;
+                subtable[r].val = ok_jpg_huffman_search(huff, code16, &subtable[r].num_bits);
+                has_codes |= subtable[r].num_bits > 0;
+            }
+            if (has_codes) {
+                num_subtables++;
+                lookup->val = (uint8_t)num_subtables;
             }
         }
     }
 
     if (is_ac_table) {
-        // Additional lookup table to get both RS and extended value
-        for (int q = 0; q < HUFFMAN_LOOKUP_SIZE; q++) {
-            huff->lookup_ac_num_bits[q] = 0;
-            int num_bits = huff->lookup_num_bits[q];
+        // Additional lookup table to get the RS value, the number of bits for both the code and
+        // the extra bits, and the extended value, all in one entry.
+        for (q = 0; q < HUFFMAN_LOOKUP_SIZE; q++) {
+            ok_jpg_huffman_ac_lookup *lookup_ac = huff->lookup_ac + q;
+            lookup_ac->val = 0;
+            lookup_ac->num_bits = 0;
+            lookup_ac->rs = 0;
+            int num_bits = huff->lookup[q].num_bits;
             if (num_bits > 0) {
-                int rs = huff->lookup_val[q];
+                int rs = huff->lookup[q].val;
                 int r = rs >> 4;
                 int s = rs & 0x0f;
                 int total_bits = num_bits;
@@ -449,15 +766,14 @@ static void ok_jpg_generate_huffman_table_lookups(ok_jpg_huffman_table *huff, bo
                     total_bits += r;
                 }
                 if (total_bits <= HUFFMAN_LOOKUP_SIZE_BITS) {
-                    huff->lookup_ac_num_bits[q] = (uint8_t)total_bits;
+                    lookup_ac->num_bits = (uint8_t)total_bits;
+                    lookup_ac->rs = (uint8_t)rs;
                     if (s > 0) {
                         int v = (q >> (HUFFMAN_LOOKUP_SIZE_BITS - total_bits)) & ((1 << s) - 1);
-                        huff->lookup_ac_val[q] = (int16_t)ok_jpg_extend(v, s);
+                        lookup_ac->val = (int16_t)ok_jpg_extend(v, s);
                     } else if (r > 0 && r < 0x0f) {
                         int v = (q >> (HUFFMAN_LOOKUP_SIZE_BITS - total_bits)) & ((1 << r) - 1);
-                        huff->lookup_ac_val[q] = (int16_t)((1 << r) + v - 1);
-                    } else {
-                        huff->lookup_ac_val[q] = 0;
+                        lookup_ac->val = (int16_t)((1 << r) + v - 1);
                     }
                 }
             }
@@ -472,22 +788,26 @@ static inline uint8_t ok_jpg_huffman_decode(ok_jpg_decoder *decoder,
     // First, try lookup tables
     ok_jpg_load_bits(decoder, 16);
     int code = ok_jpg_peek_bits(decoder, HUFFMAN_LOOKUP_SIZE_BITS);
-    int num_bits = table->lookup_num_bits[code];
-    if (num_bits != 0) {
-        ok_jpg_consume_bits(decoder, num_bits);
-        return table->lookup_val[code];
+    ok_jpg_huffman_lookup lookup = table->lookup[code];
+    if (lookup.num_bits != 0) {
+        ok_jpg_consume_bits(decoder, lookup.num_bits);
+        return lookup.val;
     }
 
     // Next, try a code up to 16-bits
-    code = ok_jpg_peek_bits(decoder, 16);
-    for (int i = HUFFMAN_LOOKUP_SIZE_BITS; i < 16; i++) {
-        if (code <= table->maxcode[i]) {
-            ok_jpg_consume_bits(decoder, i + 1);
-            code >>= (15 - i);
-            int j = table->valptr[i];
-            j += code - table->mincode[i];
-            return table->val[j];
-        }
+    int code16 = ok_jpg_peek_bits(decoder, 16);
+    uint8_t num_bits;
+    uint8_t val;
+    if (lookup.val != 0) {
+        lookup = table->subtables[lookup.val - 1][code16 & (HUFFMAN_SUBTABLE_SIZE - 1)];
+        num_bits = lookup.num_bits;
+        val = lookup.val;
+    } else {
+        val = ok_jpg_huffman_search(table, code16, &num_bits);
+    }
+    if (num_bits != 0) {
+        ok_jpg_consume_bits(decoder, num_bits);
+        return val;
     }
 
     decoder->huffman_error = true;
@@ -522,66 +842,313 @@ static inline void ok_jpg_convert_YCbCr_to_RGB(uint8_t Y, uint8_t Cb, uint8_t Cr
     *b = ok_jpg_clip_fp_uint8(fb);
 }
 
-// Convert from grayscale to RGBA
-static void ok_jpg_convert_data_unit_grayscale(const uint8_t *y, uint8_t *output,
-                                               const int x_inc, const int y_inc,
-                                               const int max_width, const int max_height) {
-    for (int v = 0; v < max_height; v++) {
-        uint8_t *out = output;
-        for (int x = 0; x < max_width; x++) {
-            out[0] = y[x];
-            out[1] = y[x];
-            out[2] = y[x];
-            out[3] = 0xff;
-            out += x_inc;
+// Convert a row from grayscale to RGBA
+static void ok_jpg_convert_row_grayscale(const uint8_t *y, uint8_t *output, const int width) {
+    for (int x = 0; x < width; x++) {
+        output[0] = y[x];
+        output[1] = y[x];
+        output[2] = y[x];
+        output[3] = 0xff;
+        output += 4;
+    }
+}
+
+// Convert a row from YCbCr to RGBA
+static void ok_jpg_convert_row_color(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                     uint8_t *output, bool rgba, const int width) {
+    if (rgba) {
+        for (int x = 0; x < width; x++) {
+            ok_jpg_convert_YCbCr_to_RGB(y[x], cb[x], cr[x], output, output + 1, output + 2);
+            output[3] = 0xff;
+            output += 4;
+        }
+    } else { // bgra
+        for (int x = 0; x < width; x++) {
+            ok_jpg_convert_YCbCr_to_RGB(y[x], cb[x], cr[x], output + 2, output + 1, output);
+            output[3] = 0xff;
+            output += 4;
         }
-        y += C_WIDTH;
-        output += y_inc;
     }
 }
 
-// Convert from YCbCr to RGBA
-static void ok_jpg_convert_data_unit_color(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
-                                           uint8_t *output, bool rgba,
-                                           const int x_inc, const int y_inc,
-                                           const int max_width, const int max_height) {
+// The SIMD color conversions convert 16 pixels at a time, and their output is identical to the
+// portable conversion. They may read up to 15 bytes past the end of each input row.
+
+#if defined(OK_JPG_USE_SSE) || defined(OK_JPG_USE_NEON)
+
+// Stores 16 pixels of RGBA (or BGRA) data as four vectors of 4 pixels each, writing only
+// the first `width` pixels.
+#define OK_JPG_STORE_PIXELS(output, width, pixels, store) do { \
+    const int whole = (width) / 4; \
+    for (int i = 0; i < whole; i++) { \
+        store((output) + i * 16, (pixels)[i]); \
+    } \
+    if (whole < 4 && ((width) & 3) != 0) { \
+        uint8_t temp[16]; \
+        store(temp, (pixels)[whole]); \
+        memcpy((output) + whole * 16, temp, (size_t)((width) & 3) * 4); \
+    } \
+} while (0)
+
+#endif
+
+#if defined(OK_JPG_USE_SSE)
+
+static inline void ok_jpg_store_sse2(uint8_t *dst, const __m128i v) {
+    _mm_storeu_si128((__m128i *)(void *)dst, v);
+}
+
+// Interleaves 16 pixels of four channels into four vectors of 4 pixels each
+static inline void ok_jpg_interleave_sse2(const __m128i c0, const __m128i c1, const __m128i c2,
+                                          const __m128i c3, __m128i *pixels) {
+    const __m128i c01_lo = _mm_unpacklo_epi8(c0, c1);
+    const __m128i c01_hi = _mm_unpackhi_epi8(c0, c1);
+    const __m128i c23_lo = _mm_unpacklo_epi8(c2, c3);
+    const __m128i c23_hi = _mm_unpackhi_epi8(c2, c3);
+    pixels[0] = _mm_unpacklo_epi16(c01_lo, c23_lo);
+    pixels[1] = _mm_unpackhi_epi16(c01_lo, c23_lo);
+    pixels[2] = _mm_unpacklo_epi16(c01_hi, c23_hi);
+    pixels[3] = _mm_unpackhi_epi16(c01_hi, c23_hi);
+}
+
+// Returns ((a * k0 + b * k1) >> 16) for 8 lanes of 16-bit values, where k is a pair of constants
+// for _mm_madd_epi16.
+static inline __m128i ok_jpg_madd_shift_sse2(const __m128i a, const __m128i b, const __m128i k) {
+    const __m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), k), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), k), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Converts 8 pixels of 16-bit YCbCr to 16-bit RGB (unclipped). This is the same 16:16 fixed point
+// math as ok_jpg_convert_YCbCr_to_RGB, with each multiplier split into a multiple of (1 << 16),
+// which is added to Y, and a 16-bit remainder:
+//   1.402   * (1 << 16) =  91881 = (1 << 16) + 26345
+//   0.71414 * (1 << 16) =  46802 = (1 << 16) - 18734
+//   1.772   * (1 << 16) = 116130 = (2 << 16) - 14942
+// For R and B, the (1 << 15) rounding term is included in the madd as (2 * 16384).
+static inline void ok_jpg_convert_YCbCr_to_RGB_sse2(const __m128i y, __m128i cb, __m128i cr,
+                                                    __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i offset = _mm_set1_epi16(128);
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i kr = _mm_set1_epi32((16384 << 16) | 26345);
+    const __m128i kg = _mm_set1_epi32((18734 << 16) | (-22553 & 0xffff));
+    const __m128i kb = _mm_set1_epi32((16384 << 16) | (-14942 & 0xffff));
+    const __m128i round = _mm_set1_epi32(1 << 15);
+    cb = _mm_sub_epi16(cb, offset);
+    cr = _mm_sub_epi16(cr, offset);
+    *r = _mm_add_epi16(_mm_add_epi16(y, cr), ok_jpg_madd_shift_sse2(cr, two, kr));
+    const __m128i cbcr_lo = _mm_unpacklo_epi16(cb, cr);
+    const __m128i cbcr_hi = _mm_unpackhi_epi16(cb, cr);
+    const __m128i g_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cbcr_lo, kg), round), 16);
+    const __m128i g_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cbcr_hi, kg), round), 16);
+    *g = _mm_add_epi16(_mm_sub_epi16(y, cr), _mm_packs_epi32(g_lo, g_hi));
+    *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)), ok_jpg_madd_shift_sse2(cb, two, kb));
+}
+
+// Converts 16 pixels of grayscale to four vectors of 4 RGBA pixels each
+static inline void ok_jpg_convert_grayscale_sse2(const uint8_t *y, __m128i *pixels) {
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    const __m128i gray = _mm_loadu_si128((const __m128i *)(const void *)y);
+    ok_jpg_interleave_sse2(gray, gray, gray, alpha, pixels);
+}
+
+// Converts 16 pixels of YCbCr to four vectors of 4 RGBA (or BGRA) pixels each
+static inline void ok_jpg_convert_color_sse2(const uint8_t *y, const uint8_t *cb,
+                                             const uint8_t *cr, bool rgba, __m128i *pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    const __m128i y8 = _mm_loadu_si128((const __m128i *)(const void *)y);
+    const __m128i cb8 = _mm_loadu_si128((const __m128i *)(const void *)cb);
+    const __m128i cr8 = _mm_loadu_si128((const __m128i *)(const void *)cr);
+    __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+    ok_jpg_convert_YCbCr_to_RGB_sse2(_mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi8(cb8, zero),
+                                     _mm_unpacklo_epi8(cr8, zero), &r_lo, &g_lo, &b_lo);
+    ok_jpg_convert_YCbCr_to_RGB_sse2(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(cb8, zero),
+                                     _mm_unpackhi_epi8(cr8, zero), &r_hi, &g_hi, &b_hi);
+    const __m128i r = _mm_packus_epi16(r_lo, r_hi);
+    const __m128i g = _mm_packus_epi16(g_lo, g_hi);
+    const __m128i b = _mm_packus_epi16(b_lo, b_hi);
     if (rgba) {
-        for (int v = 0; v < max_height; v++) {
-            uint8_t *out = output;
-            for (int x = 0; x < max_width; x++) {
-                ok_jpg_convert_YCbCr_to_RGB(y[x], cb[x], cr[x], out, out + 1, out + 2);
-                out[3] = 0xff;
-                out += x_inc;
+        ok_jpg_interleave_sse2(r, g, b, alpha, pixels);
+    } else {
+        ok_jpg_interleave_sse2(b, g, r, alpha, pixels);
+    }
+}
+
+static void ok_jpg_convert_row_grayscale_sse2(const uint8_t *y, uint8_t *output, const int width) {
+    __m128i pixels[4];
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        ok_jpg_convert_grayscale_sse2(y + x, pixels);
+        for (int i = 0; i < 4; i++) {
+            ok_jpg_store_sse2(output + x * 4 + i * 16, pixels[i]);
+        }
+    }
+    if (x < width) {
+        ok_jpg_convert_grayscale_sse2(y + x, pixels);
+        OK_JPG_STORE_PIXELS(output + x * 4, width - x, pixels, ok_jpg_store_sse2);
+    }
+}
+
+static void ok_jpg_convert_row_color_sse2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                          uint8_t *output, bool rgba, const int width) {
+    __m128i pixels[4];
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        ok_jpg_convert_color_sse2(y + x, cb + x, cr + x, rgba, pixels);
+        for (int i = 0; i < 4; i++) {
+            ok_jpg_store_sse2(output + x * 4 + i * 16, pixels[i]);
+        }
+    }
+    if (x < width) {
+        ok_jpg_convert_color_sse2(y + x, cb + x, cr + x, rgba, pixels);
+        OK_JPG_STORE_PIXELS(output + x * 4, width - x, pixels, ok_jpg_store_sse2);
+    }
+}
+
+#elif defined(OK_JPG_USE_NEON)
+
+static inline void ok_jpg_store_neon(uint8_t *dst, const uint8x16_t v) {
+    vst1q_u8(dst, v);
+}
+
+// Stores 16 pixels of four channels, writing only the first `width` pixels
+static inline void ok_jpg_store_channels_neon(uint8_t *output, const int width,
+                                              const uint8x16x4_t channels) {
+    if (width == 16) {
+        vst4q_u8(output, channels);
+    } else {
+        uint8_t interleaved[64];
+        vst4q_u8(interleaved, channels);
+        uint8x16_t pixels[4];
+        for (int i = 0; i < 4; i++) {
+            pixels[i] = vld1q_u8(interleaved + i * 16);
+        }
+        OK_JPG_STORE_PIXELS(output, width, pixels, ok_jpg_store_neon);
+    }
+}
+
+// Converts 4 pixels with the same 16:16 fixed point math as ok_jpg_convert_YCbCr_to_RGB,
+// without clipping.
+static inline void ok_jpg_convert_YCbCr_to_RGB_neon(const int32x4_t y, const int32x4_t cb,
+                                                    const int32x4_t cr, int16x4_t *r,
+                                                    int16x4_t *g, int16x4_t *b) {
+    const int32x4_t fy = vaddq_s32(vshlq_n_s32(y, 16), vdupq_n_s32(1 << 15));
+    *r = vshrn_n_s32(vmlaq_n_s32(fy, cr, 91881), 16);
+    *g = vshrn_n_s32(vmlaq_n_s32(vmlaq_n_s32(fy, cb, -22553), cr, -46802), 16);
+    *b = vshrn_n_s32(vmlaq_n_s32(fy, cb, 116130), 16);
+}
+
+static void ok_jpg_convert_row_grayscale_neon(const uint8_t *y, uint8_t *output, const int width) {
+    uint8x16x4_t channels;
+    channels.val[3] = vdupq_n_u8(0xff);
+    for (int x = 0; x < width; x += 16) {
+        const uint8x16_t gray = vld1q_u8(y + x);
+        channels.val[0] = gray;
+        channels.val[1] = gray;
+        channels.val[2] = gray;
+        ok_jpg_store_channels_neon(output + x * 4, min(16, width - x), channels);
+    }
+}
+
+static void ok_jpg_convert_row_color_neon(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                          uint8_t *output, bool rgba, const int width) {
+    const int32x4_t offset = vdupq_n_s32(128);
+    uint8x16x4_t channels;
+    channels.val[3] = vdupq_n_u8(0xff);
+    for (int x = 0; x < width; x += 16) {
+        const uint8x16_t y8 = vld1q_u8(y + x);
+        const uint8x16_t cb8 = vld1q_u8(cb + x);
+        const uint8x16_t cr8 = vld1q_u8(cr + x);
+        const uint16x8_t y16[2] = { vmovl_u8(vget_low_u8(y8)), vmovl_u8(vget_high_u8(y8)) };
+        const uint16x8_t cb16[2] = { vmovl_u8(vget_low_u8(cb8)), vmovl_u8(vget_high_u8(cb8)) };
+        const uint16x8_t cr16[2] = { vmovl_u8(vget_low_u8(cr8)), vmovl_u8(vget_high_u8(cr8)) };
+        int16x8_t r16[2];
+        int16x8_t g16[2];
+        int16x8_t b16[2];
+        for (int i = 0; i < 2; i++) {
+            int16x4_t r[2], g[2], b[2];
+            for (int j = 0; j < 2; j++) {
+                const uint16x4_t y4 = j == 0 ? vget_low_u16(y16[i]) : vget_high_u16(y16[i]);
+                const uint16x4_t cb4 = j == 0 ? vget_low_u16(cb16[i]) : vget_high_u16(cb16[i]);
+                const uint16x4_t cr4 = j == 0 ? vget_low_u16(cr16[i]) : vget_high_u16(cr16[i]);
+                ok_jpg_convert_YCbCr_to_RGB_neon(vreinterpretq_s32_u32(vmovl_u16(y4)),
+                                                 vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(cb4)), offset),
+                                                 vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(cr4)), offset),
+                                                 &r[j], &g[j], &b[j]);
+            }
+            r16[i] = vcombine_s16(r[0], r[1]);
+            g16[i] = vcombine_s16(g[0], g[1]);
+            b16[i] = vcombine_s16(b[0], b[1]);
+        }
+        const uint8x16_t r8 = vcombine_u8(vqmovun_s16(r16[0]), vqmovun_s16(r16[1]));
+        const uint8x16_t b8 = vcombine_u8(vqmovun_s16(b16[0]), vqmovun_s16(b16[1]));
+        channels.val[0] = rgba ? r8 : b8;
+        channels.val[1] = vcombine_u8(vqmovun_s16(g16[0]), vqmovun_s16(g16[1]));
+        channels.val[2] = rgba ? b8 : r8;
+        ok_jpg_store_channels_neon(output + x * 4, min(16, width - x), channels);
+    }
+}
+
+#endif
+
+// Converts the rows of a decoded chunk to RGBA or BGRA, starting at (x, y) in the chunk. The
+// output stride may be negative.
+static void ok_jpg_convert_rows(ok_jpg_decoder *decoder, const int x, const int y,
+                                uint8_t *output, const int output_stride,
+                                const int width, const int height) {
+    const ok_jpg_component *c = decoder->components;
+    const size_t stride = decoder->mcu_row_stride;
+    const size_t start = (size_t)y * stride + (size_t)x;
+    const bool rgba = decoder->color_rgba;
+#if defined(OK_JPG_USE_SSE)
+    if (decoder->simd != OK_JPG_SIMD_NONE) {
+        for (int v = 0; v < height; v++) {
+            const size_t offset = start + (size_t)v * stride;
+            if (decoder->num_components == 1) {
+                ok_jpg_convert_row_grayscale_sse2(c->output + offset, output, width);
+            } else {
+                ok_jpg_convert_row_color_sse2(c->output + offset, (c + 1)->output + offset,
+                                              (c + 2)->output + offset, output, rgba, width);
             }
-            y += C_WIDTH;
-            cb += C_WIDTH;
-            cr += C_WIDTH;
-            output += y_inc;
+            output += output_stride;
         }
+        return;
     }
-    else { // bgra
-        for (int v = 0; v < max_height; v++) {
-            uint8_t *out = output;
-            for (int x = 0; x < max_width; x++) {
-                ok_jpg_convert_YCbCr_to_RGB(y[x], cb[x], cr[x], out + 2, out + 1, out);
-                out[3] = 0xff;
-                out += x_inc;
+#elif defined(OK_JPG_USE_NEON)
+    if (decoder->simd != OK_JPG_SIMD_NONE) {
+        for (int v = 0; v < height; v++) {
+            const size_t offset = start + (size_t)v * stride;
+            if (decoder->num_components == 1) {
+                ok_jpg_convert_row_grayscale_neon(c->output + offset, output, width);
+            } else {
+                ok_jpg_convert_row_color_neon(c->output + offset, (c + 1)->output + offset,
+                                              (c + 2)->output + offset, output, rgba, width);
             }
-            y += C_WIDTH;
-            cb += C_WIDTH;
-            cr += C_WIDTH;
-            output += y_inc;
+            output += output_stride;
+        }
+        return;
+    }
+#endif
+    for (int v = 0; v < height; v++) {
+        const size_t offset = start + (size_t)v * stride;
+        if (decoder->num_components == 1) {
+            ok_jpg_convert_row_grayscale(c->output + offset, output, width);
+        } else {
+            ok_jpg_convert_row_color(c->output + offset, (c + 1)->output + offset,
+                                     (c + 2)->output + offset, output, rgba, width);
         }
+        output += output_stride;
     }
 }
 
-static void ok_jpg_convert_data_unit(ok_jpg_decoder *decoder, int data_unit_x, int data_unit_y) {
+// Copies a converted chunk from transform_data to the output at (x, y), rotating and flipping it.
+// The copy is done in blocks of 16 columns, so that with rotation each block writes up to
+// 16 output rows, 64 contiguous bytes each.
+static void ok_jpg_transform_chunk(ok_jpg_decoder *decoder, int x, int y, int width, int height,
+                                   uint32_t output_height) {
     ok_jpg *jpg = decoder->jpg;
-    ok_jpg_component *c = decoder->components;
-    int x = data_unit_x * c->H * 8;
-    int y = data_unit_y * c->V * 8;
-    const int width = min(c->H * 8, decoder->in_width - x);
-    const int height = min(c->V * 8, decoder->in_height - y);
+    const size_t src_stride = (size_t)width * 4;
     int x_inc = 4;
     int y_inc = (int)jpg->stride;
     uint8_t *data = jpg->data;
@@ -597,7 +1164,7 @@ static void ok_jpg_convert_data_unit(ok_jpg_decoder *decoder, int data_unit_x, i
         data += (size_t)x * (size_t)x_inc;
     }
     if (decoder->flip_y) {
-        data += ((jpg->height - (size_t)y - 1) * (size_t)y_inc);
+        data += ((output_height - (size_t)y - 1) * (size_t)y_inc);
         y_inc = -y_inc;
     } else {
         data += (size_t)y * (size_t)y_inc;
@@ -608,13 +1175,66 @@ static void ok_jpg_convert_data_unit(ok_jpg_decoder *decoder, int data_unit_x, i
         y_inc = temp;
     }
 
-    if (decoder->num_components == 1) {
-        ok_jpg_convert_data_unit_grayscale(c->output, data, x_inc, y_inc, width, height);
+    for (int block_x = 0; block_x < width; block_x += 16) {
+        const int block_width = min(16, width - block_x);
+        for (int v = 0; v < height; v++) {
+            const uint8_t *src = decoder->transform_data + v * src_stride + block_x * 4;
+            uint8_t *dst = data + v * y_inc + block_x * x_inc;
+            for (int u = 0; u < block_width; u++) {
+                memcpy(dst, src, 4);
+                src += 4;
+                dst += x_inc;
+            }
+        }
+    }
+}
+
+// Converts a decoded chunk of an MCU row, starting at data unit (data_unit_x, data_unit_y), to the
+// output. Only the part of the chunk in the region is converted. Without rotation or horizontal
+// flipping, each row is converted directly into the output image. With row output, the MCU row
+// is sent to rows_func after its last chunk.
+static bool ok_jpg_convert_chunk(ok_jpg_decoder *decoder, int data_unit_x, int data_unit_y,
+                                 int num_data_units) {
+    ok_jpg *jpg = decoder->jpg;
+    const int chunk_x = data_unit_x * decoder->mcu_width;
+    const int chunk_y = data_unit_y * decoder->mcu_height;
+    const int region_x = max(chunk_x, decoder->region_x);
+    const int region_y = max(chunk_y, decoder->region_y);
+    const int width = (min(chunk_x + num_data_units * decoder->mcu_width,
+                           decoder->region_x + decoder->region_width) - region_x);
+    const int height = (min(chunk_y + decoder->mcu_height,
+                            decoder->region_y + decoder->region_height) - region_y);
+    const int x = region_x - decoder->region_x;
+    const int y = region_y - decoder->region_y;
+    const int src_x = region_x - chunk_x;
+    const int src_y = region_y - chunk_y;
+    const int output_y = decoder->row_output ? 0 : y;
+    const uint32_t output_height = decoder->row_output ? (uint32_t)height : jpg->height;
+    if (decoder->rotate || decoder->flip_x) {
+        ok_jpg_convert_rows(decoder, src_x, src_y, decoder->transform_data, width * 4,
+                            width, height);
+        ok_jpg_transform_chunk(decoder, x, output_y, width, height, output_height);
+    } else if (decoder->flip_y) {
+        uint8_t *output = (jpg->data + (output_height - (size_t)output_y - 1) * jpg->stride +
+                           (size_t)x * 4);
+        ok_jpg_convert_rows(decoder, src_x, src_y, output, -(int)jpg->stride, width, height);
     } else {
-        ok_jpg_convert_data_unit_color(c->output, (c + 1)->output, (c + 2)->output,
-                                       data, decoder->color_rgba,
-                                       x_inc, y_inc, width, height);
+        uint8_t *output = jpg->data + (size_t)output_y * jpg->stride + (size_t)x * 4;
+        ok_jpg_convert_rows(decoder, src_x, src_y, output, (int)jpg->stride, width, height);
+    }
+    if (x + width == decoder->region_width && !decoder->rotate) {
+        decoder->rows_completed += (uint32_t)height;
+        if (decoder->row_output) {
+            const uint32_t first_row = (decoder->flip_y ? jpg->height - (uint32_t)(y + height) :
+                                        (uint32_t)y);
+            if (!decoder->rows_func(decoder->rows_user_data, jpg->width, jpg->height, first_row,
+                                    (uint32_t)height, jpg->data, jpg->stride)) {
+                ok_jpg_error(jpg, OK_JPG_ERROR_CANCELED, "Canceled");
+                return false;
+            }
+        }
     }
+    return true;
 }
 
 // MARK: IDCT
@@ -833,7 +1453,8 @@ static inline void ok_jpg_idct_1d_col_16(const int16_t *in, int *out) {
 }
 
 // Output is scaled by (1 << 12) * sqrt(2) / (1 << out_shift)
-static inline void ok_jpg_idct_1d_row_8(int h, const int *in, uint8_t *out) {
+static inline void ok_jpg_idct_1d_row_8(int h, const int *in, uint8_t *out,
+                                        const size_t out_stride) {
     static const int out_shift = 19;
 
     int t0, t1, t2;
@@ -859,12 +1480,13 @@ static inline void ok_jpg_idct_1d_row_8(int h, const int *in, uint8_t *out) {
             out[7] = ok_jpg_clip_uint8(((p0 - q0) >> out_shift) + 128);
         }
         in += 8;
-        out += C_WIDTH;
+        out += out_stride;
     }
 }
 
 // Output is scaled by (1 << 12) * sqrt(2) / (1 << out_shift)
-static inline void ok_jpg_idct_1d_row_16(int h, const int *in, uint8_t *out) {
+static inline void ok_jpg_idct_1d_row_16(int h, const int *in, uint8_t *out,
+                                         const size_t out_stride) {
     static const int out_shift = 19;
 
     int t0, t1, t2;
@@ -898,155 +1520,875 @@ static inline void ok_jpg_idct_1d_row_16(int h, const int *in, uint8_t *out) {
             out[15] = ok_jpg_clip_uint8(((p0 - q0) >> out_shift) + 128);
         }
         in += 8;
-        out += C_WIDTH;
+        out += out_stride;
     }
 }
 
-// IDCT a 8x8 input block to 8x8 in an output of size (C_WIDTH x C_WIDTH)
-static void ok_jpg_idct_8x8(const int16_t *input, uint8_t *output) {
+// IDCT a 8x8 block to 8x8
+static void ok_jpg_idct_8x8(const int16_t *input, uint8_t *output, const size_t output_stride) {
     int temp[8 * 8];
     ok_jpg_idct_1d_col_8(input, temp);
-    ok_jpg_idct_1d_row_8(8, temp, output);
+    ok_jpg_idct_1d_row_8(8, temp, output, output_stride);
 }
 
-// IDCT a 8x8 block to 8x16 in an output of size (C_WIDTH x C_WIDTH)
-static void ok_jpg_idct_8x16(const int16_t *input, uint8_t *output) {
+// IDCT a 8x8 block to 8x16
+static void ok_jpg_idct_8x16(const int16_t *input, uint8_t *output, const size_t output_stride) {
     int temp[8 * 16];
     ok_jpg_idct_1d_col_16(input, temp);
-    ok_jpg_idct_1d_row_8(16, temp, output);
+    ok_jpg_idct_1d_row_8(16, temp, output, output_stride);
 }
 
-// IDCT a 8x8 block to 16x8 in an output of size (C_WIDTH x C_WIDTH)
-static void ok_jpg_idct_16x8(const int16_t *input, uint8_t *output) {
+// IDCT a 8x8 block to 16x8
+static void ok_jpg_idct_16x8(const int16_t *input, uint8_t *output, const size_t output_stride) {
     int temp[8 * 8];
     ok_jpg_idct_1d_col_8(input, temp);
-    ok_jpg_idct_1d_row_16(8, temp, output);
+    ok_jpg_idct_1d_row_16(8, temp, output, output_stride);
 }
 
-// IDCT a 8x8 block to 16x16 in an output of size (C_WIDTH x C_WIDTH)
-static void ok_jpg_idct_16x16(const int16_t *input, uint8_t *output) {
+// IDCT a 8x8 block to 16x16
+static void ok_jpg_idct_16x16(const int16_t *input, uint8_t *output, const size_t output_stride) {
     int temp[8 * 16];
     ok_jpg_idct_1d_col_16(input, temp);
-    ok_jpg_idct_1d_row_16(16, temp, output);
+    ok_jpg_idct_1d_row_16(16, temp, output, output_stride);
 }
 
-// MARK: Entropy decoding
-
-#define OK_JPG_BLOCK_EXTRA_SPACE 15
-
-// Transposed from spec
-static const int ok_jpg_zig_zag[] = {
-    0,  8,  1,  2,  9,  16, 24, 17,
-    10, 3,  4,  11, 18, 25, 32, 40,
-    33, 26, 19, 12, 5,  6,  13, 20,
-    27, 34, 41, 48, 56, 49, 42, 35,
-    28, 21, 14, 7,  15, 22, 29, 36,
-    43, 50, 57, 58, 51, 44, 37, 30,
-    23, 31, 38, 45, 52, 59, 60, 53,
-    46, 39, 47, 54, 61, 62, 55, 63,
-    // 15 byte overrun for invalid r values
-    63, 63, 63, 63, 63, 63, 63, 63,
-    63, 63, 63, 63, 63, 63, 63
-};
+// MARK: Reduced IDCT
+//
+// For scaled decoding, an N-point IDCT of the first N coefficients (N = 1, 2, or 4) produces the
+// block scaled to N pixels. The fixed-point scale is the same as ok_jpg_idct_1d_8, and the
+// constants are the same because cos((2x + 1) * u * pi / 8) = cos((2x + 1) * 2u * pi / 16).
 
-static inline void ok_jpg_decode_block(ok_jpg_decoder *decoder, ok_jpg_component *c,
-                                       int16_t *block) {
-    memset(block, 0, 8 * 8 * sizeof(*block));
+#define ok_jpg_idct_1d_4(v0, v1, v2, v3) do { \
+    static const int c2 = 5352; /* cos(2*pi/16) * sqrt(2) * (1 << 12) */ \
+    static const int c6 = 2217; /* cos(6*pi/16) * sqrt(2) * (1 << 12) */ \
+    \
+    t0 = (v0 << 12) + (1 << (out_shift - 1)); \
+    t1 = (v2 << 12); \
+    p0 = t0 + t1; \
+    p1 = t0 - t1; \
+    \
+    q0 = v1 * c2 + v3 * c6; \
+    q1 = v1 * c6 - v3 * c2; \
+} while (0)
 
-    const uint8_t *q_table = decoder->q_table[c->Tq];
+// Output is scaled by (1 << 12) * sqrt(2) / (1 << out_shift). Only the first `count` rows are
+// transformed, since the row pass of an N-point IDCT only reads the first N columns.
+static inline void ok_jpg_idct_1d_col_reduced(int n, int count, const int16_t *in, int *out) {
+    static const int out_shift = 8;
 
-    // Decode DC coefficients - F.2.2.1
-    ok_jpg_huffman_table *dc = decoder->dc_huffman_tables + c->Td;
-    uint8_t t = ok_jpg_huffman_decode(decoder, dc);
-    if (t > 0) {
-        int diff = ok_jpg_load_next_bits(decoder, t);
-        c->pred += ok_jpg_extend(diff, t);
-    }
-    block[0] = c->pred * q_table[0];
+    int t0, t1;
+    int p0, p1;
+    int q0, q1;
 
-    // Decode AC coefficients - Figures F.13 and F.14
-    ok_jpg_huffman_table *ac = decoder->ac_huffman_tables + c->Ta;
-    int k = 1;
-    while (k <= 63) {
-        ok_jpg_load_bits(decoder, 16);
-        int code = ok_jpg_peek_bits(decoder, HUFFMAN_LOOKUP_SIZE_BITS);
-        uint8_t num_bits = ac->lookup_ac_num_bits[code];
-        if (num_bits > 0) {
-            ok_jpg_consume_bits(decoder, num_bits);
-            uint8_t rs = ac->lookup_val[code];
-            int s = rs & 0x0f;
-            if (s > 0) {
-                int r = rs >> 4;
-                k += r;
-                block[ok_jpg_zig_zag[k]] = ac->lookup_ac_val[code] * q_table[k];
-                k++;
-            } else {
-                if (rs == 0) {
-                    break;
-                }
-                k += 16;
-            }
+    for (int x = 0; x < count; x++) {
+        if (n == 4) {
+            ok_jpg_idct_1d_4(in[0], in[1], in[2], in[3]);
+            out[0 * 8] = (p0 + q0) >> out_shift;
+            out[1 * 8] = (p1 + q1) >> out_shift;
+            out[2 * 8] = (p1 - q1) >> out_shift;
+            out[3 * 8] = (p0 - q0) >> out_shift;
+        } else if (n == 2) {
+            t0 = (in[0] << 12) + (1 << (out_shift - 1));
+            t1 = (in[1] << 12);
+            out[0 * 8] = (t0 + t1) >> out_shift;
+            out[1 * 8] = (t0 - t1) >> out_shift;
         } else {
-            uint8_t rs = ok_jpg_huffman_decode(decoder, ac);
-            int s = rs & 0x0f;
-            if (s > 0) {
-                int r = rs >> 4;
-                k += r;
-                int v = ok_jpg_load_next_bits(decoder, s);
-                block[ok_jpg_zig_zag[k]] = (int16_t)ok_jpg_extend(v, s) * q_table[k];
-                k++;
-            } else {
-                if (rs == 0) {
-                    break;
-                }
-                k += 16;
-            }
+            out[0 * 8] = in[0] << (12 - out_shift);
         }
+
+        in += 8;
+        out++;
     }
 }
 
-static void ok_jpg_decode_block_progressive(ok_jpg_decoder *decoder, ok_jpg_component *c,
-                                            int16_t *block) {
-    int k = decoder->scan_start;
-    const int k_end = decoder->scan_end;
-    const int scale = decoder->scan_scale;
+// Output is scaled by (1 << 12) * sqrt(2) / (1 << out_shift)
+static inline void ok_jpg_idct_1d_row_reduced(int n, int h, const int *in, uint8_t *out,
+                                              const size_t out_stride) {
+    static const int out_shift = 19;
 
-    memset(block + k, 0, (size_t)(k_end - k + 1) * sizeof(*block));
+    int t0, t1;
+    int p0, p1;
+    int q0, q1;
 
-    // Decode DC coefficients - F.2.2.1
-    if (k == 0) {
-        ok_jpg_huffman_table *dc = decoder->dc_huffman_tables + c->Td;
-        uint8_t t = ok_jpg_huffman_decode(decoder, dc);
-        if (t > 0) {
-            int diff = ok_jpg_load_next_bits(decoder, t);
-            c->pred += ok_jpg_extend(diff, t) << scale;
+    for (int y = 0; y < h; y++) {
+        if (n == 4) {
+            ok_jpg_idct_1d_4(in[0], in[1], in[2], in[3]);
+            out[0] = ok_jpg_clip_uint8(((p0 + q0) >> out_shift) + 128);
+            out[1] = ok_jpg_clip_uint8(((p1 + q1) >> out_shift) + 128);
+            out[2] = ok_jpg_clip_uint8(((p1 - q1) >> out_shift) + 128);
+            out[3] = ok_jpg_clip_uint8(((p0 - q0) >> out_shift) + 128);
+        } else if (n == 2) {
+            t0 = (in[0] << 12) + (1 << (out_shift - 1));
+            t1 = (in[1] << 12);
+            out[0] = ok_jpg_clip_uint8(((t0 + t1) >> out_shift) + 128);
+            out[1] = ok_jpg_clip_uint8(((t0 - t1) >> out_shift) + 128);
+        } else {
+            const int offset = 1 << (out_shift - 12 - 1);
+            out[0] = ok_jpg_clip_uint8(((in[0] + offset) >> (out_shift - 12)) + 128);
         }
-        block[0] = c->pred;
-        k++;
+        in += 8;
+        out += out_stride;
     }
+}
 
-    // Decode AC coefficients - Figures F.13, F.14, and G.2
-    if (c->eob_run > 0) {
-        c->eob_run--;
+// IDCT a 8x8 block to (w x h), where w and h are 1, 2, 4, or 8, and w or h is less than 8
+static inline void ok_jpg_idct_reduced(int w, int h, const int16_t *input, uint8_t *output,
+                                       const size_t output_stride) {
+    int temp[8 * 8];
+    if (h == 8) {
+        ok_jpg_idct_1d_col_8(input, temp);
+    } else {
+        ok_jpg_idct_1d_col_reduced(h, w, input, temp);
+    }
+    if (w == 8) {
+        ok_jpg_idct_1d_row_8(h, temp, output, output_stride);
+    } else {
+        ok_jpg_idct_1d_row_reduced(w, h, temp, output, output_stride);
+    }
+}
+
+static void ok_jpg_idct_1x1(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(1, 1, input, output, output_stride);
+}
+
+static void ok_jpg_idct_1x2(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(1, 2, input, output, output_stride);
+}
+
+static void ok_jpg_idct_2x1(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(2, 1, input, output, output_stride);
+}
+
+static void ok_jpg_idct_2x2(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(2, 2, input, output, output_stride);
+}
+
+static void ok_jpg_idct_2x4(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(2, 4, input, output, output_stride);
+}
+
+static void ok_jpg_idct_4x2(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(4, 2, input, output, output_stride);
+}
+
+static void ok_jpg_idct_4x4(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(4, 4, input, output, output_stride);
+}
+
+static void ok_jpg_idct_4x8(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(4, 8, input, output, output_stride);
+}
+
+static void ok_jpg_idct_8x4(const int16_t *input, uint8_t *output, const size_t output_stride) {
+    ok_jpg_idct_reduced(8, 4, input, output, output_stride);
+}
+
+// MARK: SIMD IDCT
+//
+// The SIMD IDCTs compute the same fixed-point sums as the portable IDCT, so the output is
+// identical. Each 1D pass transforms eight columns at once. The factored multiplies of
+// ok_jpg_idct_1d_8 and ok_jpg_idct_1d_16 expand to a matrix of the same constants, so each pass is
+// a matrix multiply of 16-bit inputs with 32-bit sums.
+//
+// The intermediate values between the two passes are packed to 16 bits. Coefficients of a valid
+// image never exceed that range, but if one does, the second pass falls back to the portable code.
+
+#if defined(OK_JPG_USE_SSE) || defined(OK_JPG_USE_NEON)
+
+// Matrix rows for the even inputs (v0, v4, v2, v6) and the odd inputs (v1, v3, v5, v7).
+// Output k is (even[k] + odd[k]), and output (n - 1 - k) is (even[k] - odd[k]).
+static const int16_t ok_jpg_idct_8_even[4][4] = {
+    { 4096,  4096,  5352,  2217 },
+    { 4096, -4096,  2217, -5352 },
+    { 4096, -4096, -2217,  5352 },
+    { 4096,  4096, -5352, -2217 },
+};
+
+static const int16_t ok_jpg_idct_8_odd[4][4] = {
+    { 5681,  4816,  3218,  1130 },
+    { 4816, -1130, -5681, -3218 },
+    { 3218, -5681,  1130,  4816 },
+    { 1130, -3218,  4816, -5681 },
+};
+
+static const int16_t ok_jpg_idct_16_even[8][4] = {
+    { 4096,  5352,  5681,  4816 },
+    { 4096,  2217,  4816, -1130 },
+    { 4096, -2217,  3218, -5681 },
+    { 4096, -5352,  1130, -3218 },
+    { 4096, -5352, -1130,  3218 },
+    { 4096, -2217, -3218,  5681 },
+    { 4096,  2217, -4816,  1130 },
+    { 4096,  5352, -5681, -4816 },
+};
+
+static const int16_t ok_jpg_idct_16_odd[8][4] = {
+    { 5765,  5543,  5109,  4478 },
+    { 5543,  3675,   568, -2731 },
+    { 5109,   568, -4478, -5543 },
+    { 4478, -2731, -5543,   568 },
+    { 3675, -5109, -1682,  5765 },
+    { 2731, -5765,  3675,  1682 },
+    { 1682, -4478,  5765, -5109 },
+    {  568, -1682,  2731, -3675 },
+};
+
+// Fills the output of the IDCT with a single value
+static inline void ok_jpg_idct_fill(uint8_t *output, const size_t output_stride, const int w,
+                                    const int h, const uint8_t value) {
+    for (int y = 0; y < h; y++) {
+        memset(output + y * output_stride, value, (size_t)w);
+    }
+}
+
+// Output of a block with only a DC coefficient. Same as the "quick check" in the portable IDCT.
+static inline uint8_t ok_jpg_idct_dc(const int16_t dc) {
+    return ok_jpg_clip_uint8(((dc * 16 + (1 << 6)) >> 7) + 128);
+}
+
+#endif
+
+#if defined(OK_JPG_USE_SSE)
+
+// Returns a pair of 16-bit constants, for use with _mm_madd_epi16
+static inline int ok_jpg_idct_pair(const int16_t *c) {
+    return (int)((uint32_t)(uint16_t)c[0] | ((uint32_t)(uint16_t)c[1] << 16));
+}
+
+static inline void ok_jpg_transpose_8x8_sse2(__m128i *v) {
+    const __m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+    const __m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+    const __m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+    const __m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+    const __m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+    const __m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+    const __m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+    const __m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+    const __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    const __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    const __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    const __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    const __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    const __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    const __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    const __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+    v[0] = _mm_unpacklo_epi64(b0, b4);
+    v[1] = _mm_unpackhi_epi64(b0, b4);
+    v[2] = _mm_unpacklo_epi64(b1, b5);
+    v[3] = _mm_unpackhi_epi64(b1, b5);
+    v[4] = _mm_unpacklo_epi64(b2, b6);
+    v[5] = _mm_unpackhi_epi64(b2, b6);
+    v[6] = _mm_unpacklo_epi64(b3, b7);
+    v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// 1D IDCT of eight columns, where v[i] is input i of each column. Output k of columns 0-3 is in
+// out[k][0], and columns 4-7 in out[k][1]. Each output is (sum + rounding) >> shift.
+typedef void (*ok_jpg_idct_1d_sse_func)(const __m128i *v, int n, int rounding, int shift,
+                                        __m128i (*out)[2]);
+
+static inline void ok_jpg_idct_1d_sse2(const __m128i *v, const int n, const int rounding,
+                                       const int shift, __m128i (*out)[2]) {
+    const int16_t (*even)[4] = n == 8 ? ok_jpg_idct_8_even : ok_jpg_idct_16_even;
+    const int16_t (*odd)[4] = n == 8 ? ok_jpg_idct_8_odd : ok_jpg_idct_16_odd;
+    const __m128i round = _mm_set1_epi32(rounding);
+    const __m128i v04[2] = { _mm_unpacklo_epi16(v[0], v[4]), _mm_unpackhi_epi16(v[0], v[4]) };
+    const __m128i v26[2] = { _mm_unpacklo_epi16(v[2], v[6]), _mm_unpackhi_epi16(v[2], v[6]) };
+    const __m128i v13[2] = { _mm_unpacklo_epi16(v[1], v[3]), _mm_unpackhi_epi16(v[1], v[3]) };
+    const __m128i v57[2] = { _mm_unpacklo_epi16(v[5], v[7]), _mm_unpackhi_epi16(v[5], v[7]) };
+    for (int k = 0; k < n / 2; k++) {
+        const __m128i c04 = _mm_set1_epi32(ok_jpg_idct_pair(even[k]));
+        const __m128i c26 = _mm_set1_epi32(ok_jpg_idct_pair(even[k] + 2));
+        const __m128i c13 = _mm_set1_epi32(ok_jpg_idct_pair(odd[k]));
+        const __m128i c57 = _mm_set1_epi32(ok_jpg_idct_pair(odd[k] + 2));
+        for (int i = 0; i < 2; i++) {
+            const __m128i e = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(v04[i], c04),
+                                                          _mm_madd_epi16(v26[i], c26)), round);
+            const __m128i o = _mm_add_epi32(_mm_madd_epi16(v13[i], c13),
+                                            _mm_madd_epi16(v57[i], c57));
+            out[k][i] = _mm_srai_epi32(_mm_add_epi32(e, o), shift);
+            out[n - 1 - k][i] = _mm_srai_epi32(_mm_sub_epi32(e, o), shift);
+        }
+    }
+}
+
+OK_JPG_TARGET("avx2")
+static inline __m256i ok_jpg_unpack_epi16_avx2(const __m128i a, const __m128i b) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, b)),
+                                   _mm_unpackhi_epi16(a, b), 1);
+}
+
+OK_JPG_TARGET("avx2")
+static inline void ok_jpg_idct_1d_avx2(const __m128i *v, const int n, const int rounding,
+                                       const int shift, __m128i (*out)[2]) {
+    const int16_t (*even)[4] = n == 8 ? ok_jpg_idct_8_even : ok_jpg_idct_16_even;
+    const int16_t (*odd)[4] = n == 8 ? ok_jpg_idct_8_odd : ok_jpg_idct_16_odd;
+    const __m256i round = _mm256_set1_epi32(rounding);
+    const __m256i v04 = ok_jpg_unpack_epi16_avx2(v[0], v[4]);
+    const __m256i v26 = ok_jpg_unpack_epi16_avx2(v[2], v[6]);
+    const __m256i v13 = ok_jpg_unpack_epi16_avx2(v[1], v[3]);
+    const __m256i v57 = ok_jpg_unpack_epi16_avx2(v[5], v[7]);
+    for (int k = 0; k < n / 2; k++) {
+        const __m256i c04 = _mm256_set1_epi32(ok_jpg_idct_pair(even[k]));
+        const __m256i c26 = _mm256_set1_epi32(ok_jpg_idct_pair(even[k] + 2));
+        const __m256i c13 = _mm256_set1_epi32(ok_jpg_idct_pair(odd[k]));
+        const __m256i c57 = _mm256_set1_epi32(ok_jpg_idct_pair(odd[k] + 2));
+        const __m256i e = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(v04, c04),
+                                                            _mm256_madd_epi16(v26, c26)), round);
+        const __m256i o = _mm256_add_epi32(_mm256_madd_epi16(v13, c13),
+                                           _mm256_madd_epi16(v57, c57));
+        const __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(e, o), shift);
+        const __m256i diff = _mm256_srai_epi32(_mm256_sub_epi32(e, o), shift);
+        out[k][0] = _mm256_castsi256_si128(sum);
+        out[k][1] = _mm256_extracti128_si256(sum, 1);
+        out[n - 1 - k][0] = _mm256_castsi256_si128(diff);
+        out[n - 1 - k][1] = _mm256_extracti128_si256(diff, 1);
+    }
+}
+
+// IDCT a 8x8 block to (w x h)
+static inline void ok_jpg_idct_2d_sse(const int16_t *input, uint8_t *output,
+                                      const size_t output_stride, const int w, const int h,
+                                      ok_jpg_idct_1d_sse_func idct_1d) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v[8];
+    v[0] = _mm_loadu_si128((const __m128i *)(const void *)input);
+    __m128i ac = _mm_andnot_si128(_mm_cvtsi32_si128(0xffff), v[0]);
+    for (int i = 1; i < 8; i++) {
+        v[i] = _mm_loadu_si128((const __m128i *)(const void *)(input + i * 8));
+        ac = _mm_or_si128(ac, v[i]);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(ac, zero)) == 0xffff) {
+        ok_jpg_idct_fill(output, output_stride, w, h, ok_jpg_idct_dc(input[0]));
+        return;
+    }
+
+    // Columns. Output row k is the same as row k of temp in the portable IDCT.
+    __m128i p[16][2];
+    __m128i rows[16];
+    ok_jpg_transpose_8x8_sse2(v);
+    idct_1d(v, h, 1 << 7, 8, p);
+    const __m128i bias = _mm_set1_epi32(1 << 15);
+    __m128i range = zero;
+    for (int k = 0; k < h; k++) {
+        range = _mm_or_si128(range, _mm_or_si128(_mm_add_epi32(p[k][0], bias),
+                                                 _mm_add_epi32(p[k][1], bias)));
+        rows[k] = _mm_packs_epi32(p[k][0], p[k][1]);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(range, 16), zero)) != 0xffff) {
+        int temp[8 * 16];
+        for (int k = 0; k < h; k++) {
+            _mm_storeu_si128((__m128i *)(void *)(temp + k * 8), p[k][0]);
+            _mm_storeu_si128((__m128i *)(void *)(temp + k * 8 + 4), p[k][1]);
+        }
+        if (w == 8) {
+            ok_jpg_idct_1d_row_8(h, temp, output, output_stride);
+        } else {
+            ok_jpg_idct_1d_row_16(h, temp, output, output_stride);
+        }
+        return;
+    }
+
+    // Rows, eight at a time
+    const __m128i offset = _mm_set1_epi16(128);
+    for (int y = 0; y < h; y += 8) {
+        __m128i q[16][2];
+        __m128i out[16];
+        ok_jpg_transpose_8x8_sse2(rows + y);
+        idct_1d(rows + y, w, 1 << 18, 19, q);
+        for (int k = 0; k < w; k++) {
+            out[k] = _mm_adds_epi16(_mm_packs_epi32(q[k][0], q[k][1]), offset);
+        }
+        ok_jpg_transpose_8x8_sse2(out);
+        if (w == 8) {
+            for (int i = 0; i < 8; i++) {
+                _mm_storel_epi64((__m128i *)(void *)(output + (y + i) * output_stride),
+                                 _mm_packus_epi16(out[i], out[i]));
+            }
+        } else {
+            ok_jpg_transpose_8x8_sse2(out + 8);
+            for (int i = 0; i < 8; i++) {
+                _mm_storeu_si128((__m128i *)(void *)(output + (y + i) * output_stride),
+                                 _mm_packus_epi16(out[i], out[i + 8]));
+            }
+        }
+    }
+}
+
+static void ok_jpg_idct_8x8_sse2(const int16_t *input, uint8_t *output,
+                                 const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 8, 8, ok_jpg_idct_1d_sse2);
+}
+
+static void ok_jpg_idct_8x16_sse2(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 8, 16, ok_jpg_idct_1d_sse2);
+}
+
+static void ok_jpg_idct_16x8_sse2(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 16, 8, ok_jpg_idct_1d_sse2);
+}
+
+static void ok_jpg_idct_16x16_sse2(const int16_t *input, uint8_t *output,
+                                   const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 16, 16, ok_jpg_idct_1d_sse2);
+}
+
+OK_JPG_TARGET("avx2")
+static void ok_jpg_idct_8x8_avx2(const int16_t *input, uint8_t *output,
+                                 const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 8, 8, ok_jpg_idct_1d_avx2);
+}
+
+OK_JPG_TARGET("avx2")
+static void ok_jpg_idct_8x16_avx2(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 8, 16, ok_jpg_idct_1d_avx2);
+}
+
+OK_JPG_TARGET("avx2")
+static void ok_jpg_idct_16x8_avx2(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 16, 8, ok_jpg_idct_1d_avx2);
+}
+
+OK_JPG_TARGET("avx2")
+static void ok_jpg_idct_16x16_avx2(const int16_t *input, uint8_t *output,
+                                   const size_t output_stride) {
+    ok_jpg_idct_2d_sse(input, output, output_stride, 16, 16, ok_jpg_idct_1d_avx2);
+}
+
+#elif defined(OK_JPG_USE_NEON)
+
+static inline int16x8_t ok_jpg_combine_neon(const int32x2_t a, const int32x2_t b) {
+    return vcombine_s16(vreinterpret_s16_s32(a), vreinterpret_s16_s32(b));
+}
+
+static inline void ok_jpg_transpose_8x8_neon(int16x8_t *v) {
+    const int16x8x2_t t01 = vtrnq_s16(v[0], v[1]);
+    const int16x8x2_t t23 = vtrnq_s16(v[2], v[3]);
+    const int16x8x2_t t45 = vtrnq_s16(v[4], v[5]);
+    const int16x8x2_t t67 = vtrnq_s16(v[6], v[7]);
+    const int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]),
+                                      vreinterpretq_s32_s16(t23.val[0]));
+    const int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]),
+                                      vreinterpretq_s32_s16(t23.val[1]));
+    const int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]),
+                                      vreinterpretq_s32_s16(t67.val[0]));
+    const int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]),
+                                      vreinterpretq_s32_s16(t67.val[1]));
+    v[0] = ok_jpg_combine_neon(vget_low_s32(u02.val[0]), vget_low_s32(u46.val[0]));
+    v[1] = ok_jpg_combine_neon(vget_low_s32(u13.val[0]), vget_low_s32(u57.val[0]));
+    v[2] = ok_jpg_combine_neon(vget_low_s32(u02.val[1]), vget_low_s32(u46.val[1]));
+    v[3] = ok_jpg_combine_neon(vget_low_s32(u13.val[1]), vget_low_s32(u57.val[1]));
+    v[4] = ok_jpg_combine_neon(vget_high_s32(u02.val[0]), vget_high_s32(u46.val[0]));
+    v[5] = ok_jpg_combine_neon(vget_high_s32(u13.val[0]), vget_high_s32(u57.val[0]));
+    v[6] = ok_jpg_combine_neon(vget_high_s32(u02.val[1]), vget_high_s32(u46.val[1]));
+    v[7] = ok_jpg_combine_neon(vget_high_s32(u13.val[1]), vget_high_s32(u57.val[1]));
+}
+
+// 1D IDCT of eight columns, where v[i] is input i of each column. Output k of columns 0-3 is in
+// out[k][0], and columns 4-7 in out[k][1]. Each output is (sum + rounding) >> shift, where
+// shift is 8 or 19.
+static inline void ok_jpg_idct_1d_neon(const int16x8_t *v, const int n, const int rounding,
+                                       const int shift, int32x4_t (*out)[2]) {
+    const int16_t (*even)[4] = n == 8 ? ok_jpg_idct_8_even : ok_jpg_idct_16_even;
+    const int16_t (*odd)[4] = n == 8 ? ok_jpg_idct_8_odd : ok_jpg_idct_16_odd;
+    const int32x4_t round = vdupq_n_s32(rounding);
+    for (int k = 0; k < n / 2; k++) {
+        for (int i = 0; i < 2; i++) {
+            const int16x4_t v0 = i == 0 ? vget_low_s16(v[0]) : vget_high_s16(v[0]);
+            const int16x4_t v1 = i == 0 ? vget_low_s16(v[1]) : vget_high_s16(v[1]);
+            const int16x4_t v2 = i == 0 ? vget_low_s16(v[2]) : vget_high_s16(v[2]);
+            const int16x4_t v3 = i == 0 ? vget_low_s16(v[3]) : vget_high_s16(v[3]);
+            const int16x4_t v4 = i == 0 ? vget_low_s16(v[4]) : vget_high_s16(v[4]);
+            const int16x4_t v5 = i == 0 ? vget_low_s16(v[5]) : vget_high_s16(v[5]);
+            const int16x4_t v6 = i == 0 ? vget_low_s16(v[6]) : vget_high_s16(v[6]);
+            const int16x4_t v7 = i == 0 ? vget_low_s16(v[7]) : vget_high_s16(v[7]);
+            int32x4_t e = vmlal_n_s16(round, v0, even[k][0]);
+            e = vmlal_n_s16(e, v4, even[k][1]);
+            e = vmlal_n_s16(e, v2, even[k][2]);
+            e = vmlal_n_s16(e, v6, even[k][3]);
+            int32x4_t o = vmull_n_s16(v1, odd[k][0]);
+            o = vmlal_n_s16(o, v3, odd[k][1]);
+            o = vmlal_n_s16(o, v5, odd[k][2]);
+            o = vmlal_n_s16(o, v7, odd[k][3]);
+            if (shift == 8) {
+                out[k][i] = vshrq_n_s32(vaddq_s32(e, o), 8);
+                out[n - 1 - k][i] = vshrq_n_s32(vsubq_s32(e, o), 8);
+            } else {
+                out[k][i] = vshrq_n_s32(vaddq_s32(e, o), 19);
+                out[n - 1 - k][i] = vshrq_n_s32(vsubq_s32(e, o), 19);
+            }
+        }
+    }
+}
+
+// IDCT a 8x8 block to (w x h)
+static inline void ok_jpg_idct_2d_neon(const int16_t *input, uint8_t *output,
+                                       const size_t output_stride, const int w, const int h) {
+    int16x8_t v[8];
+    v[0] = vld1q_s16(input);
+    int16x8_t ac = vsetq_lane_s16(0, v[0], 0);
+    for (int i = 1; i < 8; i++) {
+        v[i] = vld1q_s16(input + i * 8);
+        ac = vorrq_s16(ac, v[i]);
+    }
+    const uint64x2_t ac64 = vreinterpretq_u64_s16(ac);
+    if ((vgetq_lane_u64(ac64, 0) | vgetq_lane_u64(ac64, 1)) == 0) {
+        ok_jpg_idct_fill(output, output_stride, w, h, ok_jpg_idct_dc(input[0]));
+        return;
+    }
+
+    // Columns. Output row k is the same as row k of temp in the portable IDCT.
+    int32x4_t p[16][2];
+    int16x8_t rows[16];
+    ok_jpg_transpose_8x8_neon(v);
+    ok_jpg_idct_1d_neon(v, h, 1 << 7, 8, p);
+    const int32x4_t bias = vdupq_n_s32(1 << 15);
+    uint32x4_t range = vdupq_n_u32(0);
+    for (int k = 0; k < h; k++) {
+        range = vorrq_u32(range, vreinterpretq_u32_s32(vaddq_s32(p[k][0], bias)));
+        range = vorrq_u32(range, vreinterpretq_u32_s32(vaddq_s32(p[k][1], bias)));
+        rows[k] = vcombine_s16(vqmovn_s32(p[k][0]), vqmovn_s32(p[k][1]));
+    }
+    const uint32x4_t out_of_range = vshrq_n_u32(range, 16);
+    const uint32x2_t out_of_range2 = vorr_u32(vget_low_u32(out_of_range),
+                                              vget_high_u32(out_of_range));
+    if ((vget_lane_u32(out_of_range2, 0) | vget_lane_u32(out_of_range2, 1)) != 0) {
+        int temp[8 * 16];
+        for (int k = 0; k < h; k++) {
+            vst1q_s32(temp + k * 8, p[k][0]);
+            vst1q_s32(temp + k * 8 + 4, p[k][1]);
+        }
+        if (w == 8) {
+            ok_jpg_idct_1d_row_8(h, temp, output, output_stride);
+        } else {
+            ok_jpg_idct_1d_row_16(h, temp, output, output_stride);
+        }
+        return;
+    }
+
+    // Rows, eight at a time
+    const int16x8_t offset = vdupq_n_s16(128);
+    for (int y = 0; y < h; y += 8) {
+        int32x4_t q[16][2];
+        int16x8_t out[16];
+        ok_jpg_transpose_8x8_neon(rows + y);
+        ok_jpg_idct_1d_neon(rows + y, w, 1 << 18, 19, q);
+        for (int k = 0; k < w; k++) {
+            out[k] = vqaddq_s16(vcombine_s16(vqmovn_s32(q[k][0]), vqmovn_s32(q[k][1])), offset);
+        }
+        ok_jpg_transpose_8x8_neon(out);
+        if (w == 8) {
+            for (int i = 0; i < 8; i++) {
+                vst1_u8(output + (y + i) * output_stride, vqmovun_s16(out[i]));
+            }
+        } else {
+            ok_jpg_transpose_8x8_neon(out + 8);
+            for (int i = 0; i < 8; i++) {
+                vst1q_u8(output + (y + i) * output_stride,
+                         vcombine_u8(vqmovun_s16(out[i]), vqmovun_s16(out[i + 8])));
+            }
+        }
+    }
+}
+
+static void ok_jpg_idct_8x8_neon(const int16_t *input, uint8_t *output,
+                                 const size_t output_stride) {
+    ok_jpg_idct_2d_neon(input, output, output_stride, 8, 8);
+}
+
+static void ok_jpg_idct_8x16_neon(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_neon(input, output, output_stride, 8, 16);
+}
+
+static void ok_jpg_idct_16x8_neon(const int16_t *input, uint8_t *output,
+                                  const size_t output_stride) {
+    ok_jpg_idct_2d_neon(input, output, output_stride, 16, 8);
+}
+
+static void ok_jpg_idct_16x16_neon(const int16_t *input, uint8_t *output,
+                                   const size_t output_stride) {
+    ok_jpg_idct_2d_neon(input, output, output_stride, 16, 16);
+}
+
+#endif
+
+static ok_jpg_simd ok_jpg_simd_preference = OK_JPG_SIMD_AUTO;
+
+static bool ok_jpg_simd_supported(ok_jpg_simd simd) {
+    switch (simd) {
+        case OK_JPG_SIMD_AUTO:
+        case OK_JPG_SIMD_NONE:
+            return true;
+#if defined(OK_JPG_USE_SSE)
+        case OK_JPG_SIMD_SSE2:
+            return true;
+        case OK_JPG_SIMD_AVX2: {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            const int max_leaf = info[0];
+            __cpuid(info, 1);
+            const bool os_supports_avx = ((info[2] & (1 << 27)) != 0 &&
+                                          (info[2] & (1 << 28)) != 0 &&
+                                          (_xgetbv(0) & 6) == 6);
+            if (max_leaf < 7 || !os_supports_avx) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+#elif defined(OK_JPG_USE_NEON)
+        case OK_JPG_SIMD_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+bool ok_jpg_set_simd(ok_jpg_simd simd) {
+    if (ok_jpg_simd_supported(simd)) {
+        ok_jpg_simd_preference = simd;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+// Returns the preferred instruction set, or the best supported one if the preference is AUTO.
+static ok_jpg_simd ok_jpg_get_simd(void) {
+    ok_jpg_simd simd = ok_jpg_simd_preference;
+    if (simd == OK_JPG_SIMD_AUTO) {
+        static const ok_jpg_simd best_to_worst[] = {
+            OK_JPG_SIMD_NEON, OK_JPG_SIMD_AVX2, OK_JPG_SIMD_SSE2
+        };
+        simd = OK_JPG_SIMD_NONE;
+        for (size_t i = 0; i < sizeof(best_to_worst) / sizeof(best_to_worst[0]); i++) {
+            if (ok_jpg_simd_supported(best_to_worst[i])) {
+                simd = best_to_worst[i];
+                break;
+            }
+        }
+    }
+    return simd;
+}
+
+// Returns the IDCT function for a 8x8 block scaled to (w x h), where w and h are 8 or 16. For
+// scaled decoding, w and h may also be 1, 2, or 4, up to twice the other.
+static ok_jpg_idct_func ok_jpg_get_idct_func(ok_jpg_simd simd, int w, int h) {
+    if (w < 8 || h < 8) {
+        // Indexed by log2 of w and h
+        static const ok_jpg_idct_func idct_reduced[4][4] = {
+            { ok_jpg_idct_1x1, ok_jpg_idct_1x2, NULL, NULL },
+            { ok_jpg_idct_2x1, ok_jpg_idct_2x2, ok_jpg_idct_2x4, NULL },
+            { NULL, ok_jpg_idct_4x2, ok_jpg_idct_4x4, ok_jpg_idct_4x8 },
+            { NULL, NULL, ok_jpg_idct_8x4, NULL },
+        };
+        static const int log2_size[9] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+        return idct_reduced[log2_size[w]][log2_size[h]];
+    }
+    static const ok_jpg_idct_func idct[2][2] = {
+        { ok_jpg_idct_8x8, ok_jpg_idct_8x16 },
+        { ok_jpg_idct_16x8, ok_jpg_idct_16x16 },
+    };
+    const int i = w / 16;
+    const int j = h / 16;
+    switch (simd) {
+#if defined(OK_JPG_USE_SSE)
+        case OK_JPG_SIMD_SSE2: {
+            static const ok_jpg_idct_func idct_sse2[2][2] = {
+                { ok_jpg_idct_8x8_sse2, ok_jpg_idct_8x16_sse2 },
+                { ok_jpg_idct_16x8_sse2, ok_jpg_idct_16x16_sse2 },
+            };
+            return idct_sse2[i][j];
+        }
+        case OK_JPG_SIMD_AVX2: {
+            static const ok_jpg_idct_func idct_avx2[2][2] = {
+                { ok_jpg_idct_8x8_avx2, ok_jpg_idct_8x16_avx2 },
+                { ok_jpg_idct_16x8_avx2, ok_jpg_idct_16x16_avx2 },
+            };
+            return idct_avx2[i][j];
+        }
+#elif defined(OK_JPG_USE_NEON)
+        case OK_JPG_SIMD_NEON: {
+            static const ok_jpg_idct_func idct_neon[2][2] = {
+                { ok_jpg_idct_8x8_neon, ok_jpg_idct_8x16_neon },
+                { ok_jpg_idct_16x8_neon, ok_jpg_idct_16x16_neon },
+            };
+            return idct_neon[i][j];
+        }
+#endif
+        default:
+            return idct[i][j];
+    }
+}
+
+// MARK: Entropy decoding
+
+#define OK_JPG_BLOCK_EXTRA_SPACE 15
+
+// Transposed from spec
+static const int ok_jpg_zig_zag[] = {
+    0,  8,  1,  2,  9,  16, 24, 17,
+    10, 3,  4,  11, 18, 25, 32, 40,
+    33, 26, 19, 12, 5,  6,  13, 20,
+    27, 34, 41, 48, 56, 49, 42, 35,
+    28, 21, 14, 7,  15, 22, 29, 36,
+    43, 50, 57, 58, 51, 44, 37, 30,
+    23, 31, 38, 45, 52, 59, 60, 53,
+    46, 39, 47, 54, 61, 62, 55, 63,
+    // 15 byte overrun for invalid r values
+    63, 63, 63, 63, 63, 63, 63, 63,
+    63, 63, 63, 63, 63, 63, 63
+};
+
+static inline void ok_jpg_decode_block(ok_jpg_decoder *decoder, ok_jpg_component *c,
+                                       int16_t *block) {
+    memset(block, 0, 8 * 8 * sizeof(*block));
+
+    const uint8_t *q_table = decoder->q_table[c->Tq];
+
+    // Decode DC coefficients - F.2.2.1
+    ok_jpg_huffman_table *dc = decoder->dc_huffman_tables + c->Td;
+    uint8_t t = ok_jpg_huffman_decode(decoder, dc);
+    if (t > 0) {
+        int diff = ok_jpg_load_next_bits(decoder, t);
+        c->pred += ok_jpg_extend(diff, t);
+    }
+    block[0] = c->pred * q_table[0];
+
+    // Decode AC coefficients - Figures F.13 and F.14
+    ok_jpg_huffman_table *ac = decoder->ac_huffman_tables + c->Ta;
+    int k = 1;
+    while (k <= 63) {
+        ok_jpg_load_bits(decoder, 16);
+        int code = ok_jpg_peek_bits(decoder, HUFFMAN_LOOKUP_SIZE_BITS);
+        ok_jpg_huffman_ac_lookup lookup = ac->lookup_ac[code];
+        if (lookup.num_bits > 0) {
+            ok_jpg_consume_bits(decoder, lookup.num_bits);
+            uint8_t rs = lookup.rs;
+            int s = rs & 0x0f;
+            if (s > 0) {
+                int r = rs >> 4;
+                k += r;
+                block[ok_jpg_zig_zag[k]] = lookup.val * q_table[k];
+                k++;
+            } else {
+                if (rs == 0) {
+                    break;
+                }
+                k += 16;
+            }
+        } else {
+            uint8_t rs = ok_jpg_huffman_decode(decoder, ac);
+            int s = rs & 0x0f;
+            if (s > 0) {
+                int r = rs >> 4;
+                k += r;
+                int v = ok_jpg_load_next_bits(decoder, s);
+                block[ok_jpg_zig_zag[k]] = (int16_t)ok_jpg_extend(v, s) * q_table[k];
+                k++;
+            } else {
+                if (rs == 0) {
+                    break;
+                }
+                k += 16;
+            }
+        }
+    }
+}
+
+// Consumes the bits of a baseline block without storing its coefficients. Only the DC prediction
+// is updated. The bits consumed must be exactly the same as ok_jpg_decode_block, so DC values are
+// not clamped here (they are validated in ok_jpg_read_dht).
+static inline void ok_jpg_skip_block(ok_jpg_decoder *decoder, ok_jpg_component *c) {
+    // Decode DC coefficients - F.2.2.1
+    ok_jpg_huffman_table *dc = decoder->dc_huffman_tables + c->Td;
+    uint8_t t = ok_jpg_huffman_decode(decoder, dc);
+    if (t > 0) {
+        int diff = ok_jpg_load_next_bits(decoder, t);
+        c->pred += ok_jpg_extend(diff, t);
+    }
+
+    // Skip AC coefficients. The combined lookup table has the length of the code plus the extra
+    // bits, so most coefficients are skipped with one lookup.
+    ok_jpg_huffman_table *ac = decoder->ac_huffman_tables + c->Ta;
+    int k = 1;
+    while (k <= 63) {
+        ok_jpg_load_bits(decoder, 16);
+        int code = ok_jpg_peek_bits(decoder, HUFFMAN_LOOKUP_SIZE_BITS);
+        ok_jpg_huffman_ac_lookup lookup = ac->lookup_ac[code];
+        uint8_t rs;
+        if (lookup.num_bits > 0) {
+            ok_jpg_consume_bits(decoder, lookup.num_bits);
+            rs = lookup.rs;
+        } else {
+            rs = ok_jpg_huffman_decode(decoder, ac);
+            if (rs & 0x0f) {
+                ok_jpg_load_next_bits(decoder, rs & 0x0f);
+            }
+        }
+        if (rs & 0x0f) {
+            k += (rs >> 4) + 1;
+        } else if (rs == 0) {
+            break;
+        } else {
+            k += 16;
+        }
+    }
+}
+
+static void ok_jpg_decode_block_progressive(ok_jpg_decoder *decoder, ok_jpg_component *c,
+                                            int16_t *block) {
+    int k = decoder->scan_start;
+    const int k_end = decoder->scan_end;
+    const int scale = decoder->scan_scale;
+
+    memset(block + k, 0, (size_t)(k_end - k + 1) * sizeof(*block));
+
+    // Decode DC coefficients - F.2.2.1
+    if (k == 0) {
+        ok_jpg_huffman_table *dc = decoder->dc_huffman_tables + c->Td;
+        uint8_t t = ok_jpg_huffman_decode(decoder, dc);
+        if (t > 0) {
+            int diff = ok_jpg_load_next_bits(decoder, t);
+            c->pred += ok_jpg_extend(diff, t) << scale;
+        }
+        block[0] = c->pred;
+        k++;
+    }
+
+    // Decode AC coefficients - Figures F.13, F.14, and G.2
+    if (c->eob_run > 0) {
+        c->eob_run--;
         return;
     }
     ok_jpg_huffman_table *ac = decoder->ac_huffman_tables + c->Ta;
     while (k <= k_end) {
         ok_jpg_load_bits(decoder, 16);
         int code = ok_jpg_peek_bits(decoder, HUFFMAN_LOOKUP_SIZE_BITS);
-        uint8_t num_bits = ac->lookup_ac_num_bits[code];
-        if (num_bits > 0) {
-            ok_jpg_consume_bits(decoder, num_bits);
-            uint8_t rs = ac->lookup_val[code];
+        ok_jpg_huffman_ac_lookup lookup = ac->lookup_ac[code];
+        if (lookup.num_bits > 0) {
+            ok_jpg_consume_bits(decoder, lookup.num_bits);
+            uint8_t rs = lookup.rs;
             int s = rs & 0x0f;
             int r = rs >> 4;
             if (s > 0) {
                 k += r;
-                block[k] = (int16_t)(ac->lookup_ac_val[code] << scale);
+                block[k] = (int16_t)(lookup.val << scale);
                 k++;
             } else {
                 if (r != 0x0f) {
-                    c->eob_run = ac->lookup_ac_val[code];
+                    c->eob_run = lookup.val;
                     break;
                 }
                 k += 16;
@@ -1155,6 +2497,49 @@ static inline void ok_jpg_dequantize(ok_jpg_decoder *decoder, ok_jpg_component *
                                      int16_t *in_block, int16_t *out_block) {
     // Apply zig-zag here because it makes ok_jpg_decode_block_subsequent_scan a bit faster.
     const uint8_t *q_table = decoder->q_table[c->Tq];
+#if defined(OK_JPG_USE_SSE)
+    // Most high-frequency coefficients are zero, so only groups of 8 with a non-zero coefficient
+    // are reordered.
+    if (decoder->simd != OK_JPG_SIMD_NONE) {
+        int16_t group[8];
+        const __m128i zero = _mm_setzero_si128();
+        for (int k = 0; k < 64; k += 8) {
+            _mm_storeu_si128((__m128i *)(out_block + k), zero);
+        }
+        for (int k = 0; k < 64; k += 8) {
+            __m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(q_table + k)), zero);
+            __m128i v = _mm_mullo_epi16(_mm_loadu_si128((const __m128i *)(in_block + k)), q);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) != 0xffff) {
+                _mm_storeu_si128((__m128i *)group, v);
+                for (int i = 0; i < 8; i++) {
+                    out_block[ok_jpg_zig_zag[k + i]] = group[i];
+                }
+            }
+        }
+        return;
+    }
+#elif defined(OK_JPG_USE_NEON)
+    // Most high-frequency coefficients are zero, so only groups of 8 with a non-zero coefficient
+    // are reordered.
+    if (decoder->simd != OK_JPG_SIMD_NONE) {
+        int16_t group[8];
+        for (int k = 0; k < 64; k += 8) {
+            vst1q_s16(out_block + k, vdupq_n_s16(0));
+        }
+        for (int k = 0; k < 64; k += 8) {
+            int16x8_t q = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(q_table + k)));
+            int16x8_t v = vmulq_s16(vld1q_s16(in_block + k), q);
+            uint64x2_t bits = vreinterpretq_u64_s16(v);
+            if ((vgetq_lane_u64(bits, 0) | vgetq_lane_u64(bits, 1)) != 0) {
+                vst1q_s16(group, v);
+                for (int i = 0; i < 8; i++) {
+                    out_block[ok_jpg_zig_zag[k + i]] = group[i];
+                }
+            }
+        }
+        return;
+    }
+#endif
     for (int k = 0; k < 64; k++) {
         out_block[ok_jpg_zig_zag[k]] = in_block[k] * q_table[k];
     }
@@ -1200,13 +2585,345 @@ static bool ok_jpg_decode_restart_if_needed(ok_jpg_decoder *decoder) {
     return true;
 }
 
-static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
+// Returns the number of bytes available to read without suspending, in push mode
+static size_t ok_jpg_push_available(ok_jpg_decoder *decoder) {
+    return ((size_t)(decoder->input_buffer_end - decoder->input_buffer_start) +
+            (decoder->push_buffer_length - decoder->push_buffer_start) +
+            decoder->push_input_length);
+}
+
+// Returns true if a marker was received at or after `offset` bytes from the current position, in
+// push mode
+static bool ok_jpg_push_marker_available(ok_jpg_decoder *decoder, size_t offset) {
+    const uint64_t position = decoder->push_total_length - ok_jpg_push_available(decoder) + offset;
+    return decoder->push_marker_offset > position;
+}
+
+// In push mode, suspends the scan at (data_unit_x, data_unit_y) if the next MCU may not be
+// completely available. The MCU is available if the end of the scan (a marker other than a
+// restart marker) has been received, or if the largest possible MCU is available.
+static bool ok_jpg_push_suspend_scan(ok_jpg_decoder *decoder, int data_unit_x, int data_unit_y) {
+    const int marker = decoder->next_marker;
+    if ((marker != 0 && !(marker >= 0xD0 && marker <= 0xD7)) ||
+        ok_jpg_push_marker_available(decoder, 0) ||
+        ok_jpg_push_available(decoder) >= OK_JPG_PUSH_MCU_SIZE_MAX) {
+        return false;
+    }
+    decoder->scan_x = data_unit_x;
+    decoder->scan_y = data_unit_y;
+    decoder->push_suspended = true;
+    return true;
+}
+
+// Skips the next `count` MCUs of a baseline scan, starting at MCU (scan_x, scan_y), handling
+// restart markers. The MCUs are entropy decoded, but their coefficients are not stored. On
+// return, (scan_x, scan_y) is the position of the next MCU. In push mode, the scan may be
+// suspended, in which case false is returned.
+static bool ok_jpg_skip_mcus(ok_jpg_decoder *decoder, int count) {
+    for (; count > 0; count--) {
+        if (decoder->push && ok_jpg_push_suspend_scan(decoder, decoder->scan_x, decoder->scan_y)) {
+            return false;
+        }
+        if (!ok_jpg_decode_restart_if_needed(decoder)) {
+            return false;
+        }
+        for (int i = 0; i < decoder->num_scan_components; i++) {
+            ok_jpg_component *c = decoder->components + decoder->scan_components[i];
+            for (int j = c->H * c->V; j > 0; j--) {
+                ok_jpg_skip_block(decoder, c);
+            }
+        }
+        if (decoder->huffman_error) {
+            return false;
+        }
+        decoder->scan_x++;
+        if (decoder->scan_x == decoder->data_units_x) {
+            decoder->scan_x = 0;
+            decoder->scan_y++;
+        }
+    }
+    return true;
+}
+
+static void ok_jpg_begin_scan(ok_jpg_decoder *decoder) {
     decoder->next_restart = 0;
     ok_jpg_decode_restart(decoder);
     if (decoder->restart_intervals_remaining > 0) {
         // Increment because the restart is checked before each data unit instead of after.
         decoder->restart_intervals_remaining++;
     }
+    for (int i = 0; i < decoder->num_scan_components; i++) {
+        ok_jpg_component *c = decoder->components + decoder->scan_components[i];
+        c->next_block = 0;
+    }
+    decoder->scan_x = 0;
+    decoder->scan_y = 0;
+}
+
+// Decodes the MCUs of a baseline scan, starting at (scan_x, scan_y), up to (but not including) MCU
+// index `end`. Chunks of MCUs are converted starting at MCU index `begin`, so that a range of MCUs
+// can be decoded without converting any MCUs outside of it. MCUs outside of the region are
+// skipped with ok_jpg_skip_mcus(). In push mode, the scan is suspended before a data
+// unit that may not be completely available.
+static bool ok_jpg_decode_scan_baseline(ok_jpg_decoder *decoder, int begin, int end) {
+    int16_t block[64];
+    const size_t stride = decoder->mcu_row_stride;
+    const int data_units_x = decoder->data_units_x;
+    for (int data_unit_y = decoder->scan_y; data_unit_y * data_units_x < end; data_unit_y++) {
+        const int row_begin = max(begin - data_unit_y * data_units_x, 0);
+        const int row_end = min(end - data_unit_y * data_units_x, data_units_x);
+        int convert_begin = max(row_begin, decoder->region_begin_x);
+        int convert_end = min(row_end, decoder->region_end_x);
+        if (data_unit_y < decoder->region_begin_y || data_unit_y >= decoder->region_end_y) {
+            convert_begin = convert_end = row_end;
+        }
+        for (int data_unit_x = decoder->scan_x; data_unit_x < row_end; data_unit_x++) {
+            if (data_unit_x < convert_begin || data_unit_x >= convert_end) {
+                // Skip to the start of the region, or to the end of the row
+                const int skip_end = data_unit_x < convert_begin ? convert_begin : row_end;
+                decoder->scan_x = data_unit_x;
+                decoder->scan_y = data_unit_y;
+                if (!ok_jpg_skip_mcus(decoder, skip_end - data_unit_x)) {
+                    return false;
+                }
+                data_unit_x = skip_end - 1;
+                continue;
+            }
+            if (decoder->push && ok_jpg_push_suspend_scan(decoder, data_unit_x, data_unit_y)) {
+                return false;
+            }
+            if (!ok_jpg_decode_restart_if_needed(decoder)) {
+                return false;
+            }
+            const int chunk_x = (data_unit_x - convert_begin) % decoder->data_units_per_chunk;
+            const size_t offset = (size_t)(chunk_x * decoder->mcu_width);
+            for (int i = 0; i < decoder->num_scan_components; i++) {
+                ok_jpg_component *c = decoder->components + decoder->scan_components[i];
+                size_t offset_y = offset;
+                for (int y = 0; y < c->V; y++) {
+                    size_t offset_x = 0;
+                    for (int x = 0; x < c->H; x++) {
+                        ok_jpg_decode_block(decoder, c, block);
+                        c->idct(block, c->output + offset_x + offset_y, stride);
+                        offset_x += (size_t)decoder->block_size;
+                    }
+                    offset_y += stride * (size_t)decoder->block_size;
+                }
+            }
+            if (decoder->huffman_error) {
+                return false;
+            }
+            if (chunk_x + 1 == decoder->data_units_per_chunk || data_unit_x + 1 == convert_end) {
+                if (!ok_jpg_convert_chunk(decoder, data_unit_x - chunk_x, data_unit_y,
+                                          chunk_x + 1)) {
+                    return false;
+                }
+            }
+        }
+        decoder->scan_x = 0;
+        if (decoder->eof_found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A range of MCUs decoded by one task, when decoding in parallel
+typedef struct {
+    ok_jpg_decoder decoder; // Copy of the decoder, with its own input range and MCU row buffers
+    ok_jpg jpg; // Copy of the image, so that errors are kept per task
+    int begin; // Index of the first MCU
+    int end;
+    bool success;
+} ok_jpg_task;
+
+// Creates tasks, each with a copy of the decoder that has its own MCU row buffers. The tasks and
+// their buffers are a single allocation, freed with the decoder's allocator. Returns NULL if the
+// allocation failed.
+static ok_jpg_task *ok_jpg_create_tasks(ok_jpg_decoder *decoder, int num_tasks) {
+    const size_t plane_size = decoder->mcu_row_stride * (size_t)decoder->mcu_height;
+    const size_t planes_size = (plane_size * (size_t)decoder->num_components +
+                                OK_JPG_MCU_ROW_PADDING);
+    const size_t transform_size = (decoder->transform_data ?
+                                   (size_t)(decoder->data_units_per_chunk * decoder->mcu_width) *
+                                   4 * (size_t)decoder->mcu_height : 0);
+    const size_t task_buffer_size = (planes_size + transform_size + 15) & ~(size_t)15;
+    const size_t tasks_size = (sizeof(ok_jpg_task) * (size_t)num_tasks + 15) & ~(size_t)15;
+    ok_jpg_task *tasks = decoder->allocator.alloc(decoder->allocator_user_data,
+                                                  tasks_size + task_buffer_size *
+                                                  (size_t)num_tasks);
+    if (!tasks) {
+        return NULL;
+    }
+    uint8_t *task_buffer = (uint8_t *)tasks + tasks_size;
+    for (int t = 0; t < num_tasks; t++) {
+        ok_jpg_task *task = tasks + t;
+        task->jpg = *decoder->jpg;
+        task->decoder = *decoder;
+        task->success = false;
+
+        ok_jpg_decoder *task_decoder = &task->decoder;
+        memset(task_buffer, 0, planes_size);
+        task_decoder->jpg = &task->jpg;
+        task_decoder->mcu_row_data = task_buffer;
+        for (int i = 0; i < decoder->num_components; i++) {
+            task_decoder->components[i].output = task_buffer + plane_size * (size_t)i;
+        }
+        if (transform_size > 0) {
+            task_decoder->transform_data = task_buffer + planes_size;
+        }
+        task_buffer += task_buffer_size;
+    }
+    return tasks;
+}
+
+// Runs each task on the thread pool, and returns after all tasks have finished
+static void ok_jpg_run_tasks(ok_jpg_decoder *decoder, void (*task)(void *task_data),
+                             ok_jpg_task *tasks, int num_tasks) {
+    void *task_data[OK_JPG_PARALLEL_MAX_TASKS];
+    for (int t = 0; t < num_tasks; t++) {
+        task_data[t] = tasks + t;
+    }
+    decoder->thread_pool.run_tasks(decoder->thread_pool_user_data, task, task_data,
+                                   (size_t)num_tasks);
+}
+
+// Returns the index of the MCU after the last MCU to decode in a baseline scan. If the scan has
+// all components, the MCU rows after the region aren't needed.
+static int ok_jpg_baseline_scan_end(const ok_jpg_decoder *decoder) {
+    if (decoder->num_scan_components == decoder->num_components) {
+        return decoder->region_end_y * decoder->data_units_x;
+    } else {
+        return decoder->data_units_y * decoder->data_units_x;
+    }
+}
+
+static void ok_jpg_decode_scan_task(void *task_data) {
+    ok_jpg_task *task = task_data;
+    ok_jpg_decoder *decoder = &task->decoder;
+    bool success = ok_jpg_decode_scan_baseline(decoder, task->begin, task->end);
+    if (success && task->end < ok_jpg_baseline_scan_end(decoder)) {
+        // Check the restart marker after the last interval, like sequential decoding does before
+        // the next MCU, and make sure the next task's input starts after it.
+        success = (ok_jpg_decode_restart_if_needed(decoder) &&
+                   decoder->input_buffer_start == decoder->input_buffer_end);
+    }
+    task->success = success && task->jpg.error_code == OK_JPG_SUCCESS;
+}
+
+// Finds the next marker in the entropy-coded data, and returns a pointer to its 0xFF byte,
+// or NULL if not found
+static const uint8_t *ok_jpg_find_marker(const uint8_t *data, const uint8_t *data_end) {
+    while (data_end - data >= 2) {
+        data = memchr(data, 0xff, (size_t)(data_end - data - 1));
+        if (!data) {
+            break;
+        } else if (data[1] != 0) {
+            return data;
+        }
+        data += 2;
+    }
+    return NULL;
+}
+
+// Decodes a baseline scan with restart intervals in parallel, when reading from memory. The
+// restart markers are found first, and then ranges of restart intervals are decoded on separate
+// tasks, each converting its MCUs directly into the output image.
+//
+// Returns false if the scan wasn't decoded, and should be decoded sequentially instead. This
+// happens if the scan can't be split, or if any task fails, so that errors are found and reported
+// exactly as in sequential decoding.
+static bool ok_jpg_decode_scan_parallel(ok_jpg_decoder *decoder) {
+    // The thread pool is only set when reading from memory, without row output.
+    if (!decoder->has_thread_pool || decoder->restart_intervals <= 0 ||
+        decoder->scan_x != 0 || decoder->scan_y != 0 || decoder->next_marker != 0 ||
+        decoder->input_buffer_bit_count != 0) {
+        return false;
+    }
+    const int num_mcus = ok_jpg_baseline_scan_end(decoder);
+    const int num_intervals = (num_mcus + decoder->restart_intervals - 1) /
+        decoder->restart_intervals;
+    const int num_tasks = min(min(num_intervals, OK_JPG_PARALLEL_MAX_TASKS),
+                              num_mcus / OK_JPG_PARALLEL_MIN_TASK_MCUS);
+    if (num_tasks < 2) {
+        return false;
+    }
+
+    ok_jpg_task *tasks = ok_jpg_create_tasks(decoder, num_tasks);
+    bool success = tasks != NULL;
+
+    // Find the input for each task. Each task after the first starts after a restart marker.
+    const uint8_t *data = decoder->input_buffer_start;
+    const uint8_t *data_end = decoder->input_buffer_end;
+    int interval = 0;
+    for (int t = 0; t < num_tasks && success; t++) {
+        const int first_interval = (int)((int64_t)num_intervals * t / num_tasks);
+        while (interval < first_interval && success) {
+            const uint8_t *marker = ok_jpg_find_marker(data, data_end);
+            success = marker && marker[1] == 0xD0 + (interval & 7);
+            if (success) {
+                data = marker + 2;
+                interval++;
+            }
+        }
+        if (success) {
+            ok_jpg_task *task = tasks + t;
+            const int next_interval = (int)((int64_t)num_intervals * (t + 1) / num_tasks);
+            task->begin = first_interval * decoder->restart_intervals;
+            task->end = min(next_interval * decoder->restart_intervals, num_mcus);
+
+            ok_jpg_decoder *task_decoder = &task->decoder;
+            task_decoder->input_buffer_start = data;
+            task_decoder->input_buffer_end = data_end;
+            if (t > 0) {
+                // The previous task's input ends after the restart marker
+                tasks[t - 1].decoder.input_buffer_end = data;
+            }
+            task_decoder->scan_x = task->begin % decoder->data_units_x;
+            task_decoder->scan_y = task->begin / decoder->data_units_x;
+            task_decoder->next_restart = first_interval & 7;
+            ok_jpg_decode_restart(task_decoder);
+            // Increment because the restart is checked before each data unit instead of after.
+            task_decoder->restart_intervals_remaining++;
+        }
+    }
+
+    // Decode
+    if (success) {
+        ok_jpg_run_tasks(decoder, ok_jpg_decode_scan_task, tasks, num_tasks);
+        for (int t = 0; t < num_tasks && success; t++) {
+            success = tasks[t].success;
+        }
+    }
+
+    // Continue from where the last task finished
+    if (success) {
+        const ok_jpg_decoder *last = &tasks[num_tasks - 1].decoder;
+        if (last->input_buffer_end == data_end) {
+            decoder->input_buffer_start = last->input_buffer_start;
+        } else {
+            // The last task read to the end of the data, and switched to its own input buffer
+            decoder->input_buffer_start = decoder->input_buffer;
+            decoder->input_buffer_end = decoder->input_buffer;
+        }
+        decoder->input_buffer_bits = last->input_buffer_bits;
+        decoder->input_buffer_bit_count = last->input_buffer_bit_count;
+        decoder->next_marker = last->next_marker;
+        decoder->next_restart = last->next_restart;
+        decoder->restart_intervals_remaining = last->restart_intervals_remaining;
+        for (int i = 0; i < decoder->num_components; i++) {
+            decoder->components[i].pred = last->components[i].pred;
+            decoder->components[i].eob_run = last->components[i].eob_run;
+        }
+    }
+
+    decoder->allocator.free(decoder->allocator_user_data, tasks);
+    return success;
+}
+
+// Decodes the scan, starting at (scan_x, scan_y). In push mode, the scan is suspended before a
+// data unit that may not be completely available.
+static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
     if (decoder->progressive) {
         void (*decode_function)(ok_jpg_decoder *decoder, ok_jpg_component *c, int16_t *block);
         if (decoder->scan_prev_scale > 0) {
@@ -1216,28 +2933,34 @@ static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
         }
         if (decoder->num_scan_components == 1) {
             ok_jpg_component *c = decoder->components + decoder->scan_components[0];
-            c->next_block = 0;
-            for (int data_unit_y = 0; data_unit_y < c->blocks_v; data_unit_y++) {
-                int16_t *block = c->blocks + (c->next_block * 64);
-                for (int data_unit_x = 0; data_unit_x < c->blocks_h; data_unit_x++) {
+            for (int data_unit_y = decoder->scan_y; data_unit_y < c->blocks_v; data_unit_y++) {
+                int16_t *block = c->blocks + ((c->next_block + (size_t)decoder->scan_x) * 64);
+                for (int data_unit_x = decoder->scan_x; data_unit_x < c->blocks_h; data_unit_x++) {
+                    if (decoder->push &&
+                        ok_jpg_push_suspend_scan(decoder, data_unit_x, data_unit_y)) {
+                        return false;
+                    }
                     if (!ok_jpg_decode_restart_if_needed(decoder)) {
                         return false;
                     }
                     decode_function(decoder, c, block);
                     block += 64;
                 }
+                decoder->scan_x = 0;
                 if (decoder->eof_found || decoder->huffman_error) {
                     return false;
                 }
                 c->next_block += (size_t)(c->H * decoder->data_units_x);
             }
         } else {
-            for (int i = 0; i < decoder->num_scan_components; i++) {
-                ok_jpg_component *c = decoder->components + decoder->scan_components[i];
-                c->next_block = 0;
-            }
-            for (int data_unit_y = 0; data_unit_y < decoder->data_units_y; data_unit_y++) {
-                for (int data_unit_x = 0; data_unit_x < decoder->data_units_x; data_unit_x++) {
+            for (int data_unit_y = decoder->scan_y; data_unit_y < decoder->data_units_y;
+                 data_unit_y++) {
+                for (int data_unit_x = decoder->scan_x; data_unit_x < decoder->data_units_x;
+                     data_unit_x++) {
+                    if (decoder->push &&
+                        ok_jpg_push_suspend_scan(decoder, data_unit_x, data_unit_y)) {
+                        return false;
+                    }
                     if (!ok_jpg_decode_restart_if_needed(decoder)) {
                         return false;
                     }
@@ -1254,6 +2977,7 @@ static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
                         c->next_block += c->H;
                     }
                 }
+                decoder->scan_x = 0;
                 if (decoder->eof_found || decoder->huffman_error) {
                     return false;
                 }
@@ -1264,33 +2988,14 @@ static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
             }
         }
     } else {
-        int16_t block[64];
-        for (int data_unit_y = 0; data_unit_y < decoder->data_units_y; data_unit_y++) {
-            for (int data_unit_x = 0; data_unit_x < decoder->data_units_x; data_unit_x++) {
-                if (!ok_jpg_decode_restart_if_needed(decoder)) {
-                    return false;
-                }
-                for (int i = 0; i < decoder->num_scan_components; i++) {
-                    ok_jpg_component *c = decoder->components + decoder->scan_components[i];
-                    int offset_y = 0;
-                    for (int y = 0; y < c->V; y++) {
-                        int offset_x = 0;
-                        for (int x = 0; x < c->H; x++) {
-                            ok_jpg_decode_block(decoder, c, block);
-                            c->idct(block, c->output + offset_x + offset_y);
-                            offset_x += 8;
-                        }
-                        offset_y += C_WIDTH * 8;
-                    }
-                }
-                if (decoder->huffman_error) {
-                    return false;
-                }
-                ok_jpg_convert_data_unit(decoder, data_unit_x, data_unit_y);
-            }
-            if (decoder->eof_found) {
-                return false;
-            }
+        const int end = ok_jpg_baseline_scan_end(decoder);
+        if (!ok_jpg_decode_scan_parallel(decoder) &&
+            !ok_jpg_decode_scan_baseline(decoder, 0, end)) {
+            return false;
+        }
+        if (end < decoder->data_units_x * decoder->data_units_y) {
+            // The rest of the image is after the region, so decoding is done
+            decoder->eoi_found = true;
         }
     }
 
@@ -1306,40 +3011,92 @@ static bool ok_jpg_decode_scan(ok_jpg_decoder *decoder) {
     return true;
 }
 
-static void ok_jpg_progressive_finish(ok_jpg_decoder *decoder) {
+// Dequantizes, transforms, and converts the MCU rows from `begin` up to (but not including) `end`
+// of a progressive image. Only the MCUs in the region are converted.
+static bool ok_jpg_progressive_finish_rows(ok_jpg_decoder *decoder, int begin, int end) {
     int16_t out_block[64];
-    for (int i = 0; i < decoder->num_components; i++) {
-        ok_jpg_component *c = decoder->components + i;
-        c->next_block = 0;
-    }
-    for (int data_unit_y = 0; data_unit_y < decoder->data_units_y; data_unit_y++) {
-        for (int data_unit_x = 0; data_unit_x < decoder->data_units_x; data_unit_x++) {
+    const size_t stride = decoder->mcu_row_stride;
+    const int data_units_x = decoder->data_units_x;
+    const int region_begin_x = decoder->region_begin_x;
+    const int region_end_x = decoder->region_end_x;
+    for (int data_unit_y = begin; data_unit_y < end; data_unit_y++) {
+        for (int data_unit_x = region_begin_x; data_unit_x < region_end_x; data_unit_x++) {
+            const int chunk_x = (data_unit_x - region_begin_x) % decoder->data_units_per_chunk;
+            const size_t offset = (size_t)(chunk_x * decoder->mcu_width);
             for (int i = 0; i < decoder->num_components; i++) {
                 ok_jpg_component *c = decoder->components + i;
-                size_t block_index = c->next_block;
-                int offset_y = 0;
+                size_t block_index = ((size_t)data_unit_y * (size_t)(c->V * data_units_x) +
+                                      (size_t)data_unit_x) * (size_t)c->H;
+                size_t offset_y = offset;
                 for (int y = 0; y < c->V; y++) {
-                    int offset_x = 0;
+                    size_t offset_x = 0;
                     for (int x = 0; x < c->H; x++) {
                         int16_t *in_block = c->blocks + (block_index * 64);
                         ok_jpg_dequantize(decoder, c, in_block, out_block);
-                        c->idct(out_block, c->output + offset_x + offset_y);
+                        c->idct(out_block, c->output + offset_x + offset_y, stride);
                         block_index++;
-                        offset_x += 8;
+                        offset_x += (size_t)decoder->block_size;
                     }
-                    offset_y += C_WIDTH * 8;
-                    block_index += (size_t)(c->H * (decoder->data_units_x - 1));
+                    offset_y += stride * (size_t)decoder->block_size;
+                    block_index += (size_t)(c->H * (data_units_x - 1));
+                }
+            }
+            if (chunk_x + 1 == decoder->data_units_per_chunk || data_unit_x + 1 == region_end_x) {
+                if (!ok_jpg_convert_chunk(decoder, data_unit_x - chunk_x, data_unit_y,
+                                          chunk_x + 1)) {
+                    return false;
                 }
-                c->next_block += c->H;
             }
-
-            ok_jpg_convert_data_unit(decoder, data_unit_x, data_unit_y);
-        }
-        for (int i = 0; i < decoder->num_components; i++) {
-            ok_jpg_component *c = decoder->components + i;
-            c->next_block += (size_t)((c->V - 1) * c->H * decoder->data_units_x);
         }
     }
+    return true;
+}
+
+static void ok_jpg_progressive_finish_task(void *task_data) {
+    ok_jpg_task *task = task_data;
+    const int data_units_x = task->decoder.data_units_x;
+    task->success = (ok_jpg_progressive_finish_rows(&task->decoder, task->begin / data_units_x,
+                                                    task->end / data_units_x) &&
+                     task->jpg.error_code == OK_JPG_SUCCESS);
+}
+
+// Finishes a progressive image in parallel, in bands of MCU rows of the region. All coefficients
+// are already decoded, so the bands are independent. Returns false if the image wasn't finished,
+// and should be finished sequentially instead.
+static bool ok_jpg_progressive_finish_parallel(ok_jpg_decoder *decoder) {
+    if (!decoder->has_thread_pool) {
+        return false;
+    }
+    const int data_units_x = decoder->data_units_x;
+    const int begin = decoder->region_begin_y;
+    const int rows = decoder->region_end_y - begin;
+    const int num_tasks = min(min(rows, OK_JPG_PARALLEL_MAX_TASKS),
+                              (decoder->region_end_x - decoder->region_begin_x) * rows /
+                              OK_JPG_PARALLEL_MIN_TASK_MCUS);
+    if (num_tasks < 2) {
+        return false;
+    }
+    ok_jpg_task *tasks = ok_jpg_create_tasks(decoder, num_tasks);
+    if (!tasks) {
+        return false;
+    }
+    for (int t = 0; t < num_tasks; t++) {
+        tasks[t].begin = (begin + (int)((int64_t)rows * t / num_tasks)) * data_units_x;
+        tasks[t].end = (begin + (int)((int64_t)rows * (t + 1) / num_tasks)) * data_units_x;
+    }
+    ok_jpg_run_tasks(decoder, ok_jpg_progressive_finish_task, tasks, num_tasks);
+    bool success = true;
+    for (int t = 0; t < num_tasks && success; t++) {
+        success = tasks[t].success;
+    }
+    decoder->allocator.free(decoder->allocator_user_data, tasks);
+    return success;
+}
+
+static bool ok_jpg_progressive_finish(ok_jpg_decoder *decoder) {
+    return (ok_jpg_progressive_finish_parallel(decoder) ||
+            ok_jpg_progressive_finish_rows(decoder, decoder->region_begin_y,
+                                           decoder->region_end_y));
 }
 
 // MARK: EXIF
@@ -1473,6 +3230,49 @@ static bool ok_jpg_read_exif(ok_jpg_decoder *decoder) {
 
 // MARK: Segment reading
 
+// Sets the region to decode, and the image dimensions to the region's size. The requested region
+// is in output coordinates, so it is mapped to scaled coordinates before rotation and flipping.
+static bool ok_jpg_init_region(ok_jpg_decoder *decoder) {
+    ok_jpg *jpg = decoder->jpg;
+    const int width = decoder->rotate ? decoder->scaled_height : decoder->scaled_width;
+    const int height = decoder->rotate ? decoder->scaled_width : decoder->scaled_height;
+    int x = 0;
+    int y = 0;
+    int region_width = width;
+    int region_height = height;
+    if (decoder->has_region) {
+        const ok_jpg_region *region = &decoder->requested_region;
+        if (region->x >= (uint32_t)width || region->y >= (uint32_t)height) {
+            ok_jpg_error(jpg, OK_JPG_ERROR_API, "Invalid argument: region is outside of image");
+            return false;
+        }
+        x = (int)region->x;
+        y = (int)region->y;
+        region_width = (int)min(region->width, (uint32_t)(width - x));
+        region_height = (int)min(region->height, (uint32_t)(height - y));
+        if (decoder->flip_x) {
+            x = width - x - region_width;
+        }
+        if (decoder->flip_y != decoder->region_flip_y) {
+            y = height - y - region_height;
+        }
+    }
+    jpg->width = (uint32_t)region_width;
+    jpg->height = (uint32_t)region_height;
+    if (decoder->rotate) {
+        decoder->region_x = y;
+        decoder->region_y = x;
+        decoder->region_width = region_height;
+        decoder->region_height = region_width;
+    } else {
+        decoder->region_x = x;
+        decoder->region_y = y;
+        decoder->region_width = region_width;
+        decoder->region_height = region_height;
+    }
+    return true;
+}
+
 #define intDivCeil(x, y) (((x) + (y)-1) / (y))
 
 static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
@@ -1494,8 +3294,12 @@ static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
         ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Invalid image dimensions");
         return false;
     }
-    jpg->width = decoder->rotate ? decoder->in_height : decoder->in_width;
-    jpg->height = decoder->rotate ? decoder->in_width : decoder->in_height;
+    const int scale = 1 << decoder->scale_shift;
+    decoder->scaled_width = intDivCeil(decoder->in_width, scale);
+    decoder->scaled_height = intDivCeil(decoder->in_height, scale);
+    if (!ok_jpg_init_region(decoder)) {
+        return false;
+    }
     jpg->bpp = 4; // Always decoding to 32-bit color
     decoder->num_components = buffer[7];
     
@@ -1564,6 +3368,15 @@ static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
     }
     decoder->data_units_x = intDivCeil(decoder->in_width, maxH * 8);
     decoder->data_units_y = intDivCeil(decoder->in_height, maxV * 8);
+    decoder->block_size = 8 / scale;
+    decoder->mcu_width = maxH * decoder->block_size;
+    decoder->mcu_height = maxV * decoder->block_size;
+    decoder->region_begin_x = decoder->region_x / decoder->mcu_width;
+    decoder->region_end_x = intDivCeil(decoder->region_x + decoder->region_width,
+                                       decoder->mcu_width);
+    decoder->region_begin_y = decoder->region_y / decoder->mcu_height;
+    decoder->region_end_y = intDivCeil(decoder->region_y + decoder->region_height,
+                                       decoder->mcu_height);
 
     // Skip remaining length, if any
     if (length > 0) {
@@ -1577,18 +3390,12 @@ static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
         ok_jpg_component *c = decoder->components + i;
         c->blocks_h = intDivCeil(decoder->in_width, (maxH / c->H) * 8);
         c->blocks_v = intDivCeil(decoder->in_height, (maxV / c->V) * 8);
-        if (c->H == maxH && c->V == maxV) {
-            c->idct = ok_jpg_idct_8x8;
-        } else if (c->H * 2 == maxH && c->V * 2 == maxV) {
-            c->idct = ok_jpg_idct_16x16;
-        } else if (c->H == maxH && c->V * 2 == maxV) {
-            c->idct = ok_jpg_idct_8x16;
-        } else if (c->H * 2 == maxH && c->V == maxV) {
-            c->idct = ok_jpg_idct_16x8;
-        } else {
+        if ((c->H != maxH && c->H * 2 != maxH) || (c->V != maxV && c->V * 2 != maxV)) {
             ok_jpg_error(jpg, OK_JPG_ERROR_UNSUPPORTED, "Unsupported IDCT sampling factor");
             return false;
         }
+        c->idct = ok_jpg_get_idct_func(decoder->simd, decoder->block_size * maxH / c->H,
+                                       decoder->block_size * maxV / c->V);
     }
 
     // Allocate data
@@ -1599,6 +3406,34 @@ static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
         }
         decoder->sof_found = true;
 
+        // The stride is rounded up so the SIMD color conversion can read past the last pixel
+        decoder->data_units_per_chunk = min(decoder->data_units_x,
+                                            OK_JPG_MCU_ROW_CHUNK_WIDTH / decoder->mcu_width);
+        const size_t chunk_width = (size_t)(decoder->data_units_per_chunk * decoder->mcu_width);
+        decoder->mcu_row_stride = (chunk_width + 15) & ~(size_t)15;
+        const size_t plane_size = decoder->mcu_row_stride * (size_t)decoder->mcu_height;
+        const size_t planes_size = (plane_size * (size_t)decoder->num_components +
+                                    OK_JPG_MCU_ROW_PADDING);
+        decoder->mcu_row_data = decoder->allocator.alloc(decoder->allocator_user_data,
+                                                         planes_size);
+        if (!decoder->mcu_row_data) {
+            ok_jpg_error(jpg, OK_JPG_ERROR_ALLOCATION, "Couldn't allocate memory for image");
+            return false;
+        }
+        memset(decoder->mcu_row_data, 0, planes_size);
+        for (int i = 0; i < decoder->num_components; i++) {
+            decoder->components[i].output = decoder->mcu_row_data + plane_size * (size_t)i;
+        }
+        if (decoder->rotate || decoder->flip_x) {
+            const size_t transform_size = chunk_width * 4 * (size_t)decoder->mcu_height;
+            decoder->transform_data = decoder->allocator.alloc(decoder->allocator_user_data,
+                                                               transform_size);
+            if (!decoder->transform_data) {
+                ok_jpg_error(jpg, OK_JPG_ERROR_ALLOCATION, "Couldn't allocate memory for image");
+                return false;
+            }
+        }
+
         if (decoder->progressive) {
             for (int i = 0; i < decoder->num_components; i++) {
                 ok_jpg_component *c = decoder->components + i;
@@ -1614,7 +3449,20 @@ static bool ok_jpg_read_sof(ok_jpg_decoder *decoder) {
             }
         }
 
-        if (!jpg->data) {
+        if (decoder->rows_func) {
+            // Rotated images are decoded in full, then sent to rows_func
+            decoder->row_output = !decoder->rotate;
+            uint64_t size = (uint64_t)jpg->stride * (decoder->row_output ?
+                                                     (uint32_t)decoder->mcu_height : jpg->height);
+            size_t platform_size = (size_t)size;
+            if (platform_size == size) {
+                jpg->data = decoder->allocator.alloc(decoder->allocator_user_data, platform_size);
+            }
+            if (!jpg->data) {
+                ok_jpg_error(jpg, OK_JPG_ERROR_ALLOCATION, "Couldn't allocate memory for image");
+                return false;
+            }
+        } else if (!jpg->data) {
             if (decoder->allocator.image_alloc) {
                 decoder->allocator.image_alloc(decoder->allocator_user_data,
                                                jpg->width, jpg->height, jpg->bpp,
@@ -1752,6 +3600,7 @@ static bool ok_jpg_read_sos(ok_jpg_decoder *decoder) {
            decoder->scan_prev_scale, decoder->scan_scale);
 #endif
 
+    ok_jpg_begin_scan(decoder);
     return ok_jpg_decode_scan(decoder);
 }
 
@@ -1826,6 +3675,16 @@ static bool ok_jpg_read_dht(ok_jpg_decoder *decoder) {
             length -= table->count;
         }
         bool is_ac_table = Tc == 1;
+        if (!is_ac_table) {
+            // DC values are the number of extra bits to read, which is at most 11 for 8-bit
+            // samples. Like libjpeg, allow up to 15.
+            for (int i = 0; i < table->count; i++) {
+                if (table->val[i] > 15) {
+                    ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Invalid DHT DC value");
+                    return false;
+                }
+            }
+        }
         ok_jpg_generate_huffman_table_lookups(table, is_ac_table);
     }
     if (length != 0) {
@@ -1881,6 +3740,79 @@ static bool ok_jpg_scan_to_next_marker(ok_jpg_decoder *decoder) {
 
 // MARK: JPEG decoding entry point
 
+// Reads the segment for a marker. Returns false on error, or if a push-mode scan is suspended.
+static bool ok_jpg_read_segment(ok_jpg_decoder *decoder, int marker) {
+    bool success = true;
+    if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+        // SOF
+        decoder->progressive = (marker == 0xC2);
+        success = ok_jpg_read_sof(decoder);
+        decoder->info_complete = success && decoder->info_only;
+    } else if (marker == 0xC4) {
+        // DHT
+        success = decoder->info_only ? ok_jpg_skip_segment(decoder) : ok_jpg_read_dht(decoder);
+    } else if (marker >= 0xD0 && marker <= 0xD7) {
+        decoder->next_marker = marker;
+        success = ok_jpg_decode_restart_if_needed(decoder);
+        if (success) {
+            success = ok_jpg_scan_to_next_marker(decoder);
+        }
+    } else if (marker == 0xD9) {
+        // EOI
+        decoder->eoi_found = true;
+        if (!decoder->info_only && decoder->progressive) {
+            success = ok_jpg_progressive_finish(decoder);
+        }
+    } else if (marker == 0xDA) {
+        // SOS
+        if (!decoder->info_only) {
+            success = ok_jpg_read_sos(decoder);
+        } else {
+            success = ok_jpg_skip_segment(decoder);
+            if (success) {
+                success = ok_jpg_scan_to_next_marker(decoder);
+            }
+        }
+    } else if (marker == 0xDB) {
+        // DQT
+        success = decoder->info_only ? ok_jpg_skip_segment(decoder) : ok_jpg_read_dqt(decoder);
+    } else if (marker == 0xDD) {
+        // DRI
+        success = ok_jpg_read_dri(decoder);
+    } else if (marker == 0xE1) {
+        // APP1 - EXIF metadata
+        // (Expect to find before allocation in SOF)
+        if (decoder->sof_found) {
+            success = ok_jpg_skip_segment(decoder);
+        } else {
+            success = ok_jpg_read_exif(decoder);
+        }
+    } else if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+        // APP or Comment
+        success = ok_jpg_skip_segment(decoder);
+    } else if (marker == 0xFF) {
+        // Ignore
+    } else {
+        ok_jpg_error(decoder->jpg, OK_JPG_ERROR_INVALID, "Unsupported or corrupt JPEG");
+        success = false;
+    }
+    return success;
+}
+
+static void ok_jpg_check_completed(ok_jpg_decoder *decoder) {
+    ok_jpg *jpg = decoder->jpg;
+    if (decoder->num_components == 0) {
+        ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "SOF not found");
+    } else {
+        for (int i = 0; i < decoder->num_components; i++) {
+            if (!decoder->components[i].complete) {
+                ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Missing JPEG image data");
+                break;
+            }
+        }
+    }
+}
+
 static void ok_jpg_decode2(ok_jpg_decoder *decoder) {
     ok_jpg *jpg = decoder->jpg;
 
@@ -1918,115 +3850,385 @@ static void ok_jpg_decode2(ok_jpg_decoder *decoder) {
             }
         }
 
-        bool success = true;
-        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
-            // SOF
-            decoder->progressive = (marker == 0xC2);
-            success = ok_jpg_read_sof(decoder);
-            if (success && decoder->info_only) {
-                return;
-            }
-        } else if (marker == 0xC4) {
-            // DHT
-            success = decoder->info_only ? ok_jpg_skip_segment(decoder) : ok_jpg_read_dht(decoder);
-        } else if (marker >= 0xD0 && marker <= 0xD7) {
-            decoder->next_marker = marker;
-            success = ok_jpg_decode_restart_if_needed(decoder);
-            if (success) {
-                success = ok_jpg_scan_to_next_marker(decoder);
-            }
-        } else if (marker == 0xD9) {
-            // EOI
-            decoder->eoi_found = true;
-            if (!decoder->info_only && decoder->progressive) {
-                ok_jpg_progressive_finish(decoder);
-            }
-        } else if (marker == 0xDA) {
-            // SOS
-            if (!decoder->info_only) {
-                success = ok_jpg_read_sos(decoder);
-            } else {
-                success = ok_jpg_skip_segment(decoder);
-                if (success) {
-                    success = ok_jpg_scan_to_next_marker(decoder);
-                }
-            }
-        } else if (marker == 0xDB) {
-            // DQT
-            success = decoder->info_only ? ok_jpg_skip_segment(decoder) : ok_jpg_read_dqt(decoder);
-        } else if (marker == 0xDD) {
-            // DRI
-            success = ok_jpg_read_dri(decoder);
-        } else if (marker == 0xE1) {
-            // APP1 - EXIF metadata
-            // (Expect to find before allocation in SOF)
-            if (decoder->sof_found) {
-                success = ok_jpg_skip_segment(decoder);
-            } else {
-                success = ok_jpg_read_exif(decoder);
-            }
-        } else if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
-            // APP or Comment
-            success = ok_jpg_skip_segment(decoder);
-        } else if (marker == 0xFF) {
-            // Ignore
-        } else {
-            ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Unsupported or corrupt JPEG");
-            success = false;
+        if (!ok_jpg_read_segment(decoder, marker) || decoder->info_complete) {
+            return;
         }
+    }
 
-        if (!success) {
+    ok_jpg_check_completed(decoder);
+}
+
+// Sends a fully decoded image to rows_func, in strips of up to 16 rows
+static void ok_jpg_send_rows(ok_jpg_decoder *decoder) {
+    ok_jpg *jpg = decoder->jpg;
+    const uint32_t strip_height = 16;
+    for (uint32_t i = 0; i < jpg->height; i += strip_height) {
+        const uint32_t num_rows = min(strip_height, jpg->height - i);
+        const uint32_t y = decoder->flip_y ? jpg->height - i - num_rows : i;
+        if (!decoder->rows_func(decoder->rows_user_data, jpg->width, jpg->height, y, num_rows,
+                                jpg->data + (size_t)y * jpg->stride, jpg->stride)) {
+            ok_jpg_error(jpg, OK_JPG_ERROR_CANCELED, "Canceled");
             return;
         }
     }
+}
 
-    if (decoder->num_components == 0) {
-        ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "SOF not found");
-    } else {
-        for (int i = 0; i < decoder->num_components; i++) {
-            if (!decoder->components[i].complete) {
-                ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Missing JPEG image data");
-                break;
-            }
+// Called after decoding. With row output, sends the image if it wasn't sent row by row, and frees
+// the image data.
+static void ok_jpg_finish_rows(ok_jpg_decoder *decoder) {
+    ok_jpg *jpg = decoder->jpg;
+    if (decoder->rows_func) {
+        if (jpg->data && !decoder->row_output && jpg->error_code == OK_JPG_SUCCESS) {
+            ok_jpg_send_rows(decoder);
         }
+        decoder->allocator.free(decoder->allocator_user_data, jpg->data);
+        jpg->data = NULL;
     }
 }
 
-static void ok_jpg_decode(ok_jpg *jpg, ok_jpg_decode_flags decode_flags,
-                          ok_jpg_input input, void *input_user_data,
-                          ok_jpg_allocator allocator, void *allocator_user_data) {
-    if (!input.read || !input.seek) {
-        ok_jpg_error(jpg, OK_JPG_ERROR_API,
-                     "Invalid argument: read_func and seek_func must not be NULL");
-        return;
-    }
-    
+static ok_jpg_decoder *ok_jpg_decoder_create(ok_jpg *jpg, ok_jpg_decode_flags decode_flags,
+                                             ok_jpg_allocator allocator, void *allocator_user_data,
+                                             ok_jpg_rows_func rows_func, void *rows_user_data) {
     if (!allocator.alloc || !allocator.free) {
         ok_jpg_error(jpg, OK_JPG_ERROR_API,
                      "Invalid argument: allocator alloc and free functions must not be NULL");
-        return;
+        return NULL;
     }
 
     ok_jpg_decoder *decoder = allocator.alloc(allocator_user_data, sizeof(ok_jpg_decoder));
     if (!decoder) {
         ok_jpg_error(jpg, OK_JPG_ERROR_ALLOCATION, "Couldn't allocate decoder.");
-        return;
+        return NULL;
     }
     memset(decoder, 0, sizeof(ok_jpg_decoder));
 
     decoder->jpg = jpg;
-    decoder->input = input;
-    decoder->input_user_data = input_user_data;
     decoder->allocator = allocator;
     decoder->allocator_user_data = allocator_user_data;
     decoder->color_rgba = (decode_flags & OK_JPG_COLOR_FORMAT_BGRA) == 0;
     decoder->flip_y = (decode_flags & OK_JPG_FLIP_Y) != 0;
     decoder->info_only = (decode_flags & OK_JPG_INFO_ONLY) != 0;
+    // The scale flags are a 2-bit field, where OK_JPG_SCALE_1_8 has both bits set
+    decoder->scale_shift = (int)((decode_flags & OK_JPG_SCALE_1_8) / OK_JPG_SCALE_1_2);
+    decoder->simd = ok_jpg_get_simd();
+    decoder->rows_func = rows_func;
+    decoder->rows_user_data = rows_user_data;
+    return decoder;
+}
 
-    ok_jpg_decode2(decoder);
-
+static void ok_jpg_decoder_destroy(ok_jpg_decoder *decoder) {
+    ok_jpg_allocator allocator = decoder->allocator;
+    void *allocator_user_data = decoder->allocator_user_data;
     for (int i = 0; i < MAX_COMPONENTS; i++) {
         allocator.free(allocator_user_data, decoder->components[i].blocks);
     }
+    allocator.free(allocator_user_data, decoder->mcu_row_data);
+    allocator.free(allocator_user_data, decoder->transform_data);
+    allocator.free(allocator_user_data, decoder->push_buffer);
     allocator.free(allocator_user_data, decoder);
 }
+
+static void ok_jpg_decode(ok_jpg *jpg, ok_jpg_decode_flags decode_flags,
+                          const ok_jpg_region *region,
+                          ok_jpg_input input, void *input_user_data,
+                          ok_jpg_allocator allocator, void *allocator_user_data,
+                          ok_jpg_rows_func rows_func, void *rows_user_data,
+                          const ok_jpg_thread_pool *thread_pool, void *thread_pool_user_data) {
+    if (!input.read || !input.seek) {
+        ok_jpg_error(jpg, OK_JPG_ERROR_API,
+                     "Invalid argument: read_func and seek_func must not be NULL");
+        return;
+    }
+
+    ok_jpg_decoder *decoder = ok_jpg_decoder_create(jpg, decode_flags, allocator,
+                                                    allocator_user_data, rows_func, rows_user_data);
+    if (!decoder) {
+        return;
+    }
+    decoder->input = input;
+    decoder->input_user_data = input_user_data;
+    if (thread_pool) {
+        decoder->has_thread_pool = true;
+        decoder->thread_pool = *thread_pool;
+        decoder->thread_pool_user_data = thread_pool_user_data;
+    }
+    if (region) {
+        decoder->has_region = true;
+        decoder->region_flip_y = decoder->flip_y;
+        decoder->requested_region = *region;
+    }
+    if (input.read == ok_memory_read && ((ok_jpg_memory_input *)input_user_data)->length > 0) {
+        const ok_jpg_memory_input *memory = input_user_data;
+        decoder->input_buffer_start = memory->data;
+        decoder->input_buffer_end = memory->data + memory->length;
+    }
+
+    ok_jpg_decode2(decoder);
+    ok_jpg_finish_rows(decoder);
+    ok_jpg_decoder_destroy(decoder);
+}
+
+// MARK: Push decoding
+
+// Input functions for push mode, reading from push_buffer, then from the data passed to
+// ok_jpg_decoder_feed()
+static size_t ok_jpg_push_read(void *user_data, uint8_t *buffer, size_t count) {
+    ok_jpg_decoder *decoder = user_data;
+    const size_t buffered = min(count, decoder->push_buffer_length - decoder->push_buffer_start);
+    if (buffered > 0) {
+        memcpy(buffer, decoder->push_buffer + decoder->push_buffer_start, buffered);
+        decoder->push_buffer_start += buffered;
+    }
+    const size_t len = min(count - buffered, decoder->push_input_length);
+    if (len > 0) {
+        memcpy(buffer + buffered, decoder->push_input, len);
+        decoder->push_input += len;
+        decoder->push_input_length -= len;
+    }
+    return buffered + len;
+}
+
+static bool ok_jpg_push_seek(void *user_data, long count) {
+    ok_jpg_decoder *decoder = user_data;
+    const size_t buffered = decoder->push_buffer_length - decoder->push_buffer_start;
+    if (count < 0 || (size_t)count > buffered + decoder->push_input_length) {
+        return false;
+    }
+    const size_t len = min((size_t)count, buffered);
+    decoder->push_buffer_start += len;
+    decoder->push_input += (size_t)count - len;
+    decoder->push_input_length -= (size_t)count - len;
+    return true;
+}
+
+static const ok_jpg_input OK_JPG_PUSH_INPUT = {
+    .read = ok_jpg_push_read,
+    .seek = ok_jpg_push_seek,
+};
+
+ok_jpg_decoder *ok_jpg_decoder_init(ok_jpg_decode_flags decode_flags,
+                                    ok_jpg_allocator allocator, void *allocator_user_data,
+                                    ok_jpg_rows_func rows_func, void *rows_user_data) {
+    ok_jpg jpg = { 0 };
+    ok_jpg_decoder *decoder = ok_jpg_decoder_create(&jpg, decode_flags, allocator,
+                                                    allocator_user_data, rows_func, rows_user_data);
+    if (decoder) {
+        decoder->jpg = &decoder->push_image;
+        decoder->input = OK_JPG_PUSH_INPUT;
+        decoder->input_user_data = decoder;
+        decoder->push = true;
+    }
+    return decoder;
+}
+
+// Copies input to `buffer` without reading it. Returns false if `length` bytes aren't available.
+static bool ok_jpg_push_peek(ok_jpg_decoder *decoder, uint8_t *buffer, size_t length) {
+    const uint8_t *sources[3] = {
+        decoder->input_buffer_start,
+        decoder->push_buffer + decoder->push_buffer_start,
+        decoder->push_input
+    };
+    const size_t source_lengths[3] = {
+        (size_t)(decoder->input_buffer_end - decoder->input_buffer_start),
+        decoder->push_buffer_length - decoder->push_buffer_start,
+        decoder->push_input_length
+    };
+    for (int i = 0; i < 3 && length > 0; i++) {
+        const size_t len = min(length, source_lengths[i]);
+        if (len > 0) {
+            memcpy(buffer, sources[i], len);
+            buffer += len;
+            length -= len;
+        }
+    }
+    return length == 0;
+}
+
+// Returns true if the segment for the marker can be read without suspending. Segments are read
+// whole, except scans, which are suspended as needed.
+static bool ok_jpg_push_segment_available(ok_jpg_decoder *decoder, int marker) {
+    if (marker >= 0xD0 && marker <= 0xD7) {
+        // Restart marker outside of a scan. Skips to the next marker.
+        return ok_jpg_push_marker_available(decoder, 0);
+    }
+    const bool has_length = ((marker >= 0xC0 && marker <= 0xC2) || marker == 0xC4 ||
+                             marker == 0xDA || marker == 0xDB || marker == 0xDD ||
+                             (marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE);
+    if (!has_length) {
+        return true;
+    }
+    uint8_t buffer[2];
+    if (!ok_jpg_push_peek(decoder, buffer, sizeof(buffer))) {
+        return false;
+    }
+    // Some segment readers read a fixed-size header before checking the segment length
+    const size_t min_length = (marker <= 0xC2 ? 8 : marker == 0xDD ? 4 : marker == 0xDA ? 3 : 2);
+    const size_t length = max(readBE16(buffer), min_length);
+    if (ok_jpg_push_available(decoder) < length) {
+        return false;
+    } else if (marker == 0xDA && decoder->info_only) {
+        // Skips the scan
+        return ok_jpg_push_marker_available(decoder, length);
+    } else {
+        return true;
+    }
+}
+
+// Finds the last marker in data fed to the decoder, so that scans can tell whether all of their
+// data is available.
+static void ok_jpg_push_find_marker(ok_jpg_decoder *decoder, const uint8_t *data, size_t length) {
+    const uint64_t offset = decoder->push_total_length;
+    for (size_t i = 0; i < length; i++) {
+        const uint8_t b = data[i];
+        if (decoder->push_last_byte_ff && b != 0 && b != 0xFF && !(b >= 0xD0 && b <= 0xD7)) {
+            // The 0xFF byte is at (offset + i - 1)
+            decoder->push_marker_offset = offset + i;
+        }
+        decoder->push_last_byte_ff = (b == 0xFF);
+    }
+    decoder->push_total_length += length;
+}
+
+// Moves the input that wasn't read to push_buffer
+static bool ok_jpg_push_save_input(ok_jpg_decoder *decoder) {
+    const size_t buffered = decoder->push_buffer_length - decoder->push_buffer_start;
+    const size_t length = buffered + decoder->push_input_length;
+    if (length > decoder->push_buffer_capacity) {
+        const size_t capacity = max(length, decoder->push_buffer_capacity * 2);
+        uint8_t *buffer = decoder->allocator.alloc(decoder->allocator_user_data, capacity);
+        if (!buffer) {
+            ok_jpg_error(decoder->jpg, OK_JPG_ERROR_ALLOCATION, "Couldn't allocate input buffer");
+            return false;
+        }
+        if (buffered > 0) {
+            memcpy(buffer, decoder->push_buffer + decoder->push_buffer_start, buffered);
+        }
+        decoder->allocator.free(decoder->allocator_user_data, decoder->push_buffer);
+        decoder->push_buffer = buffer;
+        decoder->push_buffer_capacity = capacity;
+    } else if (buffered > 0 && decoder->push_buffer_start > 0) {
+        memmove(decoder->push_buffer, decoder->push_buffer + decoder->push_buffer_start, buffered);
+    }
+    if (decoder->push_input_length > 0) {
+        memcpy(decoder->push_buffer + buffered, decoder->push_input, decoder->push_input_length);
+    }
+    decoder->push_buffer_start = 0;
+    decoder->push_buffer_length = length;
+    return true;
+}
+
+ok_jpg_decoder_status ok_jpg_decoder_feed(ok_jpg_decoder *decoder, const uint8_t *data,
+                                          size_t length) {
+    if (!decoder) {
+        return OK_JPG_DECODER_ERROR;
+    }
+    ok_jpg *jpg = decoder->jpg;
+    if (!data && length > 0) {
+        ok_jpg_error(jpg, OK_JPG_ERROR_API, "Invalid argument: data must not be NULL");
+        decoder->push_state = OK_JPG_PUSH_ERROR;
+    }
+    const uint32_t rows_completed = decoder->rows_completed;
+    if (decoder->push_state != OK_JPG_PUSH_DONE && decoder->push_state != OK_JPG_PUSH_ERROR) {
+        ok_jpg_push_find_marker(decoder, data, length);
+        decoder->push_input = data;
+        decoder->push_input_length = length;
+    }
+    while (decoder->push_state != OK_JPG_PUSH_DONE && decoder->push_state != OK_JPG_PUSH_ERROR) {
+        bool success = true;
+        if (decoder->push_state == OK_JPG_PUSH_SIGNATURE) {
+            uint8_t jpg_header[2];
+            if (ok_jpg_push_available(decoder) < sizeof(jpg_header)) {
+                break;
+            }
+            success = ok_read(decoder, jpg_header, sizeof(jpg_header));
+            if (success && (jpg_header[0] != 0xFF || jpg_header[1] != 0xD8)) {
+                ok_jpg_error(jpg, OK_JPG_ERROR_INVALID, "Invalid signature (not a JPEG file)");
+                success = false;
+            }
+            decoder->push_state = OK_JPG_PUSH_MARKER;
+        } else if (decoder->push_state == OK_JPG_PUSH_MARKER) {
+            if (decoder->next_marker != 0) {
+                decoder->push_marker = decoder->next_marker;
+                decoder->next_marker = 0;
+                decoder->push_state = OK_JPG_PUSH_SEGMENT;
+            } else {
+                // Same as ok_jpg_decode2(), but only reads when two bytes are available
+                uint8_t b;
+                if (ok_jpg_push_available(decoder) < 2) {
+                    break;
+                }
+                success = ok_read(decoder, &b, 1);
+                if (success && b == 0xFF) {
+                    success = ok_read(decoder, &b, 1);
+                    if (success && b != 0 && b != 0xFF) {
+                        decoder->push_marker = b;
+                        decoder->push_state = OK_JPG_PUSH_SEGMENT;
+                    }
+                }
+            }
+        } else if (decoder->push_state == OK_JPG_PUSH_SEGMENT) {
+            if (!ok_jpg_push_segment_available(decoder, decoder->push_marker)) {
+                break;
+            }
+            success = ok_jpg_read_segment(decoder, decoder->push_marker);
+            decoder->push_state = OK_JPG_PUSH_MARKER;
+        } else if (decoder->push_state == OK_JPG_PUSH_SCAN) {
+            success = ok_jpg_decode_scan(decoder);
+            decoder->push_state = OK_JPG_PUSH_MARKER;
+        }
+        if (decoder->push_suspended) {
+            decoder->push_suspended = false;
+            decoder->push_state = OK_JPG_PUSH_SCAN;
+            break;
+        }
+        if (success && decoder->info_complete) {
+            decoder->push_state = OK_JPG_PUSH_DONE;
+        } else if (success && decoder->eoi_found) {
+            ok_jpg_check_completed(decoder);
+            decoder->push_state = OK_JPG_PUSH_DONE;
+        }
+        if (!success || jpg->error_code != OK_JPG_SUCCESS) {
+            decoder->push_state = OK_JPG_PUSH_ERROR;
+        } else if (decoder->push_state == OK_JPG_PUSH_DONE) {
+            ok_jpg_finish_rows(decoder);
+            if (jpg->error_code != OK_JPG_SUCCESS) {
+                decoder->push_state = OK_JPG_PUSH_ERROR;
+            }
+        }
+    }
+    if (decoder->push_state != OK_JPG_PUSH_DONE && decoder->push_state != OK_JPG_PUSH_ERROR) {
+        if (!ok_jpg_push_save_input(decoder)) {
+            decoder->push_state = OK_JPG_PUSH_ERROR;
+        }
+    }
+    decoder->push_input = NULL;
+    decoder->push_input_length = 0;
+
+    if (decoder->push_state == OK_JPG_PUSH_ERROR) {
+        return OK_JPG_DECODER_ERROR;
+    } else if (decoder->push_state == OK_JPG_PUSH_DONE) {
+        return OK_JPG_DECODER_DONE;
+    } else if (decoder->rows_completed != rows_completed) {
+        return OK_JPG_DECODER_ROWS_AVAILABLE;
+    } else {
+        return OK_JPG_DECODER_NEED_MORE_INPUT;
+    }
+}
+
+ok_jpg ok_jpg_decoder_finish(ok_jpg_decoder *decoder) {
+    ok_jpg jpg = { 0 };
+    if (!decoder) {
+        ok_jpg_error(&jpg, OK_JPG_ERROR_API, "Invalid argument: decoder must not be NULL");
+        return jpg;
+    }
+    if (decoder->push_state != OK_JPG_PUSH_DONE && decoder->push_state != OK_JPG_PUSH_ERROR) {
+        ok_jpg_error(decoder->jpg, OK_JPG_ERROR_IO, "Missing image data");
+    }
+    jpg = *decoder->jpg;
+    if (jpg.error_code != OK_JPG_SUCCESS) {
+        decoder->allocator.free(decoder->allocator_user_data, jpg.data);
+        jpg.data = NULL;
+    }
+    ok_jpg_decoder_destroy(decoder);
+    return jpg;
+}
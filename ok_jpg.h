@@ -31,7 +31,14 @@
  * - Interprets EXIF orientation tags.
  * - Option to get the image dimensions without decoding.
  * - Option to flip the image vertically.
+ * - Option to decode at 1/2, 1/4, or 1/8 size, which is much faster than decoding at full size.
+ * - Option to decode a region of the image (see #ok_jpg_read_region_from_input()).
  * - Returns data in RGBA or BGRA format.
+ * - Option to receive decoded rows as they are decoded, without allocating the whole image.
+ * - Option to decode data as it arrives, without blocking (see #ok_jpg_decoder_feed()).
+ * - Option to read from memory in place, without copying (see #ok_jpg_read_from_memory()).
+ * - Option to decode in parallel on a thread pool (see #ok_jpg_read_from_memory_with_thread_pool()).
+ * - Uses SSE2, AVX2, or NEON when available.
  *
  * Caveats:
  * - No CMYK or YCCK support.
@@ -70,6 +77,7 @@ typedef enum {
     OK_JPG_ERROR_UNSUPPORTED, // Unsupported JPG file (CMYK)
     OK_JPG_ERROR_ALLOCATION, // Couldn't allocate memory
     OK_JPG_ERROR_IO, // Couldn't read or seek the file
+    OK_JPG_ERROR_CANCELED, // Decoding was stopped by a callback
 } ok_jpg_error;
 
 /**
@@ -96,8 +104,15 @@ typedef enum {
     /// the last row in the image.
     OK_JPG_FLIP_Y = (1 << 2),
     /// Set to read an image's dimensions and color format without reading the image data.
-    OK_JPG_INFO_ONLY = (1 << 3)
-
+    OK_JPG_INFO_ONLY = (1 << 3),
+    /// Set to decode the image at 1/2 size. The image is scaled while decoding, using smaller
+    /// inverse DCTs, which is faster and uses less memory than decoding at full size. The
+    /// dimensions are rounded up, and are also scaled with `OK_JPG_INFO_ONLY`.
+    OK_JPG_SCALE_1_2 = (1 << 4),
+    /// Set to decode the image at 1/4 size.
+    OK_JPG_SCALE_1_4 = (2 << 4),
+    /// Set to decode the image at 1/8 size.
+    OK_JPG_SCALE_1_8 = (3 << 4),
 } ok_jpg_decode_flags;
 
 // MARK: Reading from a FILE
@@ -226,6 +241,247 @@ ok_jpg ok_jpg_read_from_input(ok_jpg_decode_flags decode_flags,
                               ok_jpg_input input_callbacks, void *input_callbacks_user_data,
                               ok_jpg_allocator allocator, void *allocator_user_data);
 
+/**
+ * Reads a rectangular region of a JPG image, like #ok_jpg_read_from_input(). On success,
+ * #ok_jpg.width and #ok_jpg.height are the size of the region, and #ok_jpg.data contains only the
+ * region's image data.
+ *
+ * The region is in the coordinates of the decoded image, after the EXIF orientation and scaling
+ * are applied (and before `OK_JPG_FLIP_Y`). If the region extends past the image, it is clipped.
+ *
+ * Only the parts of the image that overlap the region are transformed and converted. The rest of
+ * the image data is only entropy decoded, and for baseline images, decoding stops after the last
+ * row of the region.
+ *
+ * @param decode_flags The JPG decode flags. Use `OK_JPG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param region_x The left edge of the region.
+ * @param region_y The top edge of the region.
+ * @param region_width The width of the region. Must be greater than zero.
+ * @param region_height The height of the region. Must be greater than zero.
+ * @param input_callbacks The custom input functions.
+ * @param input_callbacks_user_data The parameter to be passed to the input's `read` and `seek`
+ * functions.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_JPG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @return a #ok_jpg object. If the region is empty or outside of the image, #ok_jpg.error_code is
+ * `OK_JPG_ERROR_API`.
+ */
+ok_jpg ok_jpg_read_region_from_input(ok_jpg_decode_flags decode_flags,
+                                     uint32_t region_x, uint32_t region_y,
+                                     uint32_t region_width, uint32_t region_height,
+                                     ok_jpg_input input_callbacks, void *input_callbacks_user_data,
+                                     ok_jpg_allocator allocator, void *allocator_user_data);
+
+// MARK: Reading from memory
+
+/**
+ * Reads a JPG image from memory. The data is read in place, without copying it, so this function
+ * works well with memory-mapped files. On success, #ok_jpg.data contains the packed image data,
+ * with a size of (`width * height * 4`). On failure, #ok_jpg.data is `NULL` and
+ * #ok_jpg.error_code is nonzero.
+ *
+ * The returned `data` must be freed by the caller.
+ *
+ * @param data The JPG file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @param decode_flags The JPG decode flags. Use `OK_JPG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_JPG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @return a #ok_jpg object.
+ */
+ok_jpg ok_jpg_read_from_memory(const uint8_t *data, size_t length,
+                               ok_jpg_decode_flags decode_flags,
+                               ok_jpg_allocator allocator, void *allocator_user_data);
+
+// MARK: Reading with a thread pool
+
+typedef struct {
+    /**
+     * Runs tasks, possibly concurrently, and returns after all tasks have finished.
+     * Each task is run by calling `task(task_data[i])`, for `i` from 0 to `num_tasks - 1`.
+     *
+     * @param user_data The pointer passed to #ok_jpg_read_from_memory_with_thread_pool().
+     * @param task The task function.
+     * @param task_data The data to pass to each task.
+     * @param num_tasks The number of tasks.
+     */
+    void (*run_tasks)(void *user_data, void (*task)(void *task_data), void **task_data,
+                      size_t num_tasks);
+} ok_jpg_thread_pool;
+
+/**
+ * Reads a JPG image from memory, like #ok_jpg_read_from_memory(), using a thread pool to decode
+ * parts of the image in parallel.
+ *
+ * Baseline images with restart markers (common in images from cameras) are split at the restart
+ * markers. Each part is decoded on a separate task, directly into the output image. For progressive
+ * images, the coefficients are decoded on the calling thread, and the final pass (dequantization,
+ * IDCT, and color conversion) is split into bands of rows. Other images are decoded on the calling
+ * thread, the same as #ok_jpg_read_from_memory().
+ *
+ * The allocator functions are only called from the calling thread.
+ *
+ * @param data The JPG file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @param decode_flags The JPG decode flags. Use `OK_JPG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_JPG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param thread_pool The thread pool to use.
+ * @param thread_pool_user_data The pointer to pass to the thread pool's `run_tasks` function.
+ * @return a #ok_jpg object.
+ */
+ok_jpg ok_jpg_read_from_memory_with_thread_pool(const uint8_t *data, size_t length,
+                                                ok_jpg_decode_flags decode_flags,
+                                                ok_jpg_allocator allocator,
+                                                void *allocator_user_data,
+                                                ok_jpg_thread_pool thread_pool,
+                                                void *thread_pool_user_data);
+
+// MARK: Reading rows
+
+/**
+ * Receives decoded rows from #ok_jpg_read_rows().
+ *
+ * @param user_data The parameter that was passed to #ok_jpg_read_rows().
+ * @param width The image's width, in pixels.
+ * @param height The image's height, in pixels.
+ * @param y The index of the first row in `data`.
+ * @param num_rows The number of rows in `data`, typically 8 or 16 (fewer when scaled).
+ * @param data The decoded rows, in top-to-bottom order (bottom-to-top, if `OK_JPG_FLIP_Y` is set).
+ * The data is only valid until the function returns.
+ * @param stride The stride of `data`, in bytes.
+ * @return `true` to continue decoding, or `false` to stop.
+ */
+typedef bool (*ok_jpg_rows_func)(void *user_data, uint32_t width, uint32_t height, uint32_t y,
+                                 uint32_t num_rows, const uint8_t *data, uint32_t stride);
+
+/**
+ * Reads a JPG image, sending the decoded rows to `rows_func` one MCU row at a time, instead of
+ * allocating memory for the whole image. Rows are sent in decoding order, which is
+ * top-to-bottom (or bottom-to-top, if `OK_JPG_FLIP_Y` is set).
+ *
+ * For baseline images, the memory used is proportional to the image width. Progressive images
+ * also keep the image's DCT coefficients in memory (2 bytes per sample). Images with an EXIF
+ * orientation that rotates the image are decoded in full before any rows are sent.
+ *
+ * On success, #ok_jpg.error_code is zero and #ok_jpg.data is `NULL`. If `rows_func` returns `false`,
+ * #ok_jpg.error_code is `OK_JPG_ERROR_CANCELED`.
+ *
+ * The allocator's `image_alloc` function is not used.
+ *
+ * @param decode_flags The JPG decode flags. Use `OK_JPG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param input_callbacks The custom input functions.
+ * @param input_callbacks_user_data The parameter to be passed to the input's `read` and `seek` functions.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_JPG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param rows_func The function to receive decoded rows.
+ * @param rows_user_data The parameter to be passed to `rows_func`.
+ * @return a #ok_jpg object.
+ */
+ok_jpg ok_jpg_read_rows(ok_jpg_decode_flags decode_flags,
+                        ok_jpg_input input_callbacks, void *input_callbacks_user_data,
+                        ok_jpg_allocator allocator, void *allocator_user_data,
+                        ok_jpg_rows_func rows_func, void *rows_user_data);
+
+// MARK: Push decoding
+
+/**
+ * A JPEG decoder that receives data as it arrives, for example from a network connection,
+ * instead of reading from an input.
+ */
+typedef struct ok_jpg_decoder ok_jpg_decoder;
+
+/**
+ * The status returned from #ok_jpg_decoder_feed().
+ */
+typedef enum {
+    /// All data was consumed, and more data is needed.
+    OK_JPG_DECODER_NEED_MORE_INPUT = 0,
+    /// More data is needed. One or more rows were decoded (and sent to `rows_func`, if set).
+    /// Rows of progressive and rotated images are only available when decoding is done.
+    OK_JPG_DECODER_ROWS_AVAILABLE,
+    /// The image is decoded. Any remaining data is ignored.
+    OK_JPG_DECODER_DONE,
+    /// An error occurred. Call #ok_jpg_decoder_finish() to get the error code.
+    OK_JPG_DECODER_ERROR,
+} ok_jpg_decoder_status;
+
+/**
+ * Creates a push decoder.
+ *
+ * If `rows_func` is `NULL`, the whole image is decoded, and is returned from
+ * #ok_jpg_decoder_finish(). Otherwise, rows are sent to `rows_func` as they are decoded, like
+ * #ok_jpg_read_rows().
+ *
+ * @param decode_flags The JPG decode flags. Use `OK_JPG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_JPG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param rows_func The function to receive decoded rows, or `NULL`.
+ * @param rows_user_data The parameter to be passed to `rows_func`.
+ * @return The new decoder, or `NULL` if it couldn't be allocated.
+ */
+ok_jpg_decoder *ok_jpg_decoder_init(ok_jpg_decode_flags decode_flags,
+                                    ok_jpg_allocator allocator, void *allocator_user_data,
+                                    ok_jpg_rows_func rows_func, void *rows_user_data);
+
+/**
+ * Decodes the next part of the JPEG data. The decoder keeps its state between calls, and copies
+ * any data it hasn't decoded yet, so `data` can be reused after the function returns.
+ *
+ * Decoding stops at a marker segment or MCU (minimum coded unit) that isn't completely available,
+ * and continues from there when more data is fed.
+ *
+ * @param decoder The decoder.
+ * @param data The next part of the JPEG data.
+ * @param length The length of the data, in bytes.
+ * @return The decoder status.
+ */
+ok_jpg_decoder_status ok_jpg_decoder_feed(ok_jpg_decoder *decoder, const uint8_t *data,
+                                          size_t length);
+
+/**
+ * Frees the decoder and returns the decoded image.
+ * On success, #ok_jpg.data contains the image data (or is `NULL`, if using `rows_func`).
+ * If decoding failed or is incomplete, #ok_jpg.data is `NULL` and #ok_jpg.error_code is nonzero.
+ *
+ * The returned `data` must be freed by the caller.
+ *
+ * @param decoder The decoder.
+ * @return a #ok_jpg object.
+ */
+ok_jpg ok_jpg_decoder_finish(ok_jpg_decoder *decoder);
+
+// MARK: SIMD
+
+/**
+ * SIMD instruction sets used for decoding. Define `OK_NO_SIMD` to build with portable C code only.
+ * All instruction sets decode exactly the same image data as the portable C code.
+ */
+typedef enum {
+    /// Use the fastest instruction set supported by the CPU. This is the default.
+    OK_JPG_SIMD_AUTO = 0,
+    /// Use portable C code only.
+    OK_JPG_SIMD_NONE,
+    OK_JPG_SIMD_SSE2,
+    OK_JPG_SIMD_AVX2,
+    OK_JPG_SIMD_NEON,
+} ok_jpg_simd;
+
+/**
+ * Sets the SIMD instruction set used for decoding. This is a global setting, intended for
+ * testing and benchmarking, and should not be changed while an image is being decoded.
+ *
+ * @param simd The instruction set to use.
+ * @return `true` if the instruction set was compiled in and is supported by the CPU. If `false`,
+ * the setting is unchanged.
+ */
+bool ok_jpg_set_simd(ok_jpg_simd simd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,8 @@ typedef struct {
 
     uint8_t *key_offset_buffer;
     uint8_t *value_offset_buffer;
+    const uint8_t *key_offsets; // Points to key_offset_buffer, or to the data in memory
+    const uint8_t *value_offsets; // Points to value_offset_buffer, or to the data in memory
 
     // Input
     void *input_data;
@@ -135,6 +137,62 @@ static bool ok_file_seek_func(void *user_data, long count) {
 
 #endif
 
+// Input functions for ok_mo_read_from_memory()
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} ok_mo_memory_input;
+
+static size_t ok_memory_read_func(void *user_data, uint8_t *buffer, size_t length) {
+    ok_mo_memory_input *memory = user_data;
+    const size_t len = min(length, memory->length - memory->position);
+    if (len > 0) {
+        memcpy(buffer, memory->data + memory->position, len);
+        memory->position += len;
+    }
+    return len;
+}
+
+static bool ok_memory_seek_func(void *user_data, long count) {
+    ok_mo_memory_input *memory = user_data;
+    if (count < 0) {
+        // The offsets in MO files may point backwards
+        const size_t back = (size_t)-(count + 1) + 1;
+        if (back > memory->position) {
+            return false;
+        }
+        memory->position -= back;
+    } else {
+        if ((size_t)count > memory->length - memory->position) {
+            return false;
+        }
+        memory->position += (size_t)count;
+    }
+    return true;
+}
+
+// Reads `length` bytes. When reading from memory, returns a pointer to the data in place.
+// Otherwise, allocates `*buffer` and copies the data to it. Returns NULL on failure.
+static const uint8_t *ok_read_in_place(ok_mo_decoder *decoder, uint8_t **buffer, size_t length) {
+    if (decoder->input_read_func == ok_memory_read_func) {
+        ok_mo_memory_input *memory = decoder->input_data;
+        if (length > memory->length - memory->position) {
+            ok_mo_error(decoder->mo, "Read error: unexpected end of data");
+            return NULL;
+        }
+        const uint8_t *data = memory->data + memory->position;
+        memory->position += length;
+        return data;
+    }
+    *buffer = malloc(length);
+    if (!*buffer) {
+        ok_mo_error(decoder->mo, "Couldn't allocate arrays");
+        return NULL;
+    }
+    return ok_read(decoder, *buffer, length) ? *buffer : NULL;
+}
+
 // MARK: Public API
 
 #ifndef OK_NO_STDIO
@@ -162,6 +220,17 @@ ok_mo *ok_mo_read_from_callbacks(void *user_data, ok_mo_read_func read_func,
     return mo;
 }
 
+ok_mo *ok_mo_read_from_memory(const uint8_t *data, size_t length) {
+    ok_mo *mo = calloc(1, sizeof(ok_mo));
+    if (data || length == 0) {
+        ok_mo_memory_input memory = { data, length, 0 };
+        ok_mo_decode(mo, &memory, ok_memory_read_func, ok_memory_seek_func);
+    } else {
+        ok_mo_error(mo, "Invalid argument: data must not be NULL");
+    }
+    return mo;
+}
+
 void ok_mo_free(ok_mo *mo) {
     if (mo) {
         ok_mo_cleanup(mo);
@@ -237,9 +306,7 @@ static void ok_mo_decode2(ok_mo_decoder *decoder) {
     }
 
     mo->strings = calloc(mo->num_strings, sizeof(struct ok_mo_string));
-    decoder->key_offset_buffer = malloc(bytes_per_string);
-    decoder->value_offset_buffer = malloc(bytes_per_string);
-    if (!mo->strings || !decoder->key_offset_buffer || !decoder->value_offset_buffer) {
+    if (!mo->strings) {
         ok_mo_error(mo, "Couldn't allocate arrays");
         return;
     }
@@ -250,16 +317,18 @@ static void ok_mo_decode2(ok_mo_decoder *decoder) {
     if (!ok_seek(decoder, (long)(key_offset - tell))) {
         return;
     }
-    if (!ok_read(decoder, decoder->key_offset_buffer, bytes_per_string)) {
-        ok_mo_error(mo, "Couldn't get key offsets");
+    decoder->key_offsets = ok_read_in_place(decoder, &decoder->key_offset_buffer,
+                                            bytes_per_string);
+    if (!decoder->key_offsets) {
         return;
     }
     tell = key_offset + bytes_per_string;
     if (!ok_seek(decoder, (long)(value_offset - tell))) {
         return;
     }
-    if (!ok_read(decoder, decoder->value_offset_buffer, bytes_per_string)) {
-        ok_mo_error(mo, "Couldn't get value offsets");
+    decoder->value_offsets = ok_read_in_place(decoder, &decoder->value_offset_buffer,
+                                              bytes_per_string);
+    if (!decoder->value_offsets) {
         return;
     }
     tell = value_offset + bytes_per_string;
@@ -267,8 +336,8 @@ static void ok_mo_decode2(ok_mo_decoder *decoder) {
     // Read keys
     // Assumes keys are sorted, per the spec.
     for (uint32_t i = 0; i < mo->num_strings; i++) {
-        uint32_t length = read32(decoder->key_offset_buffer + 8 * i, little_endian);
-        uint32_t offset = read32(decoder->key_offset_buffer + 8 * i + 4, little_endian);
+        uint32_t length = read32(decoder->key_offsets + 8 * i, little_endian);
+        uint32_t offset = read32(decoder->key_offsets + 8 * i + 4, little_endian);
 
         mo->strings[i].key = length == UINT32_MAX ? NULL : malloc(length + 1);
         if (!mo->strings[i].key) {
@@ -286,8 +355,8 @@ static void ok_mo_decode2(ok_mo_decoder *decoder) {
 
     // Read values
     for (uint32_t i = 0; i < mo->num_strings; i++) {
-        uint32_t length = read32(decoder->value_offset_buffer + 8 * i, little_endian);
-        uint32_t offset = read32(decoder->value_offset_buffer + 8 * i + 4, little_endian);
+        uint32_t length = read32(decoder->value_offsets + 8 * i, little_endian);
+        uint32_t offset = read32(decoder->value_offsets + 8 * i + 4, little_endian);
 
         mo->strings[i].value = length == UINT32_MAX ? NULL : malloc(length + 1);
         if (!mo->strings[i].value) {
@@ -186,6 +186,20 @@ typedef bool (*ok_mo_seek_func)(void *user_data, long count);
 ok_mo *ok_mo_read_from_callbacks(void *user_data, ok_mo_read_func read_func,
                                  ok_mo_seek_func seek_func);
 
+// MARK: Read from memory
+
+/**
+ * Reads a MO file from memory. The string tables are read in place, without copying them, so this
+ * function works well with memory-mapped files.
+ * On failure, #ok_mo.num_strings is 0 and #ok_mo.error_message is set.
+ *
+ * @param data The MO file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @return A new #ok_mo object. Never returns `NULL`. The object should be freed with
+ * #ok_mo_free().
+ */
+ok_mo *ok_mo_read_from_memory(const uint8_t *data, size_t length);
+
 #ifdef __cplusplus
 }
 #endif
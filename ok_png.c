@@ -33,8 +33,35 @@
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 #define OK_SIZE_MAX (~(size_t)0)
 
+#if !defined(OK_NO_SIMD)
+#  if defined(__x86_64__) || defined(_M_X64) || \
+      ((defined(__i386__) || defined(_M_IX86)) && defined(__SSE2__)) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define OK_PNG_USE_SSE
+#    include <emmintrin.h>
+#    include <tmmintrin.h>
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#      include <intrin.h>
+#    endif
+#  elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    define OK_PNG_USE_NEON
+#    include <arm_neon.h>
+#  endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define OK_PNG_TARGET(isa) __attribute__((target(isa)))
+#else
+#define OK_PNG_TARGET(isa)
+#endif
+
 #define PNG_TYPE(a, b, c, d) ((a << 24) | (b << 16) | (c << 8) | d)
 
 static const uint32_t OK_PNG_CHUNK_IHDR = PNG_TYPE('I', 'H', 'D', 'R');
@@ -71,6 +98,25 @@ const ok_png_allocator OK_PNG_DEFAULT_ALLOCATOR = {
 
 #endif
 
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} ok_png_region;
+
+typedef enum {
+    OK_PNG_PUSH_SIGNATURE = 0,
+    OK_PNG_PUSH_CHUNK_HEADER,
+    OK_PNG_PUSH_CHUNK_DATA,
+    OK_PNG_PUSH_CHUNK_FOOTER,
+    OK_PNG_PUSH_DONE,
+    OK_PNG_PUSH_ERROR,
+} ok_png_push_state;
+
+// Large enough for the IHDR, PLTE, and tRNS chunks, which are read whole
+#define OK_PNG_PUSH_BUFFER_SIZE (256 * 3)
+
 typedef enum {
     OK_PNG_FILTER_NONE = 0,
     OK_PNG_FILTER_SUB,
@@ -80,7 +126,7 @@ typedef enum {
     OK_PNG_NUM_FILTERS
 } ok_png_filter_type;
 
-typedef struct {
+struct ok_png_decoder {
     // Image
     ok_png *png;
     
@@ -95,6 +141,12 @@ typedef struct {
     // Decode options
     ok_png_decode_flags decode_flags;
 
+    // Row output (ok_png_read_rows). For non-interlaced images, the image data holds two rows:
+    // the current row and the previous row.
+    ok_png_rows_func rows_func;
+    void *rows_user_data;
+    bool row_output;
+
     // Decoding
     ok_inflater *inflater;
     size_t inflater_bytes_read;
@@ -106,8 +158,13 @@ typedef struct {
     bool ready_for_next_interlace_pass;
     uint8_t *temp_data_row;
     bool decoding_completed;
+    bool hdr_found;
+    bool end_found;
+    bool info_complete; // All info was found (OK_PNG_INFO_ONLY)
 
     // PNG data
+    uint32_t width; // The image size. png->width and png->height are the region size.
+    uint32_t height;
     uint8_t bit_depth;
     uint8_t color_type;
     uint8_t interlace_method;
@@ -117,7 +174,46 @@ typedef struct {
     bool has_single_transparent_color;
     bool is_ios_format;
 
-} ok_png_decoder;
+    // Region to decode (ok_png_read_region_from_input), in image coordinates (before FLIP_Y).
+    // Set to the whole image if there is no region.
+    bool has_region;
+    uint32_t region_x;
+    uint32_t region_y;
+    uint32_t region_width;
+    uint32_t region_height;
+
+    // Filter function, chosen at runtime
+    void (*decode_filter)(uint8_t *curr, const uint8_t *prev, size_t length, int filter,
+                          uint8_t bpp);
+
+    // CRC verification (OK_PNG_VERIFY_CRC)
+    bool verify_crc;
+    uint32_t chunk_crc;
+    uint32_t (*crc_update)(uint32_t crc, const uint8_t *buffer, size_t length);
+
+    // Adler-32 verification (OK_PNG_VERIFY_ADLER32)
+    bool verify_adler32;
+    bool adler32_verified;
+
+    // Multi-threaded decoding
+    bool has_thread_pool;
+    ok_png_thread_pool thread_pool;
+    void *thread_pool_user_data;
+    uint8_t *idat_data;
+    size_t idat_data_length;
+    size_t idat_data_capacity;
+
+    // Push decoding (ok_png_decoder_feed)
+    ok_png push_image;
+    ok_png_push_state push_state;
+    const uint8_t *push_input;
+    size_t push_input_length;
+    uint8_t push_buffer[OK_PNG_PUSH_BUFFER_SIZE]; // Signature, chunk header, footer, or small chunk
+    size_t push_buffer_length;
+    uint32_t chunk_type;
+    uint32_t chunk_bytes_remaining;
+    uint32_t rows_completed;
+};
 
 #define ok_alloc(decoder, size) (decoder)->allocator.alloc((decoder)->allocator_user_data, (size))
 #define ok_png_error(png, error_code, message) ok_png_set_error((png), (error_code))
@@ -132,6 +228,9 @@ static void ok_png_set_error(ok_png *png, ok_png_error error_code) {
 
 static bool ok_read(ok_png_decoder *decoder, uint8_t *buffer, size_t length) {
     if (decoder->input.read(decoder->input_user_data, buffer, length) == length) {
+        if (decoder->verify_crc) {
+            decoder->chunk_crc = decoder->crc_update(decoder->chunk_crc, buffer, length);
+        }
         return true;
     } else {
         ok_png_error(decoder->png, OK_PNG_ERROR_IO, "Read error: error calling input function.");
@@ -140,6 +239,18 @@ static bool ok_read(ok_png_decoder *decoder, uint8_t *buffer, size_t length) {
 }
 
 static bool ok_seek(ok_png_decoder *decoder, long length) {
+    if (decoder->verify_crc && length > 0) {
+        // Skipped data is still part of the chunk's CRC, so read it instead.
+        uint8_t buffer[4096];
+        while (length > 0) {
+            const size_t len = min(sizeof(buffer), (size_t)length);
+            if (!ok_read(decoder, buffer, len)) {
+                return false;
+            }
+            length -= (long)len;
+        }
+        return true;
+    }
     if (decoder->input.seek(decoder->input_user_data, length)) {
         return true;
     } else {
@@ -165,9 +276,48 @@ static const ok_png_input OK_PNG_FILE_INPUT = {
 
 #endif
 
+// Input functions for ok_png_read_from_memory(). Compressed image data is not read through these
+// functions; it is inflated in place (see ok_png_read_compressed_data()).
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} ok_png_memory_input;
+
+static size_t ok_memory_read(void *user_data, uint8_t *buffer, size_t length) {
+    ok_png_memory_input *memory = user_data;
+    const size_t len = min(length, memory->length - memory->position);
+    if (len > 0) {
+        memcpy(buffer, memory->data + memory->position, len);
+        memory->position += len;
+    }
+    return len;
+}
+
+static bool ok_memory_seek(void *user_data, long count) {
+    ok_png_memory_input *memory = user_data;
+    if (count < 0 || (size_t)count > memory->length - memory->position) {
+        return false;
+    }
+    memory->position += (size_t)count;
+    return true;
+}
+
+static const ok_png_input OK_PNG_MEMORY_INPUT = {
+    .read = ok_memory_read,
+    .seek = ok_memory_seek,
+};
+
 static void ok_png_decode(ok_png *png, ok_png_decode_flags decode_flags,
-                          ok_png_input input, void *input_user_data,
-                          ok_png_allocator allocator, void *allocator_user_data);
+                          const ok_png_region *region, ok_png_input input, void *input_user_data,
+                          ok_png_allocator allocator, void *allocator_user_data,
+                          const ok_png_thread_pool *thread_pool, void *thread_pool_user_data,
+                          ok_png_rows_func rows_func, void *rows_user_data);
+
+static bool ok_inflater_is_done(const ok_inflater *inflater);
+static bool ok_inflater_is_at_flush_point(const ok_inflater *inflater);
+static uint32_t ok_inflater_get_adler32(const ok_inflater *inflater);
+static size_t ok_inflater_get_unused_input_length(const ok_inflater *inflater);
 
 // Public API
 
@@ -185,7 +335,8 @@ ok_png ok_png_read_with_allocator(FILE *file, ok_png_decode_flags decode_flags,
                                   ok_png_allocator allocator, void *allocator_user_data) {
     ok_png png = { 0 };
     if (file) {
-        ok_png_decode(&png, decode_flags, OK_PNG_FILE_INPUT, file, allocator, allocator_user_data);
+        ok_png_decode(&png, decode_flags, NULL, OK_PNG_FILE_INPUT, file, allocator,
+                      allocator_user_data, NULL, NULL, NULL, NULL);
     } else {
         ok_png_error(&png, OK_PNG_ERROR_API, "File not found");
     }
@@ -198,8 +349,70 @@ ok_png ok_png_read_from_input(ok_png_decode_flags decode_flags,
                               ok_png_input input_callbacks, void *input_callbacks_user_data,
                               ok_png_allocator allocator, void *allocator_user_data) {
     ok_png png = { 0 };
-    ok_png_decode(&png, decode_flags, input_callbacks, input_callbacks_user_data,
-                  allocator, allocator_user_data);
+    ok_png_decode(&png, decode_flags, NULL, input_callbacks, input_callbacks_user_data,
+                  allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    return png;
+}
+
+ok_png ok_png_read_region_from_input(ok_png_decode_flags decode_flags,
+                                     uint32_t region_x, uint32_t region_y,
+                                     uint32_t region_width, uint32_t region_height,
+                                     ok_png_input input_callbacks, void *input_callbacks_user_data,
+                                     ok_png_allocator allocator, void *allocator_user_data) {
+    ok_png png = { 0 };
+    if (region_width > 0 && region_height > 0) {
+        ok_png_region region = { region_x, region_y, region_width, region_height };
+        ok_png_decode(&png, decode_flags, &region, input_callbacks, input_callbacks_user_data,
+                      allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    } else {
+        ok_png_error(&png, OK_PNG_ERROR_API, "Invalid argument: region must not be empty");
+    }
+    return png;
+}
+
+ok_png ok_png_read_from_memory(const uint8_t *data, size_t length,
+                               ok_png_decode_flags decode_flags,
+                               ok_png_allocator allocator, void *allocator_user_data) {
+    ok_png png = { 0 };
+    if (data || length == 0) {
+        ok_png_memory_input memory = { data, length, 0 };
+        ok_png_decode(&png, decode_flags, NULL, OK_PNG_MEMORY_INPUT, &memory,
+                      allocator, allocator_user_data, NULL, NULL, NULL, NULL);
+    } else {
+        ok_png_error(&png, OK_PNG_ERROR_API, "Invalid argument: data must not be NULL");
+    }
+    return png;
+}
+
+ok_png ok_png_read_rows(ok_png_decode_flags decode_flags,
+                        ok_png_input input_callbacks, void *input_callbacks_user_data,
+                        ok_png_allocator allocator, void *allocator_user_data,
+                        ok_png_rows_func rows_func, void *rows_user_data) {
+    ok_png png = { 0 };
+    if (!rows_func) {
+        ok_png_error(&png, OK_PNG_ERROR_API, "Invalid argument: rows_func must not be NULL");
+        return png;
+    }
+    ok_png_decode(&png, decode_flags, NULL, input_callbacks, input_callbacks_user_data,
+                  allocator, allocator_user_data, NULL, NULL, rows_func, rows_user_data);
+    return png;
+}
+
+ok_png ok_png_read_from_input_with_thread_pool(ok_png_decode_flags decode_flags,
+                                               ok_png_input input_callbacks,
+                                               void *input_callbacks_user_data,
+                                               ok_png_allocator allocator,
+                                               void *allocator_user_data,
+                                               ok_png_thread_pool thread_pool,
+                                               void *thread_pool_user_data) {
+    ok_png png = { 0 };
+    if (!thread_pool.run_tasks) {
+        ok_png_error(&png, OK_PNG_ERROR_API,
+                     "Invalid argument: thread pool run_tasks function must not be NULL");
+        return png;
+    }
+    ok_png_decode(&png, decode_flags, NULL, input_callbacks, input_callbacks_user_data,
+                  allocator, allocator_user_data, &thread_pool, thread_pool_user_data, NULL, NULL);
     return png;
 }
 
@@ -238,6 +451,30 @@ static inline void ok_png_unpremultiply(uint8_t *dst) {
     }
 }
 
+// Clips the region to the image, and sets the output size. Without a region, the region is set to
+// the whole image.
+static bool ok_png_init_region(ok_png_decoder *decoder) {
+    ok_png *png = decoder->png;
+    if (decoder->has_region) {
+        if (decoder->region_x >= decoder->width || decoder->region_y >= decoder->height) {
+            ok_png_error(png, OK_PNG_ERROR_API, "Invalid argument: region is outside of image");
+            return false;
+        }
+        decoder->region_width = min(decoder->region_width, decoder->width - decoder->region_x);
+        decoder->region_height = min(decoder->region_height, decoder->height - decoder->region_y);
+        decoder->has_region = (decoder->region_width < decoder->width ||
+                               decoder->region_height < decoder->height);
+    } else {
+        decoder->region_x = 0;
+        decoder->region_y = 0;
+        decoder->region_width = decoder->width;
+        decoder->region_height = decoder->height;
+    }
+    png->width = decoder->region_width;
+    png->height = decoder->region_height;
+    return true;
+}
+
 static bool ok_png_read_header(ok_png_decoder *decoder, uint32_t chunk_length) {
     ok_png *png = decoder->png;
     if (chunk_length != 13) {
@@ -248,15 +485,15 @@ static bool ok_png_read_header(ok_png_decoder *decoder, uint32_t chunk_length) {
     if (!ok_read(decoder, chunk_data, sizeof(chunk_data))) {
         return false;
     }
-    png->width = readBE32(chunk_data);
-    png->height = readBE32(chunk_data + 4);
+    decoder->width = readBE32(chunk_data);
+    decoder->height = readBE32(chunk_data + 4);
     png->bpp = 4; // Always decoding to 32-bit color
     decoder->bit_depth = chunk_data[8];
     decoder->color_type = chunk_data[9];
     uint8_t compression_method = chunk_data[10];
     uint8_t filter_method = chunk_data[11];
     decoder->interlace_method = chunk_data[12];
-    uint64_t stride = (uint64_t)png->width * png->bpp;
+    uint64_t stride = (uint64_t)decoder->width * png->bpp;
 
     if (compression_method != 0) {
         ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid compression method");
@@ -286,7 +523,10 @@ static bool ok_png_read_header(ok_png_decoder *decoder, uint32_t chunk_length) {
         return false;
     }
 
-    png->stride = (uint32_t)stride;
+    if (!ok_png_init_region(decoder)) {
+        return false;
+    }
+    png->stride = png->width * png->bpp;
     png->has_alpha = (c == OK_PNG_COLOR_TYPE_GRAYSCALE_WITH_ALPHA ||
                       c == OK_PNG_COLOR_TYPE_RGB_WITH_ALPHA);
     decoder->interlace_pass = 0;
@@ -456,26 +696,888 @@ static void ok_png_decode_filter(uint8_t * RESTRICT curr, const uint8_t * RESTRI
     }
 }
 
-static void ok_png_transform_scanline(ok_png_decoder *decoder, const uint8_t *src, uint32_t width) {
-    ok_png *png = decoder->png;
+// MARK: SIMD filters
+//
+// The Sub, Average, and Paeth filters depend on the previous pixel, so they are vectorized
+// within a pixel (3, 4, 6, or 8 bytes per pixel). The Up filter is vectorized across the entire
+// scanline. All other cases use ok_png_decode_filter.
+
+#if defined(OK_PNG_USE_SSE)
+
+static inline __m128i ok_png_load_pixel_sse2(const uint8_t *src, const size_t bpp) {
+    if (bpp == 4) {
+        int32_t v;
+        memcpy(&v, src, 4);
+        return _mm_cvtsi32_si128(v);
+    } else if (bpp == 8) {
+        return _mm_loadl_epi64((const __m128i *)(const void *)src);
+    } else {
+        uint8_t v[8] = { 0 };
+        memcpy(v, src, bpp);
+        return _mm_loadl_epi64((const __m128i *)(const void *)v);
+    }
+}
+
+static inline void ok_png_store_pixel_sse2(uint8_t *dst, const __m128i v, const size_t bpp) {
+    if (bpp == 4) {
+        const int32_t v32 = _mm_cvtsi128_si32(v);
+        memcpy(dst, &v32, 4);
+    } else if (bpp == 8) {
+        _mm_storel_epi64((__m128i *)(void *)dst, v);
+    } else {
+        uint8_t v8[8];
+        _mm_storel_epi64((__m128i *)(void *)v8, v);
+        memcpy(dst, v8, bpp);
+    }
+}
+
+static inline __m128i ok_png_select_sse2(const __m128i mask, const __m128i a, const __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline void ok_png_filter_up_sse2(uint8_t *curr, const uint8_t *prev, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(const void *)(curr + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(prev + i));
+        _mm_storeu_si128((__m128i *)(void *)(curr + i), _mm_add_epi8(x, b));
+    }
+    for (; i < length; i++) {
+        curr[i] = curr[i] + prev[i];
+    }
+}
+
+static inline void ok_png_filter_sub_sse2(uint8_t *curr, size_t length, const size_t bpp) {
+    __m128i a = _mm_setzero_si128();
+    for (size_t i = 0; i < length; i += bpp) {
+        a = _mm_add_epi8(ok_png_load_pixel_sse2(curr + i, bpp), a);
+        ok_png_store_pixel_sse2(curr + i, a, bpp);
+    }
+}
+
+static inline void ok_png_filter_avg_sse2(uint8_t *curr, const uint8_t *prev, size_t length,
+                                          const size_t bpp) {
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i a = _mm_setzero_si128();
+    for (size_t i = 0; i < length; i += bpp) {
+        const __m128i b = ok_png_load_pixel_sse2(prev + i, bpp);
+        const __m128i x = ok_png_load_pixel_sse2(curr + i, bpp);
+        // _mm_avg_epu8 rounds up, so subtract the low bit of (a ^ b) to round down
+        const __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                                         _mm_and_si128(_mm_xor_si128(a, b), one));
+        a = _mm_add_epi8(x, avg);
+        ok_png_store_pixel_sse2(curr + i, a, bpp);
+    }
+}
+
+// Paeth predictor on 16-bit lanes. Ties go to a, then b, then c.
+#define OK_PNG_PAETH_SSE(out, a, b, c, abs_epi16) do { \
+    const __m128i pa = abs_epi16(_mm_sub_epi16(b, c)); \
+    const __m128i pb = abs_epi16(_mm_sub_epi16(a, c)); \
+    const __m128i pc = abs_epi16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c))); \
+    const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+    out = ok_png_select_sse2(_mm_cmpeq_epi16(smallest, pa), a, \
+                             ok_png_select_sse2(_mm_cmpeq_epi16(smallest, pb), b, c)); \
+} while (0)
+
+static inline __m128i ok_png_abs_epi16_sse2(const __m128i x) {
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline void ok_png_filter_paeth_sse2(uint8_t *curr, const uint8_t *prev, size_t length,
+                                            const size_t bpp) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    __m128i c = zero;
+    for (size_t i = 0; i < length; i += bpp) {
+        const __m128i b = _mm_unpacklo_epi8(ok_png_load_pixel_sse2(prev + i, bpp), zero);
+        const __m128i x = ok_png_load_pixel_sse2(curr + i, bpp);
+        __m128i predictor;
+        OK_PNG_PAETH_SSE(predictor, a, b, c, ok_png_abs_epi16_sse2);
+        const __m128i raw = _mm_add_epi8(x, _mm_packus_epi16(predictor, predictor));
+        ok_png_store_pixel_sse2(curr + i, raw, bpp);
+        a = _mm_unpacklo_epi8(raw, zero);
+        c = b;
+    }
+}
+
+OK_PNG_TARGET("ssse3")
+static inline void ok_png_filter_paeth_ssse3(uint8_t *curr, const uint8_t *prev, size_t length,
+                                             const size_t bpp) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    __m128i c = zero;
+    for (size_t i = 0; i < length; i += bpp) {
+        const __m128i b = _mm_unpacklo_epi8(ok_png_load_pixel_sse2(prev + i, bpp), zero);
+        const __m128i x = ok_png_load_pixel_sse2(curr + i, bpp);
+        __m128i predictor;
+        OK_PNG_PAETH_SSE(predictor, a, b, c, _mm_abs_epi16);
+        const __m128i raw = _mm_add_epi8(x, _mm_packus_epi16(predictor, predictor));
+        ok_png_store_pixel_sse2(curr + i, raw, bpp);
+        a = _mm_unpacklo_epi8(raw, zero);
+        c = b;
+    }
+}
+
+OK_PNG_TARGET("avx2")
+static void ok_png_filter_up_avx2(uint8_t *curr, const uint8_t *prev, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(const void *)(curr + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(const void *)(prev + i));
+        _mm256_storeu_si256((__m256i *)(void *)(curr + i), _mm256_add_epi8(x, b));
+    }
+    ok_png_filter_up_sse2(curr + i, prev + i, length - i);
+}
+
+#define OK_PNG_DECODE_FILTER_SSE(bpp_value, paeth_function) \
+    case bpp_value: \
+        if (filter == OK_PNG_FILTER_SUB) { \
+            ok_png_filter_sub_sse2(curr, length, bpp_value); \
+        } else if (filter == OK_PNG_FILTER_AVG) { \
+            ok_png_filter_avg_sse2(curr, prev, length, bpp_value); \
+        } else { \
+            paeth_function(curr, prev, length, bpp_value); \
+        } \
+        return;
+
+static void ok_png_decode_filter_sse2(uint8_t *curr, const uint8_t *prev, size_t length,
+                                      int filter, uint8_t bpp) {
+    if (filter == OK_PNG_FILTER_UP) {
+        ok_png_filter_up_sse2(curr, prev, length);
+        return;
+    } else if (filter != OK_PNG_FILTER_NONE) {
+        switch (bpp) {
+            OK_PNG_DECODE_FILTER_SSE(3, ok_png_filter_paeth_sse2)
+            OK_PNG_DECODE_FILTER_SSE(4, ok_png_filter_paeth_sse2)
+            OK_PNG_DECODE_FILTER_SSE(6, ok_png_filter_paeth_sse2)
+            OK_PNG_DECODE_FILTER_SSE(8, ok_png_filter_paeth_sse2)
+            default:
+                break;
+        }
+    }
+    ok_png_decode_filter(curr, prev, length, filter, bpp);
+}
+
+OK_PNG_TARGET("ssse3")
+static void ok_png_decode_filter_ssse3(uint8_t *curr, const uint8_t *prev, size_t length,
+                                       int filter, uint8_t bpp) {
+    if (filter == OK_PNG_FILTER_UP) {
+        ok_png_filter_up_sse2(curr, prev, length);
+        return;
+    } else if (filter != OK_PNG_FILTER_NONE) {
+        switch (bpp) {
+            OK_PNG_DECODE_FILTER_SSE(3, ok_png_filter_paeth_ssse3)
+            OK_PNG_DECODE_FILTER_SSE(4, ok_png_filter_paeth_ssse3)
+            OK_PNG_DECODE_FILTER_SSE(6, ok_png_filter_paeth_ssse3)
+            OK_PNG_DECODE_FILTER_SSE(8, ok_png_filter_paeth_ssse3)
+            default:
+                break;
+        }
+    }
+    ok_png_decode_filter(curr, prev, length, filter, bpp);
+}
+
+OK_PNG_TARGET("avx2")
+static void ok_png_decode_filter_avx2(uint8_t *curr, const uint8_t *prev, size_t length,
+                                      int filter, uint8_t bpp) {
+    if (filter == OK_PNG_FILTER_UP) {
+        ok_png_filter_up_avx2(curr, prev, length);
+    } else {
+        ok_png_decode_filter_ssse3(curr, prev, length, filter, bpp);
+    }
+}
+
+#undef OK_PNG_DECODE_FILTER_SSE
+#undef OK_PNG_PAETH_SSE
+
+#elif defined(OK_PNG_USE_NEON)
+
+static inline uint8x8_t ok_png_load_pixel_neon(const uint8_t *src, const size_t bpp) {
+    if (bpp == 8) {
+        return vld1_u8(src);
+    } else {
+        uint8_t v[8] = { 0 };
+        memcpy(v, src, bpp);
+        return vld1_u8(v);
+    }
+}
+
+static inline void ok_png_store_pixel_neon(uint8_t *dst, const uint8x8_t v, const size_t bpp) {
+    if (bpp == 8) {
+        vst1_u8(dst, v);
+    } else {
+        uint8_t v8[8];
+        vst1_u8(v8, v);
+        memcpy(dst, v8, bpp);
+    }
+}
+
+static inline void ok_png_filter_up_neon(uint8_t *curr, const uint8_t *prev, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(curr + i, vaddq_u8(vld1q_u8(curr + i), vld1q_u8(prev + i)));
+    }
+    for (; i < length; i++) {
+        curr[i] = curr[i] + prev[i];
+    }
+}
+
+static inline void ok_png_filter_sub_neon(uint8_t *curr, size_t length, const size_t bpp) {
+    uint8x8_t a = vdup_n_u8(0);
+    for (size_t i = 0; i < length; i += bpp) {
+        a = vadd_u8(ok_png_load_pixel_neon(curr + i, bpp), a);
+        ok_png_store_pixel_neon(curr + i, a, bpp);
+    }
+}
+
+static inline void ok_png_filter_avg_neon(uint8_t *curr, const uint8_t *prev, size_t length,
+                                          const size_t bpp) {
+    uint8x8_t a = vdup_n_u8(0);
+    for (size_t i = 0; i < length; i += bpp) {
+        const uint8x8_t b = ok_png_load_pixel_neon(prev + i, bpp);
+        const uint8x8_t x = ok_png_load_pixel_neon(curr + i, bpp);
+        a = vadd_u8(x, vhadd_u8(a, b));
+        ok_png_store_pixel_neon(curr + i, a, bpp);
+    }
+}
+
+static inline void ok_png_filter_paeth_neon(uint8_t *curr, const uint8_t *prev, size_t length,
+                                            const size_t bpp) {
+    uint8x8_t a = vdup_n_u8(0);
+    uint8x8_t c = vdup_n_u8(0);
+    for (size_t i = 0; i < length; i += bpp) {
+        const uint8x8_t b = ok_png_load_pixel_neon(prev + i, bpp);
+        const uint8x8_t x = ok_png_load_pixel_neon(curr + i, bpp);
+        // Ties go to a, then b, then c.
+        const uint16x8_t pa = vabdl_u8(b, c);
+        const uint16x8_t pb = vabdl_u8(a, c);
+        const uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+        const uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+        const uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+        const uint8x8_t predictor = vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+        a = vadd_u8(x, predictor);
+        ok_png_store_pixel_neon(curr + i, a, bpp);
+        c = b;
+    }
+}
+
+#define OK_PNG_DECODE_FILTER_NEON(bpp_value) \
+    case bpp_value: \
+        if (filter == OK_PNG_FILTER_SUB) { \
+            ok_png_filter_sub_neon(curr, length, bpp_value); \
+        } else if (filter == OK_PNG_FILTER_AVG) { \
+            ok_png_filter_avg_neon(curr, prev, length, bpp_value); \
+        } else { \
+            ok_png_filter_paeth_neon(curr, prev, length, bpp_value); \
+        } \
+        return;
+
+static void ok_png_decode_filter_neon(uint8_t *curr, const uint8_t *prev, size_t length,
+                                      int filter, uint8_t bpp) {
+    if (filter == OK_PNG_FILTER_UP) {
+        ok_png_filter_up_neon(curr, prev, length);
+        return;
+    } else if (filter != OK_PNG_FILTER_NONE) {
+        switch (bpp) {
+            OK_PNG_DECODE_FILTER_NEON(3)
+            OK_PNG_DECODE_FILTER_NEON(4)
+            OK_PNG_DECODE_FILTER_NEON(6)
+            OK_PNG_DECODE_FILTER_NEON(8)
+            default:
+                break;
+        }
+    }
+    ok_png_decode_filter(curr, prev, length, filter, bpp);
+}
+
+#undef OK_PNG_DECODE_FILTER_NEON
+
+#endif
+
+static ok_png_simd ok_png_simd_preference = OK_PNG_SIMD_AUTO;
+
+static bool ok_png_simd_supported(ok_png_simd simd) {
+    switch (simd) {
+        case OK_PNG_SIMD_AUTO:
+        case OK_PNG_SIMD_NONE:
+            return true;
+#if defined(OK_PNG_USE_SSE)
+        case OK_PNG_SIMD_SSE2:
+            return true;
+        case OK_PNG_SIMD_SSSE3:
+        case OK_PNG_SIMD_AVX2: {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            const int max_leaf = info[0];
+            __cpuid(info, 1);
+            if (simd == OK_PNG_SIMD_SSSE3) {
+                return (info[2] & (1 << 9)) != 0;
+            }
+            const bool os_supports_avx = ((info[2] & (1 << 27)) != 0 &&
+                                          (info[2] & (1 << 28)) != 0 &&
+                                          (_xgetbv(0) & 6) == 6);
+            if (max_leaf < 7 || !os_supports_avx) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            if (simd == OK_PNG_SIMD_SSSE3) {
+                return __builtin_cpu_supports("ssse3") != 0;
+            } else {
+                return __builtin_cpu_supports("avx2") != 0;
+            }
+#endif
+        }
+#elif defined(OK_PNG_USE_NEON)
+        case OK_PNG_SIMD_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+bool ok_png_set_simd(ok_png_simd simd) {
+    if (ok_png_simd_supported(simd)) {
+        ok_png_simd_preference = simd;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+// Returns the preferred instruction set, or the best supported one if the preference is AUTO.
+static ok_png_simd ok_png_get_simd(void) {
+    ok_png_simd simd = ok_png_simd_preference;
+    if (simd == OK_PNG_SIMD_AUTO) {
+        static const ok_png_simd best_to_worst[] = {
+            OK_PNG_SIMD_NEON, OK_PNG_SIMD_AVX2, OK_PNG_SIMD_SSSE3, OK_PNG_SIMD_SSE2
+        };
+        simd = OK_PNG_SIMD_NONE;
+        for (size_t i = 0; i < sizeof(best_to_worst) / sizeof(best_to_worst[0]); i++) {
+            if (ok_png_simd_supported(best_to_worst[i])) {
+                simd = best_to_worst[i];
+                break;
+            }
+        }
+    }
+    return simd;
+}
+
+static void ok_png_init_simd(ok_png_decoder *decoder) {
+    switch (ok_png_get_simd()) {
+#if defined(OK_PNG_USE_SSE)
+        case OK_PNG_SIMD_SSE2:
+            decoder->decode_filter = ok_png_decode_filter_sse2;
+            break;
+        case OK_PNG_SIMD_SSSE3:
+            decoder->decode_filter = ok_png_decode_filter_ssse3;
+            break;
+        case OK_PNG_SIMD_AVX2:
+            decoder->decode_filter = ok_png_decode_filter_avx2;
+            break;
+#elif defined(OK_PNG_USE_NEON)
+        case OK_PNG_SIMD_NEON:
+            decoder->decode_filter = ok_png_decode_filter_neon;
+            break;
+#endif
+        default:
+            decoder->decode_filter = ok_png_decode_filter;
+            break;
+    }
+}
+
+// MARK: CRC
+
+// Slice-by-8 tables. ok_crc_table[0] is the standard byte-wise table; ok_crc_table[k] advances
+// the CRC of a byte by k more zero bytes, so eight bytes can be processed per iteration.
+static uint32_t ok_crc_table[8][256];
+
+#if defined(OK_PNG_USE_SSE)
+
+static bool ok_crc_pclmul_supported(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") != 0;
+#endif
+}
+
+#endif
+
+static void ok_crc_table_initialize(void) {
+    static bool ok_crc_table_initialized = false;
+    if (ok_crc_table_initialized) {
+        return;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (uint32_t k = 0; k < 8; k++) {
+            if (c & 1) {
+                c = 0xedb88320L ^ (c >> 1);
+            } else {
+                c = c >> 1;
+            }
+        }
+        ok_crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = ok_crc_table[0][n];
+        for (uint32_t k = 1; k < 8; k++) {
+            c = ok_crc_table[0][c & 0xff] ^ (c >> 8);
+            ok_crc_table[k][n] = c;
+        }
+    }
+    ok_crc_table_initialized = true;
+}
+
+// The CRC functions below operate on the pre- and post-conditioned value (crc ^ 0xffffffff).
+
+static uint32_t ok_crc_update_scalar(uint32_t c, const uint8_t *buffer, size_t length) {
+    while (length >= 8) {
+        c ^= ((uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+              ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+        c = (ok_crc_table[7][c & 0xff] ^
+             ok_crc_table[6][(c >> 8) & 0xff] ^
+             ok_crc_table[5][(c >> 16) & 0xff] ^
+             ok_crc_table[4][c >> 24] ^
+             ok_crc_table[3][buffer[4]] ^
+             ok_crc_table[2][buffer[5]] ^
+             ok_crc_table[1][buffer[6]] ^
+             ok_crc_table[0][buffer[7]]);
+        buffer += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        c = ok_crc_table[0][(c ^ *buffer++) & 0xff] ^ (c >> 8);
+        length--;
+    }
+    return c;
+}
+
+#if defined(OK_PNG_USE_SSE)
+
+// Folds 64 bytes at a time with carry-less multiplication, then reduces to 32 bits with a
+// Barrett reduction. See Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+// Instruction". The constants are for the bit-reflected polynomial 0xedb88320.
+OK_PNG_TARGET("pclmul")
+static uint32_t ok_crc_update_pclmul(uint32_t c, const uint8_t *buffer, size_t length) {
+    if (length < 64) {
+        return ok_crc_update_scalar(c, buffer, length);
+    }
+    const __m128i k1k2 = _mm_setr_epi32(0x54442bd4, 0x1, (int)0xc6e41596, 0x1);
+    const __m128i k3k4 = _mm_setr_epi32(0x751997d0, 0x1, (int)0xccaa009e, 0x0);
+    const __m128i k5k0 = _mm_setr_epi32(0x63cd6124, 0x1, 0x0, 0x0);
+    const __m128i poly = _mm_setr_epi32((int)0xdb710641, 0x1, (int)0xf7011641, 0x1);
+    const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buffer + 0));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buffer + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buffer + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buffer + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)c));
+    buffer += 64;
+    length -= 64;
+
+    // Fold 4x128 bits
+    while (length >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buffer + 0)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buffer + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buffer + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buffer + 48)));
+        buffer += 64;
+        length -= 64;
+    }
+
+    // Fold 4x128 bits into 128 bits
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold 128 bits at a time
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buffer)), x5);
+        buffer += 16;
+        length -= 16;
+    }
+
+    // Fold 128 bits into 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    c = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+    return ok_crc_update_scalar(c, buffer, length);
+}
+
+#endif
+
+static void ok_png_init_crc(ok_png_decoder *decoder) {
+    ok_crc_table_initialize();
+    decoder->crc_update = ok_crc_update_scalar;
+#if defined(OK_PNG_USE_SSE)
+    if (ok_png_get_simd() != OK_PNG_SIMD_NONE && ok_crc_pclmul_supported()) {
+        decoder->crc_update = ok_crc_update_pclmul;
+    }
+#endif
+}
+
+// MARK: Adler
+
+static uint32_t ok_adler_update_scalar(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_run_length = 5552;
+    
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    
+    if (length == 1) {
+        adler_sum1 += buffer[0];
+        if (adler_sum1 >= adler_base) {
+            adler_sum1 -= adler_base;
+        }
+        adler_sum2 += adler_sum1;
+        if (adler_sum2 >= adler_base) {
+            adler_sum2 -= adler_base;
+        }
+    } else {
+        for (size_t i = 0; i < length; i += adler_max_run_length) {
+            const size_t end = i + min(length - i, adler_max_run_length);
+            for (size_t j = i; j < end; j++) {
+                adler_sum1 += buffer[j];
+                adler_sum2 += adler_sum1;
+            }
+            adler_sum1 %= adler_base;
+            adler_sum2 %= adler_base;
+        }
+    }
+    return (adler_sum2 << 16) | adler_sum1;
+}
+
+#if defined(OK_PNG_USE_SSE)
+
+// The SIMD functions process blocks of 32 bytes. For each block, sum1 is increased by the sum of
+// the bytes, and sum2 is increased by 32 * sum1 (before the block) plus the sum of each byte
+// multiplied by its distance from the end of the block (32, 31, ... 1).
+// At most 5552 bytes are summed before the modulo, as in the scalar function.
+
+OK_PNG_TARGET("ssse3")
+static uint32_t ok_adler_update_ssse3(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    const __m128i taps1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                        24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i taps2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    while (num_blocks > 0) {
+        const size_t n = min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        // v_prev_sum1 is the sum of sum1 before each block; it's multiplied by 32 at the end
+        __m128i v_prev_sum1 = _mm_cvtsi32_si128((int)(adler_sum1 * n));
+        __m128i v_sum1 = zero;
+        __m128i v_sum2 = _mm_cvtsi32_si128((int)adler_sum2);
+        for (size_t i = 0; i < n; i++) {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buffer);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buffer + 16));
+            v_prev_sum1 = _mm_add_epi32(v_prev_sum1, v_sum1);
+            v_sum1 = _mm_add_epi32(v_sum1, _mm_sad_epu8(bytes1, zero));
+            v_sum1 = _mm_add_epi32(v_sum1, _mm_sad_epu8(bytes2, zero));
+            v_sum2 = _mm_add_epi32(v_sum2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, taps1), ones));
+            v_sum2 = _mm_add_epi32(v_sum2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, taps2), ones));
+            buffer += 32;
+        }
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_slli_epi32(v_prev_sum1, 5));
+
+        // Horizontal sums
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        adler_sum1 = (adler_sum1 + (uint32_t)_mm_cvtsi128_si32(v_sum1)) % adler_base;
+        adler_sum2 = (uint32_t)_mm_cvtsi128_si32(v_sum2) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+OK_PNG_TARGET("avx2")
+static uint32_t ok_adler_update_avx2(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                          24, 23, 22, 21, 20, 19, 18, 17,
+                                          16, 15, 14, 13, 12, 11, 10, 9,
+                                          8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    while (num_blocks > 0) {
+        const size_t n = min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        __m256i v_prev_sum1 = _mm256_setr_epi32((int)(adler_sum1 * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_sum1 = zero;
+        __m256i v_sum2 = _mm256_setr_epi32((int)adler_sum2, 0, 0, 0, 0, 0, 0, 0);
+        for (size_t i = 0; i < n; i++) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)buffer);
+            v_prev_sum1 = _mm256_add_epi32(v_prev_sum1, v_sum1);
+            v_sum1 = _mm256_add_epi32(v_sum1, _mm256_sad_epu8(bytes, zero));
+            v_sum2 = _mm256_add_epi32(v_sum2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, taps), ones));
+            buffer += 32;
+        }
+        v_sum2 = _mm256_add_epi32(v_sum2, _mm256_slli_epi32(v_prev_sum1, 5));
+
+        // Horizontal sums
+        __m128i sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_sum1), _mm256_extracti128_si256(v_sum1, 1));
+        __m128i sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_sum2), _mm256_extracti128_si256(v_sum2, 1));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        adler_sum1 = (adler_sum1 + (uint32_t)_mm_cvtsi128_si32(sum1)) % adler_base;
+        adler_sum2 = (uint32_t)_mm_cvtsi128_si32(sum2) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+#elif defined(OK_PNG_USE_NEON)
+
+static uint32_t ok_adler_update_neon(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+    static const uint16_t taps[32] = {
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    };
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    while (num_blocks > 0) {
+        const size_t n = min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        // Sums of each byte position (at most 173 * 255, so 16 bits is enough)
+        uint16x8_t v_column_sum1 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum2 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum3 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum4 = vdupq_n_u16(0);
+        uint32x4_t v_prev_sum1 = vsetq_lane_u32((uint32_t)(adler_sum1 * n), vdupq_n_u32(0), 0);
+        uint32x4_t v_sum1 = vdupq_n_u32(0);
+        for (size_t i = 0; i < n; i++) {
+            const uint8x16_t bytes1 = vld1q_u8(buffer);
+            const uint8x16_t bytes2 = vld1q_u8(buffer + 16);
+            v_prev_sum1 = vaddq_u32(v_prev_sum1, v_sum1);
+            v_sum1 = vpadalq_u16(v_sum1, vpadalq_u8(vpaddlq_u8(bytes1), bytes2));
+            v_column_sum1 = vaddw_u8(v_column_sum1, vget_low_u8(bytes1));
+            v_column_sum2 = vaddw_u8(v_column_sum2, vget_high_u8(bytes1));
+            v_column_sum3 = vaddw_u8(v_column_sum3, vget_low_u8(bytes2));
+            v_column_sum4 = vaddw_u8(v_column_sum4, vget_high_u8(bytes2));
+            buffer += 32;
+        }
+        uint32x4_t v_sum2 = vshlq_n_u32(v_prev_sum1, 5);
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum1), vld1_u16(taps + 0));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum1), vld1_u16(taps + 4));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum2), vld1_u16(taps + 8));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum2), vld1_u16(taps + 12));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum3), vld1_u16(taps + 16));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum3), vld1_u16(taps + 20));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum4), vld1_u16(taps + 24));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum4), vld1_u16(taps + 28));
+
+        // Horizontal sums
+        const uint32x2_t sum1 = vpadd_u32(vget_low_u32(v_sum1), vget_high_u32(v_sum1));
+        const uint32x2_t sum2 = vpadd_u32(vget_low_u32(v_sum2), vget_high_u32(v_sum2));
+        const uint32x2_t sums = vpadd_u32(sum1, sum2);
+        adler_sum1 = (adler_sum1 + vget_lane_u32(sums, 0)) % adler_base;
+        adler_sum2 = (adler_sum2 + vget_lane_u32(sums, 1)) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+#endif
+
+// Returns the Adler-32 of two concatenated buffers, given the Adler-32 of each buffer and the length
+// of the second buffer (like zlib's adler32_combine).
+static uint32_t ok_adler_combine(const uint32_t adler1, const uint32_t adler2, uint64_t length2) {
+    static const uint32_t adler_base = 65521;
+    
+    const uint32_t rem = (uint32_t)(length2 % adler_base);
+    uint32_t adler_sum1 = adler1 & 0xffff;
+    uint32_t adler_sum2 = (rem * adler_sum1) % adler_base;
+    adler_sum1 += (adler2 & 0xffff) + adler_base - 1;
+    adler_sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + adler_base - rem;
+    if (adler_sum1 >= adler_base) {
+        adler_sum1 -= adler_base;
+    }
+    if (adler_sum1 >= adler_base) {
+        adler_sum1 -= adler_base;
+    }
+    if (adler_sum2 >= (adler_base << 1)) {
+        adler_sum2 -= (adler_base << 1);
+    }
+    if (adler_sum2 >= adler_base) {
+        adler_sum2 -= adler_base;
+    }
+    return (adler_sum2 << 16) | adler_sum1;
+}
+
+typedef uint32_t (*ok_adler_update_function)(uint32_t adler, const uint8_t *buffer, size_t length);
+
+static ok_adler_update_function ok_png_get_adler_update_function(void) {
+    switch (ok_png_get_simd()) {
+#if defined(OK_PNG_USE_SSE)
+        case OK_PNG_SIMD_SSSE3:
+            return ok_adler_update_ssse3;
+        case OK_PNG_SIMD_AVX2:
+            return ok_adler_update_avx2;
+#elif defined(OK_PNG_USE_NEON)
+        case OK_PNG_SIMD_NEON:
+            return ok_adler_update_neon;
+#endif
+        default:
+            return ok_adler_update_scalar;
+    }
+}
+
+// MARK: Image data
+
+// Position of the first pixel of each interlace pass, and the spacing between its pixels.
+// Index 0 is for non-interlaced images.
+//                                              1  2  3  4  5  6  7
+static const uint8_t OK_PNG_PASS_X[]  = { 0,    0, 4, 0, 2, 0, 1, 0 };
+static const uint8_t OK_PNG_PASS_Y[]  = { 0,    0, 0, 4, 0, 2, 0, 1 };
+static const uint8_t OK_PNG_PASS_DX[] = { 1,    8, 8, 4, 4, 2, 2, 1 };
+static const uint8_t OK_PNG_PASS_DY[] = { 1,    8, 8, 8, 4, 4, 2, 2 };
+
+static int ok_png_get_pass_index(const ok_png_decoder *decoder) {
+    return decoder->interlace_method == 0 ? 0 : decoder->interlace_pass;
+}
+
+// Returns the image row of a scanline in the current pass
+static uint32_t ok_png_get_row_for_scanline(const ok_png_decoder *decoder, uint32_t scanline) {
+    const int i = ok_png_get_pass_index(decoder);
+    return OK_PNG_PASS_Y[i] + scanline * OK_PNG_PASS_DY[i];
+}
+
+// Returns the destination row for an image row in the region
+static uint8_t *ok_png_get_region_row(const ok_png_decoder *decoder, uint32_t y) {
+    const ok_png *png = decoder->png;
     const bool dst_flip_y = (decoder->decode_flags & OK_PNG_FLIP_Y) != 0;
+    const uint32_t region_y = y - decoder->region_y;
+    const uint32_t dst_y = (dst_flip_y ? (png->height - region_y - 1) : region_y);
+    return png->data + ((size_t)dst_y * png->stride);
+}
+
+// Returns the destination row for a scanline of a non-interlaced image
+static uint8_t *ok_png_get_data_row(const ok_png_decoder *decoder, uint32_t scanline) {
+    const ok_png *png = decoder->png;
+    if (decoder->row_output) {
+        return png->data + ((size_t)(scanline & 1) * png->stride);
+    }
+    return ok_png_get_region_row(decoder, scanline);
+}
+
+// Returns true if decoded scanlines are already in the destination format, so that they can be
+// inflated and unfiltered in place in the destination image, skipping ok_png_transform_scanline.
+static bool ok_png_can_decode_direct(const ok_png_decoder *decoder) {
+    const bool src_is_bgr = decoder->is_ios_format;
+    const bool dst_is_bgr = (decoder->decode_flags & OK_PNG_COLOR_FORMAT_BGRA) != 0;
+    const bool src_is_premultiplied = decoder->is_ios_format;
+    const bool dst_is_premultiplied = (decoder->decode_flags & OK_PNG_PREMULTIPLIED_ALPHA) != 0;
+    return (decoder->interlace_method == 0 &&
+            !decoder->has_region &&
+            decoder->color_type == OK_PNG_COLOR_TYPE_RGB_WITH_ALPHA &&
+            decoder->bit_depth == 8 &&
+            src_is_bgr == dst_is_bgr &&
+            src_is_premultiplied == dst_is_premultiplied);
+}
+
+// Transforms the pixels of a scanline that are in the region to the destination format
+static void ok_png_transform_scanline(ok_png_decoder *decoder, const uint8_t *src, uint32_t width,
+                                      uint32_t scanline) {
+    ok_png *png = decoder->png;
+    const int c = decoder->color_type;
+    const int d = decoder->bit_depth;
+
+    // Find the pixels in the region
+    const int pass = ok_png_get_pass_index(decoder);
+    const uint32_t y = ok_png_get_row_for_scanline(decoder, scanline);
+    if (y < decoder->region_y || y - decoder->region_y >= decoder->region_height) {
+        return;
+    }
+    const uint32_t pass_x = OK_PNG_PASS_X[pass];
+    const uint32_t pass_dx = OK_PNG_PASS_DX[pass];
+    const uint32_t region_end_x = decoder->region_x + decoder->region_width;
+    const uint32_t begin = (decoder->region_x > pass_x ?
+                            (decoder->region_x - pass_x + pass_dx - 1) / pass_dx : 0);
+    const uint32_t end = min(width, (region_end_x > pass_x ?
+                                     (region_end_x - pass_x + pass_dx - 1) / pass_dx : 0));
+    if (begin >= end) {
+        return;
+    }
+    const uint32_t bits_per_pixel = d * OK_PNG_SAMPLES_PER_PIXEL[c];
+    src += ((uint64_t)begin * bits_per_pixel) / 8;
+    width = end - begin;
+
     uint8_t *dst_start;
     uint8_t *dst_end;
     if (decoder->interlace_method == 0) {
-        const uint32_t dst_y =
-            (dst_flip_y ? (png->height - decoder->scanline - 1) : decoder->scanline);
-        dst_start = png->data + (dst_y * png->stride);
+        dst_start = ok_png_get_data_row(decoder, scanline);
     } else if (decoder->interlace_pass == 7) {
-        const uint32_t t_scanline = decoder->scanline * 2 + 1;
-        const uint32_t dst_y = dst_flip_y ? (png->height - t_scanline - 1) : t_scanline;
-        dst_start = png->data + (dst_y * png->stride);
+        dst_start = ok_png_get_region_row(decoder, y);
     } else {
         dst_start = decoder->temp_data_row;
     }
     dst_end = dst_start + width * png->bpp;
 
-    const int c = decoder->color_type;
-    const int d = decoder->bit_depth;
     const bool t = decoder->has_single_transparent_color;
     const bool has_full_alpha = (c == OK_PNG_COLOR_TYPE_GRAYSCALE_WITH_ALPHA ||
                                  c == OK_PNG_COLOR_TYPE_RGB_WITH_ALPHA);
@@ -541,7 +1643,7 @@ static void ok_png_transform_scanline(ok_png_decoder *decoder, const uint8_t *sr
         // Complex transforms: 1-, 2-, 4- and 16-bit, and 8-bit with single-color transparency.
         const uint8_t *palette = decoder->palette;
         const int bitmask = (1 << d) - 1;
-        int bit = 8 - d;
+        int bit = 8 - d - (int)((begin * bits_per_pixel) % 8);
         uint16_t tr = decoder->single_transparent_color_key[0];
         uint16_t tg = decoder->single_transparent_color_key[1];
         uint16_t tb = decoder->single_transparent_color_key[2];
@@ -691,23 +1793,12 @@ static void ok_png_transform_scanline(ok_png_decoder *decoder, const uint8_t *sr
 
     // If interlaced, copy from the temp buffer
     if (decoder->interlace_method == 1 && decoder->interlace_pass < 7) {
-        const int i = decoder->interlace_pass;
-        const uint32_t s = decoder->scanline;
-        //                                       1      2      3      4      5      6      7
-        static const uint32_t dst_x[]  = {0,     0,     4,     0,     2,     0,     1,     0 };
-        static const uint32_t dst_dx[] = {0,     8,     8,     4,     4,     2,     2,     1 };
-               const uint32_t dst_y[]  = {0,   s*8,   s*8, 4+s*8,   s*4, 2+s*4,   s*2, 1+s*2 };
-
-        uint32_t x = dst_x[i];
-        uint32_t y = dst_y[i];
-        uint32_t dx = 4 * dst_dx[i];
-        if (dst_flip_y) {
-            y = (png->height - y - 1);
-        }
+        const uint32_t x = pass_x + begin * pass_dx - decoder->region_x;
+        const uint32_t dx = 4 * pass_dx;
 
         src = dst_start;
         uint8_t *src_end = dst_end;
-        uint8_t *dst = png->data + (y * png->stride) + (x * 4);
+        uint8_t *dst = ok_png_get_region_row(decoder, y) + (x * 4);
         while (src < src_end) {
             memcpy(dst, src, 4);
             dst += dx;
@@ -717,7 +1808,7 @@ static void ok_png_transform_scanline(ok_png_decoder *decoder, const uint8_t *sr
 }
 
 static uint32_t ok_png_get_width_for_pass(const ok_png_decoder *decoder) {
-    const uint32_t w = decoder->png->width;
+    const uint32_t w = decoder->width;
     if (decoder->interlace_method == 0) {
         return w;
     }
@@ -735,7 +1826,7 @@ static uint32_t ok_png_get_width_for_pass(const ok_png_decoder *decoder) {
 }
 
 static uint32_t ok_png_get_height_for_pass(const ok_png_decoder *decoder) {
-    const uint32_t h = decoder->png->height;
+    const uint32_t h = decoder->height;
     if (decoder->interlace_method == 0) {
         return h;
     }
@@ -752,17 +1843,32 @@ static uint32_t ok_png_get_height_for_pass(const ok_png_decoder *decoder) {
     }
 }
 
-static bool ok_png_read_data(ok_png_decoder *decoder, uint32_t bytes_remaining) {
+static size_t ok_png_get_bytes_per_scanline(const ok_png_decoder *decoder) {
+    const uint32_t bits_per_pixel = decoder->bit_depth * OK_PNG_SAMPLES_PER_PIXEL[decoder->color_type];
+    const uint32_t width = ok_png_get_width_for_pass(decoder);
+    return (size_t)(1 + ((uint64_t)width * bits_per_pixel + 7) / 8);
+}
+
+static bool ok_png_init_buffers(ok_png_decoder *decoder) {
     ok_png *png = decoder->png;
-    size_t inflate_buffer_size = 64 * 1024;
-    size_t num_passes = decoder->interlace_method == 0 ? 1 : 7;
     uint8_t bits_per_pixel = decoder->bit_depth * OK_PNG_SAMPLES_PER_PIXEL[decoder->color_type];
-    uint8_t bytes_per_pixel = (bits_per_pixel + 7) / 8;
-    uint64_t max_bytes_per_scanline = 1 + ((uint64_t)png->width * bits_per_pixel + 7) / 8;
+    uint64_t max_bytes_per_scanline = 1 + ((uint64_t)decoder->width * bits_per_pixel + 7) / 8;
     size_t platform_max_bytes_per_scanline = (size_t)max_bytes_per_scanline;
 
     // Create buffers
-    if (!png->data) {
+    if (!png->data && decoder->rows_func) {
+        // Interlaced images are decoded in full, then sent to rows_func
+        decoder->row_output = decoder->interlace_method == 0;
+        uint64_t size = (uint64_t)png->stride * (decoder->row_output ? 2 : png->height);
+        size_t platform_size = (size_t)size;
+        if (platform_size == size) {
+            png->data = ok_alloc(decoder, platform_size);
+        }
+        if (!png->data) {
+            ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate memory for image");
+            return false;
+        }
+    } else if (!png->data) {
         if (decoder->allocator.image_alloc) {
             decoder->allocator.image_alloc(decoder->allocator_user_data,
                                            png->width, png->height, png->bpp,
@@ -793,121 +1899,645 @@ static bool ok_png_read_data(ok_png_decoder *decoder, uint32_t bytes_remaining)
             decoder->curr_scanline = ok_alloc(decoder, platform_max_bytes_per_scanline);
         }
     }
-    if (!decoder->inflate_buffer) {
-        decoder->inflate_buffer = ok_alloc(decoder, inflate_buffer_size);
-    }
     if (decoder->interlace_method == 1 && !decoder->temp_data_row) {
         decoder->temp_data_row = ok_alloc(decoder, png->width * png->bpp);
     }
-    if (!decoder->curr_scanline || !decoder->prev_scanline || !decoder->inflate_buffer ||
-        (decoder->interlace_method == 1 && !decoder->temp_data_row)) {
-        ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate buffers");
+    if (!decoder->curr_scanline || !decoder->prev_scanline ||
+        (decoder->interlace_method == 1 && !decoder->temp_data_row)) {
+        ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate buffers");
+        return false;
+    }
+
+    // Setup inflater
+    if (!decoder->inflater) {
+        decoder->inflater = ok_inflater_init(decoder->is_ios_format,
+                                             decoder->allocator, decoder->allocator_user_data);
+        if (!decoder->inflater) {
+            ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't init inflater");
+            return false;
+        }
+        ok_inflater_set_verify_adler32(decoder->inflater, decoder->verify_adler32);
+    }
+    return true;
+}
+
+// Sets up the next interlace pass, if needed. Returns false if all passes are complete.
+static bool ok_png_setup_pass(ok_png_decoder *decoder) {
+    const uint8_t num_passes = decoder->interlace_method == 0 ? 1 : 7;
+    while (decoder->ready_for_next_interlace_pass) {
+        decoder->ready_for_next_interlace_pass = false;
+        decoder->scanline = 0;
+        decoder->interlace_pass++;
+        if (decoder->interlace_pass == num_passes + 1) {
+            decoder->decoding_completed = true;
+            return false;
+        }
+        const uint32_t curr_width = ok_png_get_width_for_pass(decoder);
+        const uint32_t curr_height = ok_png_get_height_for_pass(decoder);
+        if (curr_width == 0 || curr_height == 0) {
+            // No data for this pass - happens if width or height <= 4
+            decoder->ready_for_next_interlace_pass = true;
+        } else {
+            const size_t curr_bytes_per_scanline = ok_png_get_bytes_per_scanline(decoder);
+            memset(decoder->curr_scanline, 0, curr_bytes_per_scanline);
+            memset(decoder->prev_scanline, 0, curr_bytes_per_scanline);
+            decoder->inflater_bytes_read = 0;
+        }
+    }
+    return true;
+}
+
+// Unfilters and transforms the current scanline, and sets up for the next scanline or pass.
+static bool ok_png_decode_scanline(ok_png_decoder *decoder, bool decode_direct) {
+    uint8_t bits_per_pixel = decoder->bit_depth * OK_PNG_SAMPLES_PER_PIXEL[decoder->color_type];
+    uint8_t bytes_per_pixel = (bits_per_pixel + 7) / 8;
+    uint8_t *curr = decoder->curr_scanline + 1;
+    const uint8_t *prev = decoder->prev_scanline + 1;
+    if (decode_direct) {
+        // The previous scanline is the previous row of the image. The prev_scanline
+        // buffer stays zero-filled for the first row.
+        curr = ok_png_get_data_row(decoder, decoder->scanline);
+        if (decoder->scanline > 0) {
+            prev = ok_png_get_data_row(decoder, decoder->scanline - 1);
+        }
+    }
+
+    // Apply filter
+    const int filter = decoder->curr_scanline[0];
+    if (filter > 0 && filter < OK_PNG_NUM_FILTERS) {
+        decoder->decode_filter(curr, prev, decoder->inflater_bytes_read - 1, filter,
+                               bytes_per_pixel);
+    } else if (filter != 0) {
+        ok_png_error(decoder->png, OK_PNG_ERROR_INVALID, "Invalid filter type");
+        return false;
+    }
+
+    // Transform
+    if (!decode_direct) {
+        ok_png_transform_scanline(decoder, curr, ok_png_get_width_for_pass(decoder),
+                                  decoder->scanline);
+    }
+
+    // Send the row
+    if (decoder->interlace_method == 0) {
+        decoder->rows_completed++;
+    }
+    if (decoder->row_output) {
+        ok_png *png = decoder->png;
+        const bool flip_y = (decoder->decode_flags & OK_PNG_FLIP_Y) != 0;
+        const uint32_t y = flip_y ? png->height - decoder->scanline - 1 : decoder->scanline;
+        if (!decoder->rows_func(decoder->rows_user_data, png->width, png->height, y, 1,
+                                ok_png_get_data_row(decoder, decoder->scanline), png->stride)) {
+            ok_png_error(png, OK_PNG_ERROR_CANCELED, "Canceled");
+            return false;
+        }
+    }
+
+    // Setup for next scanline or pass. In the last pass, decoding stops after the region.
+    decoder->scanline++;
+    const bool is_last_pass = decoder->interlace_method == 0 || decoder->interlace_pass == 7;
+    if (decoder->scanline == ok_png_get_height_for_pass(decoder) ||
+        (is_last_pass && ok_png_get_row_for_scanline(decoder, decoder->scanline) >=
+         decoder->region_y + decoder->region_height)) {
+        decoder->ready_for_next_interlace_pass = true;
+    } else if (decode_direct) {
+        decoder->inflater_bytes_read = 0;
+    } else {
+        uint8_t *temp = decoder->curr_scanline;
+        decoder->curr_scanline = decoder->prev_scanline;
+        decoder->prev_scanline = temp;
+        decoder->inflater_bytes_read = 0;
+    }
+    return true;
+}
+
+#define OK_PNG_INFLATE_BUFFER_SIZE (64 * 1024)
+
+// Reads compressed data (at most OK_PNG_INFLATE_BUFFER_SIZE bytes) and sets it as the inflater
+// input. When reading from memory, the data is inflated in place.
+static bool ok_png_read_compressed_data(ok_png_decoder *decoder, size_t length) {
+    if (decoder->input.read == ok_memory_read) {
+        ok_png_memory_input *memory = decoder->input_user_data;
+        if (length > memory->length - memory->position) {
+            ok_png_error(decoder->png, OK_PNG_ERROR_IO, "Read error: unexpected end of data");
+            return false;
+        }
+        const uint8_t *data = memory->data + memory->position;
+        memory->position += length;
+        if (decoder->verify_crc) {
+            decoder->chunk_crc = decoder->crc_update(decoder->chunk_crc, data, length);
+        }
+        ok_inflater_set_input(decoder->inflater, data, length);
+        return true;
+    }
+    if (!decoder->inflate_buffer) {
+        decoder->inflate_buffer = ok_alloc(decoder, OK_PNG_INFLATE_BUFFER_SIZE);
+        if (!decoder->inflate_buffer) {
+            ok_png_error(decoder->png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate buffers");
+            return false;
+        }
+    }
+    if (!ok_read(decoder, decoder->inflate_buffer, length)) {
+        return false;
+    }
+    ok_inflater_set_input(decoder->inflater, decoder->inflate_buffer, length);
+    return true;
+}
+
+// Called after all image data is decoded. Normally the rest of the IDAT data is skipped. When
+// verifying the Adler-32 checksum, the rest of the zlib stream is inflated (and ignored) instead.
+static bool ok_png_finish_data(ok_png_decoder *decoder, uint32_t bytes_remaining) {
+    if (decoder->verify_adler32 && !decoder->is_ios_format && !decoder->adler32_verified) {
+        const uint8_t bits_per_pixel = (decoder->bit_depth *
+                                        OK_PNG_SAMPLES_PER_PIXEL[decoder->color_type]);
+        const size_t max_bytes_per_scanline = (size_t)(1 + ((uint64_t)decoder->width *
+                                                            bits_per_pixel + 7) / 8);
+        while (!ok_inflater_is_done(decoder->inflater)) {
+            if (ok_inflater_needs_input(decoder->inflater)) {
+                if (bytes_remaining == 0) {
+                    // There may be another IDAT chunk.
+                    return true;
+                }
+                const size_t len = min(OK_PNG_INFLATE_BUFFER_SIZE, bytes_remaining);
+                if (!ok_png_read_compressed_data(decoder, len)) {
+                    return false;
+                }
+                bytes_remaining -= len;
+            }
+            size_t len = ok_inflater_inflate(decoder->inflater, decoder->curr_scanline,
+                                             max_bytes_per_scanline);
+            if (len == OK_SIZE_MAX) {
+                ok_png_error(decoder->png, OK_PNG_ERROR_INFLATER, "Inflater error");
+                return false;
+            }
+        }
+        decoder->adler32_verified = true;
+    }
+    if (bytes_remaining > 0) {
+        return ok_seek(decoder, (long)bytes_remaining);
+    } else {
+        return true;
+    }
+}
+
+static bool ok_png_read_data(ok_png_decoder *decoder, uint32_t bytes_remaining) {
+    ok_png *png = decoder->png;
+
+    if (!ok_png_init_buffers(decoder)) {
+        return false;
+    }
+
+    // Sanity check - this happened with one file in the PNG suite
+    if (decoder->decoding_completed) {
+        return ok_png_finish_data(decoder, bytes_remaining);
+    }
+
+    // Read data
+    const bool decode_direct = ok_png_can_decode_direct(decoder);
+    while (true) {
+        // Setup pass
+        if (!ok_png_setup_pass(decoder)) {
+            // Done decoding - skip any remaining chunk data
+            return ok_png_finish_data(decoder, bytes_remaining);
+        }
+        const size_t curr_bytes_per_scanline = ok_png_get_bytes_per_scanline(decoder);
+
+        // Read compressed data
+        if (ok_inflater_needs_input(decoder->inflater)) {
+            if (bytes_remaining == 0) {
+                // Need more data, but there is no remaining data in this chunk.
+                // There may be another IDAT chunk.
+                return true;
+            }
+            const size_t len = min(OK_PNG_INFLATE_BUFFER_SIZE, bytes_remaining);
+            if (!ok_png_read_compressed_data(decoder, len)) {
+                return false;
+            }
+            bytes_remaining -= len;
+        }
+
+        // Decompress data. In direct mode, only the filter type is inflated to curr_scanline,
+        // and the rest of the scanline is inflated to its final location in the image.
+        uint8_t *dst;
+        size_t dst_len;
+        if (!decode_direct) {
+            dst = decoder->curr_scanline + decoder->inflater_bytes_read;
+            dst_len = curr_bytes_per_scanline - decoder->inflater_bytes_read;
+        } else if (decoder->inflater_bytes_read == 0) {
+            dst = decoder->curr_scanline;
+            dst_len = 1;
+        } else {
+            dst = (ok_png_get_data_row(decoder, decoder->scanline) +
+                   decoder->inflater_bytes_read - 1);
+            dst_len = curr_bytes_per_scanline - decoder->inflater_bytes_read;
+        }
+        size_t len = ok_inflater_inflate(decoder->inflater, dst, dst_len);
+        if (len == OK_SIZE_MAX) {
+            ok_png_error(png, OK_PNG_ERROR_INFLATER, "Inflater error");
+            return false;
+        }
+        decoder->inflater_bytes_read += len;
+        if (decoder->inflater_bytes_read == curr_bytes_per_scanline) {
+            if (!ok_png_decode_scanline(decoder, decode_direct)) {
+                return false;
+            }
+        }
+    }
+}
+
+// MARK: Multi-threaded decoding
+//
+// When a thread pool is used, all IDAT data is read into memory first. The zlib stream is split
+// at full flush points (empty stored blocks, byte-aligned, after which no match refers to
+// earlier data), and each segment is inflated on the thread pool. A flush point is found by
+// searching for its LEN/NLEN bytes (00 00 FF FF). A false match, or a sync flush that is not a
+// full flush, makes a segment fail to decode, and the decoder falls back to inflating serially.
+//
+// If every segment starts on a scanline whose filter doesn't use the prior scanline (None or
+// Sub), the segments are also unfiltered and transformed on the thread pool. Otherwise that
+// step is serial.
+
+#define OK_PNG_MIN_SEGMENT_LENGTH (64 * 1024)
+#define OK_PNG_MAX_SEGMENTS 256
+
+typedef struct {
+    ok_png_decoder *decoder;
+
+    // Input
+    const uint8_t *input;
+    size_t input_length;
+    bool is_first;
+    bool is_last;
+
+    // Output (filtered scanlines)
+    uint8_t *data;
+    size_t data_length;
+    size_t data_capacity;
+    size_t max_data_length;
+    uint32_t first_scanline;
+
+    // Adler-32 of the output, and (for the last segment) the Adler-32 at the end of the stream
+    uint32_t adler;
+    uint32_t expected_adler;
+
+    bool success;
+} ok_png_segment;
+
+static void ok_png_inflate_segment(void *task_data) {
+    ok_png_segment *segment = task_data;
+    ok_png_decoder *decoder = segment->decoder;
+    segment->success = false;
+
+    const bool nowrap = decoder->is_ios_format || !segment->is_first;
+    ok_inflater *inflater = ok_inflater_init(nowrap, decoder->allocator,
+                                             decoder->allocator_user_data);
+    if (!inflater) {
+        return;
+    }
+    ok_inflater_set_verify_adler32(inflater, decoder->verify_adler32);
+    ok_inflater_set_input(inflater, segment->input, segment->input_length);
+    while (true) {
+        if (segment->data_length == segment->data_capacity) {
+            // Grow the output buffer
+            if (segment->data_capacity == segment->max_data_length) {
+                break;
+            }
+            size_t new_capacity = min(segment->max_data_length,
+                                      max(segment->data_capacity * 2, segment->input_length * 4));
+            uint8_t *new_data = ok_alloc(decoder, new_capacity);
+            if (!new_data) {
+                break;
+            }
+            if (segment->data) {
+                memcpy(new_data, segment->data, segment->data_length);
+                decoder->allocator.free(decoder->allocator_user_data, segment->data);
+            }
+            segment->data = new_data;
+            segment->data_capacity = new_capacity;
+        }
+        size_t len = ok_inflater_inflate(inflater, segment->data + segment->data_length,
+                                         segment->data_capacity - segment->data_length);
+        if (len == OK_SIZE_MAX) {
+            // Only the last segment may contain the end of the stream
+            segment->success = segment->is_last && ok_inflater_is_done(inflater);
+            if (segment->success && decoder->verify_adler32 && !decoder->is_ios_format) {
+                // The segment was inflated without the zlib wrapper, so read the checksum here
+                const size_t unused_length = ok_inflater_get_unused_input_length(inflater);
+                if (unused_length < 4) {
+                    segment->success = false;
+                } else {
+                    segment->expected_adler = readBE32(segment->input + segment->input_length -
+                                                       unused_length);
+                }
+            }
+            break;
+        } else if (len == 0) {
+            // Other segments must end at a flush point
+            segment->success = !segment->is_last && ok_inflater_is_at_flush_point(inflater);
+            break;
+        }
+        segment->data_length += len;
+    }
+    if (decoder->verify_adler32) {
+        segment->adler = ok_inflater_get_adler32(inflater);
+    }
+    ok_inflater_free(inflater);
+}
+
+static void ok_png_decode_segment(void *task_data) {
+    ok_png_segment *segment = task_data;
+    ok_png_decoder *decoder = segment->decoder;
+    uint8_t bits_per_pixel = decoder->bit_depth * OK_PNG_SAMPLES_PER_PIXEL[decoder->color_type];
+    uint8_t bytes_per_pixel = (bits_per_pixel + 7) / 8;
+    const size_t bytes_per_scanline = ok_png_get_bytes_per_scanline(decoder);
+    const uint32_t num_scanlines = (uint32_t)(segment->data_length / bytes_per_scanline);
+
+    // The first scanline of each segment is either the first in the image or doesn't use
+    // the prior scanline, so the zero-filled prev_scanline can be used.
+    const uint8_t *prev = decoder->prev_scanline + 1;
+    uint8_t *curr = segment->data + 1;
+    segment->success = true;
+    for (uint32_t i = 0; i < num_scanlines; i++) {
+        const int filter = curr[-1];
+        if (filter > 0 && filter < OK_PNG_NUM_FILTERS) {
+            decoder->decode_filter(curr, prev, bytes_per_scanline - 1, filter, bytes_per_pixel);
+        } else if (filter != 0) {
+            segment->success = false;
+            return;
+        }
+        ok_png_transform_scanline(decoder, curr, decoder->width,
+                                  segment->first_scanline + i);
+        prev = curr;
+        curr += bytes_per_scanline;
+    }
+}
+
+// Decodes already-inflated data, in order.
+static bool ok_png_decode_inflated_data(ok_png_decoder *decoder, const uint8_t *data,
+                                        size_t length) {
+    while (length > 0) {
+        if (!ok_png_setup_pass(decoder)) {
+            // Done decoding - ignore remaining data
+            return true;
+        }
+        const size_t curr_bytes_per_scanline = ok_png_get_bytes_per_scanline(decoder);
+        const size_t len = min(length, curr_bytes_per_scanline - decoder->inflater_bytes_read);
+        memcpy(decoder->curr_scanline + decoder->inflater_bytes_read, data, len);
+        data += len;
+        length -= len;
+        decoder->inflater_bytes_read += len;
+        if (decoder->inflater_bytes_read == curr_bytes_per_scanline) {
+            if (!ok_png_decode_scanline(decoder, false)) {
+                return false;
+            }
+        }
+    }
+    // Check if the last scanline completed decoding
+    ok_png_setup_pass(decoder);
+    return true;
+}
+
+static bool ok_png_decode_segments(ok_png_decoder *decoder, ok_png_segment *segments,
+                                   size_t num_segments, size_t data_length) {
+    ok_png *png = decoder->png;
+    void *task_data[OK_PNG_MAX_SEGMENTS];
+    for (size_t i = 0; i < num_segments; i++) {
+        task_data[i] = segments + i;
+    }
+
+    // Inflate
+    decoder->thread_pool.run_tasks(decoder->thread_pool_user_data, ok_png_inflate_segment,
+                                   task_data, num_segments);
+    size_t total_length = 0;
+    for (size_t i = 0; i < num_segments; i++) {
+        if (!segments[i].success) {
+            return false;
+        }
+        total_length += segments[i].data_length;
+    }
+
+    // Verify the Adler-32 of the inflated data
+    if (decoder->verify_adler32 && !decoder->is_ios_format) {
+        uint32_t adler = segments[0].adler;
+        for (size_t i = 1; i < num_segments; i++) {
+            adler = ok_adler_combine(adler, segments[i].adler, segments[i].data_length);
+        }
+        if (adler != segments[num_segments - 1].expected_adler) {
+            ok_png_error(png, OK_PNG_ERROR_INFLATER, "Invalid Adler-32 checksum");
+            return true;
+        }
+        decoder->adler32_verified = true;
+    }
+
+    // Unfilter and transform
+    bool can_decode_in_parallel = (decoder->interlace_method == 0 && total_length == data_length);
+    const size_t bytes_per_scanline = ok_png_get_bytes_per_scanline(decoder);
+    size_t offset = 0;
+    for (size_t i = 0; i < num_segments && can_decode_in_parallel; i++) {
+        ok_png_segment *segment = segments + i;
+        can_decode_in_parallel = (segment->data_length % bytes_per_scanline == 0 &&
+                                  (i == 0 || segment->data_length == 0 ||
+                                   segment->data[0] == OK_PNG_FILTER_NONE ||
+                                   segment->data[0] == OK_PNG_FILTER_SUB));
+        segment->first_scanline = (uint32_t)(offset / bytes_per_scanline);
+        offset += segment->data_length;
+    }
+    if (can_decode_in_parallel) {
+        memset(decoder->prev_scanline, 0, bytes_per_scanline);
+        decoder->thread_pool.run_tasks(decoder->thread_pool_user_data, ok_png_decode_segment,
+                                       task_data, num_segments);
+        for (size_t i = 0; i < num_segments; i++) {
+            if (!segments[i].success) {
+                ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid filter type");
+                return true;
+            }
+        }
+        decoder->decoding_completed = true;
+    } else {
+        for (size_t i = 0; i < num_segments; i++) {
+            if (!ok_png_decode_inflated_data(decoder, segments[i].data,
+                                             segments[i].data_length)) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+static bool ok_png_decode_idat_data(ok_png_decoder *decoder) {
+    ok_png *png = decoder->png;
+    const uint8_t *idat_data = decoder->idat_data;
+    const size_t idat_data_length = decoder->idat_data_length;
+    bool success = true;
+    if (!ok_png_init_buffers(decoder)) {
         return false;
     }
 
-    // Setup inflater
-    if (!decoder->inflater) {
-        decoder->inflater = ok_inflater_init(decoder->is_ios_format,
-                                             decoder->allocator, decoder->allocator_user_data);
-        if (!decoder->inflater) {
-            ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't init inflater");
-            return false;
+    // Size of all filtered scanlines
+    uint64_t data_length = 0;
+    const uint8_t num_passes = decoder->interlace_method == 0 ? 1 : 7;
+    for (uint8_t pass = 1; pass <= num_passes; pass++) {
+        decoder->interlace_pass = pass;
+        if (ok_png_get_width_for_pass(decoder) > 0) {
+            data_length += (ok_png_get_bytes_per_scanline(decoder) *
+                            (uint64_t)ok_png_get_height_for_pass(decoder));
         }
     }
+    decoder->interlace_pass = 0;
 
-    // Sanity check - this happened with one file in the PNG suite
-    if (decoder->decoding_completed) {
-        if (bytes_remaining > 0) {
-            return ok_seek(decoder, (long)bytes_remaining);
-        } else {
-            return true;
+    // Find flush points
+    size_t num_segments = 1;
+    size_t segment_start[OK_PNG_MAX_SEGMENTS];
+    segment_start[0] = 0;
+    if (data_length == (size_t)data_length) {
+        for (size_t i = OK_PNG_MIN_SEGMENT_LENGTH;
+             i + OK_PNG_MIN_SEGMENT_LENGTH <= idat_data_length && num_segments < OK_PNG_MAX_SEGMENTS;
+             i++) {
+            if (idat_data[i - 1] == 0xff && idat_data[i - 2] == 0xff &&
+                idat_data[i - 3] == 0x00 && idat_data[i - 4] == 0x00 &&
+                i - segment_start[num_segments - 1] >= OK_PNG_MIN_SEGMENT_LENGTH) {
+                segment_start[num_segments++] = i;
+            }
         }
     }
 
-    // Read data
-    uint32_t curr_width = ok_png_get_width_for_pass(decoder);
-    uint32_t curr_height = ok_png_get_height_for_pass(decoder);
-    size_t curr_bytes_per_scanline = (size_t)(1 + ((uint64_t)curr_width * bits_per_pixel + 7) / 8);
-    while (true) {
-        // Setup pass
-        while (decoder->ready_for_next_interlace_pass) {
-            decoder->ready_for_next_interlace_pass = false;
-            decoder->scanline = 0;
-            decoder->interlace_pass++;
-            if (decoder->interlace_pass == num_passes + 1) {
-                // Done decoding - skip any remaining chunk data
-                decoder->decoding_completed = true;
-                if (bytes_remaining > 0) {
-                    return ok_seek(decoder, (long)bytes_remaining);
-                } else {
-                    return true;
-                }
+    // Inflate segments in parallel
+    bool decoded = false;
+    if (num_segments > 1) {
+        ok_png_segment *segments = ok_alloc(decoder, num_segments * sizeof(ok_png_segment));
+        if (segments) {
+            memset(segments, 0, num_segments * sizeof(ok_png_segment));
+            for (size_t i = 0; i < num_segments; i++) {
+                const size_t end = (i == num_segments - 1 ? idat_data_length :
+                                    segment_start[i + 1]);
+                segments[i].decoder = decoder;
+                segments[i].input = idat_data + segment_start[i];
+                segments[i].input_length = end - segment_start[i];
+                segments[i].is_first = (i == 0);
+                segments[i].is_last = (i == num_segments - 1);
+                segments[i].max_data_length = (size_t)data_length;
             }
-            curr_width = ok_png_get_width_for_pass(decoder);
-            curr_height = ok_png_get_height_for_pass(decoder);
-            curr_bytes_per_scanline = (size_t)(1 + ((uint64_t)curr_width * bits_per_pixel + 7) / 8);
-            if (curr_width == 0 || curr_height == 0) {
-                // No data for this pass - happens if width or height <= 4
-                decoder->ready_for_next_interlace_pass = true;
-            } else {
-                memset(decoder->curr_scanline, 0, curr_bytes_per_scanline);
-                memset(decoder->prev_scanline, 0, curr_bytes_per_scanline);
-                decoder->inflater_bytes_read = 0;
+            decoded = ok_png_decode_segments(decoder, segments, num_segments,
+                                             (size_t)data_length);
+            for (size_t i = 0; i < num_segments; i++) {
+                decoder->allocator.free(decoder->allocator_user_data, segments[i].data);
             }
+            decoder->allocator.free(decoder->allocator_user_data, segments);
         }
+    }
 
-        // Read compressed data
-        if (ok_inflater_needs_input(decoder->inflater)) {
-            if (bytes_remaining == 0) {
-                // Need more data, but there is no remaining data in this chunk.
-                // There may be another IDAT chunk.
-                return true;
-            }
-            const size_t len = min(inflate_buffer_size, bytes_remaining);
-            if (!ok_read(decoder, decoder->inflate_buffer, len)) {
-                return false;
-            }
-            bytes_remaining -= len;
-            ok_inflater_set_input(decoder->inflater, decoder->inflate_buffer, len);
-        }
+    // Fallback: inflate serially
+    if (!decoded) {
+        ok_inflater_set_input(decoder->inflater, idat_data, idat_data_length);
+        success = ok_png_read_data(decoder, 0);
+    }
 
-        // Decompress data
-        size_t len = ok_inflater_inflate(decoder->inflater,
-                                         decoder->curr_scanline + decoder->inflater_bytes_read,
-                                         curr_bytes_per_scanline - decoder->inflater_bytes_read);
-        if (len == OK_SIZE_MAX) {
-            ok_png_error(png, OK_PNG_ERROR_INFLATER, "Inflater error");
+    decoder->allocator.free(decoder->allocator_user_data, decoder->idat_data);
+    decoder->idat_data = NULL;
+    decoder->idat_data_length = 0;
+    decoder->idat_data_capacity = 0;
+    return success && png->error_code == OK_PNG_SUCCESS;
+}
+
+static bool ok_png_read_idat_data(ok_png_decoder *decoder, uint32_t chunk_length) {
+    if (decoder->decoding_completed) {
+        return ok_seek(decoder, (long)chunk_length);
+    }
+    if (decoder->idat_data_length + chunk_length > decoder->idat_data_capacity) {
+        size_t new_capacity = max(decoder->idat_data_capacity * 2,
+                                  decoder->idat_data_length + chunk_length);
+        if (new_capacity < decoder->idat_data_length) {
+            ok_png_error(decoder->png, OK_PNG_ERROR_UNSUPPORTED, "Image data too large");
             return false;
         }
-        decoder->inflater_bytes_read += len;
-        if (decoder->inflater_bytes_read == curr_bytes_per_scanline) {
-            // Apply filter
-            const int filter = decoder->curr_scanline[0];
-            if (filter > 0 && filter < OK_PNG_NUM_FILTERS) {
-                ok_png_decode_filter(decoder->curr_scanline + 1, decoder->prev_scanline + 1,
-                                     curr_bytes_per_scanline - 1, filter, bytes_per_pixel);
-            } else if (filter != 0) {
-                ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid filter type");
-                return false;
-            }
+        uint8_t *new_data = ok_alloc(decoder, new_capacity);
+        if (!new_data) {
+            ok_png_error(decoder->png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate buffers");
+            return false;
+        }
+        if (decoder->idat_data) {
+            memcpy(new_data, decoder->idat_data, decoder->idat_data_length);
+            decoder->allocator.free(decoder->allocator_user_data, decoder->idat_data);
+        }
+        decoder->idat_data = new_data;
+        decoder->idat_data_capacity = new_capacity;
+    }
+    if (!ok_read(decoder, decoder->idat_data + decoder->idat_data_length, chunk_length)) {
+        return false;
+    }
+    decoder->idat_data_length += chunk_length;
+    return true;
+}
 
-            // Transform
-            ok_png_transform_scanline(decoder, decoder->curr_scanline + 1, curr_width);
+// Reads the data of a chunk. In push mode, IDAT and ignored chunks may be read in several parts.
+static bool ok_png_read_chunk(ok_png_decoder *decoder, uint32_t chunk_type, uint32_t chunk_length) {
+    ok_png *png = decoder->png;
 
-            // Setup for next scanline or pass
-            decoder->scanline++;
-            if (decoder->scanline == curr_height) {
-                decoder->ready_for_next_interlace_pass = true;
-            } else {
-                uint8_t *temp = decoder->curr_scanline;
-                decoder->curr_scanline = decoder->prev_scanline;
-                decoder->prev_scanline = temp;
-                decoder->inflater_bytes_read = 0;
-            }
+    // When info_only is true, we only care about the IHDR chunk and whether or not
+    // the tRNS chunk exists.
+    const bool info_only = (decoder->decode_flags & OK_PNG_INFO_ONLY) != 0;
+    if (!decoder->hdr_found && chunk_type != OK_PNG_CHUNK_CGBI && chunk_type != OK_PNG_CHUNK_IHDR) {
+        ok_png_error(png, OK_PNG_ERROR_INVALID, "IHDR chunk must appear first");
+        return false;
+    }
+    if (chunk_type == OK_PNG_CHUNK_IHDR) {
+        if (decoder->hdr_found) {
+            ok_png_error(png, OK_PNG_ERROR_INVALID, "Multiple IHDR chunks not allowed");
+            return false;
+        }
+        decoder->hdr_found = true;
+        const bool success = ok_png_read_header(decoder, chunk_length);
+        if (success && info_only) {
+            // If the png has alpha, then we have all the info we need.
+            // Otherwise, continue scanning to see if the tRNS chunk exists.
+            decoder->info_complete = png->has_alpha;
+        }
+        return success;
+    } else if (chunk_type == OK_PNG_CHUNK_CGBI) {
+        decoder->is_ios_format = true;
+        return ok_seek(decoder, (long)chunk_length);
+    } else if (chunk_type == OK_PNG_CHUNK_PLTE && !info_only) {
+        return ok_png_read_palette(decoder, chunk_length);
+    } else if (chunk_type == OK_PNG_CHUNK_TRNS) {
+        if (info_only) {
+            // No need to parse this chunk, we have all the info we need.
+            png->has_alpha = true;
+            decoder->info_complete = true;
+            return true;
+        } else {
+            return ok_png_read_transparency(decoder, chunk_length);
+        }
+    } else if (chunk_type == OK_PNG_CHUNK_IDAT) {
+        if (info_only) {
+            // Both IHDR and tRNS must come before IDAT, so we have all the info we need.
+            decoder->info_complete = true;
+            return true;
         }
+        if (decoder->has_thread_pool) {
+            return ok_png_read_idat_data(decoder, chunk_length);
+        } else {
+            return ok_png_read_data(decoder, chunk_length);
+        }
+    } else if (chunk_type == OK_PNG_CHUNK_IEND) {
+        decoder->end_found = true;
+        return ok_seek(decoder, (long)chunk_length);
+    } else {
+        // Ignore this chunk
+        return ok_seek(decoder, (long)chunk_length);
+    }
+}
+
+// Checks that all image data was decoded, after the IEND chunk
+static void ok_png_check_completed(ok_png_decoder *decoder) {
+    if (!decoder->decoding_completed) {
+        ok_png_error(decoder->png, OK_PNG_ERROR_INVALID, "Missing imaga data");
+    } else if (decoder->verify_adler32 && !decoder->is_ios_format && !decoder->adler32_verified) {
+        ok_png_error(decoder->png, OK_PNG_ERROR_INFLATER, "Missing Adler-32 checksum");
     }
 }
 
+static const uint8_t OK_PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
 static void ok_png_decode2(ok_png_decoder *decoder) {
     ok_png *png = decoder->png;
 
@@ -915,18 +2545,12 @@ static void ok_png_decode2(ok_png_decoder *decoder) {
     if (!ok_read(decoder, png_header, sizeof(png_header))) {
         return;
     }
-    uint8_t png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
-    if (memcmp(png_header, png_signature, 8) != 0) {
+    if (memcmp(png_header, OK_PNG_SIGNATURE, 8) != 0) {
         ok_png_error(decoder->png, OK_PNG_ERROR_INVALID, "Invalid signature (not a PNG file)");
         return;
     }
 
-    // When info_only is true, we only care about the IHDR chunk and whether or not
-    // the tRNS chunk exists.
-    bool info_only = (decoder->decode_flags & OK_PNG_INFO_ONLY) != 0;
-    bool hdr_found = false;
-    bool end_found = false;
-    while (!end_found) {
+    while (!decoder->end_found) {
         uint8_t chunk_header[8];
         uint8_t chunk_footer[4];
         if (!ok_read(decoder, chunk_header, sizeof(chunk_header))) {
@@ -934,109 +2558,344 @@ static void ok_png_decode2(ok_png_decoder *decoder) {
         }
         const uint32_t chunk_length = readBE32(chunk_header);
         const uint32_t chunk_type = readBE32(chunk_header + 4);
-        bool success = false;
-
-        if (!hdr_found && chunk_type != OK_PNG_CHUNK_CGBI && chunk_type != OK_PNG_CHUNK_IHDR) {
-            ok_png_error(png, OK_PNG_ERROR_INVALID, "IHDR chunk must appear first");
-            return;
+        if (decoder->verify_crc) {
+            // The CRC covers the chunk type and chunk data, but not the length
+            decoder->chunk_crc = decoder->crc_update(0xffffffff, chunk_header + 4, 4);
         }
-        if (chunk_type == OK_PNG_CHUNK_IHDR) {
-            if (hdr_found) {
-                ok_png_error(png, OK_PNG_ERROR_INVALID, "Multiple IHDR chunks not allowed");
-                return;
-            }
-            hdr_found = true;
-            success = ok_png_read_header(decoder, chunk_length);
-            if (success && info_only) {
-                // If the png has alpha, then we have all the info we need.
-                // Otherwise, continue scanning to see if the tRNS chunk exists.
-                if (png->has_alpha) {
-                    return;
-                }
-            }
-        } else if (chunk_type == OK_PNG_CHUNK_CGBI) {
-            success = ok_seek(decoder, (long)chunk_length);
-            decoder->is_ios_format = true;
-        } else if (chunk_type == OK_PNG_CHUNK_PLTE && !info_only) {
-            success = ok_png_read_palette(decoder, chunk_length);
-        } else if (chunk_type == OK_PNG_CHUNK_TRNS) {
-            if (info_only) {
-                // No need to parse this chunk, we have all the info we need.
-                png->has_alpha = true;
-                return;
-            } else {
-                success = ok_png_read_transparency(decoder, chunk_length);
-            }
-        } else if (chunk_type == OK_PNG_CHUNK_IDAT) {
-            if (info_only) {
-                // Both IHDR and tRNS must come before IDAT, so we have all the info we need.
+
+        if (decoder->idat_data_length > 0 && chunk_type != OK_PNG_CHUNK_IDAT) {
+            // End of consecutive IDAT chunks
+            if (!ok_png_decode_idat_data(decoder)) {
                 return;
             }
-            success = ok_png_read_data(decoder, chunk_length);
-        } else if (chunk_type == OK_PNG_CHUNK_IEND) {
-            success = ok_seek(decoder, (long)chunk_length);
-            end_found = true;
-        } else {
-            // Ignore this chunk
-            success = ok_seek(decoder, (long)chunk_length);
         }
 
-        if (!success) {
+        if (!ok_png_read_chunk(decoder, chunk_type, chunk_length) || decoder->info_complete) {
             return;
         }
 
-        // Read the footer (CRC) and ignore it
+        // Read the footer (CRC). It is ignored unless OK_PNG_VERIFY_CRC is set.
+        const uint32_t chunk_crc = decoder->chunk_crc ^ 0xffffffff;
         if (!ok_read(decoder, chunk_footer, sizeof(chunk_footer))) {
             return;
         }
+        if (decoder->verify_crc && readBE32(chunk_footer) != chunk_crc) {
+            ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid CRC");
+            return;
+        }
     }
 
-    // Sanity check
-    if (!decoder->decoding_completed) {
-        ok_png_error(png, OK_PNG_ERROR_INVALID, "Missing imaga data");
+    ok_png_check_completed(decoder);
+}
+
+// Sends a fully decoded image to rows_func, in strips of up to 16 rows
+static void ok_png_send_rows(ok_png_decoder *decoder) {
+    ok_png *png = decoder->png;
+    const bool flip_y = (decoder->decode_flags & OK_PNG_FLIP_Y) != 0;
+    const uint32_t strip_height = 16;
+    for (uint32_t i = 0; i < png->height; i += strip_height) {
+        const uint32_t num_rows = min(strip_height, png->height - i);
+        const uint32_t y = flip_y ? png->height - i - num_rows : i;
+        if (!decoder->rows_func(decoder->rows_user_data, png->width, png->height, y, num_rows,
+                                png->data + (size_t)y * png->stride, png->stride)) {
+            ok_png_error(png, OK_PNG_ERROR_CANCELED, "Canceled");
+            return;
+        }
     }
 }
 
-void ok_png_decode(ok_png *png, ok_png_decode_flags decode_flags,
-                   ok_png_input input, void *input_user_data,
-                   ok_png_allocator allocator, void *allocator_user_data) {
-    if (!input.read || !input.seek) {
-        ok_png_error(png, OK_PNG_ERROR_API,
-                     "Invalid argument: input read and seek functions must not be NULL");
-        return;
+// Called after decoding. With row output, sends the image if it wasn't sent row by row, and frees
+// the image data.
+static void ok_png_finish_rows(ok_png_decoder *decoder) {
+    ok_png *png = decoder->png;
+    if (decoder->rows_func) {
+        if (png->data && !decoder->row_output && png->error_code == OK_PNG_SUCCESS) {
+            ok_png_send_rows(decoder);
+        }
+        decoder->allocator.free(decoder->allocator_user_data, png->data);
+        png->data = NULL;
     }
-    
+}
+
+static ok_png_decoder *ok_png_decoder_create(ok_png *png, ok_png_decode_flags decode_flags,
+                                             ok_png_allocator allocator, void *allocator_user_data,
+                                             ok_png_rows_func rows_func, void *rows_user_data) {
     if (!allocator.alloc || !allocator.free) {
         ok_png_error(png, OK_PNG_ERROR_API,
                      "Invalid argument: allocator alloc and free functions must not be NULL");
-        return;
+        return NULL;
     }
 
     ok_png_decoder *decoder = allocator.alloc(allocator_user_data, sizeof(ok_png_decoder));
     if (!decoder) {
         ok_png_error(png, OK_PNG_ERROR_ALLOCATION, "Couldn't allocate decoder.");
-        return;
+        return NULL;
     }
     memset(decoder, 0, sizeof(ok_png_decoder));
 
     decoder->png = png;
     decoder->decode_flags = decode_flags;
-    decoder->input = input;
-    decoder->input_user_data = input_user_data;
     decoder->allocator = allocator;
     decoder->allocator_user_data = allocator_user_data;
+    ok_png_init_simd(decoder);
+    if (decode_flags & OK_PNG_VERIFY_CRC) {
+        decoder->verify_crc = true;
+        ok_png_init_crc(decoder);
+    }
+    decoder->verify_adler32 = (decode_flags & OK_PNG_VERIFY_ADLER32) != 0;
+    decoder->rows_func = rows_func;
+    decoder->rows_user_data = rows_user_data;
+    return decoder;
+}
 
-    ok_png_decode2(decoder);
-
-    // Cleanup decoder
+static void ok_png_decoder_destroy(ok_png_decoder *decoder) {
+    ok_png_allocator allocator = decoder->allocator;
+    void *allocator_user_data = decoder->allocator_user_data;
     ok_inflater_free(decoder->inflater);
     allocator.free(allocator_user_data, decoder->curr_scanline);
     allocator.free(allocator_user_data, decoder->prev_scanline);
     allocator.free(allocator_user_data, decoder->inflate_buffer);
     allocator.free(allocator_user_data, decoder->temp_data_row);
+    allocator.free(allocator_user_data, decoder->idat_data);
     allocator.free(allocator_user_data, decoder);
 }
 
+void ok_png_decode(ok_png *png, ok_png_decode_flags decode_flags,
+                   const ok_png_region *region, ok_png_input input, void *input_user_data,
+                   ok_png_allocator allocator, void *allocator_user_data,
+                   const ok_png_thread_pool *thread_pool, void *thread_pool_user_data,
+                   ok_png_rows_func rows_func, void *rows_user_data) {
+    if (!input.read || !input.seek) {
+        ok_png_error(png, OK_PNG_ERROR_API,
+                     "Invalid argument: input read and seek functions must not be NULL");
+        return;
+    }
+
+    ok_png_decoder *decoder = ok_png_decoder_create(png, decode_flags, allocator,
+                                                    allocator_user_data, rows_func, rows_user_data);
+    if (!decoder) {
+        return;
+    }
+    decoder->input = input;
+    decoder->input_user_data = input_user_data;
+    if (region) {
+        decoder->has_region = true;
+        decoder->region_x = region->x;
+        decoder->region_y = region->y;
+        decoder->region_width = region->width;
+        decoder->region_height = region->height;
+    }
+    if (thread_pool) {
+        decoder->has_thread_pool = true;
+        decoder->thread_pool = *thread_pool;
+        decoder->thread_pool_user_data = thread_pool_user_data;
+    }
+
+    ok_png_decode2(decoder);
+    ok_png_finish_rows(decoder);
+    ok_png_decoder_destroy(decoder);
+}
+
+// MARK: Push decoding
+
+// Input functions for push mode, reading from the data passed to ok_png_decoder_feed()
+static size_t ok_png_push_read(void *user_data, uint8_t *buffer, size_t count) {
+    ok_png_decoder *decoder = user_data;
+    const size_t len = min(count, decoder->push_input_length);
+    memcpy(buffer, decoder->push_input, len);
+    decoder->push_input += len;
+    decoder->push_input_length -= len;
+    return len;
+}
+
+static bool ok_png_push_seek(void *user_data, long count) {
+    ok_png_decoder *decoder = user_data;
+    if (count < 0 || (size_t)count > decoder->push_input_length) {
+        return false;
+    }
+    decoder->push_input += count;
+    decoder->push_input_length -= (size_t)count;
+    return true;
+}
+
+static const ok_png_input OK_PNG_PUSH_INPUT = {
+    .read = ok_png_push_read,
+    .seek = ok_png_push_seek,
+};
+
+ok_png_decoder *ok_png_decoder_init(ok_png_decode_flags decode_flags,
+                                    ok_png_allocator allocator, void *allocator_user_data,
+                                    ok_png_rows_func rows_func, void *rows_user_data) {
+    ok_png png = { 0 };
+    ok_png_decoder *decoder = ok_png_decoder_create(&png, decode_flags, allocator,
+                                                    allocator_user_data, rows_func, rows_user_data);
+    if (decoder) {
+        decoder->png = &decoder->push_image;
+        decoder->input = OK_PNG_PUSH_INPUT;
+        decoder->input_user_data = decoder;
+    }
+    return decoder;
+}
+
+// Buffers up to `length` bytes of input in push_buffer. Returns true if the buffer has `length`
+// bytes.
+static bool ok_png_push_buffer(ok_png_decoder *decoder, size_t length) {
+    const size_t len = min(length - decoder->push_buffer_length, decoder->push_input_length);
+    if (len > 0) {
+        memcpy(decoder->push_buffer + decoder->push_buffer_length, decoder->push_input, len);
+    }
+    decoder->push_buffer_length += len;
+    decoder->push_input += len;
+    decoder->push_input_length -= len;
+    return decoder->push_buffer_length == length;
+}
+
+// Reads chunk data from push_input. Small chunks that are parsed (IHDR, PLTE, and tRNS) are
+// buffered until the whole chunk is available. Other chunks are read as data arrives.
+static bool ok_png_push_chunk_data(ok_png_decoder *decoder) {
+    const uint32_t chunk_type = decoder->chunk_type;
+    if (chunk_type == OK_PNG_CHUNK_IHDR || chunk_type == OK_PNG_CHUNK_PLTE ||
+        chunk_type == OK_PNG_CHUNK_TRNS) {
+        const uint32_t chunk_length = decoder->chunk_bytes_remaining;
+        if (chunk_length > OK_PNG_PUSH_BUFFER_SIZE) {
+            ok_png_error(decoder->png, OK_PNG_ERROR_INVALID, "Invalid chunk length");
+            return false;
+        }
+        if (!ok_png_push_buffer(decoder, chunk_length)) {
+            return true;
+        }
+        // Read the chunk from push_buffer
+        const uint8_t *input = decoder->push_input;
+        const size_t input_length = decoder->push_input_length;
+        decoder->push_input = decoder->push_buffer;
+        decoder->push_input_length = chunk_length;
+        const bool success = ok_png_read_chunk(decoder, chunk_type, chunk_length);
+        decoder->push_input = input;
+        decoder->push_input_length = input_length;
+        decoder->push_buffer_length = 0;
+        decoder->chunk_bytes_remaining = 0;
+        return success;
+    } else {
+        const uint32_t len = (uint32_t)min(decoder->chunk_bytes_remaining,
+                                           decoder->push_input_length);
+        decoder->chunk_bytes_remaining -= len;
+        return ok_png_read_chunk(decoder, chunk_type, len);
+    }
+}
+
+ok_png_decoder_status ok_png_decoder_feed(ok_png_decoder *decoder, const uint8_t *data,
+                                          size_t length) {
+    if (!decoder) {
+        return OK_PNG_DECODER_ERROR;
+    }
+    if (!data && length > 0) {
+        ok_png_error(decoder->png, OK_PNG_ERROR_API, "Invalid argument: data must not be NULL");
+        decoder->push_state = OK_PNG_PUSH_ERROR;
+    }
+    ok_png *png = decoder->png;
+    const uint32_t rows_completed = decoder->rows_completed;
+    decoder->push_input = data;
+    decoder->push_input_length = length;
+    while (decoder->push_state != OK_PNG_PUSH_DONE && decoder->push_state != OK_PNG_PUSH_ERROR) {
+        bool success = true;
+        if (decoder->push_state == OK_PNG_PUSH_SIGNATURE) {
+            if (!ok_png_push_buffer(decoder, sizeof(OK_PNG_SIGNATURE))) {
+                break;
+            }
+            decoder->push_buffer_length = 0;
+            if (memcmp(decoder->push_buffer, OK_PNG_SIGNATURE, sizeof(OK_PNG_SIGNATURE)) != 0) {
+                ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid signature (not a PNG file)");
+                success = false;
+            } else {
+                decoder->push_state = OK_PNG_PUSH_CHUNK_HEADER;
+            }
+        } else if (decoder->push_state == OK_PNG_PUSH_CHUNK_HEADER) {
+            if (!ok_png_push_buffer(decoder, 8)) {
+                break;
+            }
+            decoder->push_buffer_length = 0;
+            decoder->chunk_bytes_remaining = readBE32(decoder->push_buffer);
+            decoder->chunk_type = readBE32(decoder->push_buffer + 4);
+            if (decoder->verify_crc) {
+                // The CRC covers the chunk type and chunk data, but not the length
+                decoder->chunk_crc = decoder->crc_update(0xffffffff, decoder->push_buffer + 4, 4);
+            }
+            decoder->push_state = OK_PNG_PUSH_CHUNK_DATA;
+            if (decoder->chunk_bytes_remaining == 0) {
+                // Empty chunks, like IEND
+                success = ok_png_read_chunk(decoder, decoder->chunk_type, 0);
+                decoder->push_state = OK_PNG_PUSH_CHUNK_FOOTER;
+            }
+        } else if (decoder->push_state == OK_PNG_PUSH_CHUNK_DATA) {
+            if (decoder->push_input_length == 0) {
+                break;
+            }
+            success = ok_png_push_chunk_data(decoder);
+            if (decoder->chunk_bytes_remaining == 0) {
+                decoder->push_state = OK_PNG_PUSH_CHUNK_FOOTER;
+            }
+        } else if (decoder->push_state == OK_PNG_PUSH_CHUNK_FOOTER) {
+            if (!ok_png_push_buffer(decoder, 4)) {
+                break;
+            }
+            decoder->push_buffer_length = 0;
+            // The CRC is ignored unless OK_PNG_VERIFY_CRC is set
+            const uint32_t chunk_crc = decoder->chunk_crc ^ 0xffffffff;
+            if (decoder->verify_crc && readBE32(decoder->push_buffer) != chunk_crc) {
+                ok_png_error(png, OK_PNG_ERROR_INVALID, "Invalid CRC");
+                success = false;
+            } else if (decoder->end_found) {
+                ok_png_check_completed(decoder);
+                success = png->error_code == OK_PNG_SUCCESS;
+                decoder->push_state = OK_PNG_PUSH_DONE;
+            } else {
+                decoder->push_state = OK_PNG_PUSH_CHUNK_HEADER;
+            }
+        }
+        if (success && decoder->info_complete) {
+            decoder->push_state = OK_PNG_PUSH_DONE;
+        }
+        if (!success || png->error_code != OK_PNG_SUCCESS) {
+            decoder->push_state = OK_PNG_PUSH_ERROR;
+        } else if (decoder->push_state == OK_PNG_PUSH_DONE) {
+            ok_png_finish_rows(decoder);
+            if (png->error_code != OK_PNG_SUCCESS) {
+                decoder->push_state = OK_PNG_PUSH_ERROR;
+            }
+        }
+    }
+    decoder->push_input = NULL;
+    decoder->push_input_length = 0;
+
+    if (decoder->push_state == OK_PNG_PUSH_ERROR) {
+        return OK_PNG_DECODER_ERROR;
+    } else if (decoder->push_state == OK_PNG_PUSH_DONE) {
+        return OK_PNG_DECODER_DONE;
+    } else if (decoder->rows_completed != rows_completed) {
+        return OK_PNG_DECODER_ROWS_AVAILABLE;
+    } else {
+        return OK_PNG_DECODER_NEED_MORE_INPUT;
+    }
+}
+
+ok_png ok_png_decoder_finish(ok_png_decoder *decoder) {
+    ok_png png = { 0 };
+    if (!decoder) {
+        ok_png_error(&png, OK_PNG_ERROR_API, "Invalid argument: decoder must not be NULL");
+        return png;
+    }
+    if (decoder->push_state != OK_PNG_PUSH_DONE && decoder->push_state != OK_PNG_PUSH_ERROR) {
+        ok_png_error(decoder->png, OK_PNG_ERROR_IO, "Missing image data");
+    }
+    png = *decoder->png;
+    if (png.error_code != OK_PNG_SUCCESS) {
+        decoder->allocator.free(decoder->allocator_user_data, png.data);
+        png.data = NULL;
+    }
+    ok_png_decoder_destroy(decoder);
+    return png;
+}
+
 //
 // Inflater
 // Written from RFC 1950 and RFC 1951.
@@ -1070,6 +2929,7 @@ typedef enum {
     OK_INFLATER_STATE_READING_FIXED_COMPRESSED_BLOCK,
     OK_INFLATER_STATE_READING_DYNAMIC_DISTANCE,
     OK_INFLATER_STATE_READING_FIXED_DISTANCE,
+    OK_INFLATER_STATE_READING_ADLER32,
     OK_INFLATER_STATE_DONE,
     OK_INFLATER_STATE_ERROR,
 } ok_inflater_state;
@@ -1105,6 +2965,7 @@ typedef struct {
 struct ok_inflater {
     // Options
     bool nowrap;
+    bool verify_adler32;
 
     // Allocator
     ok_png_allocator allocator;
@@ -1113,13 +2974,14 @@ struct ok_inflater {
     // Input
     const uint8_t *input;
     const uint8_t *input_end;
-    uint32_t input_buffer;
+    uint64_t input_buffer;
     unsigned int input_buffer_bits;
 
     // Inflate data
     uint8_t *buffer;
     uint16_t buffer_start_pos;
     uint16_t buffer_end_pos;
+    bool buffer_wrapped; // If false, distances can't be greater than buffer_end_pos
     bool final_block;
     ok_inflater_state state;
     int state_count;
@@ -1138,6 +3000,11 @@ struct ok_inflater {
     ok_inflater_huffman_tree *distance_huffman;
     ok_inflater_huffman_tree *fixed_literal_huffman;
     ok_inflater_huffman_tree *fixed_distance_huffman;
+
+    // Adler-32 of the inflated data, and the expected value from the end of the zlib stream
+    ok_adler_update_function adler_update;
+    uint32_t adler;
+    uint32_t expected_adler;
 };
 
 #define ok_inflater_error(inflater, message) ok_inflater_set_error(inflater)
@@ -1175,6 +3042,9 @@ static inline uint16_t ok_inflater_can_write_total(const ok_inflater *inflater)
 static inline void ok_inflater_write_byte(ok_inflater *inflater, const uint8_t b) {
     inflater->buffer[inflater->buffer_end_pos & BUFFER_SIZE_MASK] = b;
     inflater->buffer_end_pos++;
+    if (inflater->buffer_end_pos == 0) {
+        inflater->buffer_wrapped = true;
+    }
 }
 
 static inline int ok_inflater_write_bytes(ok_inflater *inflater, const uint8_t *src, int len) {
@@ -1186,6 +3056,9 @@ static inline int ok_inflater_write_bytes(ok_inflater *inflater, const uint8_t *
         }
         memcpy(inflater->buffer + inflater->buffer_end_pos, src, (size_t)n);
         inflater->buffer_end_pos += n;
+        if (inflater->buffer_end_pos == 0) {
+            inflater->buffer_wrapped = true;
+        }
         bytes_remaining -= n;
         src += n;
     }
@@ -1201,6 +3074,9 @@ static inline int ok_inflater_write_byte_n(ok_inflater *inflater, const uint8_t
         }
         memset(inflater->buffer + inflater->buffer_end_pos, b, (size_t)n);
         inflater->buffer_end_pos += n;
+        if (inflater->buffer_end_pos == 0) {
+            inflater->buffer_wrapped = true;
+        }
         bytes_remaining -= n;
     }
     return len;
@@ -1227,6 +3103,9 @@ static inline size_t ok_inflater_flush(ok_inflater *inflater, uint8_t *dst, size
             return len - bytes_remaining;
         }
         memcpy(dst, inflater->buffer + inflater->buffer_start_pos, n);
+        if (inflater->verify_adler32) {
+            inflater->adler = inflater->adler_update(inflater->adler, dst, n);
+        }
         inflater->buffer_start_pos += n;
         bytes_remaining -= n;
         dst += n;
@@ -1264,7 +3143,7 @@ static inline bool ok_inflater_can_read_bits(ok_inflater *inflater, unsigned int
 
 // Assumes at least num_bits bits are loaded into buffer (call load_bits first)
 static inline uint32_t ok_inflater_read_bits(ok_inflater *inflater, unsigned int num_bits) {
-    uint32_t ans = inflater->input_buffer & ((1 << num_bits) - 1);
+    uint32_t ans = (uint32_t)(inflater->input_buffer & ((1u << num_bits) - 1));
     inflater->input_buffer >>= num_bits;
     inflater->input_buffer_bits -= num_bits;
     return ans;
@@ -1272,7 +3151,21 @@ static inline uint32_t ok_inflater_read_bits(ok_inflater *inflater, unsigned int
 
 // Assumes at least num_bits bits are loaded into buffer (call load_bits first)
 static inline uint32_t ok_inflater_peek_bits(ok_inflater *inflater, unsigned int num_bits) {
-    return inflater->input_buffer & ((1 << num_bits) - 1);
+    return (uint32_t)(inflater->input_buffer & ((1u << num_bits) - 1));
+}
+
+// Reads 8 bytes in little-endian order. The input must have at least 8 bytes.
+static inline uint64_t ok_inflater_read_le64(const uint8_t *input) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (((uint64_t)input[0] << 0) | ((uint64_t)input[1] << 8) |
+            ((uint64_t)input[2] << 16) | ((uint64_t)input[3] << 24) |
+            ((uint64_t)input[4] << 32) | ((uint64_t)input[5] << 40) |
+            ((uint64_t)input[6] << 48) | ((uint64_t)input[7] << 56));
+#else
+    uint64_t value;
+    memcpy(&value, input, sizeof(value));
+    return value;
+#endif
 }
 
 // Huffman
@@ -1503,7 +3396,13 @@ static bool ok_inflater_init_fixed_huffman(ok_inflater *inflater) {
 
 static bool ok_inflater_next_block(ok_inflater *inflater) {
     if (inflater->final_block) {
-        inflater->state = OK_INFLATER_STATE_DONE;
+        if (inflater->verify_adler32 && !inflater->nowrap) {
+            inflater->state = OK_INFLATER_STATE_READING_ADLER32;
+            inflater->state_count = 0;
+            inflater->expected_adler = 0;
+        } else {
+            inflater->state = OK_INFLATER_STATE_DONE;
+        }
         ok_inflater_skip_byte_align(inflater);
         return true;
     } else if (!ok_inflater_load_bits(inflater, 3)) {
@@ -1620,6 +3519,8 @@ static int ok_inflater_decode_length(ok_inflater *inflater, int value) {
     }
 }
 
+static bool ok_inflater_copy_match(ok_inflater *inflater);
+
 static bool ok_inflater_distance_with_tree(ok_inflater *inflater,
                                            const ok_inflater_huffman_tree *tree) {
     if (inflater->state_count < 0) {
@@ -1636,9 +3537,16 @@ static bool ok_inflater_distance_with_tree(ok_inflater *inflater,
             // Needs input
             return false;
         }
+        if (!inflater->buffer_wrapped && inflater->state_distance > inflater->buffer_end_pos) {
+            ok_inflater_error(inflater, "Invalid distance");
+            return false;
+        }
     }
+    return ok_inflater_copy_match(inflater);
+}
 
-    // Copy len bytes from offset to buffer_end_pos
+// Copies state_count bytes from state_distance bytes back. Returns false if the buffer is full.
+static bool ok_inflater_copy_match(ok_inflater *inflater) {
     int buffer_offset = (inflater->buffer_end_pos - inflater->state_distance) & BUFFER_SIZE_MASK;
     if (inflater->state_distance == 1) {
         // Optimization: can use memset
@@ -1733,6 +3641,151 @@ static bool ok_inflater_dynamic_block_code_lengths(ok_inflater *inflater) {
     return true;
 }
 
+// Fast path for compressed blocks, used when there is enough input and output space that a full
+// length/distance pair can be decoded and copied without checking for the end of the input or
+// for circular buffer wrap. Falls back to the state machine near the buffer edges.
+
+// Most bytes written for one symbol: a 258-byte match plus the overlapping-word copy overrun.
+#define OK_INFLATER_FAST_MAX_WRITE (258 + 8)
+
+static inline bool ok_inflater_can_inflate_fast(const ok_inflater *inflater) {
+    return (inflater->input_end - inflater->input >= 8 &&
+            inflater->buffer_end_pos <= BUFFER_SIZE - OK_INFLATER_FAST_MAX_WRITE &&
+            ok_inflater_can_write_total(inflater) >= OK_INFLATER_FAST_MAX_WRITE);
+}
+
+static void ok_inflater_compressed_block_fast(ok_inflater *inflater,
+                                              const ok_inflater_huffman_tree *literal_tree,
+                                              const ok_inflater_huffman_tree *distance_tree) {
+    const uint16_t *literal_table = literal_tree->lookup_table;
+    const uint16_t *distance_table = distance_tree->lookup_table;
+    const uint64_t literal_mask = (1u << literal_tree->bits) - 1;
+    const uint64_t distance_mask = (1u << distance_tree->bits) - 1;
+    const uint8_t *input = inflater->input;
+    const uint8_t *input_start = input;
+    const uint8_t *input_fast_end = inflater->input_end - 8;
+    uint64_t input_buffer = inflater->input_buffer;
+    unsigned int input_buffer_bits = inflater->input_buffer_bits;
+    uint8_t *buffer = inflater->buffer;
+    unsigned int pos = inflater->buffer_end_pos;
+    const unsigned int pos_fast_end = BUFFER_SIZE - OK_INFLATER_FAST_MAX_WRITE;
+    const unsigned int free_pos_end = (inflater->buffer_start_pos - 1u -
+                                       OK_INFLATER_FAST_MAX_WRITE) & BUFFER_SIZE_MASK;
+
+    // The free space ends at buffer_start_pos, which may be before or after pos.
+    const bool free_space_wraps = free_pos_end < pos;
+
+    while (input <= input_fast_end && pos <= pos_fast_end &&
+           (free_space_wraps || pos <= free_pos_end)) {
+        // Branchless refill to 56-63 bits. Loaded bits past input_buffer_bits are the same bytes
+        // that will be loaded on the next refill, so OR-ing them again is harmless.
+        input_buffer |= ok_inflater_read_le64(input) << input_buffer_bits;
+        input += (63 - input_buffer_bits) >> 3;
+        input_buffer_bits |= 56;
+
+        // Literal/length (up to 15 bits)
+        unsigned int entry = literal_table[input_buffer & literal_mask];
+        unsigned int value = entry & VALUE_BIT_MASK;
+        unsigned int num_bits = entry >> VALUE_BITS;
+        input_buffer >>= num_bits;
+        input_buffer_bits -= num_bits;
+        if (value < 256) {
+            buffer[pos++] = (uint8_t)value;
+            continue;
+        } else if (value == 256) {
+            inflater->state = OK_INFLATER_STATE_READY_FOR_NEXT_BLOCK;
+            break;
+        } else if (value >= 286) {
+            ok_inflater_error(inflater, "Invalid inflater literal");
+            break;
+        }
+
+        // Length extra bits (up to 5 bits)
+        value -= 257;
+        unsigned int len;
+        if (value < 8) {
+            len = value + 3;
+        } else {
+            len = (unsigned int)OK_INFLATER_LENGTH_TABLE[value];
+            unsigned int extra_bits = (value >> 2) - 1;
+            if (extra_bits <= 5) {
+                len += (unsigned int)(input_buffer & ((1u << extra_bits) - 1));
+                input_buffer >>= extra_bits;
+                input_buffer_bits -= extra_bits;
+            }
+        }
+
+        // Distance (up to 15 bits) and distance extra bits (up to 13 bits)
+        entry = distance_table[input_buffer & distance_mask];
+        value = entry & VALUE_BIT_MASK;
+        num_bits = entry >> VALUE_BITS;
+        input_buffer >>= num_bits;
+        input_buffer_bits -= num_bits;
+        unsigned int distance;
+        if (value < 4) {
+            distance = value + 1;
+        } else if (value >= (unsigned int)OK_INFLATER_DISTANCE_TABLE_LENGTH) {
+            ok_inflater_error(inflater, "Invalid distance");
+            break;
+        } else {
+            unsigned int extra_bits = (value >> 1) - 1;
+            distance = (unsigned int)OK_INFLATER_DISTANCE_TABLE[value];
+            distance += (unsigned int)(input_buffer & ((1u << extra_bits) - 1));
+            input_buffer >>= extra_bits;
+            input_buffer_bits -= extra_bits;
+        }
+
+        // Copy
+        if (distance > pos) {
+            // The source wraps around the circular buffer (rare)
+            if (!inflater->buffer_wrapped) {
+                ok_inflater_error(inflater, "Invalid distance");
+                break;
+            }
+            inflater->buffer_end_pos = (uint16_t)pos;
+            inflater->state_count = (int)len;
+            inflater->state_distance = (int)distance;
+            ok_inflater_copy_match(inflater);
+            pos = inflater->buffer_end_pos;
+            continue;
+        }
+        uint8_t *dst = buffer + pos;
+        const uint8_t *src = dst - distance;
+        uint8_t *dst_end = dst + len;
+        pos += len;
+        if (distance >= 8) {
+            // Overlapping 8-byte copies. May write up to 7 bytes past dst_end.
+            do {
+                memcpy(dst, src, 8);
+                dst += 8;
+                src += 8;
+            } while (dst < dst_end);
+        } else if (distance == 1) {
+            const uint64_t v = *src * (uint64_t)0x0101010101010101ull;
+            do {
+                memcpy(dst, &v, 8);
+                dst += 8;
+            } while (dst < dst_end);
+        } else {
+            do {
+                *dst++ = *src++;
+            } while (dst < dst_end);
+        }
+    }
+
+    // Return unused whole bytes to the input, so that the state machine (and stored blocks)
+    // continue from the correct position. Only bytes loaded by this function can be returned.
+    unsigned int unused_bytes = min(input_buffer_bits >> 3, (unsigned int)(input - input_start));
+    input -= unused_bytes;
+    input_buffer_bits -= unused_bytes << 3;
+    input_buffer &= ((uint64_t)1 << input_buffer_bits) - 1;
+
+    inflater->input = input;
+    inflater->input_buffer = input_buffer;
+    inflater->input_buffer_bits = input_buffer_bits;
+    inflater->buffer_end_pos = (uint16_t)pos;
+}
+
 static bool ok_inflater_compressed_block(ok_inflater *inflater) {
     const bool is_fixed = inflater->state == OK_INFLATER_STATE_READING_FIXED_COMPRESSED_BLOCK;
     const ok_inflater_huffman_tree *literal_tree =
@@ -1746,6 +3799,16 @@ static bool ok_inflater_compressed_block(ok_inflater *inflater) {
     const uint16_t *tree_lookup_table = literal_tree->lookup_table;
     const unsigned int tree_bits = literal_tree->bits;
     while (max_write > 0) {
+        if (ok_inflater_can_inflate_fast(inflater)) {
+            const ok_inflater_state state = inflater->state;
+            ok_inflater_compressed_block_fast(inflater, literal_tree, distance_tree);
+            if (inflater->state != state) {
+                // End of block or error
+                return inflater->state != OK_INFLATER_STATE_ERROR;
+            }
+            max_write = ok_inflater_can_write_total(inflater);
+            continue;
+        }
         int value = ok_inflater_decode_literal(inflater, tree_lookup_table, tree_bits);
         if (value < 0) {
             // Needs input
@@ -1806,6 +3869,19 @@ static bool ok_inflater_distance_tree(ok_inflater *inflater) {
     }
 }
 
+static bool ok_inflater_adler32(ok_inflater *inflater) {
+    // The Adler-32 checksum follows the final block, most significant byte first
+    while (inflater->state_count < 4) {
+        if (!ok_inflater_load_bits(inflater, 8)) {
+            return false;
+        }
+        inflater->expected_adler = (inflater->expected_adler << 8) | ok_inflater_read_bits(inflater, 8);
+        inflater->state_count++;
+    }
+    inflater->state = OK_INFLATER_STATE_DONE;
+    return true;
+}
+
 static bool ok_inflater_noop(ok_inflater *inflater) {
     (void)inflater;
     return false;
@@ -1824,10 +3900,37 @@ static bool (*OK_INFLATER_STATE_FUNCTIONS[])(ok_inflater *) = {
     ok_inflater_compressed_block,
     ok_inflater_distance,
     ok_inflater_distance,
+    ok_inflater_adler32,
     ok_inflater_noop,
     ok_inflater_noop
 };
 
+// Internal Inflater API (used by the PNG decoder)
+
+static bool ok_inflater_is_done(const ok_inflater *inflater) {
+    return (inflater->state == OK_INFLATER_STATE_DONE &&
+            ok_inflater_can_flush_total(inflater) == 0);
+}
+
+static bool ok_inflater_is_at_flush_point(const ok_inflater *inflater) {
+    return (inflater->state == OK_INFLATER_STATE_READY_FOR_NEXT_BLOCK &&
+            !inflater->final_block &&
+            inflater->input == inflater->input_end &&
+            inflater->input_buffer_bits == 0 &&
+            ok_inflater_can_flush_total(inflater) == 0);
+}
+
+// Returns the Adler-32 of the data inflated so far. Only valid if verify_adler32 is set.
+static uint32_t ok_inflater_get_adler32(const ok_inflater *inflater) {
+    return inflater->adler;
+}
+
+// Returns the number of input bytes that haven't been used, including whole bytes that have been
+// loaded into the bit buffer. Only valid after a byte-aligned point, like the end of the stream.
+static size_t ok_inflater_get_unused_input_length(const ok_inflater *inflater) {
+    return (size_t)(inflater->input_end - inflater->input) + (inflater->input_buffer_bits >> 3);
+}
+
 // Public Inflater API
 
 ok_inflater *ok_inflater_init(bool nowrap, ok_png_allocator allocator, void *allocator_user_data) {
@@ -1839,6 +3942,7 @@ ok_inflater *ok_inflater_init(bool nowrap, ok_png_allocator allocator, void *all
         inflater->allocator_user_data = allocator_user_data;
         inflater->state = (nowrap ? OK_INFLATER_STATE_READY_FOR_NEXT_BLOCK :
                            OK_INFLATER_STATE_READY_FOR_HEAD);
+        inflater->adler = 1;
         inflater->buffer = ok_alloc(inflater, BUFFER_SIZE);
         inflater->code_length_huffman = ok_alloc(inflater, sizeof(ok_inflater_huffman_tree));
         inflater->literal_huffman = ok_alloc(inflater, sizeof(ok_inflater_huffman_tree));
@@ -1864,9 +3968,18 @@ void ok_inflater_reset(ok_inflater *inflater) {
 
         inflater->buffer_start_pos = 0;
         inflater->buffer_end_pos = 0;
+        inflater->buffer_wrapped = false;
         inflater->final_block = false;
         inflater->state = (inflater->nowrap ? OK_INFLATER_STATE_READY_FOR_NEXT_BLOCK :
                            OK_INFLATER_STATE_READY_FOR_HEAD);
+        inflater->adler = 1;
+    }
+}
+
+void ok_inflater_set_verify_adler32(ok_inflater *inflater, bool verify) {
+    if (inflater) {
+        inflater->verify_adler32 = verify;
+        inflater->adler_update = ok_png_get_adler_update_function();
     }
 }
 
@@ -1904,7 +4017,7 @@ void ok_inflater_set_input(ok_inflater *inflater, const uint8_t *buffer, size_t
 
 size_t ok_inflater_inflate(ok_inflater *inflater, uint8_t *dst, size_t dst_len) {
     if (!inflater || inflater->state == OK_INFLATER_STATE_ERROR ||
-        inflater->state == OK_INFLATER_STATE_DONE) {
+        ok_inflater_is_done(inflater)) {
         return OK_SIZE_MAX;
     }
 
@@ -1918,5 +4031,11 @@ size_t ok_inflater_inflate(ok_inflater *inflater, uint8_t *dst, size_t dst_len)
     while (ok_inflater_can_flush_total(inflater) < dst_len &&
            (*OK_INFLATER_STATE_FUNCTIONS[inflater->state])(inflater)) {
     }
-    return ok_inflater_flush(inflater, dst, dst_len);
+    size_t len = ok_inflater_flush(inflater, dst, dst_len);
+    if (inflater->verify_adler32 && !inflater->nowrap && ok_inflater_is_done(inflater) &&
+        inflater->adler != inflater->expected_adler) {
+        ok_inflater_error(inflater, "Invalid Adler-32 checksum");
+        return OK_SIZE_MAX;
+    }
+    return len;
 }
@@ -31,11 +31,16 @@
  * - Supports Apple's proprietary PNG extensions for iOS.
  * - Options to premultiply alpha and flip data vertically.
  * - Option to get image dimensions without decoding.
+ * - Options to verify chunk CRCs and the Adler-32 checksum.
+ * - Option to decode data as it arrives, without blocking (see #ok_png_decoder_feed()).
+ * - Option to read from memory in place, without copying (see #ok_png_read_from_memory()).
+ * - Option to decode a region of the image (see #ok_png_read_region_from_input()).
  * - Returns data in RGBA or BGRA format.
  *
  * Caveats:
  * - No gamma conversion.
- * - No CRC or ADLER32 checks.
+ * - CRC and ADLER32 checks are off by default (see `OK_PNG_VERIFY_CRC` and
+ *   `OK_PNG_VERIFY_ADLER32`).
  * - Ignores all chunks not related to the image.
  *
  * Example:
@@ -73,6 +78,7 @@ typedef enum {
     OK_PNG_ERROR_UNSUPPORTED, // Unsupported PNG file (width > 1073741824)
     OK_PNG_ERROR_ALLOCATION, // Couldn't allocate memory
     OK_PNG_ERROR_IO, // Couldn't read or seek the file
+    OK_PNG_ERROR_CANCELED, // Decoding was stopped by a callback
 } ok_png_error;
 
 /**
@@ -103,7 +109,13 @@ typedef enum {
     /// the last row in the image.
     OK_PNG_FLIP_Y = (1 << 2),
     /// Set to read an image's dimensions and color format without reading the image data.
-    OK_PNG_INFO_ONLY = (1 << 3)
+    OK_PNG_INFO_ONLY = (1 << 3),
+    /// Set to verify the CRC of each chunk. If a CRC doesn't match, decoding fails with
+    /// `OK_PNG_ERROR_INVALID`. By default, CRCs are ignored.
+    OK_PNG_VERIFY_CRC = (1 << 4),
+    /// Set to verify the Adler-32 checksum of the compressed image data. If the checksum doesn't
+    /// match, decoding fails with `OK_PNG_ERROR_INFLATER`. By default, the checksum is ignored.
+    OK_PNG_VERIFY_ADLER32 = (1 << 5)
 } ok_png_decode_flags;
 
 // MARK: Reading from a FILE
@@ -232,6 +244,242 @@ ok_png ok_png_read_from_input(ok_png_decode_flags decode_flags,
                               ok_png_input input_callbacks, void *input_callbacks_user_data,
                               ok_png_allocator allocator, void *allocator_user_data);
 
+/**
+ * Reads a rectangular region of a PNG image, like #ok_png_read_from_input(). On success,
+ * #ok_png.width and #ok_png.height are the size of the region, and #ok_png.data contains only the
+ * region's image data.
+ *
+ * The region is in image coordinates, from the top of the image (before `OK_PNG_FLIP_Y`). If the
+ * region extends past the image, it is clipped.
+ *
+ * Every scanline up to the last row of the region is inflated and unfiltered, but only the pixels
+ * in the region are converted. The image data after the region is skipped.
+ *
+ * @param decode_flags The PNG decode flags. Use `OK_PNG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param region_x The left edge of the region.
+ * @param region_y The top edge of the region.
+ * @param region_width The width of the region. Must be greater than zero.
+ * @param region_height The height of the region. Must be greater than zero.
+ * @param input_callbacks The custom input functions.
+ * @param input_callbacks_user_data The parameter to be passed to the input's `read` and `seek`
+ * functions.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_PNG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @return a #ok_png object. If the region is empty or outside of the image, #ok_png.error_code is
+ * `OK_PNG_ERROR_API`.
+ */
+ok_png ok_png_read_region_from_input(ok_png_decode_flags decode_flags,
+                                     uint32_t region_x, uint32_t region_y,
+                                     uint32_t region_width, uint32_t region_height,
+                                     ok_png_input input_callbacks, void *input_callbacks_user_data,
+                                     ok_png_allocator allocator, void *allocator_user_data);
+
+// MARK: Reading from memory
+
+/**
+ * Reads a PNG image from memory. The compressed image data is read in place, without copying it,
+ * so this function works well with memory-mapped files. On success, #ok_png.data contains the
+ * packed image data, with a size of (`width * height * 4`). On failure, #ok_png.data is `NULL`
+ * and #ok_png.error_code is nonzero.
+ *
+ * The returned `data` must be freed by the caller.
+ *
+ * @param data The PNG file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @param decode_flags The PNG decode flags. Use `OK_PNG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_PNG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @return a #ok_png object.
+ */
+ok_png ok_png_read_from_memory(const uint8_t *data, size_t length,
+                               ok_png_decode_flags decode_flags,
+                               ok_png_allocator allocator, void *allocator_user_data);
+
+// MARK: Reading rows
+
+/**
+ * Receives decoded rows from #ok_png_read_rows().
+ *
+ * @param user_data The parameter that was passed to #ok_png_read_rows().
+ * @param width The image's width, in pixels.
+ * @param height The image's height, in pixels.
+ * @param y The index of the first row in `data`.
+ * @param num_rows The number of rows in `data`.
+ * @param data The decoded rows, in top-to-bottom order (bottom-to-top, if `OK_PNG_FLIP_Y` is set).
+ * The data is only valid until the function returns.
+ * @param stride The stride of `data`, in bytes.
+ * @return `true` to continue decoding, or `false` to stop.
+ */
+typedef bool (*ok_png_rows_func)(void *user_data, uint32_t width, uint32_t height, uint32_t y,
+                                 uint32_t num_rows, const uint8_t *data, uint32_t stride);
+
+/**
+ * Reads a PNG image, sending each row to `rows_func` as soon as it is decoded, instead of
+ * allocating memory for the whole image. Rows are sent in decoding order, which is
+ * top-to-bottom (or bottom-to-top, if `OK_PNG_FLIP_Y` is set).
+ *
+ * For non-interlaced images, the memory used is proportional to the image width, and rows are
+ * sent one at a time. Interlaced images need the whole image in memory, so they are decoded in
+ * full, then sent in strips of up to 16 rows.
+ *
+ * On success, #ok_png.error_code is zero and #ok_png.data is `NULL`. If `rows_func` returns `false`,
+ * #ok_png.error_code is `OK_PNG_ERROR_CANCELED`.
+ *
+ * The allocator's `image_alloc` function is not used.
+ *
+ * @param decode_flags The PNG decode flags. Use `OK_PNG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param input_callbacks The custom input functions.
+ * @param input_callbacks_user_data The parameter to be passed to the input's `read` and `seek` functions.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_PNG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param rows_func The function to receive decoded rows.
+ * @param rows_user_data The parameter to be passed to `rows_func`.
+ * @return a #ok_png object.
+ */
+ok_png ok_png_read_rows(ok_png_decode_flags decode_flags,
+                        ok_png_input input_callbacks, void *input_callbacks_user_data,
+                        ok_png_allocator allocator, void *allocator_user_data,
+                        ok_png_rows_func rows_func, void *rows_user_data);
+
+// MARK: Reading with a thread pool
+
+typedef struct {
+    /**
+     * Runs tasks, possibly concurrently, and returns after all tasks have finished.
+     * Each task is run by calling `task(task_data[i])`, for `i` from 0 to `num_tasks - 1`.
+     *
+     * @param user_data The pointer passed to #ok_png_read_from_input_with_thread_pool().
+     * @param task The task function.
+     * @param task_data The data to pass to each task.
+     * @param num_tasks The number of tasks.
+     */
+    void (*run_tasks)(void *user_data, void (*task)(void *task_data), void **task_data,
+                      size_t num_tasks);
+} ok_png_thread_pool;
+
+/**
+ * Reads a PNG image, using a thread pool to inflate and unfilter parts of the image in parallel.
+ *
+ * The image data is split at zlib "full flush" points, where the compressed data can be
+ * decompressed independently. Parallel encoders like Apple's write PNG files this way. Images
+ * without full flush points are decoded on the calling thread.
+ *
+ * All compressed image data is read into memory before decoding. The allocator's `alloc` and
+ * `free` functions are called from the thread pool's threads, so they must be thread-safe.
+ *
+ * @param decode_flags The PNG decode flags. Use `OK_PNG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param input_callbacks The custom input functions.
+ * @param input_callbacks_user_data The parameter to be passed to the input's `read` and `seek` functions.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_PNG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param thread_pool The thread pool to use.
+ * @param thread_pool_user_data The pointer to pass to the thread pool's `run_tasks` function.
+ * @return a #ok_png object.
+ */
+ok_png ok_png_read_from_input_with_thread_pool(ok_png_decode_flags decode_flags,
+                                               ok_png_input input_callbacks,
+                                               void *input_callbacks_user_data,
+                                               ok_png_allocator allocator,
+                                               void *allocator_user_data,
+                                               ok_png_thread_pool thread_pool,
+                                               void *thread_pool_user_data);
+
+// MARK: Push decoding
+
+/**
+ * A PNG decoder that receives data as it arrives, for example from a network connection,
+ * instead of reading from an input.
+ */
+typedef struct ok_png_decoder ok_png_decoder;
+
+/**
+ * The status returned from #ok_png_decoder_feed().
+ */
+typedef enum {
+    /// All data was consumed, and more data is needed.
+    OK_PNG_DECODER_NEED_MORE_INPUT = 0,
+    /// All data was consumed, and more data is needed. One or more rows were decoded (and sent to
+    /// `rows_func`, if set). Rows of interlaced images are only available when decoding is done.
+    OK_PNG_DECODER_ROWS_AVAILABLE,
+    /// The image is decoded. Any remaining data is ignored.
+    OK_PNG_DECODER_DONE,
+    /// An error occurred. Call #ok_png_decoder_finish() to get the error code.
+    OK_PNG_DECODER_ERROR,
+} ok_png_decoder_status;
+
+/**
+ * Creates a push decoder.
+ *
+ * If `rows_func` is `NULL`, the whole image is decoded, and is returned from
+ * #ok_png_decoder_finish(). Otherwise, rows are sent to `rows_func` as they are decoded, like
+ * #ok_png_read_rows().
+ *
+ * @param decode_flags The PNG decode flags. Use `OK_PNG_COLOR_FORMAT_RGBA` for the most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_PNG_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @param rows_func The function to receive decoded rows, or `NULL`.
+ * @param rows_user_data The parameter to be passed to `rows_func`.
+ * @return The new decoder, or `NULL` if it couldn't be allocated.
+ */
+ok_png_decoder *ok_png_decoder_init(ok_png_decode_flags decode_flags,
+                                    ok_png_allocator allocator, void *allocator_user_data,
+                                    ok_png_rows_func rows_func, void *rows_user_data);
+
+/**
+ * Decodes the next part of the PNG data. The decoder keeps its state between calls, and copies
+ * any partial data it needs, so `data` can be reused after the function returns.
+ *
+ * @param decoder The decoder.
+ * @param data The next part of the PNG data.
+ * @param length The length of the data, in bytes.
+ * @return The decoder status.
+ */
+ok_png_decoder_status ok_png_decoder_feed(ok_png_decoder *decoder, const uint8_t *data,
+                                          size_t length);
+
+/**
+ * Frees the decoder and returns the decoded image.
+ * On success, #ok_png.data contains the packed image data (or is `NULL`, if using `rows_func`).
+ * If decoding failed or is incomplete, #ok_png.data is `NULL` and #ok_png.error_code is nonzero.
+ *
+ * The returned `data` must be freed by the caller.
+ *
+ * @param decoder The decoder.
+ * @return a #ok_png object.
+ */
+ok_png ok_png_decoder_finish(ok_png_decoder *decoder);
+
+// MARK: SIMD
+
+/**
+ * SIMD instruction sets used for decoding. Define `OK_NO_SIMD` to build with portable C code only.
+ */
+typedef enum {
+    /// Use the fastest instruction set supported by the CPU. This is the default.
+    OK_PNG_SIMD_AUTO = 0,
+    /// Use portable C code only.
+    OK_PNG_SIMD_NONE,
+    OK_PNG_SIMD_SSE2,
+    OK_PNG_SIMD_SSSE3,
+    OK_PNG_SIMD_AVX2,
+    OK_PNG_SIMD_NEON,
+} ok_png_simd;
+
+/**
+ * Sets the SIMD instruction set used for decoding. This is a global setting, intended for
+ * testing and benchmarking, and should not be changed while an image is being decoded.
+ *
+ * @param simd The instruction set to use.
+ * @return `true` if the instruction set was compiled in and is supported by the CPU. If `false`,
+ * the setting is unchanged.
+ */
+bool ok_png_set_simd(ok_png_simd simd);
+
 // MARK: Inflater
 
 typedef struct ok_inflater ok_inflater;
@@ -249,6 +497,15 @@ ok_inflater *ok_inflater_init(bool nowrap, ok_png_allocator allocator, void *all
  */
 void ok_inflater_reset(ok_inflater *inflater);
 
+/**
+ * Sets whether the inflater verifies the Adler-32 checksum at the end of the zlib stream. If the
+ * checksum doesn't match, #ok_inflater_inflate() returns `SIZE_MAX`. Has no effect if the inflater
+ * was created with `nowrap`. By default, the checksum is not verified.
+ *
+ * Call this function before inflating, or after #ok_inflater_reset().
+ */
+void ok_inflater_set_verify_adler32(ok_inflater *inflater, bool verify);
+
 /**
  * Returns true if the inflater needs more input.
  */
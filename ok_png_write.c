@@ -28,8 +28,37 @@ static void ok_stdlib_free(void *context, void *memory) {
 // To test splitting output into multiple IDAT chunks, this can be redefined as a smaller value.
 #define OK_PNG_WRITE_CHUNK_MAX_LENGTH 0x7fffffff
 
+// The minimum amount of uncompressed data in each stripe when compressing with a thread pool.
+// The maximum number of stripes is OK_PNG_WRITE_MAX_STRIPES; larger images have larger stripes.
+#define OK_PNG_WRITE_STRIPE_MIN_LENGTH (1024 * 1024)
+#define OK_PNG_WRITE_MAX_STRIPES 256
+
 #define ok_min(a, b) ((a) < (b) ? (a) : (b))
 
+#if !defined(OK_NO_SIMD)
+#  if defined(__x86_64__) || defined(_M_X64) || \
+      ((defined(__i386__) || defined(_M_IX86)) && defined(__SSE2__)) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define OK_PNG_WRITE_USE_SSE
+#    include <emmintrin.h>
+#    include <tmmintrin.h>
+#    include <wmmintrin.h>
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#      include <intrin.h>
+#    endif
+#  elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    define OK_PNG_WRITE_USE_NEON
+#    include <arm_neon.h>
+#  endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define OK_PNG_WRITE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define OK_PNG_WRITE_TARGET(isa)
+#endif
+
 // MARK: PNG write to FILE
 
 #ifndef OK_NO_STDIO
@@ -48,9 +77,52 @@ bool ok_png_write_to_file(FILE *file, ok_png_write_params image_data) {
 
 #endif
 
+// MARK: CPU features
+
+#if defined(OK_PNG_WRITE_USE_SSE)
+
+// Set by ok_cpu_features_initialize()
+static bool ok_cpu_has_pclmul = false;
+static bool ok_cpu_has_ssse3 = false;
+static bool ok_cpu_has_avx2 = false;
+
+#endif
+
+static void ok_cpu_features_initialize(void) {
+#if defined(OK_PNG_WRITE_USE_SSE)
+    static bool ok_cpu_features_initialized = false;
+    if (ok_cpu_features_initialized) {
+        return;
+    }
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    ok_cpu_has_pclmul = (info[2] & (1 << 1)) != 0;
+    ok_cpu_has_ssse3 = (info[2] & (1 << 9)) != 0;
+    const bool os_supports_avx = ((info[2] & (1 << 27)) != 0 &&
+                                  (info[2] & (1 << 28)) != 0 &&
+                                  (_xgetbv(0) & 6) == 6);
+    if (max_leaf >= 7 && os_supports_avx) {
+        __cpuidex(info, 7, 0);
+        ok_cpu_has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    ok_cpu_has_pclmul = __builtin_cpu_supports("pclmul") != 0;
+    ok_cpu_has_ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    ok_cpu_has_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+    ok_cpu_features_initialized = true;
+#endif
+}
+
 // MARK: CRC
 
-static uint32_t ok_crc_table[256];
+// Slice-by-8 tables. ok_crc_table[0] is the standard byte-wise table; ok_crc_table[k] advances
+// the CRC of a byte by k more zero bytes, so eight bytes can be processed per iteration.
+static uint32_t ok_crc_table[8][256];
 
 static void ok_crc_table_initialize(void) {
     static bool ok_crc_table_initialized = false;
@@ -66,16 +138,136 @@ static void ok_crc_table_initialize(void) {
                 c = c >> 1;
             }
         }
-        ok_crc_table[n] = c;
+        ok_crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = ok_crc_table[0][n];
+        for (uint32_t k = 1; k < 8; k++) {
+            c = ok_crc_table[0][c & 0xff] ^ (c >> 8);
+            ok_crc_table[k][n] = c;
+        }
     }
     ok_crc_table_initialized = true;
 }
 
+// The CRC functions below operate on the pre- and post-conditioned value (crc ^ 0xffffffff).
+
+static uint32_t ok_crc_update_scalar(uint32_t c, const uint8_t *buffer, size_t length) {
+    while (length >= 8) {
+        c ^= ((uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+              ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+        c = (ok_crc_table[7][c & 0xff] ^
+             ok_crc_table[6][(c >> 8) & 0xff] ^
+             ok_crc_table[5][(c >> 16) & 0xff] ^
+             ok_crc_table[4][c >> 24] ^
+             ok_crc_table[3][buffer[4]] ^
+             ok_crc_table[2][buffer[5]] ^
+             ok_crc_table[1][buffer[6]] ^
+             ok_crc_table[0][buffer[7]]);
+        buffer += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        c = ok_crc_table[0][(c ^ *buffer++) & 0xff] ^ (c >> 8);
+        length--;
+    }
+    return c;
+}
+
+#if defined(OK_PNG_WRITE_USE_SSE)
+
+// Folds 64 bytes at a time with carry-less multiplication, then reduces to 32 bits with a
+// Barrett reduction. See Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+// Instruction". The constants are for the bit-reflected polynomial 0xedb88320.
+OK_PNG_WRITE_TARGET("pclmul")
+static uint32_t ok_crc_update_pclmul(uint32_t c, const uint8_t *buffer, size_t length) {
+    if (length < 64) {
+        return ok_crc_update_scalar(c, buffer, length);
+    }
+    const __m128i k1k2 = _mm_setr_epi32(0x54442bd4, 0x1, (int)0xc6e41596, 0x1);
+    const __m128i k3k4 = _mm_setr_epi32(0x751997d0, 0x1, (int)0xccaa009e, 0x0);
+    const __m128i k5k0 = _mm_setr_epi32(0x63cd6124, 0x1, 0x0, 0x0);
+    const __m128i poly = _mm_setr_epi32((int)0xdb710641, 0x1, (int)0xf7011641, 0x1);
+    const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buffer + 0));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buffer + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buffer + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buffer + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)c));
+    buffer += 64;
+    length -= 64;
+
+    // Fold 4x128 bits
+    while (length >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buffer + 0)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buffer + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buffer + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buffer + 48)));
+        buffer += 64;
+        length -= 64;
+    }
+
+    // Fold 4x128 bits into 128 bits
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold 128 bits at a time
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buffer)), x5);
+        buffer += 16;
+        length -= 16;
+    }
+
+    // Fold 128 bits into 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    c = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+    return ok_crc_update_scalar(c, buffer, length);
+}
+
+#endif
+
 static void ok_crc_update(uint32_t *crc, const uint8_t *buffer, size_t length) {
     uint32_t c = (*crc) ^ 0xffffffffL;
-    for (uint32_t n = 0; n < length; n++) {
-        c = ok_crc_table[(c ^ buffer[n]) & 0xff] ^ (c >> 8);
+#if defined(OK_PNG_WRITE_USE_SSE)
+    if (ok_cpu_has_pclmul) {
+        c = ok_crc_update_pclmul(c, buffer, length);
+    } else {
+        c = ok_crc_update_scalar(c, buffer, length);
     }
+#else
+    c = ok_crc_update_scalar(c, buffer, length);
+#endif
     *crc = c ^ 0xffffffffL;
 }
 
@@ -151,25 +343,322 @@ typedef struct {
     void *write_function_context;
 } ok_png_deflate_output_buffer;
 
+static uint8_t *ok_png_deflate_output_buffer_get(void *write_context, size_t *capacity) {
+    ok_png_deflate_output_buffer *output_buffer = (ok_png_deflate_output_buffer *)write_context;
+    *capacity = output_buffer->capacity - output_buffer->length;
+    return output_buffer->data + output_buffer->length;
+}
+
 static bool ok_png_deflate_output_buffer_write(void *write_context, const uint8_t *data, size_t length) {
     while (length > 0) {
         ok_png_deflate_output_buffer *output_buffer = (ok_png_deflate_output_buffer *)write_context;
         const size_t copy_length = ok_min(length, output_buffer->capacity - output_buffer->length);
-        memcpy(output_buffer->data + output_buffer->length, data, copy_length);
+        if (data != output_buffer->data + output_buffer->length) {
+            // Data wasn't written in place (see ok_png_deflate_output_buffer_get)
+            memcpy(output_buffer->data + output_buffer->length, data, copy_length);
+        }
         output_buffer->length += copy_length;
         data += copy_length;
         length -= copy_length;
         if (output_buffer->length == output_buffer->capacity) {
-            ok_png_chunk_write("IDAT", output_buffer->data, output_buffer->length,
-                               output_buffer->write_function, output_buffer->write_function_context);
+            if (!ok_png_chunk_write("IDAT", output_buffer->data, output_buffer->length,
+                                    output_buffer->write_function, output_buffer->write_function_context)) {
+                return false;
+            }
             output_buffer->length = 0;
         }
     }
     return true;
 }
 
+// MARK: PNG filters
+//
+// Unlike decoding, each filtered byte only depends on unfiltered bytes, so all filters are
+// vectorized across the entire row. Each function returns the sum of the absolute values of the
+// filtered bytes, treated as signed values.
+
+#define OK_PNG_WRITE_NUM_FILTERS 5
+
+static inline uint8_t ok_png_write_paeth(uint8_t a, uint8_t b, uint8_t c) {
+    const int p = a + b - c;
+    const int pa = p > a ? p - a : a - p;
+    const int pb = p > b ? p - b : b - p;
+    const int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc) {
+        return a;
+    } else if (pb <= pc) {
+        return b;
+    } else {
+        return c;
+    }
+}
+
+static inline uint8_t ok_png_write_filter_byte(uint8_t filter_type, uint8_t x, uint8_t a, uint8_t b, uint8_t c) {
+    switch (filter_type) {
+        case 0: default:
+            return x;
+        case 1:
+            return (uint8_t)(x - a);
+        case 2:
+            return (uint8_t)(x - b);
+        case 3:
+            return (uint8_t)(x - ((a + b) >> 1));
+        case 4:
+            return (uint8_t)(x - ok_png_write_paeth(a, b, c));
+    }
+}
+
+// Filters bytes from `start` to `end`. Bytes before `bpp` use zero for the previous pixel.
+static uint64_t ok_png_write_filter_row_range(uint8_t filter_type, uint8_t *dst, const uint8_t *src,
+                                              const uint8_t *prev, size_t start, size_t end, uint8_t bpp) {
+    uint64_t sum = 0;
+    for (size_t i = start; i < end; i++) {
+        const uint8_t a = i >= bpp ? src[i - bpp] : 0;
+        const uint8_t c = i >= bpp ? prev[i - bpp] : 0;
+        const uint8_t v = ok_png_write_filter_byte(filter_type, src[i], a, prev[i], c);
+        dst[i] = v;
+        sum += v < 128 ? v : 256 - v;
+    }
+    return sum;
+}
+
+#if defined(OK_PNG_WRITE_USE_SSE)
+
+static inline __m128i ok_png_write_abs_epi16_sse2(const __m128i x) {
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i ok_png_write_paeth_epi16_sse2(const __m128i a, const __m128i b, const __m128i c) {
+    // Ties go to a, then b, then c.
+    const __m128i pa = ok_png_write_abs_epi16_sse2(_mm_sub_epi16(b, c));
+    const __m128i pb = ok_png_write_abs_epi16_sse2(_mm_sub_epi16(a, c));
+    const __m128i pc = ok_png_write_abs_epi16_sse2(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));
+    const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    const __m128i use_a = _mm_cmpeq_epi16(smallest, pa);
+    const __m128i use_b = _mm_cmpeq_epi16(smallest, pb);
+    const __m128i b_or_c = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+    return _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, b_or_c));
+}
+
+static uint64_t ok_png_write_filter_row(uint8_t filter_type, uint8_t *dst, const uint8_t *src,
+                                        const uint8_t *prev, size_t length, uint8_t bpp) {
+    const size_t start = ok_min(bpp, length);
+    uint64_t sum = ok_png_write_filter_row_range(filter_type, dst, src, prev, 0, start, bpp);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i sums = zero;
+    size_t i = start;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(const void *)(src + i));
+        __m128i v;
+        if (filter_type == 0) {
+            v = x;
+        } else if (filter_type == 1) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(src + i - bpp));
+            v = _mm_sub_epi8(x, a);
+        } else if (filter_type == 2) {
+            const __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(prev + i));
+            v = _mm_sub_epi8(x, b);
+        } else if (filter_type == 3) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(src + i - bpp));
+            const __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(prev + i));
+            // _mm_avg_epu8 rounds up, so subtract the low bit of (a ^ b) to round down
+            const __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            v = _mm_sub_epi8(x, avg);
+        } else {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(src + i - bpp));
+            const __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(prev + i));
+            const __m128i c = _mm_loadu_si128((const __m128i *)(const void *)(prev + i - bpp));
+            const __m128i lo = ok_png_write_paeth_epi16_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                                             _mm_unpacklo_epi8(c, zero));
+            const __m128i hi = ok_png_write_paeth_epi16_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                                             _mm_unpackhi_epi8(c, zero));
+            v = _mm_sub_epi8(x, _mm_packus_epi16(lo, hi));
+        }
+        _mm_storeu_si128((__m128i *)(void *)(dst + i), v);
+        const __m128i abs_v = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(abs_v, zero));
+    }
+    uint64_t sums64[2];
+    _mm_storeu_si128((__m128i *)(void *)sums64, sums);
+    sum += sums64[0] + sums64[1];
+    return sum + ok_png_write_filter_row_range(filter_type, dst, src, prev, i, length, bpp);
+}
+
+#elif defined(OK_PNG_WRITE_USE_NEON)
+
+static inline uint8x8_t ok_png_write_paeth_neon(const uint8x8_t a, const uint8x8_t b, const uint8x8_t c) {
+    // Ties go to a, then b, then c.
+    const uint16x8_t pa = vabdl_u8(b, c);
+    const uint16x8_t pb = vabdl_u8(a, c);
+    const uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+    const uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+    const uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+    return vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+}
+
+static uint64_t ok_png_write_filter_row(uint8_t filter_type, uint8_t *dst, const uint8_t *src,
+                                        const uint8_t *prev, size_t length, uint8_t bpp) {
+    const size_t start = ok_min(bpp, length);
+    uint64_t sum = ok_png_write_filter_row_range(filter_type, dst, src, prev, 0, start, bpp);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uint32x4_t sums = vdupq_n_u32(0);
+    size_t i = start;
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t x = vld1q_u8(src + i);
+        uint8x16_t v;
+        if (filter_type == 0) {
+            v = x;
+        } else if (filter_type == 1) {
+            v = vsubq_u8(x, vld1q_u8(src + i - bpp));
+        } else if (filter_type == 2) {
+            v = vsubq_u8(x, vld1q_u8(prev + i));
+        } else if (filter_type == 3) {
+            v = vsubq_u8(x, vhaddq_u8(vld1q_u8(src + i - bpp), vld1q_u8(prev + i)));
+        } else {
+            const uint8x16_t a = vld1q_u8(src + i - bpp);
+            const uint8x16_t b = vld1q_u8(prev + i);
+            const uint8x16_t c = vld1q_u8(prev + i - bpp);
+            const uint8x8_t lo = ok_png_write_paeth_neon(vget_low_u8(a), vget_low_u8(b), vget_low_u8(c));
+            const uint8x8_t hi = ok_png_write_paeth_neon(vget_high_u8(a), vget_high_u8(b), vget_high_u8(c));
+            v = vsubq_u8(x, vcombine_u8(lo, hi));
+        }
+        vst1q_u8(dst + i, v);
+        const uint8x16_t abs_v = vminq_u8(v, vsubq_u8(zero, v));
+        sums = vpadalq_u16(sums, vpaddlq_u8(abs_v));
+    }
+    const uint64x2_t sums64 = vpaddlq_u32(sums);
+    sum += vgetq_lane_u64(sums64, 0) + vgetq_lane_u64(sums64, 1);
+    return sum + ok_png_write_filter_row_range(filter_type, dst, src, prev, i, length, bpp);
+}
+
+#else
+
+static uint64_t ok_png_write_filter_row(uint8_t filter_type, uint8_t *dst, const uint8_t *src,
+                                        const uint8_t *prev, size_t length, uint8_t bpp) {
+    return ok_png_write_filter_row_range(filter_type, dst, src, prev, 0, length, bpp);
+}
+
+#endif
+
 // MARK: PNG write
 
+static inline const uint8_t *ok_png_write_get_row(const ok_png_write_params *params, uint32_t y) {
+    if (params->flip_y) {
+        return params->data + (params->height - 1 - y) * params->data_stride;
+    } else {
+        return params->data + y * params->data_stride;
+    }
+}
+
+static uint32_t ok_adler_init(void);
+static uint32_t ok_adler_update(const uint32_t adler, const uint8_t *buffer, size_t length);
+static bool ok_png_write_idat_stripes(const ok_png_write_params *params, uint64_t bytes_per_row, bool nowrap,
+                                      ok_png_deflate_output_buffer *deflate_output_buffer);
+
+static bool ok_png_write_count(void *write_context, const uint8_t *data, size_t length) {
+    (void)data;
+    *(size_t *)write_context += length;
+    return true;
+}
+
+// Filters and deflates rows y_start to y_end (exclusive). If y_end is the last row, the stream is
+// finished. Otherwise, the stream ends at a full flush point. If adler is not NULL, it is updated
+// with the uncompressed data.
+static bool ok_png_write_idat(const ok_png_write_params *params, uint64_t bytes_per_row, bool nowrap,
+                              uint32_t y_start, uint32_t y_end,
+                              bool (*write)(void *write_context, const uint8_t *data, size_t length),
+                              uint8_t *(*get_write_buffer)(void *write_context, size_t *capacity),
+                              void *write_context, uint32_t *adler) {
+    const uint8_t bits_per_pixel = params->bit_depth * ok_color_type_channels(params->color_type);
+    const uint8_t bpp = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+    const size_t length = (size_t)bytes_per_row;
+    const bool adaptive = (params->filter == OK_PNG_WRITE_FILTER_MIN_SUM ||
+                           params->filter == OK_PNG_WRITE_FILTER_BRUTE_FORCE);
+    
+    // Create deflater and buffers: two filtered rows (each with a leading filter type byte),
+    // and a row of zeros used as the row before the first row
+    size_t trial_length = 0;
+    ok_deflate *trial_deflate = NULL;
+    ok_deflate *deflate = ok_deflate_init((ok_deflate_params){
+        .nowrap = nowrap,
+        .compression_level = params->compression_level,
+        .alloc = params->alloc,
+        .free = params->free,
+        .allocator_context = params->allocator_context,
+        .write = write,
+        .get_write_buffer = get_write_buffer,
+        .write_context = write_context,
+    });
+    uint8_t *buffer = params->alloc(params->allocator_context, (length + 1) * 2 + length);
+    if (params->filter == OK_PNG_WRITE_FILTER_BRUTE_FORCE) {
+        trial_deflate = ok_deflate_init((ok_deflate_params){
+            .nowrap = true,
+            .compression_level = params->compression_level,
+            .alloc = params->alloc,
+            .free = params->free,
+            .allocator_context = params->allocator_context,
+            .write = ok_png_write_count,
+            .write_context = &trial_length,
+        });
+    }
+    bool success = (deflate != NULL && buffer != NULL &&
+                    (params->filter != OK_PNG_WRITE_FILTER_BRUTE_FORCE || trial_deflate != NULL));
+    uint8_t *filtered_rows[2] = { buffer, buffer + length + 1 };
+    const uint8_t *zero_row = buffer + (length + 1) * 2;
+    if (success) {
+        memset(buffer + (length + 1) * 2, 0, length);
+    }
+    
+    // Filter and deflate data, one row at a time
+    const bool is_final_stripe = y_end == params->height;
+    for (uint32_t y = y_start; success && y < y_end; y++) {
+        const uint8_t *src = ok_png_write_get_row(params, y);
+        const uint8_t *prev = y > 0 ? ok_png_write_get_row(params, y - 1) : zero_row;
+        uint8_t *row;
+        if (!adaptive) {
+            row = filtered_rows[0];
+            row[0] = (uint8_t)(params->filter - OK_PNG_WRITE_FILTER_NONE);
+            ok_png_write_filter_row(row[0], row + 1, src, prev, length, bpp);
+        } else {
+            // The first row of a stripe uses None or Sub, so it doesn't depend on the previous stripe
+            const uint8_t num_filters = y == y_start && y > 0 ? 2 : OK_PNG_WRITE_NUM_FILTERS;
+            uint64_t best_score = UINT64_MAX;
+            int best = 0;
+            int curr = 0;
+            for (uint8_t filter_type = 0; success && filter_type < num_filters; filter_type++) {
+                row = filtered_rows[curr];
+                row[0] = filter_type;
+                uint64_t score = ok_png_write_filter_row(filter_type, row + 1, src, prev, length, bpp);
+                if (trial_deflate) {
+                    trial_length = 0;
+                    success = ok_deflate_data(trial_deflate, row, length + 1, true);
+                    score = trial_length;
+                }
+                if (score < best_score) {
+                    best_score = score;
+                    best = curr;
+                    curr ^= 1;
+                }
+            }
+            row = filtered_rows[best];
+        }
+        success = success && ok_deflate_data(deflate, row, length + 1, is_final_stripe && y == y_end - 1);
+        if (adler) {
+            *adler = ok_adler_update(*adler, row, length + 1);
+        }
+    }
+    if (success && !is_final_stripe) {
+        success = ok_deflate_flush(deflate);
+    }
+    if (buffer) {
+        params->free(params->allocator_context, buffer);
+    }
+    ok_deflate_free(trial_deflate);
+    ok_deflate_free(deflate);
+    return success;
+}
+
 bool ok_png_write(ok_png_write_function write_function, void *write_function_context, ok_png_write_params params) {
     // Set default parameters
     if (params.bit_depth == 0) {
@@ -178,6 +667,16 @@ bool ok_png_write(ok_png_write_function write_function, void *write_function_con
     if (params.buffer_size == 0) {
         params.buffer_size = 0x10000;
     }
+    if (params.compression_level == 0) {
+        params.compression_level = 6;
+    }
+    if (params.filter == OK_PNG_WRITE_FILTER_DEFAULT) {
+        if (params.color_type == OK_PNG_WRITE_COLOR_TYPE_PALETTE || params.bit_depth < 8) {
+            params.filter = OK_PNG_WRITE_FILTER_NONE;
+        } else {
+            params.filter = OK_PNG_WRITE_FILTER_MIN_SUM;
+        }
+    }
     const uint8_t bits_per_pixel = params.bit_depth * ok_color_type_channels(params.color_type);
     const uint64_t bytes_per_row = ((uint64_t)params.width * bits_per_pixel + 7) / 8;
     if (params.data_stride == 0) {
@@ -206,10 +705,13 @@ bool ok_png_write(ok_png_write_function write_function, void *write_function_con
         ok_assert(params.data_stride >= bytes_per_row); // stride is too small
         ok_assert(valid_bit_depth);
         ok_assert(params.buffer_size <= OK_PNG_WRITE_CHUNK_MAX_LENGTH); // buffer too large
+        ok_assert(params.compression_level <= 9);
+        ok_assert(params.filter <= OK_PNG_WRITE_FILTER_BRUTE_FORCE);
         ok_assert(write_function != NULL);
         if (params.width == 0 || params.height == 0 || params.data == NULL ||
             params.data_stride < bytes_per_row || !valid_bit_depth ||
-            params.buffer_size > OK_PNG_WRITE_CHUNK_MAX_LENGTH ||
+            params.buffer_size > OK_PNG_WRITE_CHUNK_MAX_LENGTH || params.compression_level > 9 ||
+            params.filter > OK_PNG_WRITE_FILTER_BRUTE_FORCE ||
             write_function == NULL) {
             return false;
         }
@@ -360,8 +862,9 @@ bool ok_png_write(ok_png_write_function write_function, void *write_function_con
         }
     }
     
-    // Initialize CRC table
+    // Initialize CRC table and detect SIMD support
     ok_crc_table_initialize();
+    ok_cpu_features_initialize();
 
     // Write PNG signature
     const uint8_t png_signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
@@ -415,34 +918,15 @@ bool ok_png_write(ok_png_write_function write_function, void *write_function_con
             return false;
         }
         
-        // Create deflater
-        ok_deflate *deflate = ok_deflate_init((ok_deflate_params){
-            .nowrap = params.apple_cgbi_format || custom_cgbi_chunk,
-            .alloc = params.alloc,
-            .free = params.free,
-            .allocator_context = params.allocator_context,
-            .write = ok_png_deflate_output_buffer_write,
-            .write_context = &deflate_output_buffer,
-        });
-        if (deflate == NULL) {
-            params.free(params.allocator_context, deflate_output_buffer.data);
-            return false;
-        }
-       
-        // Deflate data, one row at a time. Write a IDAT chunk when deflate_output_buffer is full
-        bool idat_success = true;
-        for (uint32_t y = 0; idat_success && y < params.height; y++) {
-            const uint8_t filter = 0;
-            const uint8_t *src;
-            if (params.flip_y) {
-                src = params.data + (params.height - 1 - y) * params.data_stride;
-            } else {
-                src = params.data + y * params.data_stride;
-            }
-            idat_success &= ok_deflate_data(deflate, &filter, 1, false);
-            idat_success &= ok_deflate_data(deflate, src, bytes_per_row, y == params.height - 1);
+        const bool nowrap = params.apple_cgbi_format || custom_cgbi_chunk;
+        bool idat_success;
+        if (params.run_tasks) {
+            idat_success = ok_png_write_idat_stripes(&params, bytes_per_row, nowrap, &deflate_output_buffer);
+        } else {
+            idat_success = ok_png_write_idat(&params, bytes_per_row, nowrap, 0, params.height,
+                                             ok_png_deflate_output_buffer_write, ok_png_deflate_output_buffer_get,
+                                             &deflate_output_buffer, NULL);
         }
-        ok_deflate_free(deflate);
         
         // Write final IDAT chunk
         if (idat_success && deflate_output_buffer.length > 0) {
@@ -465,7 +949,7 @@ static uint32_t ok_adler_init(void) {
     return 1;
 }
 
-static uint32_t ok_adler_update(const uint32_t adler, const uint8_t *buffer, size_t length) {
+static uint32_t ok_adler_update_scalar(const uint32_t adler, const uint8_t *buffer, size_t length) {
     static const uint32_t adler_base = 65521;
     static const size_t adler_max_run_length = 5552;
     
@@ -495,81 +979,322 @@ static uint32_t ok_adler_update(const uint32_t adler, const uint8_t *buffer, siz
     return (adler_sum2 << 16) | adler_sum1;
 }
 
+#if defined(OK_PNG_WRITE_USE_SSE)
+
+// The SIMD functions process blocks of 32 bytes. For each block, sum1 is increased by the sum of
+// the bytes, and sum2 is increased by 32 * sum1 (before the block) plus the sum of each byte
+// multiplied by its distance from the end of the block (32, 31, ... 1).
+// At most 5552 bytes are summed before the modulo, as in the scalar function.
+
+OK_PNG_WRITE_TARGET("ssse3")
+static uint32_t ok_adler_update_ssse3(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    const __m128i taps1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                        24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i taps2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    while (num_blocks > 0) {
+        const size_t n = ok_min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        // v_prev_sum1 is the sum of sum1 before each block; it's multiplied by 32 at the end
+        __m128i v_prev_sum1 = _mm_cvtsi32_si128((int)(adler_sum1 * n));
+        __m128i v_sum1 = zero;
+        __m128i v_sum2 = _mm_cvtsi32_si128((int)adler_sum2);
+        for (size_t i = 0; i < n; i++) {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buffer);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buffer + 16));
+            v_prev_sum1 = _mm_add_epi32(v_prev_sum1, v_sum1);
+            v_sum1 = _mm_add_epi32(v_sum1, _mm_sad_epu8(bytes1, zero));
+            v_sum1 = _mm_add_epi32(v_sum1, _mm_sad_epu8(bytes2, zero));
+            v_sum2 = _mm_add_epi32(v_sum2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, taps1), ones));
+            v_sum2 = _mm_add_epi32(v_sum2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, taps2), ones));
+            buffer += 32;
+        }
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_slli_epi32(v_prev_sum1, 5));
+
+        // Horizontal sums
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        adler_sum1 = (adler_sum1 + (uint32_t)_mm_cvtsi128_si32(v_sum1)) % adler_base;
+        adler_sum2 = (uint32_t)_mm_cvtsi128_si32(v_sum2) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+OK_PNG_WRITE_TARGET("avx2")
+static uint32_t ok_adler_update_avx2(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                          24, 23, 22, 21, 20, 19, 18, 17,
+                                          16, 15, 14, 13, 12, 11, 10, 9,
+                                          8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    while (num_blocks > 0) {
+        const size_t n = ok_min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        __m256i v_prev_sum1 = _mm256_setr_epi32((int)(adler_sum1 * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_sum1 = zero;
+        __m256i v_sum2 = _mm256_setr_epi32((int)adler_sum2, 0, 0, 0, 0, 0, 0, 0);
+        for (size_t i = 0; i < n; i++) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)buffer);
+            v_prev_sum1 = _mm256_add_epi32(v_prev_sum1, v_sum1);
+            v_sum1 = _mm256_add_epi32(v_sum1, _mm256_sad_epu8(bytes, zero));
+            v_sum2 = _mm256_add_epi32(v_sum2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, taps), ones));
+            buffer += 32;
+        }
+        v_sum2 = _mm256_add_epi32(v_sum2, _mm256_slli_epi32(v_prev_sum1, 5));
+
+        // Horizontal sums
+        __m128i sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_sum1), _mm256_extracti128_si256(v_sum1, 1));
+        __m128i sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_sum2), _mm256_extracti128_si256(v_sum2, 1));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        adler_sum1 = (adler_sum1 + (uint32_t)_mm_cvtsi128_si32(sum1)) % adler_base;
+        adler_sum2 = (uint32_t)_mm_cvtsi128_si32(sum2) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+#elif defined(OK_PNG_WRITE_USE_NEON)
+
+static uint32_t ok_adler_update_neon(const uint32_t adler, const uint8_t *buffer, size_t length) {
+    static const uint32_t adler_base = 65521;
+    static const size_t adler_max_blocks = 5552 / 32;
+    static const uint16_t taps[32] = {
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    };
+
+    uint32_t adler_sum1 = adler & 0xffff;
+    uint32_t adler_sum2 = (adler >> 16) & 0xffff;
+    size_t num_blocks = length / 32;
+    length -= num_blocks * 32;
+
+    while (num_blocks > 0) {
+        const size_t n = ok_min(num_blocks, adler_max_blocks);
+        num_blocks -= n;
+
+        // Sums of each byte position (at most 173 * 255, so 16 bits is enough)
+        uint16x8_t v_column_sum1 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum2 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum3 = vdupq_n_u16(0);
+        uint16x8_t v_column_sum4 = vdupq_n_u16(0);
+        uint32x4_t v_prev_sum1 = vsetq_lane_u32((uint32_t)(adler_sum1 * n), vdupq_n_u32(0), 0);
+        uint32x4_t v_sum1 = vdupq_n_u32(0);
+        for (size_t i = 0; i < n; i++) {
+            const uint8x16_t bytes1 = vld1q_u8(buffer);
+            const uint8x16_t bytes2 = vld1q_u8(buffer + 16);
+            v_prev_sum1 = vaddq_u32(v_prev_sum1, v_sum1);
+            v_sum1 = vpadalq_u16(v_sum1, vpadalq_u8(vpaddlq_u8(bytes1), bytes2));
+            v_column_sum1 = vaddw_u8(v_column_sum1, vget_low_u8(bytes1));
+            v_column_sum2 = vaddw_u8(v_column_sum2, vget_high_u8(bytes1));
+            v_column_sum3 = vaddw_u8(v_column_sum3, vget_low_u8(bytes2));
+            v_column_sum4 = vaddw_u8(v_column_sum4, vget_high_u8(bytes2));
+            buffer += 32;
+        }
+        uint32x4_t v_sum2 = vshlq_n_u32(v_prev_sum1, 5);
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum1), vld1_u16(taps + 0));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum1), vld1_u16(taps + 4));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum2), vld1_u16(taps + 8));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum2), vld1_u16(taps + 12));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum3), vld1_u16(taps + 16));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum3), vld1_u16(taps + 20));
+        v_sum2 = vmlal_u16(v_sum2, vget_low_u16(v_column_sum4), vld1_u16(taps + 24));
+        v_sum2 = vmlal_u16(v_sum2, vget_high_u16(v_column_sum4), vld1_u16(taps + 28));
+
+        // Horizontal sums
+        const uint32x2_t sum1 = vpadd_u32(vget_low_u32(v_sum1), vget_high_u32(v_sum1));
+        const uint32x2_t sum2 = vpadd_u32(vget_low_u32(v_sum2), vget_high_u32(v_sum2));
+        const uint32x2_t sums = vpadd_u32(sum1, sum2);
+        adler_sum1 = (adler_sum1 + vget_lane_u32(sums, 0)) % adler_base;
+        adler_sum2 = (adler_sum2 + vget_lane_u32(sums, 1)) % adler_base;
+    }
+    return ok_adler_update_scalar((adler_sum2 << 16) | adler_sum1, buffer, length);
+}
+
+#endif
+
+static uint32_t ok_adler_update(const uint32_t adler, const uint8_t *buffer, size_t length) {
+#if defined(OK_PNG_WRITE_USE_SSE)
+    if (length >= 64) {
+        if (ok_cpu_has_avx2) {
+            return ok_adler_update_avx2(adler, buffer, length);
+        } else if (ok_cpu_has_ssse3) {
+            return ok_adler_update_ssse3(adler, buffer, length);
+        }
+    }
+#elif defined(OK_PNG_WRITE_USE_NEON)
+    if (length >= 64) {
+        return ok_adler_update_neon(adler, buffer, length);
+    }
+#endif
+    return ok_adler_update_scalar(adler, buffer, length);
+}
+
+// Returns the Adler-32 of two concatenated buffers, given the Adler-32 of each buffer and the length
+// of the second buffer (like zlib's adler32_combine).
+static uint32_t ok_adler_combine(const uint32_t adler1, const uint32_t adler2, uint64_t length2) {
+    static const uint32_t adler_base = 65521;
+    
+    const uint32_t rem = (uint32_t)(length2 % adler_base);
+    uint32_t adler_sum1 = adler1 & 0xffff;
+    uint32_t adler_sum2 = (rem * adler_sum1) % adler_base;
+    adler_sum1 += (adler2 & 0xffff) + adler_base - 1;
+    adler_sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + adler_base - rem;
+    if (adler_sum1 >= adler_base) {
+        adler_sum1 -= adler_base;
+    }
+    if (adler_sum1 >= adler_base) {
+        adler_sum1 -= adler_base;
+    }
+    if (adler_sum2 >= (adler_base << 1)) {
+        adler_sum2 -= (adler_base << 1);
+    }
+    if (adler_sum2 >= adler_base) {
+        adler_sum2 -= adler_base;
+    }
+    return (adler_sum2 << 16) | adler_sum1;
+}
 
 // MARK: Deflate
 
 #define OK_DEFLATE_BUFFER_LENGTH 0xffff
-//#define OK_DEFLATE_BLOCK_TYPE_NO_COMPRESSION 0
+#define OK_DEFLATE_OUTPUT_BUFFER_LENGTH 0x4000
+#define OK_DEFLATE_MIN_WRITE_BUFFER_LENGTH 64
+#define OK_DEFLATE_BLOCK_TYPE_NO_COMPRESSION 0
 #define OK_DEFLATE_BLOCK_TYPE_FIXED_HUFFMAN 1
-//#define OK_DEFLATE_BLOCK_TYPE_DYNAMIC_HUFFMAN 2
+#define OK_DEFLATE_BLOCK_TYPE_DYNAMIC_HUFFMAN 2
+
+typedef struct ok_deflate_lz77 ok_deflate_lz77;
 
 struct ok_deflate {
     ok_deflate_params params;
+    ok_deflate_lz77 *lz77; // NULL for level 1 (RLE)
     bool header_written;
     uint32_t adler;
-    uint32_t bit_buffer;
+    uint64_t bit_buffer;
     uint8_t bit_buffer_length;
+    
+    // Output: either output_buffer or a buffer from params.get_write_buffer
+    uint8_t *output;
+    size_t output_length;
+    size_t output_capacity;
+    uint8_t output_buffer[OK_DEFLATE_OUTPUT_BUFFER_LENGTH];
+    
     uint16_t buffer_length;
     uint8_t buffer[OK_DEFLATE_BUFFER_LENGTH];
 };
 
-ok_deflate *ok_deflate_init(ok_deflate_params params) {
-#ifndef OK_NO_DEFAULT_ALLOCATOR
-    if (params.alloc == NULL && params.free == NULL) {
-        params.alloc = ok_stdlib_alloc;
-        params.free = ok_stdlib_free;
+// Writes all output to the write function and releases the output buffer
+static bool ok_deflate_output_flush(ok_deflate *deflate) {
+    bool success = true;
+    if (deflate->output_length > 0) {
+        success = deflate->params.write(deflate->params.write_context, deflate->output, deflate->output_length);
     }
-#endif
-    bool has_allocator = params.alloc != NULL && params.free != NULL;
-    ok_assert(has_allocator);
-    if (!has_allocator) {
-        return NULL;
+    deflate->output = NULL;
+    deflate->output_length = 0;
+    deflate->output_capacity = 0;
+    return success;
+}
+
+// Ensures at least `length` bytes are available in the output buffer.
+// The length must be OK_DEFLATE_MIN_WRITE_BUFFER_LENGTH or less.
+static inline bool ok_deflate_output_reserve(ok_deflate *deflate, size_t length) {
+    if (deflate->output_capacity - deflate->output_length >= length) {
+        return true;
     }
-    
-    bool has_write_function = params.write != NULL;
-    ok_assert(has_write_function);
-    if (!has_write_function) {
-        return NULL;
+    if (!ok_deflate_output_flush(deflate)) {
+        return false;
     }
-
-    ok_deflate *deflate = params.alloc(params.allocator_context, sizeof(ok_deflate));
-    if (deflate) {
-        deflate->params = params;
-        deflate->header_written = false;
-        deflate->adler = ok_adler_init();
-        deflate->bit_buffer = 0;
-        deflate->bit_buffer_length = 0;
-        deflate->buffer_length = 0;
+    uint8_t *output = NULL;
+    size_t capacity = 0;
+    if (deflate->params.get_write_buffer) {
+        output = deflate->params.get_write_buffer(deflate->params.write_context, &capacity);
     }
-    return deflate;
+    if (output == NULL || capacity < OK_DEFLATE_MIN_WRITE_BUFFER_LENGTH) {
+        output = deflate->output_buffer;
+        capacity = sizeof(deflate->output_buffer);
+    }
+    deflate->output = output;
+    deflate->output_capacity = capacity;
+    return true;
 }
 
 static bool ok_deflate_bit_buffer_flush(ok_deflate *deflate) {
     while (deflate->bit_buffer_length >= 8) {
-        uint8_t v = deflate->bit_buffer & 0xff;
-        if (!deflate->params.write(deflate->params.write_context, &v, 1)) {
+        if (!ok_deflate_output_reserve(deflate, 1)) {
             return false;
         }
+        deflate->output[deflate->output_length++] = (uint8_t)deflate->bit_buffer;
         deflate->bit_buffer >>= 8;
         deflate->bit_buffer_length -= 8;
     }
     return true;
 }
 
-static bool ok_deflate_write_bits(ok_deflate *deflate, uint32_t value, uint8_t bits) {
-    ok_assert(deflate->bit_buffer_length + bits <= 32);
-    deflate->bit_buffer |= value << deflate->bit_buffer_length;
+static inline bool ok_deflate_write_bits(ok_deflate *deflate, uint32_t value, uint8_t bits) {
+    ok_assert(bits <= 32);
+    deflate->bit_buffer |= (uint64_t)value << deflate->bit_buffer_length;
     deflate->bit_buffer_length += bits;
-    return ok_deflate_bit_buffer_flush(deflate);
+    if (deflate->bit_buffer_length >= 32) {
+        if (!ok_deflate_output_reserve(deflate, 4)) {
+            return false;
+        }
+        uint8_t *output = deflate->output + deflate->output_length;
+        const uint32_t v = (uint32_t)deflate->bit_buffer;
+        output[0] = (uint8_t)v;
+        output[1] = (uint8_t)(v >> 8);
+        output[2] = (uint8_t)(v >> 16);
+        output[3] = (uint8_t)(v >> 24);
+        deflate->output_length += 4;
+        deflate->bit_buffer >>= 32;
+        deflate->bit_buffer_length -= 32;
+    }
+    return true;
 }
 
-static bool ok_deflate_write_byte_align(ok_deflate *deflate) {
-    uint8_t b = deflate->bit_buffer_length & 7;
-    if (b == 0) {
-        return ok_deflate_bit_buffer_flush(deflate);
-    } else {
-        return ok_deflate_write_bits(deflate, 0, 8 - b);
+// Writes bytes. The output must be byte-aligned.
+static bool ok_deflate_write_bytes(ok_deflate *deflate, const uint8_t *data, size_t length) {
+    ok_assert(deflate->bit_buffer_length == 0);
+    while (length > 0) {
+        if (!ok_deflate_output_reserve(deflate, 1)) {
+            return false;
+        }
+        const size_t copy_length = ok_min(length, deflate->output_capacity - deflate->output_length);
+        memcpy(deflate->output + deflate->output_length, data, copy_length);
+        deflate->output_length += copy_length;
+        data += copy_length;
+        length -= copy_length;
     }
+    return true;
+}
+
+static bool ok_deflate_write_byte_align(ok_deflate *deflate) {
+    // Pad with zero bits
+    deflate->bit_buffer_length = (deflate->bit_buffer_length + 7) & ~7;
+    return ok_deflate_bit_buffer_flush(deflate);
 }
 
 static uint16_t ok_deflate_reverse_bits(uint16_t value, uint8_t num_bits) {
@@ -672,10 +1397,7 @@ static bool ok_deflate_write_rle_block(ok_deflate *deflate, const uint8_t *buffe
     return success && ok_deflate_write_fixed_huffman_code(deflate, 256);
 }
 
-#if 0
-
 static bool ok_deflate_write_stored_block(ok_deflate *deflate, const uint8_t *buffer, uint16_t buffer_length, bool is_final) {
-    ok_assert(buffer_length <= 0xffff);
     const uint8_t block_length[4] = {
         (buffer_length & 0xff), (buffer_length >> 8),
         ((~buffer_length) & 0xff), ((~buffer_length) >> 8),
@@ -684,56 +1406,866 @@ static bool ok_deflate_write_stored_block(ok_deflate *deflate, const uint8_t *bu
     success &= ok_deflate_write_bits(deflate, is_final ? 1 : 0, 1); // final block flag
     success &= ok_deflate_write_bits(deflate, OK_DEFLATE_BLOCK_TYPE_NO_COMPRESSION, 2);
     success &= ok_deflate_write_byte_align(deflate);
-    success &= deflate->params.write(deflate->params.write_context, block_length, sizeof(block_length));
-    success &= deflate->params.write(deflate->params.write_context, buffer, buffer_length);
+    success &= ok_deflate_write_bytes(deflate, block_length, sizeof(block_length));
+    success &= ok_deflate_write_bytes(deflate, buffer, buffer_length);
     return success;
 }
 
-#endif
+static void ok_deflate_zlib_header(uint8_t compression_level, uint8_t zlib_header_buffer[2]) {
+    // RFC 1950
+    const uint16_t zlib_compression_info = 7; // 4 bits
+    const uint16_t zlib_compression_method = 8; // 4 bits
+    const uint16_t zlib_flag_compression_level = (compression_level <= 1 ? 0 : // 2 bits
+                                                  compression_level <= 5 ? 1 :
+                                                  compression_level == 6 ? 2 : 3);
+    const uint16_t zlib_flag_dict = 0; // 1 bit
+    const uint16_t zlib_raw_header = ((zlib_compression_info << 12) |
+                                      (zlib_compression_method << 8) |
+                                      (zlib_flag_compression_level << 6) |
+                                      (zlib_flag_dict << 5));
+    const uint16_t zlib_flag_check = 31 - (zlib_raw_header % 31); // 5 bits (ensure zlib_header is divisible by 31)
+    const uint16_t zlib_header = zlib_raw_header | zlib_flag_check;
+    ok_uint16_to_bytes(zlib_header, zlib_header_buffer);
+}
 
-bool ok_deflate_data(ok_deflate *deflate, const uint8_t *data, size_t length, bool is_final) {
-    do {
-        const uint8_t *current_buffer;
-        uint16_t current_buffer_length;
-        if (deflate->buffer_length == 0 && (length >= OK_DEFLATE_BUFFER_LENGTH || is_final)) {
-            // Deflate data directly without copying to buffer
-            current_buffer = data;
-            current_buffer_length = (uint16_t)ok_min(length, OK_DEFLATE_BUFFER_LENGTH);
-            data += current_buffer_length;
-            length -= current_buffer_length;
-        } else {
-            // Copy to buffer
-            if (length > 0) {
-                size_t copy_length = ok_min(length, sizeof(deflate->buffer) - deflate->buffer_length);
-                memcpy(deflate->buffer + deflate->buffer_length, data, copy_length);
-                deflate->buffer_length += copy_length;
-                data += copy_length;
-                length -= copy_length;
-            }
-            current_buffer = deflate->buffer;
-            current_buffer_length = deflate->buffer_length;
+static bool ok_deflate_write_header(ok_deflate *deflate) {
+    if (!deflate->header_written && !deflate->params.nowrap) {
+        uint8_t zlib_header_buffer[2];
+        ok_deflate_zlib_header(deflate->params.compression_level, zlib_header_buffer);
+        if (!ok_deflate_write_bytes(deflate, zlib_header_buffer, sizeof(zlib_header_buffer))) {
+            return false;
         }
-        
-        const bool is_final_write = length == 0 && is_final;
-        if (current_buffer_length == OK_DEFLATE_BUFFER_LENGTH || is_final_write) {
-            // Write zlib header (RFC 1950)
-            if (!deflate->header_written && !deflate->params.nowrap) {
-                const uint16_t zlib_compression_info = 7; // 4 bits
-                const uint16_t zlib_compression_method = 8; // 4 bits
-                const uint16_t zlib_flag_compression_level = 0; // 2 bits
-                const uint16_t zlib_flag_dict = 0; // 1 bit
-                const uint16_t zlib_raw_header = ((zlib_compression_info << 12) |
-                                                  (zlib_compression_method << 8) |
-                                                  (zlib_flag_compression_level << 6) |
-                                                  (zlib_flag_dict << 5));
-                const uint16_t zlib_flag_check = 31 - (zlib_raw_header % 31); // 5 bits (ensure zlib_header is divisible by 31)
-                const uint16_t zlib_header = zlib_raw_header | zlib_flag_check;
-                uint8_t zlib_header_buffer[2];
-                ok_uint16_to_bytes(zlib_header, zlib_header_buffer);
-                if (!deflate->params.write(deflate->params.write_context, zlib_header_buffer, sizeof(zlib_header_buffer))) {
-                    return false;
-                }
-                deflate->header_written = true;
+        deflate->header_written = true;
+    }
+    return true;
+}
+
+static bool ok_deflate_write_footer(ok_deflate *deflate) {
+    // RFC 1950
+    if (!ok_deflate_write_byte_align(deflate)) {
+        return false;
+    }
+    if (!deflate->params.nowrap) {
+        uint8_t footer[4];
+        ok_uint32_to_bytes(deflate->adler, footer);
+        if (!ok_deflate_write_bytes(deflate, footer, sizeof(footer))) {
+            return false;
+        }
+    }
+    
+    // Reset
+    deflate->header_written = false;
+    deflate->adler = ok_adler_init();
+    return ok_deflate_output_flush(deflate);
+}
+
+// MARK: Deflate LZ77 (compression levels 2 to 9)
+
+#define OK_DEFLATE_WINDOW_SIZE 0x8000
+#define OK_DEFLATE_WINDOW_MASK (OK_DEFLATE_WINDOW_SIZE - 1)
+#define OK_DEFLATE_HASH_BITS 15
+#define OK_DEFLATE_HASH_SIZE (1 << OK_DEFLATE_HASH_BITS)
+#define OK_DEFLATE_MIN_MATCH 3
+#define OK_DEFLATE_MAX_MATCH 258
+#define OK_DEFLATE_MIN_LOOKAHEAD (OK_DEFLATE_MAX_MATCH + OK_DEFLATE_MIN_MATCH + 1)
+#define OK_DEFLATE_TOO_FAR 4096
+#define OK_DEFLATE_MAX_TOKENS 0x8000
+#define OK_DEFLATE_NUM_LITERAL_CODES 288
+#define OK_DEFLATE_NUM_DISTANCE_CODES 30
+#define OK_DEFLATE_NUM_CODE_LENGTH_CODES 19
+#define OK_DEFLATE_MAX_CODE_LENGTH 15
+#define OK_DEFLATE_MAX_CODE_LENGTH_CODE_LENGTH 7
+
+typedef struct {
+    uint16_t good_length; // Reduce the search when the previous match is at least this long
+    uint16_t max_lazy; // Lazy: don't search when the previous match is this long. Greedy: max insert length
+    uint16_t nice_length; // Stop searching when a match is at least this long
+    uint16_t max_chain; // Maximum hash chain length to search
+    bool lazy;
+} ok_deflate_config;
+
+// Same parameters as zlib's levels 2 to 9. Level 1 is RLE (see ok_deflate_write_rle_block).
+static const ok_deflate_config ok_deflate_configs[10] = {
+    { 0, 0, 0, 0, false }, // Unused
+    { 0, 0, 0, 0, false }, // Unused (RLE)
+    { 4, 5, 16, 8, false },
+    { 4, 6, 32, 32, false },
+    { 4, 4, 16, 16, true },
+    { 8, 16, 32, 32, true },
+    { 8, 16, 128, 128, true },
+    { 8, 32, 128, 256, true },
+    { 32, 128, 258, 1024, true },
+    { 32, 258, 258, 4096, true },
+};
+
+static const uint16_t ok_deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t ok_deflate_length_extra_bits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t ok_deflate_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t ok_deflate_distance_extra_bits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t ok_deflate_code_length_order[OK_DEFLATE_NUM_CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+struct ok_deflate_lz77 {
+    ok_deflate_config config;
+    
+    // Window. Data is appended at window_end. When the window is full, the upper half is moved
+    // to the lower half.
+    uint8_t window[2 * OK_DEFLATE_WINDOW_SIZE];
+    uint32_t window_end;
+    uint32_t strstart;
+    
+    // Hash chains. Positions are window offsets; 0 means no position.
+    uint16_t head[OK_DEFLATE_HASH_SIZE];
+    uint16_t prev[OK_DEFLATE_WINDOW_SIZE];
+    
+    // Lazy matching state
+    uint16_t match_length;
+    uint16_t prev_length;
+    int32_t match_start;
+    int32_t prev_match;
+    bool match_available;
+    
+    // Current block
+    uint32_t block_start;
+    uint32_t block_length;
+    uint32_t num_tokens;
+    uint64_t extra_bits;
+    uint32_t literal_freqs[OK_DEFLATE_NUM_LITERAL_CODES];
+    uint32_t distance_freqs[OK_DEFLATE_NUM_DISTANCE_CODES];
+    uint16_t token_values[OK_DEFLATE_MAX_TOKENS]; // Literal or match length
+    uint16_t token_distances[OK_DEFLATE_MAX_TOKENS]; // 0 for literals
+    
+    // Lookup tables
+    uint8_t length_codes[OK_DEFLATE_MAX_MATCH + 1];
+    uint8_t distance_codes[512];
+};
+
+static void ok_deflate_lz77_init(ok_deflate_lz77 *lz77, uint8_t compression_level) {
+    lz77->config = ok_deflate_configs[compression_level];
+    lz77->window_end = 0;
+    lz77->strstart = 0;
+    lz77->match_length = OK_DEFLATE_MIN_MATCH - 1;
+    lz77->prev_length = OK_DEFLATE_MIN_MATCH - 1;
+    lz77->match_start = 0;
+    lz77->prev_match = 0;
+    lz77->match_available = false;
+    lz77->block_start = 0;
+    lz77->block_length = 0;
+    lz77->num_tokens = 0;
+    lz77->extra_bits = 0;
+    memset(lz77->literal_freqs, 0, sizeof(lz77->literal_freqs));
+    memset(lz77->distance_freqs, 0, sizeof(lz77->distance_freqs));
+    memset(lz77->head, 0, sizeof(lz77->head));
+    memset(lz77->prev, 0, sizeof(lz77->prev));
+    
+    for (uint8_t code = 0; code < 29; code++) {
+        const uint16_t end = code == 28 ? 259 : ok_deflate_length_base[code + 1];
+        for (uint16_t length = ok_deflate_length_base[code]; length < end; length++) {
+            lz77->length_codes[length] = code;
+        }
+    }
+    // Distances 1..256 map directly; larger distances map by (distance - 1) >> 7
+    for (uint8_t code = 0; code < 30; code++) {
+        const uint32_t start = ok_deflate_distance_base[code] - 1;
+        const uint32_t end = code == 29 ? 32768 : ok_deflate_distance_base[code + 1] - 1u;
+        for (uint32_t d = start; d < end; d++) {
+            if (d < 256) {
+                lz77->distance_codes[d] = code;
+            } else {
+                lz77->distance_codes[256 + (d >> 7)] = code;
+            }
+        }
+    }
+}
+
+static inline uint8_t ok_deflate_lz77_distance_code(const ok_deflate_lz77 *lz77, uint16_t distance) {
+    const uint16_t d = distance - 1;
+    return d < 256 ? lz77->distance_codes[d] : lz77->distance_codes[256 + (d >> 7)];
+}
+
+static inline uint32_t ok_deflate_lz77_hash(const uint8_t *data) {
+    const uint32_t v = ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+    return (v * 0x9e3779b1u) >> (32 - OK_DEFLATE_HASH_BITS);
+}
+
+// Inserts the string at strstart into the hash chains, and returns the previous head of the chain.
+static inline uint16_t ok_deflate_lz77_insert(ok_deflate_lz77 *lz77, uint32_t position) {
+    const uint32_t hash = ok_deflate_lz77_hash(lz77->window + position);
+    const uint16_t hash_head = lz77->head[hash];
+    lz77->prev[position & OK_DEFLATE_WINDOW_MASK] = hash_head;
+    lz77->head[hash] = (uint16_t)position;
+    return hash_head;
+}
+
+static uint16_t ok_deflate_lz77_longest_match(ok_deflate_lz77 *lz77, uint32_t cur_match, uint16_t prev_length) {
+    const uint8_t *scan = lz77->window + lz77->strstart;
+    const uint32_t limit = lz77->strstart > OK_DEFLATE_WINDOW_SIZE ? lz77->strstart - OK_DEFLATE_WINDOW_SIZE : 0;
+    const uint32_t max_length = ok_min(OK_DEFLATE_MAX_MATCH, lz77->window_end - lz77->strstart);
+    const uint32_t nice_length = ok_min(lz77->config.nice_length, max_length);
+    uint32_t chain_length = lz77->config.max_chain;
+    uint32_t best_length = prev_length;
+    if (best_length >= max_length) {
+        return 0;
+    }
+    if (prev_length >= lz77->config.good_length) {
+        chain_length >>= 2;
+    }
+    
+    do {
+        const uint8_t *match = lz77->window + cur_match;
+        if (match[best_length] == scan[best_length] && match[0] == scan[0] && match[1] == scan[1]) {
+            uint32_t length = 2;
+            while (length < max_length && match[length] == scan[length]) {
+                length++;
+            }
+            if (length > best_length) {
+                best_length = length;
+                lz77->match_start = (int32_t)cur_match;
+                if (length >= nice_length) {
+                    break;
+                }
+            }
+        }
+        cur_match = lz77->prev[cur_match & OK_DEFLATE_WINDOW_MASK];
+    } while (cur_match > limit && --chain_length > 0);
+    
+    return best_length > prev_length ? (uint16_t)best_length : 0;
+}
+
+// Moves the upper half of the window to the lower half
+static void ok_deflate_lz77_slide(ok_deflate_lz77 *lz77) {
+    memcpy(lz77->window, lz77->window + OK_DEFLATE_WINDOW_SIZE, OK_DEFLATE_WINDOW_SIZE);
+    lz77->window_end -= OK_DEFLATE_WINDOW_SIZE;
+    lz77->strstart -= OK_DEFLATE_WINDOW_SIZE;
+    lz77->block_start -= OK_DEFLATE_WINDOW_SIZE;
+    lz77->match_start -= OK_DEFLATE_WINDOW_SIZE;
+    lz77->prev_match -= OK_DEFLATE_WINDOW_SIZE;
+    for (size_t i = 0; i < OK_DEFLATE_HASH_SIZE; i++) {
+        const uint16_t v = lz77->head[i];
+        lz77->head[i] = v >= OK_DEFLATE_WINDOW_SIZE ? v - OK_DEFLATE_WINDOW_SIZE : 0;
+    }
+    for (size_t i = 0; i < OK_DEFLATE_WINDOW_SIZE; i++) {
+        const uint16_t v = lz77->prev[i];
+        lz77->prev[i] = v >= OK_DEFLATE_WINDOW_SIZE ? v - OK_DEFLATE_WINDOW_SIZE : 0;
+    }
+}
+
+// MARK: Deflate Huffman codes
+
+// Creates length-limited Huffman code lengths. At least two codes are created, so that every
+// tree is complete.
+static void ok_deflate_huffman_lengths(const uint32_t *freqs, uint16_t num_symbols, uint8_t max_length,
+                                       uint8_t *lengths) {
+    uint16_t symbols[OK_DEFLATE_NUM_LITERAL_CODES];
+    uint32_t weights[2 * OK_DEFLATE_NUM_LITERAL_CODES];
+    uint16_t parents[2 * OK_DEFLATE_NUM_LITERAL_CODES];
+    uint16_t length_counts[OK_DEFLATE_MAX_CODE_LENGTH + 1];
+    
+    // Sort used symbols by frequency (insertion sort, stable)
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < num_symbols; i++) {
+        lengths[i] = 0;
+        if (freqs[i] > 0) {
+            uint16_t j = n++;
+            while (j > 0 && freqs[symbols[j - 1]] > freqs[i]) {
+                symbols[j] = symbols[j - 1];
+                j--;
+            }
+            symbols[j] = i;
+        }
+    }
+    if (n < 2) {
+        // Use symbols 0 and 1 (or the one used symbol and another)
+        const uint16_t used = n == 1 ? symbols[0] : 0;
+        lengths[used] = 1;
+        lengths[used == 0 ? 1 : 0] = 1;
+        return;
+    }
+    
+    // Build tree with two queues: sorted leaves (0..n-1) and internal nodes (n..2n-2)
+    for (uint16_t i = 0; i < n; i++) {
+        weights[i] = freqs[symbols[i]];
+    }
+    uint16_t next_leaf = 0;
+    uint16_t next_node = n;
+    for (uint16_t node = n; node < 2 * n - 1; node++) {
+        uint16_t children[2];
+        for (int c = 0; c < 2; c++) {
+            if (next_leaf < n && (next_node >= node || weights[next_leaf] <= weights[next_node])) {
+                children[c] = next_leaf++;
+            } else {
+                children[c] = next_node++;
+            }
+        }
+        weights[node] = weights[children[0]] + weights[children[1]];
+        parents[children[0]] = node;
+        parents[children[1]] = node;
+    }
+    
+    // Depths (reuse weights). Lengths longer than max_length are shortened, then the Kraft sum is fixed
+    // by lengthening other codes.
+    memset(length_counts, 0, sizeof(length_counts));
+    weights[2 * n - 2] = 0;
+    for (int node = 2 * n - 3; node >= 0; node--) {
+        weights[node] = weights[parents[node]] + 1;
+        if (node < n) {
+            length_counts[ok_min(weights[node], max_length)]++;
+        }
+    }
+    uint32_t total = 0;
+    for (uint8_t i = 1; i <= max_length; i++) {
+        total += (uint32_t)length_counts[i] << (max_length - i);
+    }
+    while (total > (1u << max_length)) {
+        length_counts[max_length]--;
+        for (uint8_t i = max_length - 1; i > 0; i--) {
+            if (length_counts[i] > 0) {
+                length_counts[i]--;
+                length_counts[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    
+    // Assign lengths, longest codes to the least frequent symbols
+    uint16_t i = 0;
+    for (uint8_t length = max_length; length > 0; length--) {
+        for (uint16_t count = length_counts[length]; count > 0; count--) {
+            lengths[symbols[i++]] = length;
+        }
+    }
+}
+
+// Creates canonical Huffman codes (RFC 1951 section 3.2.2). The codes are bit-reversed for output.
+static void ok_deflate_huffman_codes(const uint8_t *lengths, uint16_t num_symbols, uint16_t *codes) {
+    uint16_t length_counts[OK_DEFLATE_MAX_CODE_LENGTH + 1] = { 0 };
+    uint16_t next_code[OK_DEFLATE_MAX_CODE_LENGTH + 1];
+    for (uint16_t i = 0; i < num_symbols; i++) {
+        length_counts[lengths[i]]++;
+    }
+    length_counts[0] = 0;
+    uint16_t code = 0;
+    for (uint8_t bits = 1; bits <= OK_DEFLATE_MAX_CODE_LENGTH; bits++) {
+        code = (code + length_counts[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (uint16_t i = 0; i < num_symbols; i++) {
+        const uint8_t length = lengths[i];
+        codes[i] = length == 0 ? 0 : ok_deflate_reverse_bits(next_code[length]++, length);
+    }
+}
+
+static void ok_deflate_fixed_huffman_lengths(uint8_t *literal_lengths, uint8_t *distance_lengths) {
+    // RFC 1951 section 3.2.6.
+    for (uint16_t i = 0; i < OK_DEFLATE_NUM_LITERAL_CODES; i++) {
+        literal_lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+    }
+    for (uint16_t i = 0; i < OK_DEFLATE_NUM_DISTANCE_CODES; i++) {
+        distance_lengths[i] = 5;
+    }
+}
+
+// MARK: Deflate LZ77 blocks
+
+typedef struct {
+    uint8_t literal_lengths[OK_DEFLATE_NUM_LITERAL_CODES];
+    uint8_t distance_lengths[OK_DEFLATE_NUM_DISTANCE_CODES];
+    uint16_t literal_codes[OK_DEFLATE_NUM_LITERAL_CODES];
+    uint16_t distance_codes[OK_DEFLATE_NUM_DISTANCE_CODES];
+    
+    // Dynamic header
+    uint16_t num_literal_codes;
+    uint16_t num_distance_codes;
+    uint8_t num_code_length_codes;
+    uint8_t code_length_lengths[OK_DEFLATE_NUM_CODE_LENGTH_CODES];
+    uint16_t code_length_codes[OK_DEFLATE_NUM_CODE_LENGTH_CODES];
+    uint16_t num_code_length_symbols;
+    uint8_t code_length_symbols[OK_DEFLATE_NUM_LITERAL_CODES + OK_DEFLATE_NUM_DISTANCE_CODES];
+    uint8_t code_length_extra[OK_DEFLATE_NUM_LITERAL_CODES + OK_DEFLATE_NUM_DISTANCE_CODES];
+} ok_deflate_huffman_block;
+
+static uint64_t ok_deflate_huffman_data_bits(const ok_deflate_lz77 *lz77, const uint8_t *literal_lengths,
+                                             const uint8_t *distance_lengths) {
+    uint64_t bits = lz77->extra_bits;
+    for (uint16_t i = 0; i < OK_DEFLATE_NUM_LITERAL_CODES; i++) {
+        bits += (uint64_t)lz77->literal_freqs[i] * literal_lengths[i];
+    }
+    for (uint16_t i = 0; i < OK_DEFLATE_NUM_DISTANCE_CODES; i++) {
+        bits += (uint64_t)lz77->distance_freqs[i] * distance_lengths[i];
+    }
+    return bits;
+}
+
+// Creates the dynamic Huffman codes and header for the current block, and returns the size of the
+// header, in bits.
+static uint64_t ok_deflate_dynamic_huffman_init(const ok_deflate_lz77 *lz77, ok_deflate_huffman_block *block) {
+    ok_deflate_huffman_lengths(lz77->literal_freqs, 286, OK_DEFLATE_MAX_CODE_LENGTH, block->literal_lengths);
+    block->literal_lengths[286] = 0;
+    block->literal_lengths[287] = 0;
+    ok_deflate_huffman_lengths(lz77->distance_freqs, OK_DEFLATE_NUM_DISTANCE_CODES, OK_DEFLATE_MAX_CODE_LENGTH,
+                               block->distance_lengths);
+    
+    block->num_literal_codes = 286;
+    while (block->num_literal_codes > 257 && block->literal_lengths[block->num_literal_codes - 1] == 0) {
+        block->num_literal_codes--;
+    }
+    block->num_distance_codes = OK_DEFLATE_NUM_DISTANCE_CODES;
+    while (block->num_distance_codes > 1 && block->distance_lengths[block->num_distance_codes - 1] == 0) {
+        block->num_distance_codes--;
+    }
+    
+    // Run-length encode the code lengths (RFC 1951 section 3.2.7.)
+    // The RFC allows a run to continue from the literal lengths into the distance lengths, but
+    // some inflaters (including ok_png's) decode the two sets separately, so runs stop at the end
+    // of the literal lengths.
+    uint8_t lengths[OK_DEFLATE_NUM_LITERAL_CODES + OK_DEFLATE_NUM_DISTANCE_CODES];
+    const uint16_t num_lengths = block->num_literal_codes + block->num_distance_codes;
+    memcpy(lengths, block->literal_lengths, block->num_literal_codes);
+    memcpy(lengths + block->num_literal_codes, block->distance_lengths, block->num_distance_codes);
+    uint32_t code_length_freqs[OK_DEFLATE_NUM_CODE_LENGTH_CODES] = { 0 };
+    uint64_t extra_bits = 0;
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < num_lengths;) {
+        const uint8_t length = lengths[i];
+        const uint16_t run_end = (i < block->num_literal_codes ? block->num_literal_codes : num_lengths);
+        uint16_t run = 1;
+        while (i + run < run_end && lengths[i + run] == length) {
+            run++;
+        }
+        i += run;
+        if (length == 0) {
+            while (run >= 11) {
+                const uint16_t r = ok_min(run, 138);
+                block->code_length_symbols[n] = 18;
+                block->code_length_extra[n++] = (uint8_t)(r - 11);
+                extra_bits += 7;
+                run -= r;
+            }
+            if (run >= 3) {
+                block->code_length_symbols[n] = 17;
+                block->code_length_extra[n++] = (uint8_t)(run - 3);
+                extra_bits += 3;
+                run = 0;
+            }
+        } else {
+            block->code_length_symbols[n] = length;
+            block->code_length_extra[n++] = 0;
+            run--;
+            while (run >= 3) {
+                const uint16_t r = ok_min(run, 6);
+                block->code_length_symbols[n] = 16;
+                block->code_length_extra[n++] = (uint8_t)(r - 3);
+                extra_bits += 2;
+                run -= r;
+            }
+        }
+        while (run-- > 0) {
+            block->code_length_symbols[n] = length;
+            block->code_length_extra[n++] = 0;
+        }
+    }
+    block->num_code_length_symbols = n;
+    for (uint16_t i = 0; i < n; i++) {
+        code_length_freqs[block->code_length_symbols[i]]++;
+    }
+    ok_deflate_huffman_lengths(code_length_freqs, OK_DEFLATE_NUM_CODE_LENGTH_CODES,
+                               OK_DEFLATE_MAX_CODE_LENGTH_CODE_LENGTH, block->code_length_lengths);
+    block->num_code_length_codes = OK_DEFLATE_NUM_CODE_LENGTH_CODES;
+    while (block->num_code_length_codes > 4 &&
+           block->code_length_lengths[ok_deflate_code_length_order[block->num_code_length_codes - 1]] == 0) {
+        block->num_code_length_codes--;
+    }
+    
+    uint64_t bits = 5 + 5 + 4 + 3 * block->num_code_length_codes + extra_bits;
+    for (uint16_t i = 0; i < OK_DEFLATE_NUM_CODE_LENGTH_CODES; i++) {
+        bits += (uint64_t)code_length_freqs[i] * block->code_length_lengths[i];
+    }
+    return bits;
+}
+
+static bool ok_deflate_write_dynamic_huffman_header(ok_deflate *deflate, ok_deflate_huffman_block *block) {
+    ok_deflate_huffman_codes(block->code_length_lengths, OK_DEFLATE_NUM_CODE_LENGTH_CODES, block->code_length_codes);
+    bool success = (ok_deflate_write_bits(deflate, block->num_literal_codes - 257u, 5) &&
+                    ok_deflate_write_bits(deflate, block->num_distance_codes - 1u, 5) &&
+                    ok_deflate_write_bits(deflate, block->num_code_length_codes - 4u, 4));
+    for (uint8_t i = 0; success && i < block->num_code_length_codes; i++) {
+        success = ok_deflate_write_bits(deflate, block->code_length_lengths[ok_deflate_code_length_order[i]], 3);
+    }
+    for (uint16_t i = 0; success && i < block->num_code_length_symbols; i++) {
+        const uint8_t symbol = block->code_length_symbols[i];
+        success = ok_deflate_write_bits(deflate, block->code_length_codes[symbol], block->code_length_lengths[symbol]);
+        if (success && symbol >= 16) {
+            const uint8_t extra_bits_count = symbol == 16 ? 2 : (symbol == 17 ? 3 : 7);
+            success = ok_deflate_write_bits(deflate, block->code_length_extra[i], extra_bits_count);
+        }
+    }
+    return success;
+}
+
+static bool ok_deflate_write_tokens(ok_deflate *deflate, const ok_deflate_huffman_block *block) {
+    const ok_deflate_lz77 *lz77 = deflate->lz77;
+    bool success = true;
+    for (uint32_t i = 0; success && i < lz77->num_tokens; i++) {
+        const uint16_t value = lz77->token_values[i];
+        const uint16_t distance = lz77->token_distances[i];
+        if (distance == 0) {
+            success = ok_deflate_write_bits(deflate, block->literal_codes[value], block->literal_lengths[value]);
+        } else {
+            const uint8_t length_code = lz77->length_codes[value];
+            const uint8_t distance_code = ok_deflate_lz77_distance_code(lz77, distance);
+            const uint8_t length_extra_bits = ok_deflate_length_extra_bits[length_code];
+            const uint8_t distance_extra_bits = ok_deflate_distance_extra_bits[distance_code];
+            success = (ok_deflate_write_bits(deflate, block->literal_codes[257 + length_code],
+                                             block->literal_lengths[257 + length_code]) &&
+                       (length_extra_bits == 0 ||
+                        ok_deflate_write_bits(deflate, value - ok_deflate_length_base[length_code],
+                                              length_extra_bits)) &&
+                       ok_deflate_write_bits(deflate, block->distance_codes[distance_code],
+                                             block->distance_lengths[distance_code]) &&
+                       (distance_extra_bits == 0 ||
+                        ok_deflate_write_bits(deflate, distance - ok_deflate_distance_base[distance_code],
+                                              distance_extra_bits)));
+        }
+    }
+    return success && ok_deflate_write_bits(deflate, block->literal_codes[256], block->literal_lengths[256]);
+}
+
+// Writes the current block as a dynamic Huffman, fixed Huffman, or stored block, whichever is smallest.
+static bool ok_deflate_lz77_write_block(ok_deflate *deflate, bool is_final) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    ok_deflate_huffman_block block;
+    lz77->literal_freqs[256] = 1;
+    
+    const uint64_t dynamic_bits = (ok_deflate_dynamic_huffman_init(lz77, &block) +
+                                   ok_deflate_huffman_data_bits(lz77, block.literal_lengths, block.distance_lengths));
+    uint8_t fixed_literal_lengths[OK_DEFLATE_NUM_LITERAL_CODES];
+    uint8_t fixed_distance_lengths[OK_DEFLATE_NUM_DISTANCE_CODES];
+    ok_deflate_fixed_huffman_lengths(fixed_literal_lengths, fixed_distance_lengths);
+    const uint64_t fixed_bits = ok_deflate_huffman_data_bits(lz77, fixed_literal_lengths, fixed_distance_lengths);
+    const uint64_t num_stored_blocks = lz77->block_length / 0xffff + 1;
+    const uint64_t stored_bits = num_stored_blocks * (7 + 32) + lz77->block_length * 8;
+    
+    bool success;
+    if (stored_bits <= fixed_bits && stored_bits <= dynamic_bits) {
+        const uint8_t *data = lz77->window + lz77->block_start;
+        uint32_t remaining = lz77->block_length;
+        do {
+            const uint16_t length = (uint16_t)ok_min(remaining, 0xffff);
+            remaining -= length;
+            success = ok_deflate_write_stored_block(deflate, data, length, is_final && remaining == 0);
+            data += length;
+        } while (success && remaining > 0);
+    } else {
+        if (fixed_bits <= dynamic_bits) {
+            memcpy(block.literal_lengths, fixed_literal_lengths, sizeof(fixed_literal_lengths));
+            memcpy(block.distance_lengths, fixed_distance_lengths, sizeof(fixed_distance_lengths));
+            success = (ok_deflate_write_bits(deflate, is_final ? 1 : 0, 1) &&
+                       ok_deflate_write_bits(deflate, OK_DEFLATE_BLOCK_TYPE_FIXED_HUFFMAN, 2));
+        } else {
+            success = (ok_deflate_write_bits(deflate, is_final ? 1 : 0, 1) &&
+                       ok_deflate_write_bits(deflate, OK_DEFLATE_BLOCK_TYPE_DYNAMIC_HUFFMAN, 2) &&
+                       ok_deflate_write_dynamic_huffman_header(deflate, &block));
+        }
+        ok_deflate_huffman_codes(block.literal_lengths, OK_DEFLATE_NUM_LITERAL_CODES, block.literal_codes);
+        ok_deflate_huffman_codes(block.distance_lengths, OK_DEFLATE_NUM_DISTANCE_CODES, block.distance_codes);
+        success = success && ok_deflate_write_tokens(deflate, &block);
+    }
+    
+    // Reset block
+    lz77->block_start += lz77->block_length;
+    lz77->block_length = 0;
+    lz77->num_tokens = 0;
+    lz77->extra_bits = 0;
+    memset(lz77->literal_freqs, 0, sizeof(lz77->literal_freqs));
+    memset(lz77->distance_freqs, 0, sizeof(lz77->distance_freqs));
+    return success;
+}
+
+static inline bool ok_deflate_lz77_literal(ok_deflate *deflate, uint8_t value) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    lz77->token_values[lz77->num_tokens] = value;
+    lz77->token_distances[lz77->num_tokens] = 0;
+    lz77->num_tokens++;
+    lz77->literal_freqs[value]++;
+    lz77->block_length++;
+    return lz77->num_tokens < OK_DEFLATE_MAX_TOKENS || ok_deflate_lz77_write_block(deflate, false);
+}
+
+static inline bool ok_deflate_lz77_match(ok_deflate *deflate, uint16_t distance, uint16_t length) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    const uint8_t length_code = lz77->length_codes[length];
+    const uint8_t distance_code = ok_deflate_lz77_distance_code(lz77, distance);
+    lz77->token_values[lz77->num_tokens] = length;
+    lz77->token_distances[lz77->num_tokens] = distance;
+    lz77->num_tokens++;
+    lz77->literal_freqs[257 + length_code]++;
+    lz77->distance_freqs[distance_code]++;
+    lz77->extra_bits += ok_deflate_length_extra_bits[length_code] + ok_deflate_distance_extra_bits[distance_code];
+    lz77->block_length += length;
+    return lz77->num_tokens < OK_DEFLATE_MAX_TOKENS || ok_deflate_lz77_write_block(deflate, false);
+}
+
+// MARK: Deflate LZ77 matching
+
+// Greedy matching. Processes the window until the lookahead is too small, unless flushing.
+static bool ok_deflate_lz77_greedy(ok_deflate *deflate, bool flush) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    while (lz77->strstart < lz77->window_end) {
+        const uint32_t lookahead = lz77->window_end - lz77->strstart;
+        if (lookahead < OK_DEFLATE_MIN_LOOKAHEAD && !flush) {
+            break;
+        }
+        uint16_t match_length = 0;
+        if (lookahead >= OK_DEFLATE_MIN_MATCH) {
+            const uint16_t hash_head = ok_deflate_lz77_insert(lz77, lz77->strstart);
+            if (hash_head != 0 && lz77->strstart - hash_head <= OK_DEFLATE_WINDOW_SIZE) {
+                match_length = ok_deflate_lz77_longest_match(lz77, hash_head, OK_DEFLATE_MIN_MATCH - 1);
+            }
+        }
+        if (match_length >= OK_DEFLATE_MIN_MATCH) {
+            const uint16_t distance = (uint16_t)(lz77->strstart - (uint32_t)lz77->match_start);
+            if (!ok_deflate_lz77_match(deflate, distance, match_length)) {
+                return false;
+            }
+            const uint32_t end = lz77->strstart + match_length;
+            if (match_length <= lz77->config.max_lazy) {
+                const uint32_t max_insert = lz77->window_end - OK_DEFLATE_MIN_MATCH;
+                for (uint32_t p = lz77->strstart + 1; p < end && p <= max_insert; p++) {
+                    ok_deflate_lz77_insert(lz77, p);
+                }
+            }
+            lz77->strstart = end;
+        } else {
+            if (!ok_deflate_lz77_literal(deflate, lz77->window[lz77->strstart])) {
+                return false;
+            }
+            lz77->strstart++;
+        }
+    }
+    return true;
+}
+
+// Lazy matching: a match is only used if there is no longer match at the next byte.
+static bool ok_deflate_lz77_lazy(ok_deflate *deflate, bool flush) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    while (lz77->strstart < lz77->window_end) {
+        const uint32_t lookahead = lz77->window_end - lz77->strstart;
+        if (lookahead < OK_DEFLATE_MIN_LOOKAHEAD && !flush) {
+            return true;
+        }
+        uint16_t hash_head = 0;
+        if (lookahead >= OK_DEFLATE_MIN_MATCH) {
+            hash_head = ok_deflate_lz77_insert(lz77, lz77->strstart);
+        }
+        lz77->prev_length = lz77->match_length;
+        lz77->prev_match = lz77->match_start;
+        lz77->match_length = OK_DEFLATE_MIN_MATCH - 1;
+        if (hash_head != 0 && lz77->prev_length < lz77->config.max_lazy &&
+            lz77->strstart - hash_head <= OK_DEFLATE_WINDOW_SIZE) {
+            const uint16_t match_length = ok_deflate_lz77_longest_match(lz77, hash_head, lz77->prev_length);
+            if (match_length > 0) {
+                lz77->match_length = match_length;
+                if (match_length == OK_DEFLATE_MIN_MATCH &&
+                    lz77->strstart - (uint32_t)lz77->match_start > OK_DEFLATE_TOO_FAR) {
+                    // A short match far away is probably more expensive than literals
+                    lz77->match_length = OK_DEFLATE_MIN_MATCH - 1;
+                }
+            }
+        }
+        
+        if (lz77->prev_length >= OK_DEFLATE_MIN_MATCH && lz77->match_length <= lz77->prev_length) {
+            // Use the previous match
+            const uint16_t distance = (uint16_t)(lz77->strstart - 1 - lz77->prev_match);
+            if (!ok_deflate_lz77_match(deflate, distance, lz77->prev_length)) {
+                return false;
+            }
+            const uint32_t end = lz77->strstart - 1 + lz77->prev_length;
+            const uint32_t max_insert = lz77->window_end - OK_DEFLATE_MIN_MATCH;
+            for (uint32_t p = lz77->strstart + 1; p < end && p <= max_insert; p++) {
+                ok_deflate_lz77_insert(lz77, p);
+            }
+            lz77->strstart = end;
+            lz77->match_available = false;
+            lz77->match_length = OK_DEFLATE_MIN_MATCH - 1;
+        } else if (lz77->match_available) {
+            // No better match; write the previous byte as a literal
+            if (!ok_deflate_lz77_literal(deflate, lz77->window[lz77->strstart - 1])) {
+                return false;
+            }
+            lz77->strstart++;
+        } else {
+            lz77->match_available = true;
+            lz77->strstart++;
+        }
+    }
+    if (flush && lz77->match_available) {
+        lz77->match_available = false;
+        if (!ok_deflate_lz77_literal(deflate, lz77->window[lz77->strstart - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ok_deflate_lz77_process(ok_deflate *deflate, bool flush) {
+    if (deflate->lz77->config.lazy) {
+        return ok_deflate_lz77_lazy(deflate, flush);
+    } else {
+        return ok_deflate_lz77_greedy(deflate, flush);
+    }
+}
+
+// Writes all data in the window as one or more blocks, and resets the window.
+static bool ok_deflate_lz77_flush(ok_deflate *deflate, bool is_final) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    if (!ok_deflate_lz77_process(deflate, true)) {
+        return false;
+    }
+    if ((lz77->num_tokens > 0 || is_final) && !ok_deflate_lz77_write_block(deflate, is_final)) {
+        return false;
+    }
+    lz77->window_end = 0;
+    lz77->strstart = 0;
+    lz77->block_start = 0;
+    lz77->match_length = OK_DEFLATE_MIN_MATCH - 1;
+    lz77->prev_length = OK_DEFLATE_MIN_MATCH - 1;
+    memset(lz77->head, 0, sizeof(lz77->head));
+    return true;
+}
+
+static bool ok_deflate_lz77_data(ok_deflate *deflate, const uint8_t *data, size_t length, bool is_final) {
+    ok_deflate_lz77 *lz77 = deflate->lz77;
+    if (!deflate->params.nowrap) {
+        deflate->adler = ok_adler_update(deflate->adler, data, length);
+    }
+    while (length > 0) {
+        if (lz77->window_end == sizeof(lz77->window)) {
+            // Write the current block so that it can be written as a stored block if needed
+            if (lz77->block_length > 0 && !ok_deflate_lz77_write_block(deflate, false)) {
+                return false;
+            }
+            ok_deflate_lz77_slide(lz77);
+        }
+        const size_t copy_length = ok_min(length, sizeof(lz77->window) - lz77->window_end);
+        memcpy(lz77->window + lz77->window_end, data, copy_length);
+        lz77->window_end += (uint32_t)copy_length;
+        data += copy_length;
+        length -= copy_length;
+        if (!ok_deflate_lz77_process(deflate, false)) {
+            return false;
+        }
+    }
+    return !is_final || ok_deflate_lz77_flush(deflate, true);
+}
+
+// MARK: Deflate API
+
+ok_deflate *ok_deflate_init(ok_deflate_params params) {
+    ok_cpu_features_initialize();
+    
+#ifndef OK_NO_DEFAULT_ALLOCATOR
+    if (params.alloc == NULL && params.free == NULL) {
+        params.alloc = ok_stdlib_alloc;
+        params.free = ok_stdlib_free;
+    }
+#endif
+    bool has_allocator = params.alloc != NULL && params.free != NULL;
+    ok_assert(has_allocator);
+    if (!has_allocator) {
+        return NULL;
+    }
+    
+    bool has_write_function = params.write != NULL;
+    ok_assert(has_write_function);
+    if (!has_write_function) {
+        return NULL;
+    }
+    
+    if (params.compression_level == 0) {
+        params.compression_level = 6;
+    }
+    bool valid_compression_level = params.compression_level <= 9;
+    ok_assert(valid_compression_level);
+    if (!valid_compression_level) {
+        return NULL;
+    }
+
+    ok_deflate *deflate = params.alloc(params.allocator_context, sizeof(ok_deflate));
+    if (deflate) {
+        deflate->lz77 = NULL;
+        if (params.compression_level > 1) {
+            deflate->lz77 = params.alloc(params.allocator_context, sizeof(ok_deflate_lz77));
+            if (!deflate->lz77) {
+                params.free(params.allocator_context, deflate);
+                return NULL;
+            }
+            ok_deflate_lz77_init(deflate->lz77, params.compression_level);
+        }
+        deflate->params = params;
+        deflate->header_written = false;
+        deflate->adler = ok_adler_init();
+        deflate->bit_buffer = 0;
+        deflate->bit_buffer_length = 0;
+        deflate->output = NULL;
+        deflate->output_length = 0;
+        deflate->output_capacity = 0;
+        deflate->buffer_length = 0;
+    }
+    return deflate;
+}
+
+bool ok_deflate_data(ok_deflate *deflate, const uint8_t *data, size_t length, bool is_final) {
+    if (deflate->lz77) {
+        if (!ok_deflate_write_header(deflate) || !ok_deflate_lz77_data(deflate, data, length, is_final)) {
+            return false;
+        }
+        return !is_final || ok_deflate_write_footer(deflate);
+    }
+    do {
+        const uint8_t *current_buffer;
+        uint16_t current_buffer_length;
+        if (deflate->buffer_length == 0 && (length >= OK_DEFLATE_BUFFER_LENGTH || is_final)) {
+            // Deflate data directly without copying to buffer
+            current_buffer = data;
+            current_buffer_length = (uint16_t)ok_min(length, OK_DEFLATE_BUFFER_LENGTH);
+            data += current_buffer_length;
+            length -= current_buffer_length;
+        } else {
+            // Copy to buffer
+            if (length > 0) {
+                size_t copy_length = ok_min(length, sizeof(deflate->buffer) - deflate->buffer_length);
+                memcpy(deflate->buffer + deflate->buffer_length, data, copy_length);
+                deflate->buffer_length += copy_length;
+                data += copy_length;
+                length -= copy_length;
+            }
+            current_buffer = deflate->buffer;
+            current_buffer_length = deflate->buffer_length;
+        }
+        
+        const bool is_final_write = length == 0 && is_final;
+        if (current_buffer_length == OK_DEFLATE_BUFFER_LENGTH || is_final_write) {
+            // Write zlib header (RFC 1950)
+            if (!ok_deflate_write_header(deflate)) {
+                return false;
             }
             
             // Deflate
@@ -747,30 +2279,184 @@ bool ok_deflate_data(ok_deflate *deflate, const uint8_t *data, size_t length, bo
             }
             deflate->buffer_length = 0;
             
-            // Write footer (RFC 1950) and reset
-            if (is_final_write) {
-                if (!ok_deflate_write_byte_align(deflate)) {
-                    return false;
-                }
-                if (!deflate->params.nowrap) {
-                    uint8_t footer[4];
-                    ok_uint32_to_bytes(deflate->adler, footer);
-                    if (!deflate->params.write(deflate->params.write_context, footer, sizeof(footer))) {
-                        return false;
-                    }
-                }
-                
-                // Reset
-                deflate->header_written = false;
-                deflate->adler = ok_adler_init();
+            // Write footer and reset
+            if (is_final_write && !ok_deflate_write_footer(deflate)) {
+                return false;
             }
         }
     } while (length > 0);
     return true;
 }
 
+bool ok_deflate_flush(ok_deflate *deflate) {
+    if (!ok_deflate_write_header(deflate)) {
+        return false;
+    }
+    if (deflate->lz77) {
+        if (!ok_deflate_lz77_flush(deflate, false)) {
+            return false;
+        }
+    } else if (deflate->buffer_length > 0) {
+        if (!ok_deflate_write_rle_block(deflate, deflate->buffer, deflate->buffer_length, false)) {
+            return false;
+        }
+        if (!deflate->params.nowrap) {
+            deflate->adler = ok_adler_update(deflate->adler, deflate->buffer, deflate->buffer_length);
+        }
+        deflate->buffer_length = 0;
+    }
+    // Empty stored block: 3 header bits, padding to a byte boundary, then 00 00 FF FF
+    return (ok_deflate_write_stored_block(deflate, NULL, 0, false) &&
+            ok_deflate_output_flush(deflate));
+}
+
 void ok_deflate_free(ok_deflate *deflate) {
     if (deflate) {
+        if (deflate->lz77) {
+            deflate->params.free(deflate->params.allocator_context, deflate->lz77);
+        }
         deflate->params.free(deflate->params.allocator_context, deflate);
     }
 }
+
+// MARK: PNG write with a thread pool
+
+typedef struct {
+    const ok_png_write_params *params;
+    uint64_t bytes_per_row;
+    uint32_t y_start;
+    uint32_t y_end;
+    
+    // Output
+    bool success;
+    uint32_t adler;
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} ok_png_write_stripe;
+
+static bool ok_png_write_stripe_reserve(ok_png_write_stripe *stripe, size_t length) {
+    const ok_png_write_params *params = stripe->params;
+    if (length > stripe->capacity - stripe->length) {
+        size_t new_capacity = stripe->capacity > 0 ? stripe->capacity : 0x10000;
+        while (length > new_capacity - stripe->length) {
+            new_capacity <<= 1;
+        }
+        uint8_t *new_data = (uint8_t *)params->alloc(params->allocator_context, new_capacity);
+        if (new_data == NULL) {
+            return false;
+        }
+        if (stripe->data) {
+            memcpy(new_data, stripe->data, stripe->length);
+            params->free(params->allocator_context, stripe->data);
+        }
+        stripe->data = new_data;
+        stripe->capacity = new_capacity;
+    }
+    return true;
+}
+
+static uint8_t *ok_png_write_stripe_output_get(void *write_context, size_t *capacity) {
+    ok_png_write_stripe *stripe = (ok_png_write_stripe *)write_context;
+    if (!ok_png_write_stripe_reserve(stripe, 0x1000)) {
+        return NULL;
+    }
+    *capacity = stripe->capacity - stripe->length;
+    return stripe->data + stripe->length;
+}
+
+static bool ok_png_write_stripe_output(void *write_context, const uint8_t *data, size_t length) {
+    ok_png_write_stripe *stripe = (ok_png_write_stripe *)write_context;
+    if (data != stripe->data + stripe->length) {
+        // Data wasn't written in place (see ok_png_write_stripe_output_get)
+        if (!ok_png_write_stripe_reserve(stripe, length)) {
+            return false;
+        }
+        memcpy(stripe->data + stripe->length, data, length);
+    }
+    stripe->length += length;
+    return true;
+}
+
+static void ok_png_write_stripe_task(void *task_data) {
+    ok_png_write_stripe *stripe = (ok_png_write_stripe *)task_data;
+    stripe->adler = ok_adler_init();
+    stripe->success = ok_png_write_idat(stripe->params, stripe->bytes_per_row, true,
+                                        stripe->y_start, stripe->y_end,
+                                        ok_png_write_stripe_output, ok_png_write_stripe_output_get,
+                                        stripe, &stripe->adler);
+}
+
+static bool ok_png_write_idat_stripes(const ok_png_write_params *params, uint64_t bytes_per_row, bool nowrap,
+                                      ok_png_deflate_output_buffer *deflate_output_buffer) {
+    // Each stripe is at least OK_PNG_WRITE_STRIPE_MIN_LENGTH bytes (uncompressed)
+    const uint64_t scanline_length = bytes_per_row + 1;
+    uint64_t rows_per_stripe = (OK_PNG_WRITE_STRIPE_MIN_LENGTH + scanline_length - 1) / scanline_length;
+    if (rows_per_stripe * OK_PNG_WRITE_MAX_STRIPES < params->height) {
+        rows_per_stripe = (params->height + OK_PNG_WRITE_MAX_STRIPES - 1) / OK_PNG_WRITE_MAX_STRIPES;
+    }
+    const size_t num_stripes = (size_t)((params->height + rows_per_stripe - 1) / rows_per_stripe);
+    if (num_stripes <= 1) {
+        return ok_png_write_idat(params, bytes_per_row, nowrap, 0, params->height,
+                                 ok_png_deflate_output_buffer_write, ok_png_deflate_output_buffer_get,
+                                 deflate_output_buffer, NULL);
+    }
+    
+    ok_png_write_stripe *stripes = (ok_png_write_stripe *)params->alloc(params->allocator_context,
+                                                                        num_stripes * sizeof(ok_png_write_stripe));
+    if (stripes == NULL) {
+        return false;
+    }
+    void *task_data[OK_PNG_WRITE_MAX_STRIPES];
+    for (size_t i = 0; i < num_stripes; i++) {
+        ok_png_write_stripe *stripe = &stripes[i];
+        stripe->params = params;
+        stripe->bytes_per_row = bytes_per_row;
+        stripe->y_start = (uint32_t)(i * rows_per_stripe);
+        stripe->y_end = (uint32_t)ok_min((i + 1) * rows_per_stripe, params->height);
+        stripe->success = false;
+        stripe->adler = 0;
+        stripe->data = NULL;
+        stripe->length = 0;
+        stripe->capacity = 0;
+        task_data[i] = stripe;
+    }
+    
+    // Deflate stripes
+    params->run_tasks(params->thread_pool_context, ok_png_write_stripe_task, task_data, num_stripes);
+    bool success = true;
+    for (size_t i = 0; i < num_stripes; i++) {
+        success &= stripes[i].success;
+    }
+    
+    // Join stripes. Each stripe (except the last) ends with a full flush, so the output is
+    // a single deflate stream. The zlib header and footer are written around the stripes.
+    if (success && !nowrap) {
+        uint8_t zlib_header[2];
+        ok_deflate_zlib_header(params->compression_level, zlib_header);
+        success = ok_png_deflate_output_buffer_write(deflate_output_buffer, zlib_header, sizeof(zlib_header));
+    }
+    uint32_t adler = stripes[0].adler;
+    for (size_t i = 0; success && i < num_stripes; i++) {
+        ok_png_write_stripe *stripe = &stripes[i];
+        if (i > 0) {
+            const uint64_t length = (stripe->y_end - stripe->y_start) * scanline_length;
+            adler = ok_adler_combine(adler, stripe->adler, length);
+        }
+        success = ok_png_deflate_output_buffer_write(deflate_output_buffer, stripe->data, stripe->length);
+    }
+    if (success && !nowrap) {
+        uint8_t footer[4];
+        ok_uint32_to_bytes(adler, footer);
+        success = ok_png_deflate_output_buffer_write(deflate_output_buffer, footer, sizeof(footer));
+    }
+    
+    // Cleanup
+    for (size_t i = 0; i < num_stripes; i++) {
+        if (stripes[i].data) {
+            params->free(params->allocator_context, stripes[i].data);
+        }
+    }
+    params->free(params->allocator_context, stripes);
+    return success;
+}
@@ -6,10 +6,9 @@
 
 /**
  @file
- Functions to write an uncompressed PNG file.
+ Functions to write a PNG file.
  
  Caveats:
- * PNGs are not compressed.
  * No support for interlaced output.
  
  Example:
@@ -65,6 +64,27 @@ typedef enum {
     OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA = 6,
 } ok_png_write_color_type;
 
+/**
+ Filter strategies. A filter is chosen for each row of the image before it is compressed.
+ */
+typedef enum {
+    /// The minimum sum of absolute differences heuristic (#OK_PNG_WRITE_FILTER_MIN_SUM) for 8-bit and
+    /// 16-bit images, and #OK_PNG_WRITE_FILTER_NONE for palette images and images with less than 8 bits
+    /// per sample.
+    OK_PNG_WRITE_FILTER_DEFAULT = 0,
+    OK_PNG_WRITE_FILTER_NONE,
+    OK_PNG_WRITE_FILTER_SUB,
+    OK_PNG_WRITE_FILTER_UP,
+    OK_PNG_WRITE_FILTER_AVG,
+    OK_PNG_WRITE_FILTER_PAETH,
+    /// For each row, use the filter with the minimum sum of absolute differences, treating the
+    /// filtered bytes as signed values.
+    OK_PNG_WRITE_FILTER_MIN_SUM,
+    /// For each row, compress the row with each filter, and use the filter with the smallest output.
+    /// This is much slower than the other strategies.
+    OK_PNG_WRITE_FILTER_BRUTE_FORCE,
+} ok_png_write_filter;
+
 /**
  @struct ok_png_write_chunk
  
@@ -119,6 +139,13 @@ typedef struct {
  Images with a color type of OK_PNG_WRITE_COLOR_TYPE_PALETTE must include a "PLTE" chunk.
  See the PNG spec for details.
  
+ @var filter The filter strategy. If 0, the default is #OK_PNG_WRITE_FILTER_DEFAULT.
+ When compressing with a thread pool, the first row of each stripe uses the None or Sub filter
+ (unless a fixed filter is set), so that readers can unfilter the stripes independently.
+ 
+ @var compression_level The compression level, from 1 (fastest) to 9 (smallest).
+ If 0, the default is 6. See #ok_deflate_params for details.
+ 
  @var buffer_size The size of the buffer for compressed IDAT chunks. If the compressed output
  is larger than the buffer, multiple IDAT chunks are written.
  If this value is 0, a default value of 65536 is used. This value must be 0x7fffffff or less.
@@ -128,6 +155,16 @@ typedef struct {
  @var free The memory deallocator, or NULL to use the stdlib's free.
  
  @var allocator_context The context passed to the allocator.
+ 
+ @var run_tasks The thread pool function, or NULL to compress on the calling thread.
+ If set, the image is split into horizontal stripes that are compressed concurrently. Each stripe
+ ends at a zlib "full flush" point, so readers can decompress the stripes independently.
+ The function should run each task by calling `task(task_data[i])`, for `i` from 0 to
+ `num_tasks - 1`, possibly concurrently, and return after all tasks have finished.
+ The `alloc` and `free` functions are called from the thread pool's threads, so they must be
+ thread-safe. Compressed stripes are kept in memory until all stripes are finished.
+ 
+ @var thread_pool_context The context passed to the thread pool function.
  */
 typedef struct {
     uint32_t width;
@@ -141,10 +178,17 @@ typedef struct {
     ok_png_write_chunk **additional_chunks;
     
     // Compress options
+    ok_png_write_filter filter;
+    uint8_t compression_level;
     uint32_t buffer_size;
     void *(*alloc)(void *allocator_context, size_t length);
     void (*free)(void *allocator_context, void *memory);
     void *allocator_context;
+    
+    // Multi-threaded compress options
+    void (*run_tasks)(void *thread_pool_context, void (*task)(void *task_data), void **task_data,
+                      size_t num_tasks);
+    void *thread_pool_context;
 } ok_png_write_params;
 
 #ifndef OK_NO_STDIO
@@ -166,6 +210,17 @@ typedef struct ok_deflate ok_deflate;
 
 /**
  @var nowrap If `true`, no header or footer is written before or after the output.
+ 
+ @var compression_level The compression level, from 1 (fastest) to 9 (smallest). If 0, the default is 6.
+ 
+ Level                              | Method
+ -----------------------------------+-------------------------------------------------------
+ 1                                  | Run-length encoding only, fixed Huffman codes
+ 2, 3                               | Greedy matching (hash chains over a 32K window)
+ 4 - 9                              | Lazy matching (hash chains over a 32K window)
+ 
+ For levels 2 to 9, each block is written as a dynamic Huffman, fixed Huffman, or stored block,
+ whichever is estimated to be smallest. Higher levels search longer hash chains.
 
  @var alloc The memory allocator, or NULL to use the stdlib's malloc.
  
@@ -176,16 +231,25 @@ typedef struct ok_deflate ok_deflate;
  @var write The write function for output. Must not be NULL.
  This function should write the specified buffer and return true on success.
  
+ @var get_write_buffer An optional function that returns a buffer for the deflater to write output
+ into directly, and sets `capacity` to its length. The buffer is used until it is full, or until the
+ stream is flushed or finished. Then, the write function is called with a pointer to the start of
+ the returned buffer, so that the write function does not need to copy the data.
+ If NULL, or if the function returns NULL or a buffer smaller than 64 bytes, the deflater writes to
+ an internal buffer instead. In all cases, the write function is called with large spans of output.
+
  @var write_context The context passed to the write function.
 */
 typedef struct {
     bool nowrap;
+    uint8_t compression_level;
     
     void *(*alloc)(void *allocator_context, size_t length);
     void (*free)(void *allocator_context, void *memory);
     void *allocator_context;
     
     bool (*write)(void *write_context, const uint8_t *data, size_t length);
+    uint8_t *(*get_write_buffer)(void *write_context, size_t *capacity);
     void *write_context;
 } ok_deflate_params;
 
@@ -210,6 +274,18 @@ ok_deflate *ok_deflate_init(ok_deflate_params params);
  */
 bool ok_deflate_data(ok_deflate *deflate, const uint8_t *data, size_t length, bool is_final);
 
+/**
+ Writes all buffered data, followed by an empty stored block, so that the output ends on a byte
+ boundary (a zlib "full flush").
+ 
+ Data deflated after the flush does not refer to data deflated before it, so the output
+ after the flush point can be decompressed independently. The stream is not finished; call
+ #ok_deflate_data with `is_final` set to finish the stream.
+ 
+ @return true on success, false on write error.
+ */
+bool ok_deflate_flush(ok_deflate *deflate);
+
 /// Frees a deflater created with #ok_deflate_init
 void ok_deflate_free(ok_deflate *deflate);
 
@@ -146,6 +146,53 @@ static const ok_wav_input OK_WAV_FILE_INPUT = {
 
 #endif
 
+// Input functions for ok_wav_read_from_memory()
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} ok_wav_memory_input;
+
+static size_t ok_memory_read(void *user_data, uint8_t *buffer, size_t length) {
+    ok_wav_memory_input *memory = user_data;
+    const size_t len = min(length, memory->length - memory->position);
+    if (len > 0) {
+        memcpy(buffer, memory->data + memory->position, len);
+        memory->position += len;
+    }
+    return len;
+}
+
+static bool ok_memory_seek(void *user_data, long count) {
+    ok_wav_memory_input *memory = user_data;
+    if (count < 0 || (size_t)count > memory->length - memory->position) {
+        return false;
+    }
+    memory->position += (size_t)count;
+    return true;
+}
+
+static const ok_wav_input OK_WAV_MEMORY_INPUT = {
+    .read = ok_memory_read,
+    .seek = ok_memory_seek,
+};
+
+// Reads `length` bytes. When reading from memory, returns a pointer to the data in place.
+// Otherwise, the data is copied to `buffer`, and `buffer` is returned. Returns NULL on failure.
+static const uint8_t *ok_read_in_place(ok_wav_decoder *decoder, uint8_t *buffer, size_t length) {
+    if (decoder->input.read == ok_memory_read) {
+        ok_wav_memory_input *memory = decoder->input_user_data;
+        if (length > memory->length - memory->position) {
+            ok_wav_error(decoder->wav, OK_WAV_ERROR_IO, "Read error: unexpected end of data");
+            return NULL;
+        }
+        const uint8_t *data = memory->data + memory->position;
+        memory->position += length;
+        return data;
+    }
+    return ok_read(decoder, buffer, length) ? buffer : NULL;
+}
+
 static void ok_wav_decode(ok_wav *wav, ok_wav_decode_flags decode_flags,
                           ok_wav_input input, void *input_user_data,
                           ok_wav_allocator allocator, void *allocator_user_data);
@@ -184,6 +231,20 @@ ok_wav ok_wav_read_from_input(ok_wav_decode_flags decode_flags,
     return wav;
 }
 
+ok_wav ok_wav_read_from_memory(const uint8_t *data, size_t length,
+                               ok_wav_decode_flags decode_flags,
+                               ok_wav_allocator allocator, void *allocator_user_data) {
+    ok_wav wav = { 0 };
+    if (data || length == 0) {
+        ok_wav_memory_input memory = { data, length, 0 };
+        ok_wav_decode(&wav, decode_flags, OK_WAV_MEMORY_INPUT, &memory,
+                      allocator, allocator_user_data);
+    } else {
+        ok_wav_error(&wav, OK_WAV_ERROR_API, "Invalid argument: data must not be NULL");
+    }
+    return wav;
+}
+
 // MARK: Input helpers
 
 static inline uint16_t readBE16(const uint8_t *data) {
@@ -406,12 +467,13 @@ static void ok_wav_decode_logarithmic_pcm_data(ok_wav_decoder *decoder, const in
     int16_t *output = wav->data;
     while (input_data_length > 0) {
         size_t bytes_to_read = (size_t)min(input_data_length, buffer_size);
-        if (!ok_read(decoder, buffer, bytes_to_read)) {
+        const uint8_t *input = ok_read_in_place(decoder, buffer, bytes_to_read);
+        if (!input) {
             goto done;
         }
         input_data_length -= bytes_to_read;
         for (uint64_t i = 0; i < bytes_to_read; i++) {
-            *output++ = table[buffer[i]];
+            *output++ = table[input[i]];
         }
     }
 
@@ -518,12 +580,12 @@ static void ok_wav_decode_apple_ima_adpcm_data(ok_wav_decoder *decoder) {
     int16_t *output = wav->data;
     while (remaining_frames > 0) {
         uint64_t frames = min(remaining_frames, decoder->frames_per_block);
-        if (!ok_read(decoder, block, decoder->block_size)) {
+        const uint8_t *packet = ok_read_in_place(decoder, block, decoder->block_size);
+        if (!packet) {
             goto done;
         }
 
         // Each input block contains one channel. Convert to signed 16-bit and interleave.
-        uint8_t *packet = block;
         for (int channel = 0; channel < num_channels; channel++) {
             struct ok_wav_ima_state *channel_state = channel_states + channel;
 
@@ -537,7 +599,7 @@ static void ok_wav_decode_apple_ima_adpcm_data(ok_wav_decoder *decoder) {
                 channel_state->predictor = predictor;
             }
 
-            uint8_t *input = packet;
+            const uint8_t *input = packet;
             int16_t *channel_output = output + channel;
             int16_t *channel_output_end = channel_output + num_channels * frames;
             while (channel_output < channel_output_end) {
@@ -600,12 +662,12 @@ static void ok_wav_decode_ms_ima_adpcm_data(ok_wav_decoder *decoder) {
     while (remaining_frames > 0) {
         const uint64_t block_frames = min(remaining_frames, decoder->frames_per_block);
         int64_t frames = (int64_t)block_frames;
-        if (!ok_read(decoder, block, decoder->block_size)) {
+        const uint8_t *input = ok_read_in_place(decoder, block, decoder->block_size);
+        if (!input) {
             goto done;
         }
 
         // Preamble - 2 bytes for predictor, 1 bytes for index, 1 empty byte
-        uint8_t *input = block;
         int16_t *block_output = output;
         for (int channel = 0; channel < num_channels; channel++) {
             int16_t sample = (int16_t)(wav->little_endian ? readLE16(input) : readBE16(input));
@@ -738,12 +800,12 @@ static void ok_wav_decode_ms_adpcm_data(ok_wav_decoder *decoder) {
     while (remaining_frames > 0) {
         uint64_t block_frames = min(remaining_frames, decoder->frames_per_block);
         int64_t frames = (int64_t)block_frames;
-        if (!ok_read(decoder, block, decoder->block_size)) {
+        const uint8_t *input = ok_read_in_place(decoder, block, decoder->block_size);
+        if (!input) {
             goto done;
         }
 
         // Preamble (interleaved)
-        uint8_t *input = block;
         for (int channel = 0; channel < num_channels; channel++) {
             const uint8_t coeff_index = min(*input, 6);
             channel_states[channel].coeff1 = adaptation_coeff1[coeff_index];
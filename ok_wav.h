@@ -231,6 +231,31 @@ ok_wav ok_wav_read_from_input(ok_wav_decode_flags decode_flags,
                               ok_wav_input input_callbacks, void *input_callbacks_user_data,
                               ok_wav_allocator allocator, void *allocator_user_data);
 
+// MARK: Reading from memory
+
+/**
+ * Reads a WAV (or CAF) audio file from memory. Compressed audio data is read in place, without
+ * copying it, so this function works well with memory-mapped files.
+ * On success, #ok_wav.data has a length of `(num_channels * num_frames * (bit_depth/8))`.
+ * On failure, #ok_wav.data is `NULL` and #ok_wav.error_code is nonzero.
+ *
+ * If the encoding of the file is u-law, a-law, or ADPCM, the data is converted to 16-bit
+ * signed integer PCM data.
+ *
+ * The returned `data` must be freed by the caller.
+ *
+ * @param data The WAV or CAF file data. The data is not needed after this function returns.
+ * @param length The length of `data`, in bytes.
+ * @param decode_flags The WAV decode flags. Use #OK_WAV_DEFAULT_DECODE_FLAGS in most cases.
+ * @param allocator The allocator to use.
+ * @param allocator_user_data The pointer to pass to the allocator functions.
+ * If using `OK_WAV_DEFAULT_ALLOCATOR`, this value should be `NULL`.
+ * @return a #ok_wav object.
+ */
+ok_wav ok_wav_read_from_memory(const uint8_t *data, size_t length,
+                               ok_wav_decode_flags decode_flags,
+                               ok_wav_allocator allocator, void *allocator_user_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,14 +7,20 @@
 #include <stdlib.h>
 #include <string.h>
 
-int csv_test(const char *path, bool verbose) {
-    (void)verbose;
-
+static int csv_test_read(const char *path, bool from_memory) {
     char *test1_file = get_full_path(path, "test1", "csv");
 
-    FILE *file = fopen(test1_file, "rb");
-    ok_csv *csv = ok_csv_read(file);
-    fclose(file);
+    ok_csv *csv;
+    if (from_memory) {
+        size_t length;
+        const uint8_t *data = map_file(test1_file, &length);
+        csv = ok_csv_read_from_memory(data, length);
+        unmap_file(data, length);
+    } else {
+        FILE *file = fopen(test1_file, "rb");
+        csv = ok_csv_read(file);
+        fclose(file);
+    }
     free(test1_file);
 
     if (!csv) {
@@ -76,6 +82,15 @@ int csv_test(const char *path, bool verbose) {
     }
 
     ok_csv_free(csv);
+    return 0;
+}
+
+int csv_test(const char *path, bool verbose) {
+    (void)verbose;
+
+    if (csv_test_read(path, false) != 0 || csv_test_read(path, true) != 0) {
+        return 1;
+    }
 
     printf("Success: CSV\n");
     return 0;
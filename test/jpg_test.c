@@ -3,12 +3,21 @@
 #include "test_common.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 enum jpg_test_type {
     test_normal,
     test_info_only,
     test_allocator,
+    test_rows,
+    test_memory,
+    test_thread_pool,
+    test_simd,
+    test_push,
+    test_scaled,
+    test_region,
+    test_corrupt,
 };
 
 static const char *filenames[] = {
@@ -16,6 +25,7 @@ static const char *filenames[] = {
     // Grayscale
     "jpg-gray",
     "jpeg400jfif", // With restart markers
+    "jpg-restart-intervals", // With restart markers that don't start at MCU rows
     "peace",
 
     // No upsampling
@@ -82,6 +92,489 @@ static const char *filenames[] = {
     "orientation_8",
 };
 
+// Files decoded again with corrupt Huffman tables
+static const char *corrupt_filenames[] = {
+    "jpg-gray",
+    "jpeg444",
+    "robot",
+};
+
+typedef struct {
+    bool flip_y;
+    uint8_t *data;
+    uint32_t stride;
+    uint32_t num_rows;
+} rows_image;
+
+static size_t file_read(void *user_data, uint8_t *buffer, size_t count) {
+    return fread(buffer, 1, count, (FILE *)user_data);
+}
+
+static bool file_seek(void *user_data, long count) {
+    return fseek((FILE *)user_data, count, SEEK_CUR) == 0;
+}
+
+// Copies rows to a full image, flipping them back if needed
+static bool rows_image_func(void *user_data, uint32_t width, uint32_t height, uint32_t y,
+                            uint32_t num_rows, const uint8_t *data, uint32_t stride) {
+    rows_image *image = user_data;
+    if (!image->data) {
+        image->stride = width * 4;
+        image->data = malloc((size_t)image->stride * height);
+        if (!image->data) {
+            return false;
+        }
+    }
+    if (num_rows == 0 || y + num_rows > height) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_rows; i++) {
+        uint32_t dst_y = image->flip_y ? height - (y + i) - 1 : y + i;
+        memcpy(image->data + (size_t)dst_y * image->stride, data + (size_t)i * stride,
+               image->stride);
+    }
+    image->num_rows += num_rows;
+    return true;
+}
+
+// Decodes with ok_jpg_read_rows, with and without OK_JPG_FLIP_Y
+static ok_jpg read_rows(FILE *file) {
+    const ok_jpg_input input = {
+        .read = file_read,
+        .seek = file_seek,
+    };
+    const ok_jpg_decode_flags flags_list[] = {
+        OK_JPG_COLOR_FORMAT_RGBA,
+        OK_JPG_COLOR_FORMAT_RGBA | OK_JPG_FLIP_Y,
+    };
+    uint8_t *data = NULL;
+    ok_jpg jpg = { 0 };
+    for (int i = 0; i < 2; i++) {
+        rows_image image = { 0 };
+        image.flip_y = (flags_list[i] & OK_JPG_FLIP_Y) != 0;
+        rewind(file);
+        jpg = ok_jpg_read_rows(flags_list[i], input, file, OK_JPG_DEFAULT_ALLOCATOR, NULL,
+                               rows_image_func, &image);
+        if (jpg.data || (jpg.error_code == OK_JPG_SUCCESS && image.num_rows != jpg.height)) {
+            jpg.error_code = OK_JPG_ERROR_API;
+        }
+        if (data && image.data &&
+            memcmp(data, image.data, (size_t)image.stride * jpg.height) != 0) {
+            jpg.error_code = OK_JPG_ERROR_API;
+        }
+        free(data);
+        data = image.data;
+        if (jpg.error_code != OK_JPG_SUCCESS) {
+            break;
+        }
+    }
+    jpg.data = data;
+    jpg.stride = jpg.width * 4;
+    return jpg;
+}
+
+// Decodes with ok_jpg_read_from_memory, from a memory-mapped file
+static ok_jpg read_memory(const char *filename) {
+    size_t length;
+    const uint8_t *data = map_file(filename, &length);
+    ok_jpg jpg = ok_jpg_read_from_memory(data, length, OK_JPG_COLOR_FORMAT_RGBA,
+                                         OK_JPG_DEFAULT_ALLOCATOR, NULL);
+    unmap_file(data, length);
+    return jpg;
+}
+
+// Runs the even tasks, then the odd tasks, to test that the tasks don't depend on each other and
+// don't write outside of their own range
+static void run_tasks_interleaved(void *user_data, void (*task)(void *task_data), void **task_data,
+                                  size_t num_tasks) {
+    (void)user_data;
+    for (size_t i = 0; i < num_tasks; i += 2) {
+        task(task_data[i]);
+    }
+    for (size_t i = 1; i < num_tasks; i += 2) {
+        task(task_data[i]);
+    }
+}
+
+// Decodes with ok_jpg_read_from_memory_with_thread_pool
+static ok_jpg read_thread_pool(const char *filename) {
+    const ok_jpg_thread_pool thread_pool = {
+        .run_tasks = run_tasks_interleaved
+    };
+    size_t length;
+    const uint8_t *data = map_file(filename, &length);
+    ok_jpg jpg = ok_jpg_read_from_memory_with_thread_pool(data, length, OK_JPG_COLOR_FORMAT_RGBA,
+                                                          OK_JPG_DEFAULT_ALLOCATOR, NULL,
+                                                          thread_pool, NULL);
+    unmap_file(data, length);
+    return jpg;
+}
+
+// Returns true if two decoded images have the same dimensions and pixels
+static bool same_image(ok_jpg jpg1, ok_jpg jpg2) {
+    if (jpg1.width != jpg2.width || jpg1.height != jpg2.height || !jpg1.data != !jpg2.data) {
+        return false;
+    }
+    for (uint32_t y = 0; y < jpg1.height && jpg1.data; y++) {
+        if (memcmp(jpg1.data + (size_t)y * jpg1.stride, jpg2.data + (size_t)y * jpg2.stride,
+                   (size_t)jpg1.width * 4) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Discards an image that differs from another decoding variant, so the comparison fails
+static void discard_image(ok_jpg *jpg) {
+    free(jpg->data);
+    jpg->data = NULL;
+    jpg->error_code = OK_JPG_ERROR_API;
+}
+
+// Decodes with portable C code and with each SIMD instruction set, in both RGBA and BGRA, which
+// must give exactly the same result. Returns the RGBA image.
+static ok_jpg read_simd(FILE *file) {
+    static const ok_jpg_simd simd_list[] = {
+        OK_JPG_SIMD_SSE2,
+        OK_JPG_SIMD_AVX2,
+        OK_JPG_SIMD_NEON,
+    };
+    static const ok_jpg_decode_flags format_list[] = {
+        OK_JPG_COLOR_FORMAT_RGBA,
+        OK_JPG_COLOR_FORMAT_BGRA,
+    };
+    const int num_simd = sizeof(simd_list) / sizeof(simd_list[0]);
+    const int num_formats = sizeof(format_list) / sizeof(format_list[0]);
+
+    ok_jpg jpg = { 0 };
+    for (int f = 0; f < num_formats; f++) {
+        ok_jpg_set_simd(OK_JPG_SIMD_NONE);
+        rewind(file);
+        ok_jpg expected_jpg = ok_jpg_read(file, format_list[f]);
+        bool success = true;
+        for (int i = 0; i < num_simd; i++) {
+            if (!ok_jpg_set_simd(simd_list[i])) {
+                continue;
+            }
+            rewind(file);
+            ok_jpg simd_jpg = ok_jpg_read(file, format_list[f]);
+            success = success && same_image(expected_jpg, simd_jpg);
+            free(simd_jpg.data);
+        }
+        if (f == 0) {
+            jpg = expected_jpg;
+        } else {
+            free(expected_jpg.data);
+        }
+        if (!success) {
+            discard_image(&jpg);
+        }
+    }
+    ok_jpg_set_simd(OK_JPG_SIMD_AUTO);
+    return jpg;
+}
+
+// Decodes with the push decoder, fed in parts of varying sizes, and fed all at once while sending
+// rows to rows_func, which must give the same result
+static ok_jpg read_push(const char *filename) {
+    unsigned long data_length;
+    uint8_t *data = read_file(filename, &data_length);
+
+    // Feed in parts
+    ok_jpg_decoder *decoder = ok_jpg_decoder_init(OK_JPG_COLOR_FORMAT_RGBA,
+                                                  OK_JPG_DEFAULT_ALLOCATOR, NULL, NULL, NULL);
+    ok_jpg_decoder_status status = OK_JPG_DECODER_NEED_MORE_INPUT;
+    unsigned long offset = 0;
+    for (size_t part = 1; offset < data_length; part = part % 97 + 1) {
+        size_t length = (data_length - offset < part) ? (size_t)(data_length - offset) : part;
+        status = ok_jpg_decoder_feed(decoder, data + offset, length);
+        offset += length;
+        if (status == OK_JPG_DECODER_DONE || status == OK_JPG_DECODER_ERROR) {
+            break;
+        }
+    }
+    ok_jpg jpg = ok_jpg_decoder_finish(decoder);
+    if (status != OK_JPG_DECODER_DONE) {
+        discard_image(&jpg);
+    }
+
+    // Feed all at once, with rows
+    rows_image image = { 0 };
+    decoder = ok_jpg_decoder_init(OK_JPG_COLOR_FORMAT_RGBA, OK_JPG_DEFAULT_ALLOCATOR, NULL,
+                                  rows_image_func, &image);
+    status = ok_jpg_decoder_feed(decoder, data, data_length);
+    ok_jpg rows_jpg = ok_jpg_decoder_finish(decoder);
+    if (status != OK_JPG_DECODER_DONE || rows_jpg.data || image.num_rows != rows_jpg.height) {
+        free(rows_jpg.data);
+        discard_image(&jpg);
+    } else {
+        rows_jpg.data = image.data;
+        rows_jpg.stride = image.stride;
+        if (!same_image(jpg, rows_jpg)) {
+            discard_image(&jpg);
+        }
+    }
+    free(image.data);
+    free(data);
+    return jpg;
+}
+
+// Returns the mean difference between a scaled image and the full image scaled down with a box
+// filter. The scaled image is decoded with reduced IDCTs, so it isn't identical, but should be
+// close. The boxes are offset by (offset_x, offset_y) pixels.
+static double scaled_image_mean_diff(ok_jpg full_jpg, ok_jpg scaled_jpg, int scale,
+                                     int offset_x, int offset_y) {
+    uint64_t total_diff = 0;
+    for (int y = 0; y < (int)scaled_jpg.height; y++) {
+        for (int x = 0; x < (int)scaled_jpg.width; x++) {
+            for (int c = 0; c < 3; c++) {
+                int sum = 0;
+                int count = 0;
+                for (int v = y * scale - offset_y; v < (y + 1) * scale - offset_y; v++) {
+                    for (int u = x * scale - offset_x; u < (x + 1) * scale - offset_x; u++) {
+                        if (u >= 0 && v >= 0 && u < (int)full_jpg.width &&
+                            v < (int)full_jpg.height) {
+                            sum += full_jpg.data[(uint32_t)v * full_jpg.stride +
+                                                 (uint32_t)u * 4 + (uint32_t)c];
+                            count++;
+                        }
+                    }
+                }
+                int expected = (sum + count / 2) / count;
+                total_diff += (uint64_t)abs(expected - scaled_jpg.data[(uint32_t)y *
+                                                                       scaled_jpg.stride +
+                                                                       (uint32_t)x * 4 +
+                                                                       (uint32_t)c]);
+            }
+        }
+    }
+    return (double)total_diff / (scaled_jpg.width * scaled_jpg.height * 3);
+}
+
+// Decodes with OK_JPG_SCALE_1_2, OK_JPG_SCALE_1_4, and OK_JPG_SCALE_1_8. The dimensions must be
+// rounded up, SIMD must decode exactly the same as portable C code, and the image must be close to
+// the full image scaled down. Small images are not compared, since their edge blocks include the
+// encoder's padding. Returns the full image.
+static ok_jpg read_scaled(FILE *file) {
+    static const ok_jpg_decode_flags scale_list[] = {
+        OK_JPG_SCALE_1_2,
+        OK_JPG_SCALE_1_4,
+        OK_JPG_SCALE_1_8,
+    };
+    const int num_scales = sizeof(scale_list) / sizeof(scale_list[0]);
+
+    ok_jpg full_jpg = ok_jpg_read(file, OK_JPG_COLOR_FORMAT_RGBA);
+    bool success = true;
+    for (int i = 0; i < num_scales && success && full_jpg.data; i++) {
+        const uint32_t scale = 2u << i;
+        const uint32_t width = (full_jpg.width + scale - 1) / scale;
+        const uint32_t height = (full_jpg.height + scale - 1) / scale;
+        const ok_jpg_decode_flags flags = OK_JPG_COLOR_FORMAT_RGBA | scale_list[i];
+
+        rewind(file);
+        ok_jpg info_jpg = ok_jpg_read(file, flags | OK_JPG_INFO_ONLY);
+
+        ok_jpg_set_simd(OK_JPG_SIMD_NONE);
+        rewind(file);
+        ok_jpg expected_jpg = ok_jpg_read(file, flags);
+        ok_jpg_set_simd(OK_JPG_SIMD_AUTO);
+
+        rewind(file);
+        ok_jpg jpg = ok_jpg_read(file, flags);
+
+        success = (jpg.data && info_jpg.width == width && info_jpg.height == height &&
+                   jpg.width == width && jpg.height == height && same_image(jpg, expected_jpg));
+        if (success && full_jpg.width >= 64 && full_jpg.height >= 64) {
+            // The image may be flipped by its EXIF orientation, so the scaled pixels may be
+            // aligned to either edge.
+            const int edge_x = (int)(width * scale - full_jpg.width);
+            const int edge_y = (int)(height * scale - full_jpg.height);
+            double mean_diff = scaled_image_mean_diff(full_jpg, jpg, (int)scale, 0, 0);
+            for (int j = 1; j < 4; j++) {
+                double diff = scaled_image_mean_diff(full_jpg, jpg, (int)scale,
+                                                     (j & 1) ? edge_x : 0, (j & 2) ? edge_y : 0);
+                mean_diff = diff < mean_diff ? diff : mean_diff;
+            }
+            success = mean_diff < 8.0;
+        }
+        free(jpg.data);
+        free(expected_jpg.data);
+    }
+    if (!success) {
+        discard_image(&full_jpg);
+    }
+    return full_jpg;
+}
+
+// Decodes with ok_jpg_read_region_from_input. Each region must match the same region of the full
+// image, including regions that are clipped, not aligned to MCUs, flipped, or scaled. A region
+// outside of the image must fail. Returns the full image.
+static ok_jpg read_region(FILE *file) {
+    static const ok_jpg_decode_flags flags_list[] = {
+        OK_JPG_COLOR_FORMAT_RGBA,
+        OK_JPG_COLOR_FORMAT_RGBA | OK_JPG_FLIP_Y,
+        OK_JPG_COLOR_FORMAT_RGBA | OK_JPG_SCALE_1_2,
+    };
+    const int num_flags = sizeof(flags_list) / sizeof(flags_list[0]);
+    const ok_jpg_input input = {
+        .read = file_read,
+        .seek = file_seek,
+    };
+
+    ok_jpg jpg = { 0 };
+    bool success = true;
+    for (int i = 0; i < num_flags && success; i++) {
+        const ok_jpg_decode_flags flags = flags_list[i];
+        const bool flip_y = (flags & OK_JPG_FLIP_Y) != 0;
+        rewind(file);
+        ok_jpg full_jpg = ok_jpg_read(file, flags);
+        if (!full_jpg.data) {
+            success = false;
+            break;
+        }
+        const uint32_t w = full_jpg.width;
+        const uint32_t h = full_jpg.height;
+        const uint32_t regions[][4] = {
+            { 0, 0, w, h },
+            { w / 3, h / 3, w / 3 + 1, h / 4 + 1 },
+            { w - 1, h - 1, 1, 1 },
+            { w / 2, 7 % h, w, h },
+        };
+        const int num_regions = sizeof(regions) / sizeof(regions[0]);
+        for (int j = 0; j < num_regions && success; j++) {
+            const uint32_t x = regions[j][0];
+            const uint32_t y = regions[j][1];
+            const uint32_t width = regions[j][2] < w - x ? regions[j][2] : w - x;
+            const uint32_t height = regions[j][3] < h - y ? regions[j][3] : h - y;
+            rewind(file);
+            ok_jpg region_jpg = ok_jpg_read_region_from_input(flags, x, y, regions[j][2],
+                                                              regions[j][3], input, file,
+                                                              OK_JPG_DEFAULT_ALLOCATOR, NULL);
+            success = (region_jpg.data && region_jpg.width == width &&
+                       region_jpg.height == height);
+            for (uint32_t v = 0; v < height && success; v++) {
+                const uint32_t full_y = flip_y ? h - 1 - (y + v) : y + v;
+                const uint32_t region_y = flip_y ? height - 1 - v : v;
+                success = memcmp(full_jpg.data + (size_t)full_y * full_jpg.stride + x * 4,
+                                 region_jpg.data + (size_t)region_y * region_jpg.stride,
+                                 width * 4) == 0;
+            }
+            free(region_jpg.data);
+        }
+        if (success) {
+            rewind(file);
+            ok_jpg region_jpg = ok_jpg_read_region_from_input(flags, w, 0, 1, 1, input, file,
+                                                              OK_JPG_DEFAULT_ALLOCATOR, NULL);
+            success = !region_jpg.data && region_jpg.error_code == OK_JPG_ERROR_API;
+        }
+        if (i == 0) {
+            jpg = full_jpg;
+        } else {
+            free(full_jpg.data);
+        }
+    }
+    if (!success) {
+        discard_image(&jpg);
+    }
+    return jpg;
+}
+
+// Sets every value in the DC Huffman tables to an invalid number of bits (more than the bit
+// buffer holds)
+static void corrupt_dc_huffman_tables(uint8_t *data, unsigned long length) {
+    for (unsigned long i = 0; i + 4 < length; i++) {
+        if (data[i] != 0xff || data[i + 1] != 0xc4) {
+            continue;
+        }
+        unsigned long p = i + 4;
+        unsigned long end = i + 2 + (unsigned long)((data[i + 2] << 8) | data[i + 3]);
+        while (p + 17 <= end && end <= length) {
+            unsigned long count = 0;
+            for (int j = 1; j <= 16; j++) {
+                count += data[p + j];
+            }
+            if (p + 17 + count > end) {
+                break;
+            }
+            if ((data[p] >> 4) == 0) {
+                memset(data + p + 17, 0xc8, count);
+            }
+            p += 17 + count;
+        }
+    }
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} memory_reader;
+
+static size_t memory_read(void *user_data, uint8_t *buffer, size_t count) {
+    memory_reader *reader = user_data;
+    count = reader->length - reader->position < count ? reader->length - reader->position : count;
+    memcpy(buffer, reader->data + reader->position, count);
+    reader->position += count;
+    return count;
+}
+
+static bool memory_seek(void *user_data, long count) {
+    memory_reader *reader = user_data;
+    if (count < 0 || (size_t)count > reader->length - reader->position) {
+        return false;
+    }
+    reader->position += (size_t)count;
+    return true;
+}
+
+// Decodes the bottom-right corner of an image, so most blocks are skipped
+static ok_jpg read_corner_region_from_memory(const uint8_t *data, size_t length) {
+    const ok_jpg_input input = {
+        .read = memory_read,
+        .seek = memory_seek,
+    };
+    memory_reader reader = { data, length, 0 };
+    ok_jpg info_jpg = ok_jpg_read_from_memory(data, length, OK_JPG_INFO_ONLY,
+                                              OK_JPG_DEFAULT_ALLOCATOR, NULL);
+    if (info_jpg.error_code != OK_JPG_SUCCESS) {
+        return info_jpg;
+    }
+    return ok_jpg_read_region_from_input(OK_JPG_COLOR_FORMAT_RGBA, info_jpg.width / 2,
+                                         info_jpg.height / 2, info_jpg.width, info_jpg.height,
+                                         input, &reader, OK_JPG_DEFAULT_ALLOCATOR, NULL);
+}
+
+// Decodes with ok_jpg_read_from_memory, and as a region (skipping blocks outside of it), with
+// corrupt DC Huffman tables, truncated at several lengths. Each length must fail without reading
+// past the end of the data. Returns the error of the first decode that didn't fail, or else the
+// last error.
+static ok_jpg read_corrupt(const char *filename) {
+    unsigned long length;
+    uint8_t *data = read_file(filename, &length);
+    corrupt_dc_huffman_tables(data, length);
+
+    ok_jpg jpg = { 0 };
+    for (unsigned long i = 1; i <= 8; i++) {
+        // Copy to an exact-size buffer, so memory tools can detect reads past the end
+        const unsigned long corrupt_length = length * i / 8;
+        uint8_t *corrupt_data = malloc(corrupt_length);
+        memcpy(corrupt_data, data, corrupt_length);
+        free(jpg.data);
+        jpg = ok_jpg_read_from_memory(corrupt_data, corrupt_length, OK_JPG_COLOR_FORMAT_RGBA,
+                                      OK_JPG_DEFAULT_ALLOCATOR, NULL);
+        if (jpg.error_code != OK_JPG_SUCCESS) {
+            free(jpg.data);
+            jpg = read_corner_region_from_memory(corrupt_data, corrupt_length);
+        }
+        free(corrupt_data);
+        if (jpg.error_code == OK_JPG_SUCCESS) {
+            break;
+        }
+    }
+    free(data);
+    return jpg;
+}
+
 static bool test_image(const char *path_to_jpgs,
                        const char *path_to_rgba_files,
                        const char *name,
@@ -112,12 +605,45 @@ static bool test_image(const char *path_to_jpgs,
             case test_allocator:
                 jpg = ok_jpg_read_with_allocator(file, OK_JPG_COLOR_FORMAT_RGBA, allocator, NULL);
                 break;
+            case test_rows:
+                jpg = read_rows(file);
+                break;
+            case test_memory:
+                jpg = read_memory(in_filename);
+                break;
+            case test_thread_pool:
+                jpg = read_thread_pool(in_filename);
+                break;
+            case test_simd:
+                jpg = read_simd(file);
+                break;
+            case test_push:
+                jpg = read_push(in_filename);
+                break;
+            case test_scaled:
+                jpg = read_scaled(file);
+                break;
+            case test_region:
+                jpg = read_region(file);
+                break;
+            case test_corrupt:
+                jpg = read_corrupt(in_filename);
+                break;
         }
         fclose(file);
 
-        bool info_only = test_type == test_info_only;
-        success = compare(name, "jpg", jpg.data, jpg.stride, jpg.width, jpg.height,
-                          rgba_data, rgba_data_length, info_only, 4, verbose);
+        if (test_type == test_corrupt) {
+            success = jpg.error_code != OK_JPG_SUCCESS;
+            if (!success) {
+                printf("Failure: Corrupt data was decoded without an error for %s.jpg\n", name);
+            } else if (verbose) {
+                printf("File:    %16.16s.jpg (corrupt data correctly detected).\n", name);
+            }
+        } else {
+            bool info_only = test_type == test_info_only;
+            success = compare(name, "jpg", jpg.data, jpg.stride, jpg.width, jpg.height,
+                              rgba_data, rgba_data_length, info_only, 4, verbose);
+        }
         free(jpg.data);
     } else {
         printf("Warning: File not found: %s.jpg\n", name);
@@ -133,6 +659,7 @@ static bool test_image(const char *path_to_jpgs,
 
 int jpg_test(const char *path_to_jpgs, const char *path_to_rgba_files, bool verbose) {
     const int num_files = sizeof(filenames) / sizeof(filenames[0]);
+    const int num_corrupt_files = sizeof(corrupt_filenames) / sizeof(corrupt_filenames[0]);
     if (verbose) {
         printf("Testing %i files in path \"%s\".\n", num_files, path_to_jpgs);
     }
@@ -157,6 +684,61 @@ int jpg_test(const char *path_to_jpgs, const char *path_to_rgba_files, bool verb
                              verbose);
         if (!success) {
             num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_rows,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_memory,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_thread_pool,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_push,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_simd,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_scaled,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_jpgs, path_to_rgba_files, filenames[i], test_region,
+                             verbose);
+        if (!success) {
+            num_failures++;
+        }
+    }
+    for (int i = 0; i < num_corrupt_files; i++) {
+        if (!test_image(path_to_jpgs, path_to_rgba_files, corrupt_filenames[i], test_corrupt,
+                        verbose)) {
+            num_failures++;
         }
     }
     double endTime = clock() / (double)CLOCKS_PER_SEC;
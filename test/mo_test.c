@@ -5,21 +5,27 @@
 #include <stdlib.h>
 #include <string.h>
 
-static ok_mo *mo_read(const char *filename) {
+static ok_mo *mo_read(const char *filename, bool from_memory) {
+    if (from_memory) {
+        size_t length;
+        const uint8_t *data = map_file(filename, &length);
+        ok_mo *mo = ok_mo_read_from_memory(data, length);
+        unmap_file(data, length);
+        return mo;
+    }
     FILE *file = fopen(filename, "rb");
     ok_mo *mo = ok_mo_read(file);
     fclose(file);
     return mo;
 }
 
-int gettext_test(const char *path, bool verbose) {
-    (void)verbose;
+static int gettext_test_read(const char *path, bool from_memory) {
 
     char *en_file = get_full_path(path, "en", "mo");
     char *es_file = get_full_path(path, "es", "mo");
     char *zh_file = get_full_path(path, "zh-Hans", "mo");
 
-    ok_mo *mo_en = mo_read(en_file);
+    ok_mo *mo_en = mo_read(en_file, from_memory);
     if (strcmp("Hello", ok_mo_value(mo_en, "Hello")) != 0) {
         printf("Failure: Hello\n");
         return 1;
@@ -40,14 +46,14 @@ int gettext_test(const char *path, bool verbose) {
     }
     ok_mo_free(mo_en);
 
-    ok_mo *mo_es = mo_read(es_file);
+    ok_mo *mo_es = mo_read(es_file, from_memory);
     if (strcmp("Archivo", ok_mo_value_in_context(mo_es, "Menu", "File")) != 0) {
         printf("Failure: context\n");
         return 1;
     }
     ok_mo_free(mo_es);
 
-    ok_mo *mo_zh = mo_read(zh_file);
+    ok_mo *mo_zh = mo_read(zh_file, from_memory);
     char hello_utf8[] = {(char)0xe4, (char)0xbd, (char)0xa0, (char)0xe5, (char)0xa5, (char)0xbd, 0};
     if (strcmp(hello_utf8, ok_mo_value(mo_zh, "Hello")) != 0) {
         printf("Failure: utf8\n");
@@ -58,6 +64,15 @@ int gettext_test(const char *path, bool verbose) {
     free(en_file);
     free(es_file);
     free(zh_file);
+    return 0;
+}
+
+int gettext_test(const char *path, bool verbose) {
+    (void)verbose;
+
+    if (gettext_test_read(path, false) != 0 || gettext_test_read(path, true) != 0) {
+        return 1;
+    }
 
     printf("Success: MO (gettext)\n");
     return 0;
@@ -15,6 +15,13 @@ enum png_test_type {
     test_normal,
     test_info_only,
     test_allocator,
+    test_memory,
+    test_simd,
+    test_thread_pool,
+    test_crc_error,
+    test_rows,
+    test_push,
+    test_region,
 };
 
 // This is just copied form a directory listing of the PNG Suite files
@@ -189,12 +196,12 @@ static const char *filenames[] = {
     "xc1n0g08",
     "xc9n2c08",
     "xcrn0g04",
-    //"xcsn0g01", // incorrect checksum - ok_png ignores checksums
+    //"xcsn0g01", // incorrect checksum - see crc_error_filenames
     "xd0n2c08",
     "xd3n2c08",
     "xd9n2c08",
     "xdtn0g01",
-    //"xhdn0g08", // incorrect checksum - ok_png ignores checksums
+    //"xhdn0g08", // incorrect checksum - see crc_error_filenames
     "xlfn0g04",
     "xs1n0g01",
     "xs2n0g01",
@@ -202,6 +209,292 @@ static const char *filenames[] = {
     "xs7n0g01",
 };
 
+// Files with an incorrect checksum. These only fail when using OK_PNG_VERIFY_CRC.
+static const char *crc_error_filenames[] = {
+    "xcsn0g01",
+    "xhdn0g08",
+};
+
+// Decodes with ok_png_read_from_memory, from a memory-mapped file. Checksums are verified, since
+// the checksums of data read in place are computed separately.
+static ok_png read_memory(const char *filename, ok_png_decode_flags decode_flags) {
+    size_t length;
+    const uint8_t *data = map_file(filename, &length);
+    ok_png png = ok_png_read_from_memory(data, length,
+                                         decode_flags | OK_PNG_VERIFY_CRC | OK_PNG_VERIFY_ADLER32,
+                                         OK_PNG_DEFAULT_ALLOCATOR, NULL);
+    unmap_file(data, length);
+    return png;
+}
+
+static size_t file_read_func(void *user_data, uint8_t *buffer, size_t length) {
+    return fread(buffer, 1, length, (FILE *)user_data);
+}
+
+static bool file_seek_func(void *user_data, long count) {
+    return fseek((FILE *)user_data, count, SEEK_CUR) == 0;
+}
+
+// Runs tasks in order, on the calling thread
+static void run_tasks_serially(void *user_data, void (*task)(void *task_data), void **task_data,
+                               size_t num_tasks) {
+    (void)user_data;
+    for (size_t i = 0; i < num_tasks; i++) {
+        task(task_data[i]);
+    }
+}
+
+// Decodes with ok_png_read_from_input_with_thread_pool
+static ok_png read_thread_pool(FILE *file, ok_png_decode_flags decode_flags) {
+    const ok_png_input input = {
+        .read = file_read_func,
+        .seek = file_seek_func
+    };
+    const ok_png_thread_pool thread_pool = {
+        .run_tasks = run_tasks_serially
+    };
+    return ok_png_read_from_input_with_thread_pool(decode_flags, input, file,
+                                                   OK_PNG_DEFAULT_ALLOCATOR, NULL,
+                                                   thread_pool, NULL);
+}
+
+// Returns true if two decoded images have the same dimensions and pixels
+static bool same_image(ok_png png1, ok_png png2) {
+    if (png1.width != png2.width || png1.height != png2.height || !png1.data != !png2.data) {
+        return false;
+    }
+    for (uint32_t y = 0; y < png1.height && png1.data; y++) {
+        if (memcmp(png1.data + (size_t)y * png1.stride, png2.data + (size_t)y * png2.stride,
+                   (size_t)png1.width * 4) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Discards an image that differs from another decoding variant, so the comparison fails
+static void discard_image(ok_png *png) {
+    free(png->data);
+    png->data = NULL;
+    png->error_code = OK_PNG_ERROR_API;
+}
+
+// Decodes with portable C code and with each SIMD instruction set, which must give the same
+// result. Checksums are verified, so both the portable and SIMD checksum functions are tested.
+static ok_png read_simd(FILE *file, ok_png_decode_flags decode_flags) {
+    static const ok_png_simd simd_list[] = {
+        OK_PNG_SIMD_SSE2,
+        OK_PNG_SIMD_SSSE3,
+        OK_PNG_SIMD_AVX2,
+        OK_PNG_SIMD_NEON,
+    };
+    const int num_simd = sizeof(simd_list) / sizeof(simd_list[0]);
+    decode_flags |= OK_PNG_VERIFY_CRC | OK_PNG_VERIFY_ADLER32;
+
+    ok_png_set_simd(OK_PNG_SIMD_NONE);
+    ok_png png = ok_png_read(file, decode_flags);
+    for (int i = 0; i < num_simd; i++) {
+        if (!ok_png_set_simd(simd_list[i])) {
+            continue;
+        }
+        rewind(file);
+        ok_png simd_png = ok_png_read(file, decode_flags);
+        if (!same_image(png, simd_png)) {
+            discard_image(&png);
+        }
+        free(simd_png.data);
+    }
+    ok_png_set_simd(OK_PNG_SIMD_AUTO);
+    return png;
+}
+
+typedef struct {
+    bool flip_y;
+    uint8_t *data;
+    uint32_t stride;
+    uint32_t num_rows;
+} rows_image;
+
+// Copies rows to a full image, flipping them back if needed
+static bool rows_image_func(void *user_data, uint32_t width, uint32_t height, uint32_t y,
+                            uint32_t num_rows, const uint8_t *data, uint32_t stride) {
+    rows_image *image = user_data;
+    if (!image->data) {
+        image->stride = width * 4;
+        image->data = malloc((size_t)image->stride * height);
+        if (!image->data) {
+            return false;
+        }
+    }
+    if (num_rows == 0 || y + num_rows > height) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_rows; i++) {
+        uint32_t dst_y = image->flip_y ? height - (y + i) - 1 : y + i;
+        memcpy(image->data + (size_t)dst_y * image->stride, data + (size_t)i * stride,
+               image->stride);
+    }
+    image->num_rows += num_rows;
+    return true;
+}
+
+// Decodes with ok_png_read_rows, with and without OK_PNG_FLIP_Y, which must give the same result
+static ok_png read_rows(FILE *file, ok_png_decode_flags decode_flags) {
+    const ok_png_input input = {
+        .read = file_read_func,
+        .seek = file_seek_func
+    };
+    ok_png png = { 0 };
+    for (int i = 0; i < 2; i++) {
+        rows_image image = { 0 };
+        image.flip_y = (i == 1);
+        rewind(file);
+        ok_png rows_png = ok_png_read_rows(decode_flags | (image.flip_y ? OK_PNG_FLIP_Y : 0),
+                                           input, file, OK_PNG_DEFAULT_ALLOCATOR, NULL,
+                                           rows_image_func, &image);
+        if (rows_png.data ||
+            (rows_png.error_code == OK_PNG_SUCCESS && image.num_rows != rows_png.height)) {
+            free(rows_png.data);
+            free(image.data);
+            discard_image(&png);
+            break;
+        }
+        if (rows_png.error_code != OK_PNG_SUCCESS) {
+            free(image.data);
+            image.data = NULL;
+        }
+        rows_png.data = image.data;
+        rows_png.stride = image.stride;
+        if (i == 0) {
+            png = rows_png;
+        } else {
+            if (!same_image(png, rows_png)) {
+                discard_image(&png);
+            }
+            free(rows_png.data);
+        }
+    }
+    return png;
+}
+
+// Decodes with the push decoder, fed in parts of varying sizes, and fed all at once while sending
+// rows to rows_func, which must give the same result
+static ok_png read_push(const char *filename, ok_png_decode_flags decode_flags) {
+    unsigned long data_length;
+    uint8_t *data = read_file(filename, &data_length);
+
+    // Feed in parts
+    ok_png_decoder *decoder = ok_png_decoder_init(decode_flags, OK_PNG_DEFAULT_ALLOCATOR, NULL,
+                                                  NULL, NULL);
+    ok_png_decoder_status status = OK_PNG_DECODER_NEED_MORE_INPUT;
+    unsigned long offset = 0;
+    for (size_t part = 1; offset < data_length; part = part % 97 + 1) {
+        size_t length = (data_length - offset < part) ? (size_t)(data_length - offset) : part;
+        status = ok_png_decoder_feed(decoder, data + offset, length);
+        offset += length;
+        if (status == OK_PNG_DECODER_DONE || status == OK_PNG_DECODER_ERROR) {
+            break;
+        }
+    }
+    ok_png png = ok_png_decoder_finish(decoder);
+    if ((status == OK_PNG_DECODER_DONE) != (png.data != NULL)) {
+        discard_image(&png);
+    }
+
+    // Feed all at once, with rows
+    rows_image image = { 0 };
+    decoder = ok_png_decoder_init(decode_flags, OK_PNG_DEFAULT_ALLOCATOR, NULL,
+                                  rows_image_func, &image);
+    status = ok_png_decoder_feed(decoder, data, data_length);
+    ok_png rows_png = ok_png_decoder_finish(decoder);
+    if (status != OK_PNG_DECODER_DONE) {
+        free(image.data);
+        image.data = NULL;
+    }
+    if (rows_png.data || (image.data && image.num_rows != rows_png.height)) {
+        free(rows_png.data);
+        discard_image(&png);
+    } else {
+        rows_png.data = image.data;
+        rows_png.stride = image.stride;
+        if (!same_image(png, rows_png)) {
+            discard_image(&png);
+        }
+    }
+    free(image.data);
+    free(data);
+    return png;
+}
+
+// Decodes regions, with and without OK_PNG_FLIP_Y and in another color format, which must give
+// the same result as the same part of the full image. A region outside of the image must fail.
+static ok_png read_region(FILE *file, ok_png_decode_flags decode_flags) {
+    const ok_png_decode_flags flags_list[] = {
+        decode_flags,
+        decode_flags | OK_PNG_FLIP_Y,
+        OK_PNG_COLOR_FORMAT_BGRA | OK_PNG_PREMULTIPLIED_ALPHA,
+    };
+    const int num_flags = sizeof(flags_list) / sizeof(flags_list[0]);
+    const ok_png_input input = {
+        .read = file_read_func,
+        .seek = file_seek_func
+    };
+
+    ok_png png = ok_png_read(file, decode_flags);
+    bool success = true;
+    for (int i = 0; i < num_flags && success; i++) {
+        const ok_png_decode_flags flags = flags_list[i];
+        const bool flip_y = (flags & OK_PNG_FLIP_Y) != 0;
+        rewind(file);
+        ok_png full_png = ok_png_read(file, flags);
+        const uint32_t w = full_png.width;
+        const uint32_t h = full_png.height;
+        if (!full_png.data || w == 0 || h == 0) {
+            // Invalid file
+            free(full_png.data);
+            break;
+        }
+        const uint32_t regions[][4] = {
+            { 0, 0, w, h },
+            { w / 3, h / 3, w / 3 + 1, h / 4 + 1 },
+            { w - 1, h - 1, 1, 1 },
+            { w / 2, 7 % h, w, h },
+        };
+        const int num_regions = sizeof(regions) / sizeof(regions[0]);
+        for (int j = 0; j < num_regions && success; j++) {
+            const uint32_t x = regions[j][0];
+            const uint32_t y = regions[j][1];
+            const uint32_t width = regions[j][2] < w - x ? regions[j][2] : w - x;
+            const uint32_t height = regions[j][3] < h - y ? regions[j][3] : h - y;
+            rewind(file);
+            ok_png region_png = ok_png_read_region_from_input(flags, x, y, regions[j][2],
+                                                              regions[j][3], input, file,
+                                                              OK_PNG_DEFAULT_ALLOCATOR, NULL);
+            success = (region_png.data && region_png.width == width &&
+                       region_png.height == height);
+            for (uint32_t v = 0; v < height && success; v++) {
+                const uint32_t full_y = flip_y ? h - 1 - (y + v) : y + v;
+                const uint32_t region_y = flip_y ? height - 1 - v : v;
+                success = memcmp(full_png.data + (size_t)full_y * full_png.stride + x * 4,
+                                 region_png.data + (size_t)region_y * region_png.stride,
+                                 width * 4) == 0;
+            }
+            free(region_png.data);
+        }
+        if (success) {
+            rewind(file);
+            ok_png region_png = ok_png_read_region_from_input(flags, w, 0, 1, 1, input, file,
+                                                              OK_PNG_DEFAULT_ALLOCATOR, NULL);
+            success = !region_png.data && region_png.error_code == OK_PNG_ERROR_API;
+        }
+        free(full_png.data);
+    }
+    if (!success) {
+        discard_image(&png);
+    }
+    return png;
+}
+
 static bool test_image(const char *path_to_png_suite,
                        const char *path_to_rgba_files,
                        const char *name,
@@ -254,12 +547,43 @@ static bool test_image(const char *path_to_png_suite,
             case test_allocator:
                 png = ok_png_read_with_allocator(file, decode_flags, allocator, NULL);
                 break;
+            case test_memory:
+                png = read_memory(in_filename, decode_flags);
+                break;
+            case test_simd:
+                png = read_simd(file, decode_flags);
+                break;
+            case test_thread_pool:
+                png = read_thread_pool(file, decode_flags);
+                break;
+            case test_crc_error:
+                png = ok_png_read(file, decode_flags | OK_PNG_VERIFY_CRC);
+                break;
+            case test_rows:
+                png = read_rows(file, decode_flags);
+                break;
+            case test_push:
+                png = read_push(in_filename, decode_flags);
+                break;
+            case test_region:
+                png = read_region(file, decode_flags);
+                break;
         }
         fclose(file);
 
-        bool info_only = test_type == test_info_only;
-        success = compare(name, "png", png.data, png.stride, png.width, png.height,
-                          rgba_data, rgba_data_length, info_only, 0, verbose);
+        if (test_type == test_crc_error) {
+            // The file has an incorrect checksum, which must be rejected
+            success = png.error_code == OK_PNG_ERROR_INVALID;
+            if (!success) {
+                printf("Failure: Incorrect checksum not detected in %s.png\n", name);
+            } else if (verbose) {
+                printf("File:    %16.16s.png (incorrect checksum correctly detected).\n", name);
+            }
+        } else {
+            bool info_only = test_type == test_info_only;
+            success = compare(name, "png", png.data, png.stride, png.width, png.height,
+                              rgba_data, rgba_data_length, info_only, 0, verbose);
+        }
         free(png.data);
     } else {
         printf("Warning: File not found: %s.png\n", name);
@@ -275,6 +599,7 @@ static bool test_image(const char *path_to_png_suite,
 
 int png_suite_test(const char *path_to_png_suite, const char *path_to_rgba_files, bool verbose) {
     const int num_files = sizeof(filenames) / sizeof(filenames[0]);
+    const int num_crc_error_files = sizeof(crc_error_filenames) / sizeof(crc_error_filenames[0]);
     if (verbose) {
         printf("Testing %i files in path \"%s\".\n", num_files, path_to_png_suite);
     }
@@ -299,11 +624,60 @@ int png_suite_test(const char *path_to_png_suite, const char *path_to_rgba_files
                              verbose);
         if (!success) {
             num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i], test_memory,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i], test_simd,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i],
+                             test_thread_pool, verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i], test_rows,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i], test_push,
+                             verbose);
+        if (!success) {
+            num_failures++;
+            continue;
+        }
+
+        success = test_image(path_to_png_suite, path_to_rgba_files, filenames[i], test_region,
+                             verbose);
+        if (!success) {
+            num_failures++;
+        }
+    }
+    for (int i = 0; i < num_crc_error_files; i++) {
+        if (!test_image(path_to_png_suite, path_to_rgba_files, crc_error_filenames[i],
+                        test_crc_error, verbose)) {
+            num_failures++;
         }
     }
     double endTime = clock() / (double)CLOCKS_PER_SEC;
     double elapsedTime = endTime - startTime;
-    printf("Success: PNG %i of %i\n", (num_files - num_failures), num_files);
+    const int num_tests = num_files + num_crc_error_files;
+    printf("Success: PNG %i of %i\n", (num_tests - num_failures), num_tests);
     if (verbose) {
         printf("Duration: %f seconds\n", elapsedTime);
     }
@@ -5,6 +5,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+#  include <pthread.h>
+#endif
 #if defined(__APPLE__)
 #  include <TargetConditionals.h>
 #  if TARGET_OS_IPHONE || TARGET_OS_SIMULATOR
@@ -128,9 +132,11 @@ static int test_image(const char *output_dir, ok_png_write_params params, bool v
         goto cleanup;
     }
     if (params.apple_cgbi_format) {
-        png = ok_png_read(in_file, (ok_png_decode_flags)(OK_PNG_COLOR_FORMAT_BGRA | OK_PNG_PREMULTIPLIED_ALPHA));
+        png = ok_png_read(in_file, (ok_png_decode_flags)(OK_PNG_COLOR_FORMAT_BGRA | OK_PNG_PREMULTIPLIED_ALPHA |
+                                                         OK_PNG_VERIFY_CRC | OK_PNG_VERIFY_ADLER32));
     } else {
-        png = ok_png_read(in_file, OK_PNG_COLOR_FORMAT_RGBA);
+        png = ok_png_read(in_file, (ok_png_decode_flags)(OK_PNG_COLOR_FORMAT_RGBA |
+                                                         OK_PNG_VERIFY_CRC | OK_PNG_VERIFY_ADLER32));
     }
     fclose(in_file);
     if (png.error_code != OK_PNG_SUCCESS) {
@@ -165,6 +171,244 @@ cleanup:
     return success;
 }
 
+static void run_tasks_serially(void *thread_pool_context, void (*task)(void *task_data), void **task_data,
+                               size_t num_tasks) {
+    (void)thread_pool_context;
+    for (size_t i = 0; i < num_tasks; i++) {
+        task(task_data[i]);
+    }
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} memory_buffer;
+
+static bool memory_buffer_write(void *context, const uint8_t *buffer, size_t count) {
+    memory_buffer *memory = (memory_buffer *)context;
+    if (memory->length + count > memory->capacity) {
+        size_t new_capacity = (memory->length + count) * 2;
+        uint8_t *new_data = realloc(memory->data, new_capacity);
+        if (!new_data) {
+            return false;
+        }
+        memory->data = new_data;
+        memory->capacity = new_capacity;
+    }
+    memcpy(memory->data + memory->length, buffer, count);
+    memory->length += count;
+    return true;
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+} memory_reader;
+
+static size_t memory_reader_read(void *user_data, uint8_t *buffer, size_t count) {
+    memory_reader *reader = (memory_reader *)user_data;
+    count = reader->length - reader->position < count ? reader->length - reader->position : count;
+    memcpy(buffer, reader->data + reader->position, count);
+    reader->position += count;
+    return count;
+}
+
+static bool memory_reader_seek(void *user_data, long count) {
+    memory_reader *reader = (memory_reader *)user_data;
+    if (count < 0 || (size_t)count > reader->length - reader->position) {
+        return false;
+    }
+    reader->position += (size_t)count;
+    return true;
+}
+
+// Decodes a PNG in memory, verifying the Adler-32 checksum, and returns the error code.
+static ok_png_error decode_with_adler_verification(const memory_buffer *memory, bool use_thread_pool) {
+    memory_reader reader = { memory->data, memory->length, 0 };
+    const ok_png_input input = {
+        .read = memory_reader_read,
+        .seek = memory_reader_seek
+    };
+    const ok_png_decode_flags decode_flags = (ok_png_decode_flags)(OK_PNG_COLOR_FORMAT_RGBA | OK_PNG_VERIFY_ADLER32);
+    ok_png png;
+    if (use_thread_pool) {
+        const ok_png_thread_pool thread_pool = {
+            .run_tasks = run_tasks_serially
+        };
+        png = ok_png_read_from_input_with_thread_pool(decode_flags, input, &reader, OK_PNG_DEFAULT_ALLOCATOR, NULL,
+                                                      thread_pool, NULL);
+    } else {
+        png = ok_png_read_from_input(decode_flags, input, &reader, OK_PNG_DEFAULT_ALLOCATOR, NULL);
+    }
+    free(png.data);
+    return png.error_code;
+}
+
+// Tests that the Adler-32 of an image compressed in stripes is the same as one compressed serially,
+// and that the decoder verifies it, with and without a thread pool.
+// The Adler-32 is the last 4 bytes of the last IDAT chunk, followed by the IDAT CRC and the IEND chunk.
+static int thread_pool_adler_test(bool verbose) {
+    (void)verbose;
+    const uint32_t width = 1024;
+    const uint32_t height = 1100;
+    const size_t data_length = (size_t)width * 4 * height;
+    uint8_t *data = malloc(data_length);
+    if (!data) {
+        printf("Error: Couldn't allocate memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < data_length; i++) {
+        data[i] = (i * 7 + i / 4093) & 0xff;
+    }
+    ok_png_write_params params = {
+        .width = width,
+        .height = height,
+        .data = data,
+        .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+        .filter = OK_PNG_WRITE_FILTER_PAETH, // Fixed filter, so the uncompressed data is the same
+    };
+    memory_buffer serial_output = { 0 };
+    memory_buffer stripes_output = { 0 };
+    bool success = ok_png_write(memory_buffer_write, &serial_output, params);
+    params.run_tasks = run_tasks_serially;
+    success &= ok_png_write(memory_buffer_write, &stripes_output, params);
+    const size_t footer_length = 4 + 4 + 12; // Adler, IDAT CRC, IEND chunk
+    if (success && (serial_output.length < footer_length || stripes_output.length < footer_length ||
+                    memcmp(serial_output.data + serial_output.length - footer_length,
+                           stripes_output.data + stripes_output.length - footer_length, 4) != 0)) {
+        printf("Failure: Adler-32 of image compressed in stripes is incorrect\n");
+        success = false;
+    }
+    if (success && (decode_with_adler_verification(&stripes_output, false) != OK_PNG_SUCCESS ||
+                    decode_with_adler_verification(&stripes_output, true) != OK_PNG_SUCCESS)) {
+        printf("Failure: Adler-32 of image compressed in stripes not verified\n");
+        success = false;
+    }
+    if (success) {
+        stripes_output.data[stripes_output.length - footer_length + 3] ^= 1;
+        if (decode_with_adler_verification(&stripes_output, false) != OK_PNG_ERROR_INFLATER ||
+            decode_with_adler_verification(&stripes_output, true) != OK_PNG_ERROR_INFLATER) {
+            printf("Failure: Incorrect Adler-32 not detected\n");
+            success = false;
+        }
+    }
+    free(serial_output.data);
+    free(stripes_output.data);
+    free(data);
+    return success ? 0 : 1;
+}
+
+typedef struct {
+    void (*task)(void *task_data);
+    void *task_data;
+} thread_task;
+
+#if !defined(_WIN32)
+static void *thread_task_main(void *arg) {
+    thread_task *thread = (thread_task *)arg;
+    thread->task(thread->task_data);
+    return NULL;
+}
+#endif
+
+// Runs each task on its own thread (or serially, on Windows), and records the largest number of
+// tasks requested.
+static void run_tasks_on_threads(void *user_data, void (*task)(void *task_data), void **task_data,
+                                 size_t num_tasks) {
+    size_t *max_num_tasks = (size_t *)user_data;
+    if (*max_num_tasks < num_tasks) {
+        *max_num_tasks = num_tasks;
+    }
+#if !defined(_WIN32)
+    thread_task *threads = malloc(num_tasks * sizeof(thread_task));
+    pthread_t *thread_ids = malloc(num_tasks * sizeof(pthread_t));
+    bool *started = calloc(num_tasks, sizeof(bool));
+    if (threads && thread_ids && started) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            threads[i].task = task;
+            threads[i].task_data = task_data[i];
+            started[i] = pthread_create(&thread_ids[i], NULL, thread_task_main, &threads[i]) == 0;
+        }
+        for (size_t i = 0; i < num_tasks; i++) {
+            if (started[i]) {
+                pthread_join(thread_ids[i], NULL);
+            } else {
+                task(task_data[i]);
+            }
+        }
+        free(threads);
+        free(thread_ids);
+        free(started);
+        return;
+    }
+    free(threads);
+    free(thread_ids);
+    free(started);
+#endif
+    run_tasks_serially(NULL, task, task_data, num_tasks);
+}
+
+// Tests decoding an image compressed in stripes with a thread pool, so that the stripes are
+// inflated and unfiltered on the thread pool. The image data is noise, so each stripe is larger
+// than the decoder's minimum segment length.
+static int thread_pool_decode_test(bool verbose) {
+    const uint32_t width = 1024;
+    const uint32_t height = 1100;
+    const size_t data_length = (size_t)width * 4 * height;
+    uint8_t *data = malloc(data_length);
+    if (!data) {
+        printf("Error: Couldn't allocate memory\n");
+        return 1;
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data_length; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    size_t max_write_tasks = 0;
+    const ok_png_write_params params = {
+        .width = width,
+        .height = height,
+        .data = data,
+        .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+        .run_tasks = run_tasks_on_threads,
+        .thread_pool_context = &max_write_tasks,
+    };
+    memory_buffer output = { 0 };
+    bool success = ok_png_write(memory_buffer_write, &output, params);
+    if (!success) {
+        printf("Error writing PNG data\n");
+    }
+
+    size_t max_read_tasks = 0;
+    if (success) {
+        memory_reader reader = { output.data, output.length, 0 };
+        const ok_png_input input = {
+            .read = memory_reader_read,
+            .seek = memory_reader_seek
+        };
+        const ok_png_thread_pool thread_pool = {
+            .run_tasks = run_tasks_on_threads
+        };
+        ok_png png = ok_png_read_from_input_with_thread_pool(
+            (ok_png_decode_flags)(OK_PNG_COLOR_FORMAT_RGBA | OK_PNG_VERIFY_CRC | OK_PNG_VERIFY_ADLER32),
+            input, &reader, OK_PNG_DEFAULT_ALLOCATOR, NULL, thread_pool, &max_read_tasks);
+        success = (png.error_code == OK_PNG_SUCCESS &&
+                   compare("png_write_thread_pool", "png", png.data, png.stride, png.width, png.height,
+                           data, data_length, false, 0, verbose));
+        free(png.data);
+    }
+    if (success && (max_write_tasks <= 1 || max_read_tasks <= 1)) {
+        printf("Failure: Image was not compressed or decoded in parallel\n");
+        success = false;
+    }
+    free(output.data);
+    free(data);
+    return success ? 0 : 1;
+}
+
 static size_t uncompressed_size(uint32_t width, uint32_t height, uint32_t bpp, bool apple_cgbi_format) {
     size_t data_size = (((size_t)width * bpp) + 1) * height; // RGBA data + filter per row
     size_t stored_block_count = (data_size + 0xffff - 1) / 0xffff; // Number of stored blocks (max size 0xffff)
@@ -172,7 +416,7 @@ static size_t uncompressed_size(uint32_t width, uint32_t height, uint32_t bpp, b
     return wrapper + 5 * stored_block_count + data_size;
 }
 
-// This tests writing various size images; doesn't test CRC or Adler checksums (ok_png reader ignores them)
+// This tests writing various size images. The CRC and Adler checksums are verified when reading.
 int png_write_test(bool verbose) {
     // Get output dir
     char output_dir[PATH_MAX];
@@ -191,6 +435,12 @@ int png_write_test(bool verbose) {
     num_tests++;
     num_failures += api_test(output_dir, verbose);
     
+    num_tests++;
+    num_failures += thread_pool_adler_test(verbose);
+
+    num_tests++;
+    num_failures += thread_pool_decode_test(verbose);
+    
     // Test params. Image data filled in by test_image()
     const ok_png_write_params test_params[] = {
         (ok_png_write_params) {
@@ -211,6 +461,56 @@ int png_write_test(bool verbose) {
             .buffer_size = (uint32_t)uncompressed_size(100, 1, 4, false) - 4, // Adler in a separate IDAT chunk
             .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
         },
+        (ok_png_write_params) {
+            .width = 67, .height = 50,
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .filter = OK_PNG_WRITE_FILTER_SUB,
+        },
+        (ok_png_write_params) {
+            .width = 67, .height = 50,
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .filter = OK_PNG_WRITE_FILTER_UP,
+        },
+        (ok_png_write_params) {
+            .width = 67, .height = 50,
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .filter = OK_PNG_WRITE_FILTER_AVG,
+        },
+        (ok_png_write_params) {
+            .width = 67, .height = 50,
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .filter = OK_PNG_WRITE_FILTER_PAETH,
+        },
+        (ok_png_write_params) {
+            .width = 67, .height = 50,
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .filter = OK_PNG_WRITE_FILTER_BRUTE_FORCE,
+        },
+        (ok_png_write_params) {
+            .width = 300, .height = 200, // RLE only
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .compression_level = 1,
+        },
+        (ok_png_write_params) {
+            .width = 300, .height = 200, // Greedy matching
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .compression_level = 2,
+        },
+        (ok_png_write_params) {
+            .width = 300, .height = 200, // Lazy matching
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .compression_level = 9,
+        },
+        (ok_png_write_params) {
+            .width = 1024, .height = 1100, // Multiple stripes
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .run_tasks = run_tasks_serially,
+        },
+        (ok_png_write_params) {
+            .width = 100, .height = 100, // One stripe
+            .color_type = OK_PNG_WRITE_COLOR_TYPE_RGB_ALPHA,
+            .run_tasks = run_tasks_serially,
+        },
     };
         
     for (size_t i = 0; i < sizeof(test_params) / sizeof(*test_params); i++) {
@@ -4,6 +4,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifndef min
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -135,6 +141,50 @@ uint8_t *read_file(const char *filename, unsigned long *length) {
     return buffer;
 }
 
+#if !defined(_WIN32)
+
+const uint8_t *map_file(const char *filename, size_t *length) {
+    *length = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            *length = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+void unmap_file(const uint8_t *data, size_t length) {
+    if (data) {
+        munmap((void *)(uintptr_t)data, length);
+    }
+}
+
+#else
+
+const uint8_t *map_file(const char *filename, size_t *length) {
+    unsigned long file_length;
+    uint8_t *data = read_file(filename, &file_length);
+    *length = data ? (size_t)file_length : 0;
+    return data;
+}
+
+void unmap_file(const uint8_t *data, size_t length) {
+    (void)length;
+    free((void *)(uintptr_t)data);
+}
+
+#endif
+
 static bool fuzzy_memcmp(const uint8_t *data1, const uint8_t *data2,
                          size_t pitch1, size_t pitch2,
                          size_t width, size_t height,
@@ -18,6 +18,12 @@ char *get_full_path(const char *path, const char *name, const char *ext);
 
 uint8_t *read_file(const char *filename, unsigned long *length);
 
+// Maps a file into memory (read-only). On Windows, the file is read into memory instead.
+// Returns NULL if the file couldn't be mapped. The data must be released with unmap_file().
+const uint8_t *map_file(const char *filename, size_t *length);
+
+void unmap_file(const uint8_t *data, size_t length);
+
 // Tests if two images are the same.
 // If fuzziness > 0, then the diff of the pixel values have to be within (fuzziness).
 bool compare(const char *name, const char *ext,
@@ -13,6 +13,7 @@
 enum wav_test_type {
     test_normal,
     test_allocator,
+    test_memory,
 };
 
 static void print_diff(const uint8_t *data1, const uint8_t *data2, const unsigned long length) {
@@ -73,6 +74,14 @@ static bool test_wav(const char *path, const char *container_type, const char *f
         case test_allocator:
             wav = ok_wav_read_with_allocator(file, OK_WAV_ENDIAN_NO_CONVERSION, allocator, NULL);
             break;
+        case test_memory: {
+            size_t data_length;
+            const uint8_t *data = map_file(src_path, &data_length);
+            wav = ok_wav_read_from_memory(data, data_length, OK_WAV_ENDIAN_NO_CONVERSION,
+                                          OK_WAV_DEFAULT_ALLOCATOR, NULL);
+            unmap_file(data, data_length);
+            break;
+        }
     }
     fclose(file);
     free(src_path);
@@ -143,6 +152,10 @@ int wav_test(const char *path, bool verbose) {
             if (!success) {
                 num_failures++;
             }
+            success = test_wav(path, "caf", caf_data_formats[j], channels[i], test_memory, verbose);
+            if (!success) {
+                num_failures++;
+            }
         }
 
         for (int j = 0; j < num_wav_types; j++) {
@@ -154,6 +167,10 @@ int wav_test(const char *path, bool verbose) {
             if (!success) {
                 num_failures++;
             }
+            success = test_wav(path, "wav", wav_data_formats[j], channels[i], test_memory, verbose);
+            if (!success) {
+                num_failures++;
+            }
         }
     }
 